@@ -0,0 +1,48 @@
+# Byte histogram: 4096 xorshift bytes are stored with sb, counted into 256
+# halfword bins with lhu/sh and summed as signed bytes with lb into a1; the
+# bins are read back with lh and folded into a0 (rotate left 1, xor)
+	li s0, 0x10010000	# bytes[4096]
+	li s1, 0x10011000	# bins[256], halfwords
+	li t0, 0x2545f491
+	li t1, 4096
+	mv t2, s0
+fill:
+	slli t3, t0, 13
+	xor t0, t0, t3
+	srli t3, t0, 17
+	xor t0, t0, t3
+	slli t3, t0, 5
+	xor t0, t0, t3
+	sb t0, 0(t2)
+	addi t2, t2, 1
+	addi t1, t1, -1
+	bnez t1, fill
+	li a1, 0
+	li t1, 4096
+	mv t2, s0
+count:
+	lbu t3, 0(t2)
+	lb t4, 0(t2)
+	add a1, a1, t4
+	slli t3, t3, 1
+	add t3, t3, s1
+	lhu t5, 0(t3)
+	addi t5, t5, 1
+	sh t5, 0(t3)
+	addi t2, t2, 1
+	addi t1, t1, -1
+	bnez t1, count
+	li a0, 0
+	li t1, 256
+	mv t2, s1
+fold:
+	lh t3, 0(t2)
+	slli t4, a0, 1
+	srli a0, a0, 31
+	or a0, a0, t4
+	xor a0, a0, t3
+	addi t2, t2, 2
+	addi t1, t1, -1
+	bnez t1, fold
+done:
+	nop
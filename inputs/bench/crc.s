@@ -0,0 +1,37 @@
+# bitwise CRC-32 (reflected, polynomial 0xEDB88320) of 1 KB of xorshift32
+# data, a word at a time; a0 equals zlib's crc32 of the same bytes
+	li s0, 0x10010000
+	li t0, 0xC0FFEE11
+	li t1, 256
+	mv t2, s0
+fill:
+	slli t3, t0, 13
+	xor t0, t0, t3
+	srli t3, t0, 17
+	xor t0, t0, t3
+	slli t3, t0, 5
+	xor t0, t0, t3
+	sw t0, 0(t2)
+	addi t2, t2, 4
+	addi t1, t1, -1
+	bnez t1, fill
+	li a0, -1
+	li s2, 0xEDB88320
+	mv t2, s0
+	li t1, 256
+word:
+	lw t3, 0(t2)
+	xor a0, a0, t3
+	li t4, 32
+bit:
+	andi t5, a0, 1
+	srli a0, a0, 1
+	beqz t5, nopoly
+	xor a0, a0, s2
+nopoly:
+	addi t4, t4, -1
+	bnez t4, bit
+	addi t2, t2, 4
+	addi t1, t1, -1
+	bnez t1, word
+	xori a0, a0, -1
@@ -0,0 +1,47 @@
+# dot product of two 512-element vectors of bytes; RV32I has no multiply,
+# so each product goes through a shift-and-add routine
+	li s0, 0x10010000	# a[512], then b[512] right after it
+	li s1, 0x10010800
+	li t0, 0x12345678
+	li t1, 1024
+	mv t2, s0
+fill:
+	slli t3, t0, 13
+	xor t0, t0, t3
+	srli t3, t0, 17
+	xor t0, t0, t3
+	slli t3, t0, 5
+	xor t0, t0, t3
+	andi t3, t0, 255
+	sw t3, 0(t2)
+	addi t2, t2, 4
+	addi t1, t1, -1
+	bnez t1, fill
+	li a0, 0
+	li s2, 512
+	mv s3, s0
+	mv s4, s1
+loop:
+	lw a1, 0(s3)
+	lw a2, 0(s4)
+	jal ra, mul
+	add a0, a0, a3
+	addi s3, s3, 4
+	addi s4, s4, 4
+	addi s2, s2, -1
+	bnez s2, loop
+	j done
+# a3 = a1 * a2; clobbers a1, a2 and t4
+mul:
+	li a3, 0
+mul_loop:
+	andi t4, a2, 1
+	beqz t4, mul_skip
+	add a3, a3, a1
+mul_skip:
+	slli a1, a1, 1
+	srli a2, a2, 1
+	bnez a2, mul_loop
+	ret
+done:
+	nop
@@ -0,0 +1,63 @@
+# 16-tap FIR filter over 1024 signed 12-bit samples with RV32M multiplies;
+# each output is folded into a0 (rotate left 1, xor), then a0 is split by
+# divu/remu so the divider is exercised too
+	li s0, 0x10010000	# x[1039]
+	li s1, 0x10012000	# h[16]
+	li t0, 0x31415926
+	li t1, 1039
+	mv t2, s0
+fill:
+	slli t3, t0, 13
+	xor t0, t0, t3
+	srli t3, t0, 17
+	xor t0, t0, t3
+	slli t3, t0, 5
+	xor t0, t0, t3
+	slli t3, t0, 16
+	srai t3, t3, 20
+	sw t3, 0(t2)
+	addi t2, t2, 4
+	addi t1, t1, -1
+	bnez t1, fill
+	li t1, 0
+	li t4, 16
+	mv t2, s1
+taps:
+	addi t3, t1, 1		# h[k] = (k + 1) * (16 - k) - 40
+	sub t5, t4, t1
+	mul t3, t3, t5
+	addi t3, t3, -40
+	sw t3, 0(t2)
+	addi t2, t2, 4
+	addi t1, t1, 1
+	blt t1, t4, taps
+	li a0, 0
+	li s2, 1024
+	mv s3, s0
+outer:
+	li a1, 0
+	mv t2, s3
+	mv t3, s1
+	li t1, 16
+inner:
+	lw t5, 0(t2)
+	lw t6, 0(t3)
+	mul t5, t5, t6
+	add a1, a1, t5
+	addi t2, t2, 4
+	addi t3, t3, 4
+	addi t1, t1, -1
+	bnez t1, inner
+	srai a1, a1, 4
+	slli t5, a0, 1
+	srli t6, a0, 31
+	or a0, t5, t6
+	xor a0, a0, a1
+	addi s3, s3, 4
+	addi s2, s2, -1
+	bnez s2, outer
+	li t1, 1000003
+	divu a2, a0, t1
+	remu a3, a0, t1
+done:
+	nop
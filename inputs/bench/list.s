@@ -0,0 +1,35 @@
+# linked list: 512 two-word nodes {next, value} scattered by the
+# permutation pos(i) = 97 * i mod 512, walked from the head 16 times
+	li s0, 0x10010000
+	li s1, 512
+	li t1, 0		# nodes built
+	li t5, 0		# position of the current node
+build:
+	addi t6, t5, 97
+	andi t6, t6, 511
+	slli t2, t5, 3
+	add t2, t2, s0
+	slli t3, t6, 3
+	add t3, t3, s0
+	addi t1, t1, 1
+	beq t1, s1, last
+	sw t3, 0(t2)
+	j value
+last:
+	sw zero, 0(t2)
+value:
+	xor t4, t1, t5
+	sw t4, 4(t2)
+	mv t5, t6
+	bne t1, s1, build
+	li a0, 0
+	li s2, 16
+walk:
+	mv t2, s0
+node:
+	lw t4, 4(t2)
+	add a0, a0, t4
+	lw t2, 0(t2)
+	bnez t2, node
+	addi s2, s2, -1
+	bnez s2, walk
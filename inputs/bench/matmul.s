@@ -0,0 +1,84 @@
+# 12x12 integer matrix multiply C = A * B with values 0..15, using a
+# shift-and-add multiply; C is folded into a0 (rotate left 1, xor)
+	li s0, 0x10010000	# A, row-major
+	addi s1, s0, 576	# B, right after A
+	li s5, 0x10010800	# C
+	li s6, 12
+	li t0, 0xDEADBEEF
+	li t1, 288
+	mv t2, s0
+fill:
+	slli t3, t0, 13
+	xor t0, t0, t3
+	srli t3, t0, 17
+	xor t0, t0, t3
+	slli t3, t0, 5
+	xor t0, t0, t3
+	andi t3, t0, 15
+	sw t3, 0(t2)
+	addi t2, t2, 4
+	addi t1, t1, -1
+	bnez t1, fill
+	li s2, 0		# i
+row:
+	li s3, 0		# j
+col:
+	li s7, 0		# C[i][j]
+	li s4, 0		# k
+dotk:
+	slli t1, s2, 3		# A[i][k]
+	slli t2, s2, 2
+	add t1, t1, t2
+	add t1, t1, s4
+	slli t1, t1, 2
+	add t1, t1, s0
+	lw a1, 0(t1)
+	slli t1, s4, 3		# B[k][j]
+	slli t2, s4, 2
+	add t1, t1, t2
+	add t1, t1, s3
+	slli t1, t1, 2
+	add t1, t1, s1
+	lw a2, 0(t1)
+	jal ra, mul
+	add s7, s7, a3
+	addi s4, s4, 1
+	bne s4, s6, dotk
+	slli t1, s2, 3
+	slli t2, s2, 2
+	add t1, t1, t2
+	add t1, t1, s3
+	slli t1, t1, 2
+	add t1, t1, s5
+	sw s7, 0(t1)
+	addi s3, s3, 1
+	bne s3, s6, col
+	addi s2, s2, 1
+	bne s2, s6, row
+	li a0, 0
+	mv t3, s5
+	li t1, 144
+sum:
+	lw t4, 0(t3)
+	slli t5, a0, 1
+	srli t6, a0, 31
+	or a0, t5, t6
+	xor a0, a0, t4
+	addi t3, t3, 4
+	addi t1, t1, -1
+	bnez t1, sum
+	j done
+# a3 = a1 * a2; clobbers a1, a2 and t4
+mul:
+	li a3, 0
+mul_loop:
+	andi t4, a2, 1
+	beqz t4, mul_skip
+	add a3, a3, a1
+mul_skip:
+	slli a1, a1, 1
+	srli a2, a2, 1
+	bnez a2, mul_loop
+	ret
+done:
+	nop
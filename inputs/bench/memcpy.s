@@ -0,0 +1,50 @@
+# memcpy: fill 1024 words with xorshift32, copy them 4 times 16 bytes
+# at a time, then fold the copy into a0 (rotate left 1, xor)
+	li s0, 0x10010000	# source
+	li s1, 0x10011000	# destination
+	li t0, 0x2545F491	# xorshift state
+	li t1, 1024
+	mv t2, s0
+fill:
+	slli t3, t0, 13
+	xor t0, t0, t3
+	srli t3, t0, 17
+	xor t0, t0, t3
+	slli t3, t0, 5
+	xor t0, t0, t3
+	sw t0, 0(t2)
+	addi t2, t2, 4
+	addi t1, t1, -1
+	bnez t1, fill
+	li s2, 4
+pass:
+	mv t2, s0
+	mv t3, s1
+	li t1, 256
+copy:
+	lw t4, 0(t2)
+	lw t5, 4(t2)
+	lw t6, 8(t2)
+	lw a1, 12(t2)
+	sw t4, 0(t3)
+	sw t5, 4(t3)
+	sw t6, 8(t3)
+	sw a1, 12(t3)
+	addi t2, t2, 16
+	addi t3, t3, 16
+	addi t1, t1, -1
+	bnez t1, copy
+	addi s2, s2, -1
+	bnez s2, pass
+	li a0, 0
+	mv t3, s1
+	li t1, 1024
+sum:
+	lw t4, 0(t3)
+	slli t5, a0, 1
+	srli t6, a0, 31
+	or a0, t5, t6
+	xor a0, a0, t4
+	addi t3, t3, 4
+	addi t1, t1, -1
+	bnez t1, sum
@@ -0,0 +1,47 @@
+# insertion sort of 256 signed xorshift32 words, then fold the sorted
+# array into a0 (rotate left 1, xor)
+	li s0, 0x10010000
+	li s1, 256
+	li t0, 0x9E3779B9
+	mv t1, s1
+	mv t2, s0
+fill:
+	slli t3, t0, 13
+	xor t0, t0, t3
+	srli t3, t0, 17
+	xor t0, t0, t3
+	slli t3, t0, 5
+	xor t0, t0, t3
+	sw t0, 0(t2)
+	addi t2, t2, 4
+	addi t1, t1, -1
+	bnez t1, fill
+	li t1, 1
+outer:
+	slli t2, t1, 2
+	add t2, t2, s0
+	lw t3, 0(t2)		# key
+	mv t4, t2
+inner:
+	beq t4, s0, place
+	lw t5, -4(t4)
+	bge t3, t5, place
+	sw t5, 0(t4)
+	addi t4, t4, -4
+	j inner
+place:
+	sw t3, 0(t4)
+	addi t1, t1, 1
+	bne t1, s1, outer
+	li a0, 0
+	mv t3, s0
+	mv t1, s1
+sum:
+	lw t4, 0(t3)
+	slli t5, a0, 1
+	srli t6, a0, 31
+	or a0, t5, t6
+	xor a0, a0, t4
+	addi t3, t3, 4
+	addi t1, t1, -1
+	bnez t1, sum
@@ -0,0 +1,18 @@
+# Shared counters for a multi-hart run (mu-riscv --harts <n>): every hart adds 1
+# to [0x10010000] 1000 times with amoadd.w and to [0x10010004] with an lr.w/sc.w
+# loop, then exits with its hart id (a0). Both words end at 1000 x harts.
+	lui s0, 0x10010		# counters
+	addi t3, s0, 4
+	li t0, 1000
+	li t1, 1
+loop:
+	amoadd.w zero, t1, (s0)
+retry:
+	lr.w t2, (t3)
+	addi t2, t2, 1
+	sc.w t4, t2, (t3)
+	bnez t4, retry
+	addi t0, t0, -1
+	bnez t0, loop
+	li a7, 93
+	ecall
@@ -0,0 +1,378 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <time.h>
+
+#include "muriscv.h"
+
+/***************************************************************/
+/* mu-riscv-bench: run the benchmark kernels, check that each one  */
+/* ends in its known state and report simulated and host              */
+/* throughput, optionally against a recorded baseline.                   */
+/***************************************************************/
+/*
+	The manifest lists one kernel per line:
+
+		<program> [insts=<n>] [x<n>=<val>] [[<address>]=<val>]...
+
+	Program paths are relative to the manifest. Blank lines and lines
+	starting with # are ignored. Each kernel runs to completion on the
+	cycle-accurate pipeline and again through fast-forward on the
+	functional engine. Both runs must retire insts instructions and leave
+	the listed registers and words as given. Runs repeat until
+	BENCH_MIN_SECONDS of host time has passed, and the fastest one counts.
+	Afterwards every kernel is loaded in turn into one instance per
+	functional engine and fast-forwarded, which must give the same results.
+
+	With -b, simulated MIPS are compared against the baseline file. The
+	file is written when missing or with -u. A kernel more than -t percent
+	slower than its baseline fails the run, as does any wrong result.
+*/
+
+#define BENCH_MAX_CHECKS 16
+#define BENCH_MIN_SECONDS 0.2
+#define BENCH_MAX_RUNS 1000
+
+typedef struct {
+	bool is_mem;
+	uint32_t where;	/* register number or address */
+	uint32_t value;
+} bench_check_t;
+
+typedef struct {
+	char name[64];
+	char program[512];
+	uint32_t insts;	/* 0: not checked */
+	int num_checks;
+	bench_check_t checks[BENCH_MAX_CHECKS];
+
+	/* results */
+	uint32_t cycles, instructions;
+	double pipeline_seconds, functional_seconds;
+	double pipeline_mips, functional_mips;
+	bool ok;
+} bench_kernel_t;
+
+static bench_kernel_t *kernels;
+static int num_kernels;
+
+void usage(const char *prog) {
+	printf("Usage: %s [-b <baseline>] [-u] [-t <percent>] [-e <engine>] <manifest>\n", prog);
+	printf("  -b\tcompare throughput against <baseline> (written if it does not exist)\n");
+	printf("  -u\trewrite the baseline with this run's throughput\n");
+	printf("  -t\tallowed slowdown against the baseline in percent (default 25)\n");
+	printf("  -e\tfunctional engine for the fast-forward runs: step, threaded or jit (default threaded)\n");
+}
+
+int parse_check(bench_kernel_t *kernel, const char *setting) {
+	const char *eq = strchr(setting, '=');
+	char *end;
+	if (eq == NULL || eq[1] == '\0') {
+		return -1;
+	}
+	uint32_t value = strtoul(eq + 1, &end, 0);
+	if (*end != '\0') {
+		return -1;
+	}
+	if (strncmp(setting, "insts=", 6) == 0) {
+		kernel->insts = value;
+		return 0;
+	}
+	if (kernel->num_checks == BENCH_MAX_CHECKS) {
+		return -1;
+	}
+	bench_check_t *check = &kernel->checks[kernel->num_checks];
+	if (setting[0] == '[') {
+		check->is_mem = true;
+		check->where = strtoul(setting + 1, &end, 0);
+		if (*end != ']' || end + 1 != eq) {
+			return -1;
+		}
+	} else if (setting[0] == 'x') {
+		check->is_mem = false;
+		check->where = strtoul(setting + 1, &end, 10);
+		if (end != eq || end == setting + 1 || check->where >= 32) {
+			return -1;
+		}
+	} else {
+		return -1;
+	}
+	check->value = value;
+	kernel->num_checks++;
+	return 0;
+}
+
+int load_manifest(const char *path) {
+	FILE *fp = fopen(path, "r");
+	char line[1024], dir[512];
+	int line_no = 0, cap = 0;
+	if (fp == NULL) {
+		printf("Error: Can't open manifest %s\n", path);
+		return -1;
+	}
+	snprintf(dir, sizeof(dir), "%s", path);
+	dirname(dir);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		char *token = strtok(line, " \t\r\n");
+		line_no++;
+		if (token == NULL || token[0] == '#') {
+			continue;
+		}
+		if (num_kernels == cap) {
+			cap = cap ? cap * 2 : 16;
+			kernels = realloc(kernels, cap * sizeof(bench_kernel_t));
+			if (kernels == NULL) {
+				printf("Error: Out of memory reading %s\n", path);
+				exit(1);
+			}
+		}
+		bench_kernel_t *kernel = &kernels[num_kernels++];
+		memset(kernel, 0, sizeof(*kernel));
+		if (snprintf(kernel->program, sizeof(kernel->program), "%s/%s", dir, token) >= (int)sizeof(kernel->program)) {
+			printf("Error: %s:%d: program path too long\n", path, line_no);
+			fclose(fp);
+			return -1;
+		}
+		snprintf(kernel->name, sizeof(kernel->name), "%s", token);
+		char *dot = strrchr(kernel->name, '.');
+		if (dot != NULL) {
+			*dot = '\0';
+		}
+		while ((token = strtok(NULL, " \t\r\n")) != NULL) {
+			if (parse_check(kernel, token) != 0) {
+				printf("Error: %s:%d: bad check %s\n", path, line_no, token);
+				fclose(fp);
+				return -1;
+			}
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* does the simulator hold what the manifest says? prints every mismatch */
+bool check_state(muriscv_t *sim, bench_kernel_t *kernel, const char *mode) {
+	bool ok = true;
+	int i;
+	if (kernel->insts != 0 && muriscv_instructions(sim) != kernel->insts) {
+		printf("%s (%s): retired %u instructions, expected %u\n", kernel->name, mode,
+				muriscv_instructions(sim), kernel->insts);
+		ok = false;
+	}
+	for (i = 0; i < kernel->num_checks; i++) {
+		bench_check_t *check = &kernel->checks[i];
+		uint32_t actual = check->is_mem ? muriscv_read_mem(sim, check->where) : muriscv_read_reg(sim, check->where);
+		if (actual != check->value) {
+			if (check->is_mem) {
+				printf("%s (%s): [0x%08x] = 0x%08x, expected 0x%08x\n", kernel->name, mode, check->where,
+						actual, check->value);
+			} else {
+				printf("%s (%s): x%u = 0x%08x, expected 0x%08x\n", kernel->name, mode, check->where,
+						actual, check->value);
+			}
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+/* best-of-N wall time of one kernel in one mode; the first run is checked */
+double time_runs(muriscv_t *sim, bench_kernel_t *kernel, bool functional) {
+	double best = 0, total = 0;
+	int run;
+	for (run = 0; run < BENCH_MAX_RUNS && (run == 0 || total < BENCH_MIN_SECONDS); run++) {
+		muriscv_reset(sim);
+		double start = now();
+		if (functional) {
+			muriscv_fast_forward(sim, UINT32_MAX);
+		} else {
+			muriscv_run(sim);
+		}
+		double elapsed = now() - start;
+		if (run == 0) {
+			kernel->ok &= check_state(sim, kernel, functional ? "functional" : "pipeline");
+			if (!functional) {
+				kernel->cycles = muriscv_cycles(sim);
+				kernel->instructions = muriscv_instructions(sim);
+			}
+		}
+		if (run == 0 || elapsed < best) {
+			best = elapsed;
+		}
+		total += elapsed;
+	}
+	return best;
+}
+
+void run_kernel(bench_kernel_t *kernel, const char *engine) {
+	muriscv_t *sim = muriscv_create();
+	kernel->ok = false;
+	if (sim == NULL) {
+		return;
+	}
+	muriscv_set_trace_level(sim, MURISCV_TRACE_NONE);
+	if (muriscv_set_engine(sim, engine) != 0 || muriscv_load(sim, kernel->program) != 0) {
+		muriscv_destroy(sim);
+		return;
+	}
+	kernel->ok = true;
+	kernel->pipeline_seconds = time_runs(sim, kernel, false);
+	kernel->functional_seconds = time_runs(sim, kernel, true);
+	kernel->pipeline_mips = kernel->pipeline_seconds > 0 ? kernel->instructions / kernel->pipeline_seconds / 1e6 : 0;
+	kernel->functional_mips = kernel->functional_seconds > 0 ?
+			kernel->instructions / kernel->functional_seconds / 1e6 : 0;
+	muriscv_destroy(sim);
+}
+
+/* every kernel in turn on one instance, through fast-forward on each engine, so state
+ * left behind by the previous program (translations, predecoded text) shows up as a
+ * wrong result; returns how many runs were wrong */
+int check_reload(void) {
+	static const char *engines[] = { "step", "threaded", "jit" };
+	int e, i, wrong = 0;
+	for (e = 0; e < (int)(sizeof(engines) / sizeof(engines[0])); e++) {
+		muriscv_t *sim = muriscv_create();
+		char mode[32];
+		if (sim == NULL) {
+			return 1;
+		}
+		muriscv_set_trace_level(sim, MURISCV_TRACE_NONE);
+		if (muriscv_set_engine(sim, engines[e]) != 0) {
+			muriscv_destroy(sim);
+			continue;
+		}
+		snprintf(mode, sizeof(mode), "reload, %s", engines[e]);
+		for (i = 0; i < num_kernels; i++) {
+			if (muriscv_load(sim, kernels[i].program) != 0) {
+				wrong++;
+				continue;
+			}
+			muriscv_fast_forward(sim, UINT32_MAX);
+			wrong += !check_state(sim, &kernels[i], mode);
+		}
+		muriscv_destroy(sim);
+	}
+	return wrong;
+}
+
+/* fails kernels that slowed down past tolerance percent; returns how many did */
+int compare_baseline(const char *path, double tolerance) {
+	FILE *fp = fopen(path, "r");
+	char line[256], name[64];
+	double pipeline, functional;
+	int i, slower = 0;
+	if (fp == NULL) {
+		return 0;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (line[0] == '#' || sscanf(line, "%63s %lf %lf", name, &pipeline, &functional) != 3) {
+			continue;
+		}
+		for (i = 0; i < num_kernels; i++) {
+			bench_kernel_t *kernel = &kernels[i];
+			if (strcmp(kernel->name, name) != 0) {
+				continue;
+			}
+			double floor = 1.0 - tolerance / 100.0;
+			if (kernel->pipeline_mips < pipeline * floor || kernel->functional_mips < functional * floor) {
+				printf("%s: %.1f / %.1f MIPS is more than %.0f%% below the baseline %.1f / %.1f\n", name,
+						kernel->pipeline_mips, kernel->functional_mips, tolerance, pipeline, functional);
+				slower++;
+			}
+		}
+	}
+	fclose(fp);
+	return slower;
+}
+
+int write_baseline(const char *path) {
+	FILE *fp = fopen(path, "w");
+	int i;
+	if (fp == NULL) {
+		printf("Error: Can't write baseline %s\n", path);
+		return -1;
+	}
+	fprintf(fp, "# kernel pipeline-MIPS functional-MIPS\n");
+	for (i = 0; i < num_kernels; i++) {
+		fprintf(fp, "%s %.3f %.3f\n", kernels[i].name, kernels[i].pipeline_mips, kernels[i].functional_mips);
+	}
+	fclose(fp);
+	printf("Baseline written to %s\n", path);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	const char *baseline = NULL, *engine = "threaded";
+	bool update = false;
+	double tolerance = 25;
+	int opt, i, failed = 0;
+
+	while ((opt = getopt(argc, argv, "b:ut:e:h")) != -1) {
+		switch (opt) {
+			case 'b':
+				baseline = optarg;
+				break;
+			case 'u':
+				update = true;
+				break;
+			case 't':
+				tolerance = strtod(optarg, NULL);
+				break;
+			case 'e':
+				engine = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				exit(opt == 'h' ? 0 : 1);
+		}
+	}
+	if (optind + 1 != argc) {
+		usage(argv[0]);
+		exit(1);
+	}
+	if (load_manifest(argv[optind]) != 0) {
+		exit(1);
+	}
+
+	printf("%-10s %10s %10s %6s %12s %10s %12s %10s  %s\n", "kernel", "cycles", "insts", "CPI",
+			"pipeline ms", "MIPS", "ff ms", "ff MIPS", "result");
+	for (i = 0; i < num_kernels; i++) {
+		bench_kernel_t *kernel = &kernels[i];
+		run_kernel(kernel, engine);
+		printf("%-10s %10u %10u %6.3f %12.3f %10.2f %12.3f %10.2f  %s\n", kernel->name, kernel->cycles,
+				kernel->instructions, kernel->instructions ? (double)kernel->cycles / kernel->instructions : 0.0,
+				kernel->pipeline_seconds * 1e3, kernel->pipeline_mips, kernel->functional_seconds * 1e3,
+				kernel->functional_mips, kernel->ok ? "ok" : "WRONG");
+		failed += !kernel->ok;
+	}
+	failed += check_reload();
+
+	if (baseline != NULL) {
+		FILE *fp = fopen(baseline, "r");
+		if (fp != NULL) {
+			fclose(fp);
+		}
+		if (fp == NULL || update) {
+			if (failed == 0 && write_baseline(baseline) != 0) {
+				exit(1);
+			}
+		} else {
+			failed += compare_baseline(baseline, tolerance);
+		}
+	}
+	if (failed > 0) {
+		printf("%d kernel(s) failed\n", failed);
+		return 1;
+	}
+	return 0;
+}
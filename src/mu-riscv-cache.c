@@ -0,0 +1,225 @@
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Cache model: tags only, data always comes from guest memory.     */
+/* An access returns the stall cycles it costs the pipeline.            */
+/***************************************************************/
+
+static const char *cache_repl_names[NUM_CACHE_REPL] = { "lru", "fifo", "random" };
+
+/***************************************************************/
+/* Parse <size>[k|m]:<assoc>:<line>[:<policy>[:wb|wt[:<latency>]]]  */
+/***************************************************************/
+int cache_configure(cache_t *cache, const char *spec)
+{
+	char policy[16] = "lru", write[8] = "wb", *end;
+	uint32_t size, assoc, line_size, latency = CACHE_DEFAULT_MISS_LATENCY;
+	int i;
+
+	size = strtoul(spec, &end, 0);
+	if (*end == 'k' || *end == 'K') {
+		size <<= 10;
+		end++;
+	} else if (*end == 'm' || *end == 'M') {
+		size <<= 20;
+		end++;
+	}
+	if (*end != ':' || sscanf(end + 1, "%u:%u:%15[^:]:%7[^:]:%u", &assoc, &line_size, policy, write, &latency) < 2) {
+		printf("Error: Bad cache spec %s (<size>:<assoc>:<line>[:lru|fifo|random[:wb|wt[:<latency>]]])\n", spec);
+		return -1;
+	}
+	if (line_size < 4 || (line_size & (line_size - 1)) != 0) {
+		printf("Error: Cache line size must be a power of two of at least 4 bytes\n");
+		return -1;
+	}
+	if (assoc == 0 || size == 0 || size % (assoc * line_size) != 0) {
+		printf("Error: Cache size must be a multiple of associativity x line size\n");
+		return -1;
+	}
+	for (i = 0; i < NUM_CACHE_REPL && strcmp(policy, cache_repl_names[i]) != 0; i++);
+	if (i == NUM_CACHE_REPL) {
+		printf("Error: Unknown replacement policy %s (lru, fifo, random)\n", policy);
+		return -1;
+	}
+	if (strcmp(write, "wb") != 0 && strcmp(write, "wt") != 0) {
+		printf("Error: Unknown write policy %s (wb, wt)\n", write);
+		return -1;
+	}
+
+	cache_line_t *lines = calloc(size / line_size, sizeof(cache_line_t));
+	if (lines == NULL) {
+		printf("Error: Out of memory for %s\n", cache->name);
+		return -1;
+	}
+	cache_free(cache);
+	cache->lines = lines;
+	cache->enabled = true;
+	cache->size = size;
+	cache->assoc = assoc;
+	cache->line_size = line_size;
+	cache->num_sets = size / (assoc * line_size);
+	for (cache->line_shift = 0; (1u << cache->line_shift) < line_size; cache->line_shift++);
+	cache->repl = i;
+	cache->write_back = strcmp(write, "wb") == 0;
+	cache->miss_latency = latency;
+	cache_reset(cache);
+	return 0;
+}
+
+/* invalidate every line and zero the statistics */
+void cache_reset(cache_t *cache)
+{
+	if (cache->lines != NULL) {
+		memset(cache->lines, 0, cache->num_sets * cache->assoc * sizeof(cache_line_t));
+	}
+	cache->clock = 0;
+	cache->rng = 0x2545F491;
+	cache->reads = cache->writes = 0;
+	cache->read_misses = cache->write_misses = 0;
+	cache->evictions = cache->writebacks = 0;
+	cache->stall_cycles = 0;
+}
+
+void cache_free(cache_t *cache)
+{
+	free(cache->lines);
+	cache->lines = NULL;
+	cache->enabled = false;
+}
+
+/* "l1i", "l1d" or "l2"; NULL if there is no such level */
+cache_t *cache_by_name(mu_sim_t *sim, const char *name)
+{
+	if (strcasecmp(name, "l1i") == 0) return &sim->l1i;
+	if (strcasecmp(name, "l1d") == 0) return &sim->l1d;
+	if (strcasecmp(name, "l2") == 0) return &sim->l2;
+	return NULL;
+}
+
+/* L1s miss into L2 when there is one, otherwise straight to memory */
+void cache_link(mu_sim_t *sim)
+{
+	cache_t *next = sim->l2.enabled ? &sim->l2 : NULL;
+	sim->l1i.next = next;
+	sim->l1d.next = next;
+	sim->l2.next = NULL;
+}
+
+static cache_line_t *cache_victim(cache_t *cache, cache_line_t *set)
+{
+	cache_line_t *victim = &set[0];
+	uint32_t way;
+	for (way = 0; way < cache->assoc; way++) {
+		if (!set[way].valid) {
+			return &set[way];
+		}
+	}
+	if (cache->repl == REPL_RANDOM) {
+		cache->rng ^= cache->rng << 13;
+		cache->rng ^= cache->rng >> 17;
+		cache->rng ^= cache->rng << 5;
+		return &set[cache->rng % cache->assoc];
+	}
+	/* LRU stamps on every hit, FIFO only on fill; either way evict the oldest */
+	for (way = 1; way < cache->assoc; way++) {
+		if (set[way].stamp < victim->stamp) {
+			victim = &set[way];
+		}
+	}
+	return victim;
+}
+
+/* a write that drains through the write buffer: nobody waits for it */
+static void cache_write_buffered(cache_t *cache, uint32_t address)
+{
+	if (cache != NULL) {
+		cache->stall_cycles -= cache_access(cache, address, true);
+	}
+}
+
+/*
+	Look up one access and return the cycles it stalls for: 0 on a hit,
+	otherwise this level's miss latency plus whatever the next level adds.
+	Write-back caches allocate on a write miss; write-through caches do not
+	and pass every write down. Writes to the next level (write-through and
+	dirty evictions) are assumed to drain through a write buffer and cost
+	nothing.
+*/
+uint32_t cache_access(cache_t *cache, uint32_t address, bool write)
+{
+	if (cache == NULL || !cache->enabled) {
+		return 0;
+	}
+	uint32_t line_addr = address >> cache->line_shift;
+	cache_line_t *set = &cache->lines[(line_addr % cache->num_sets) * cache->assoc];
+	uint32_t way;
+
+	if (write) {
+		cache->writes++;
+	} else {
+		cache->reads++;
+	}
+	for (way = 0; way < cache->assoc; way++) {
+		cache_line_t *line = &set[way];
+		if (line->valid && line->tag == line_addr) {
+			if (cache->repl == REPL_LRU) {
+				line->stamp = ++cache->clock;
+			}
+			if (write && cache->write_back) {
+				line->dirty = true;
+			} else if (write) {
+				cache_write_buffered(cache->next, address);
+			}
+			return 0;
+		}
+	}
+
+	if (write) {
+		cache->write_misses++;
+		if (!cache->write_back) {
+			cache_write_buffered(cache->next, address);
+			return 0;
+		}
+	} else {
+		cache->read_misses++;
+	}
+
+	cache_line_t *victim = cache_victim(cache, set);
+	if (victim->valid) {
+		cache->evictions++;
+		if (victim->dirty) {
+			cache->writebacks++;
+			cache_write_buffered(cache->next, victim->tag << cache->line_shift);
+		}
+	}
+	uint32_t stall = cache->miss_latency + cache_access(cache->next, address, false);
+	victim->valid = true;
+	victim->dirty = write;
+	victim->tag = line_addr;
+	victim->stamp = ++cache->clock;
+	cache->stall_cycles += stall;
+	return stall;
+}
+
+void show_cache_stats(mu_sim_t *sim)
+{
+	cache_t *levels[] = { &sim->l1i, &sim->l1d, &sim->l2 };
+	int i;
+	for (i = 0; i < 3; i++) {
+		cache_t *cache = levels[i];
+		if (!cache->enabled) {
+			continue;
+		}
+		uint32_t accesses = cache->reads + cache->writes;
+		uint32_t misses = cache->read_misses + cache->write_misses;
+		printf("%s: %u B, %u-way, %u B lines, %s, %s, %u-cycle miss\n", cache->name, cache->size, cache->assoc,
+				cache->line_size, cache_repl_names[cache->repl], cache->write_back ? "write-back" : "write-through",
+				cache->miss_latency);
+		printf("  Reads: %u (%u misses) | Writes: %u (%u misses) | Hit rate: %.2f%%\n", cache->reads,
+				cache->read_misses, cache->writes, cache->write_misses,
+				accesses ? 100.0 * (accesses - misses) / accesses : 100.0);
+		printf("  Evictions: %u | Writebacks: %u | Stall cycles: %u\n", cache->evictions, cache->writebacks,
+				cache->stall_cycles);
+	}
+	printf("\n");
+}
@@ -0,0 +1,387 @@
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Breakpoints and data watchpoints                                            */
+/***************************************************************/
+/*
+	A run only takes the checked loop while a breakpoint or watchpoint is
+	set (debug_armed), so the untraced cycle loop is unchanged otherwise.
+
+	A stop never changes the pipeline, so cycle counts are the same with or
+	without a debugger. The program is stopped between the instructions in
+	EX/MEM and MEM/WB: the one in MEM/WB has made its memory access and only
+	its register write is pending (debug_reg shows it already applied), the
+	one in EX/MEM has not touched memory yet. debug_pc() is the PC of that
+	next instruction.
+
+	Breakpoints live in an open-addressed hash set and are looked up once
+	per instruction, before the cycle in which it would leave EX/MEM.
+	Watchpoints are checked in mem_load/mem_store behind a one-bit-per-page
+	filter, so accesses to pages without a watchpoint skip the list; the
+	run stops after the cycle that made the access.
+
+	A stopped run resumes past the instruction it stopped at (skip_pc), so
+	'run' after a breakpoint makes progress instead of stopping again.
+*/
+
+#define BREAKPOINT_EMPTY	1u	/* never a PC: instructions are 4-byte aligned */
+#define BREAKPOINT_DELETED	3u
+#define BREAKPOINT_MIN_CAPACITY 16
+
+static uint32_t breakpoint_slot(uint32_t pc, uint32_t capacity)
+{
+	return ((pc >> 2) * 0x9E3779B1u) & (capacity - 1);
+}
+
+/* slot holding pc, or -1 */
+static int64_t breakpoint_find(mu_sim_t *sim, uint32_t pc)
+{
+	debug_state_t *debug = &sim->debug;
+	uint32_t i, slot;
+	if (debug->num_breakpoints == 0) {
+		return -1;
+	}
+	for (i = 0, slot = breakpoint_slot(pc, debug->capacity); i < debug->capacity; i++,
+			slot = (slot + 1) & (debug->capacity - 1)) {
+		if (debug->breakpoints[slot] == pc) {
+			return slot;
+		}
+		if (debug->breakpoints[slot] == BREAKPOINT_EMPTY) {
+			break;
+		}
+	}
+	return -1;
+}
+
+static int breakpoint_resize(mu_sim_t *sim, uint32_t capacity)
+{
+	debug_state_t *debug = &sim->debug;
+	uint32_t *old = debug->breakpoints, old_capacity = debug->capacity, i;
+	uint32_t *slots = malloc(capacity * sizeof(uint32_t));
+	if (slots == NULL) {
+		printf("Error: Out of memory for breakpoints\n");
+		return -1;
+	}
+	for (i = 0; i < capacity; i++) {
+		slots[i] = BREAKPOINT_EMPTY;
+	}
+	debug->breakpoints = slots;
+	debug->capacity = capacity;
+	debug->used = debug->num_breakpoints;
+	for (i = 0; i < old_capacity; i++) {
+		if (old[i] != BREAKPOINT_EMPTY && old[i] != BREAKPOINT_DELETED) {
+			uint32_t slot = breakpoint_slot(old[i], capacity);
+			while (slots[slot] != BREAKPOINT_EMPTY) {
+				slot = (slot + 1) & (capacity - 1);
+			}
+			slots[slot] = old[i];
+		}
+	}
+	free(old);
+	return 0;
+}
+
+int breakpoint_add(mu_sim_t *sim, uint32_t pc)
+{
+	debug_state_t *debug = &sim->debug;
+	if (pc & 3) {
+		printf("Error: Breakpoint 0x%08x is not word aligned\n", pc);
+		return -1;
+	}
+	if (breakpoint_find(sim, pc) >= 0) {
+		return 0;
+	}
+	/* keep at least a quarter of the slots empty so probes stay short */
+	if ((debug->used + 1) * 4 > debug->capacity * 3) {
+		uint32_t capacity = debug->capacity ? debug->capacity : BREAKPOINT_MIN_CAPACITY;
+		while ((debug->num_breakpoints + 1) * 2 > capacity) {
+			capacity *= 2;
+		}
+		if (breakpoint_resize(sim, capacity) != 0) {
+			return -1;
+		}
+	}
+	uint32_t slot = breakpoint_slot(pc, debug->capacity);
+	while (debug->breakpoints[slot] != BREAKPOINT_EMPTY && debug->breakpoints[slot] != BREAKPOINT_DELETED) {
+		slot = (slot + 1) & (debug->capacity - 1);
+	}
+	if (debug->breakpoints[slot] == BREAKPOINT_EMPTY) {
+		debug->used++;
+	}
+	debug->breakpoints[slot] = pc;
+	debug->num_breakpoints++;
+	return 0;
+}
+
+int breakpoint_remove(mu_sim_t *sim, uint32_t pc)
+{
+	int64_t slot = breakpoint_find(sim, pc);
+	if (slot < 0) {
+		return -1;
+	}
+	sim->debug.breakpoints[slot] = BREAKPOINT_DELETED;
+	sim->debug.num_breakpoints--;
+	return 0;
+}
+
+void breakpoints_clear(mu_sim_t *sim)
+{
+	free(sim->debug.breakpoints);
+	sim->debug.breakpoints = NULL;
+	sim->debug.capacity = 0;
+	sim->debug.num_breakpoints = 0;
+	sim->debug.used = 0;
+}
+
+/***************************************************************/
+/* Watchpoints                                                                                                */
+/***************************************************************/
+static void watch_filter_rebuild(mu_mem_t *mem)
+{
+	uint32_t i, page;
+	memset(mem->watch_filter, 0, sizeof(mem->watch_filter));
+	for (i = 0; i < mem->num_watchpoints; i++) {
+		watchpoint_t *watch = &mem->watchpoints[i];
+		uint32_t first = watch->address >> MEM_PAGE_SHIFT, last = (watch->address + watch->len - 1) >> MEM_PAGE_SHIFT;
+		for (page = first; ; page++) {
+			mem->watch_filter[(page % WATCH_FILTER_BITS) / 64] |= 1ull << (page % 64);
+			if (page == last || page - first >= WATCH_FILTER_BITS) {
+				break;
+			}
+		}
+	}
+}
+
+int watchpoint_add(mu_mem_t *mem, uint32_t address, uint32_t len, int kind)
+{
+	if (len == 0 || address + len - 1 < address || (kind & (MURISCV_WATCH_READ | MURISCV_WATCH_WRITE)) == 0) {
+		printf("Error: Bad watchpoint 0x%08x, %u bytes\n", address, len);
+		return -1;
+	}
+	watchpoint_t *watchpoints = realloc(mem->watchpoints, (mem->num_watchpoints + 1) * sizeof(watchpoint_t));
+	if (watchpoints == NULL) {
+		printf("Error: Out of memory for watchpoints\n");
+		return -1;
+	}
+	mem->watchpoints = watchpoints;
+	mem->watchpoints[mem->num_watchpoints].address = address;
+	mem->watchpoints[mem->num_watchpoints].len = len;
+	mem->watchpoints[mem->num_watchpoints].kind = kind;
+	mem->num_watchpoints++;
+	watch_filter_rebuild(mem);
+	return 0;
+}
+
+/* len and kind 0 match any watchpoint at address; returns how many were removed, -1 for none */
+int watchpoint_remove(mu_mem_t *mem, uint32_t address, uint32_t len, int kind)
+{
+	uint32_t i, kept = 0;
+	for (i = 0; i < mem->num_watchpoints; i++) {
+		watchpoint_t *watch = &mem->watchpoints[i];
+		if (watch->address == address && (len == 0 || watch->len == len) && (kind == 0 || watch->kind == kind)) {
+			continue;
+		}
+		mem->watchpoints[kept++] = *watch;
+	}
+	int removed = mem->num_watchpoints - kept;
+	mem->num_watchpoints = kept;
+	watch_filter_rebuild(mem);
+	return removed > 0 ? removed : -1;
+}
+
+void watchpoints_clear(mu_mem_t *mem)
+{
+	free(mem->watchpoints);
+	mem->watchpoints = NULL;
+	mem->num_watchpoints = 0;
+	memset(mem->watch_filter, 0, sizeof(mem->watch_filter));
+	mem->watch_hit.hit = false;
+}
+
+/* an access touched a filtered page: record the first watchpoint it hits */
+void watch_access(mu_mem_t *mem, uint32_t address, uint32_t len, bool write)
+{
+	uint32_t i;
+	if (mem->watch_hit.hit) {
+		return;
+	}
+	for (i = 0; i < mem->num_watchpoints; i++) {
+		watchpoint_t *watch = &mem->watchpoints[i];
+		if ((watch->kind & (write ? MURISCV_WATCH_WRITE : MURISCV_WATCH_READ)) &&
+				address <= watch->address + (watch->len - 1) && watch->address <= address + (len - 1)) {
+			mem->watch_hit.hit = true;
+			mem->watch_hit.write = write;
+			mem->watch_hit.address = address;
+			mem->watch_hit.len = len;
+			mem->watch_hit.kind = watch->kind;
+			return;
+		}
+	}
+}
+
+/***************************************************************/
+/* Stopping and resuming                                                                                 */
+/***************************************************************/
+/* PC of the oldest instruction that has not reached memory: where the program is */
+uint32_t debug_pc(mu_sim_t *sim)
+{
+	if (sim->EX_MEM.IR) return sim->EX_MEM.PC;
+	if (sim->ID_EX.IR) return sim->ID_EX.PC;
+	if (sim->IF_ID.IR) return sim->IF_ID.PC;
+	return sim->CURRENT_STATE.PC;
+}
+
+/* a register as the debugger sees it: with the write-back in MEM/WB applied */
+uint32_t debug_reg(mu_sim_t *sim, int reg)
+{
+	decoded_inst_t *dec = &sim->MEM_WB.dec;
+	if (sim->MEM_WB.IR && (dec->flags & DEC_WRITES_RD) && dec->rd == reg && reg != 0) {
+		return (dec->flags & DEC_LOAD) ? sim->MEM_WB.LMD : sim->MEM_WB.ALUOutput;
+	}
+	return sim->CURRENT_STATE.REGS[reg];
+}
+
+/* finish the instruction in MEM/WB, drop the younger ones and refetch from
+ * debug_pc(), after the debugger changed registers or memory they may have read */
+void debug_squash(mu_sim_t *sim)
+{
+	uint32_t pc = debug_pc(sim);
+	if (sim->MEM_WB.IR) {
+		WB(sim);
+		sim->CURRENT_STATE = sim->NEXT_STATE;
+	}
+	memset(&sim->IF_ID, 0, sizeof(sim->IF_ID));
+	memset(&sim->ID_EX, 0, sizeof(sim->ID_EX));
+	memset(&sim->EX_MEM, 0, sizeof(sim->EX_MEM));
+	memset(&sim->MEM_WB, 0, sizeof(sim->MEM_WB));
+	sim->bubble = false;
+	sim->flush = false;
+	sim->fetch_stall = 0;
+	sim->mem_stall = 0;
+	sim->ex_busy = 0;
+	sim->CURRENT_STATE.PC = pc;
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+}
+
+void debug_reset(mu_sim_t *sim)
+{
+	sim->debug.skip = false;
+	sim->debug.stop = STOP_NONE;
+	sim->mem->watch_hit.hit = false;
+}
+
+static void debug_stopped(mu_sim_t *sim, stop_reason_t reason)
+{
+	uint32_t pc = debug_pc(sim);
+	sim->debug.stop = reason;
+	sim->debug.skip = true;
+	sim->debug.skip_pc = pc;
+	if (sim->TRACE_LEVEL < TRACE_SUMMARY || reason == STOP_STEP) {
+		return;
+	}
+	const elf_symbol_t *symbol = symbol_at(sim, pc);
+	if (reason == STOP_BREAKPOINT) {
+		printf("Breakpoint at 0x%08x%s%s%s", pc, symbol ? " <" : "", symbol ? symbol->name : "", symbol ? ">" : "");
+	} else if (reason == STOP_WATCHPOINT) {
+		watch_hit_t *hit = &sim->mem->watch_hit;
+		printf("Watchpoint: %s of 0x%08x (%u bytes) by 0x%08x", hit->write ? "write" : "read", hit->address,
+				hit->len, pc);
+	} else {
+		printf("Interrupted at 0x%08x", pc);
+	}
+	printf(" after %u cycles, %u instructions\n", sim->CYCLE_COUNT, sim->INSTRUCTION_COUNT);
+}
+
+/* instruction at pc is next to execute: stop if it has a breakpoint, unless we are resuming from it */
+bool debug_break_at(mu_sim_t *sim, uint32_t pc)
+{
+	if (sim->debug.skip) {
+		sim->debug.skip = false;
+		if (pc == sim->debug.skip_pc) {
+			return false;
+		}
+	}
+	if (breakpoint_find(sim, pc) < 0) {
+		return false;
+	}
+	debug_stopped(sim, STOP_BREAKPOINT);
+	return true;
+}
+
+/* before a cycle: stop if the instruction about to access memory has a breakpoint */
+bool debug_break(mu_sim_t *sim)
+{
+	if (!sim->EX_MEM.IR || sim->mem_stall > 0) {
+		return false;	// nothing moves past MEM this cycle
+	}
+	return debug_break_at(sim, sim->EX_MEM.PC);
+}
+
+/* after a cycle or instruction: stop if it touched a watchpoint */
+bool debug_watch(mu_sim_t *sim)
+{
+	if (!sim->mem->watch_hit.hit) {
+		return false;
+	}
+	debug_stopped(sim, STOP_WATCHPOINT);
+	sim->mem->watch_hit.hit = false;
+	return true;
+}
+
+/* continue (or single-step one instruction) on the pipeline until something stops it;
+ * interrupted is polled every 64K cycles */
+stop_reason_t debug_resume(mu_sim_t *sim, bool step, bool (*interrupted)(void *), void *arg)
+{
+	uint32_t n = 0;
+	bool traced = sim->TRACE_LEVEL > TRACE_SUMMARY || sim->btrace.file != NULL;
+	bool stepped = false;
+	sim->debug.stop = STOP_NONE;
+	while (sim->RUN_FLAG) {
+		bool leaves_ex_mem = sim->EX_MEM.IR && sim->mem_stall == 0;
+		if (step && stepped && leaves_ex_mem) {
+			debug_stopped(sim, STOP_STEP);
+			return STOP_STEP;
+		}
+		if (debug_break(sim)) {
+			return STOP_BREAKPOINT;
+		}
+		stepped |= leaves_ex_mem;
+		if (traced) {
+			cycle_traced(sim);
+		} else {
+			cycle(sim);
+		}
+		if (debug_watch(sim)) {
+			return STOP_WATCHPOINT;
+		}
+		if ((++n & 0xFFFF) == 0 && interrupted != NULL && interrupted(arg)) {
+			debug_stopped(sim, STOP_INTERRUPT);
+			return STOP_INTERRUPT;
+		}
+	}
+	sim->debug.stop = STOP_EXITED;
+	return STOP_EXITED;
+}
+
+/***************************************************************/
+/* break / watch with no arguments                                                                 */
+/***************************************************************/
+void show_debug_points(mu_sim_t *sim)
+{
+	uint32_t i;
+	printf("Breakpoints\t: %u\n", sim->debug.num_breakpoints);
+	for (i = 0; i < sim->debug.capacity; i++) {
+		uint32_t pc = sim->debug.breakpoints[i];
+		if (pc == BREAKPOINT_EMPTY || pc == BREAKPOINT_DELETED) {
+			continue;
+		}
+		const elf_symbol_t *symbol = symbol_at(sim, pc);
+		printf("\t0x%08x%s%s%s\n", pc, symbol ? " <" : "", symbol ? symbol->name : "", symbol ? ">" : "");
+	}
+	printf("Watchpoints\t: %u\n", sim->mem->num_watchpoints);
+	for (i = 0; i < sim->mem->num_watchpoints; i++) {
+		watchpoint_t *watch = &sim->mem->watchpoints[i];
+		printf("\t0x%08x..0x%08x %s%s\n", watch->address, watch->address + watch->len - 1,
+				(watch->kind & MURISCV_WATCH_READ) ? "r" : "", (watch->kind & MURISCV_WATCH_WRITE) ? "w" : "");
+	}
+}
@@ -0,0 +1,212 @@
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mu-riscv.h"
+
+#ifndef EM_RISCV
+#define EM_RISCV 243
+#endif
+
+/***************************************************************/
+/* ELF32 loader: the file is mmap'd and every PT_LOAD segment is */
+/* copied into guest memory a page at a time.                                */
+/***************************************************************/
+/*
+	Programs must be linked for the MU-RISCV memory map, e.g.
+		riscv32-unknown-elf-gcc -nostdlib -Wl,-Ttext=0x00400000 -Wl,-Tdata=0x10010000
+	The executable segment becomes the text the pipeline fetches from, the
+	PC starts at the entry point, sp at the top of the stack and gp at
+	__global_pointer$ when the program defines it.
+*/
+
+/* does [address, address + len) fall inside one region of guest memory? */
+static bool elf_range_mapped(mu_mem_t *mem, uint32_t address, uint32_t len)
+{
+	uint32_t last = address + len - 1;
+	int i;
+	if (len == 0) {
+		return true;
+	}
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		if (address >= mem->regions[i].begin && last >= address && last <= mem->regions[i].end) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int symbol_cmp(const void *a, const void *b)
+{
+	const elf_symbol_t *x = a, *y = b;
+	return x->value < y->value ? -1 : x->value > y->value;
+}
+
+/* keep named object, function and label symbols (not $x/$d mapping symbols), sorted by address */
+static void elf_load_symbols(mu_sim_t *sim, const uint8_t *image, size_t size, const Elf32_Ehdr *ehdr)
+{
+	const Elf32_Shdr *shdrs = (const Elf32_Shdr *)(image + ehdr->e_shoff);
+	uint32_t i, j;
+
+	if (ehdr->e_shoff == 0 || ehdr->e_shentsize != sizeof(Elf32_Shdr) ||
+			ehdr->e_shoff + (size_t)ehdr->e_shnum * sizeof(Elf32_Shdr) > size) {
+		return;
+	}
+	for (i = 0; i < ehdr->e_shnum; i++) {
+		if (shdrs[i].sh_type != SHT_SYMTAB || shdrs[i].sh_link >= ehdr->e_shnum) {
+			continue;
+		}
+		const Elf32_Shdr *strtab = &shdrs[shdrs[i].sh_link];
+		if ((size_t)shdrs[i].sh_offset + shdrs[i].sh_size > size || (size_t)strtab->sh_offset + strtab->sh_size > size) {
+			continue;
+		}
+		const Elf32_Sym *syms = (const Elf32_Sym *)(image + shdrs[i].sh_offset);
+		const char *names = (const char *)(image + strtab->sh_offset);
+		uint32_t count = shdrs[i].sh_size / sizeof(Elf32_Sym);
+
+		sim->symbols = malloc(count * sizeof(elf_symbol_t));
+		if (sim->symbols == NULL) {
+			return;
+		}
+		for (j = 0; j < count; j++) {
+			int type = ELF32_ST_TYPE(syms[j].st_info);
+			if (syms[j].st_name == 0 || syms[j].st_name >= strtab->sh_size || syms[j].st_shndx == SHN_UNDEF ||
+					names[syms[j].st_name] == '$' || (type != STT_FUNC && type != STT_OBJECT && type != STT_NOTYPE)) {
+				continue;
+			}
+			elf_symbol_t *symbol = &sim->symbols[sim->num_symbols];
+			symbol->name = strndup(names + syms[j].st_name, strtab->sh_size - syms[j].st_name);
+			symbol->value = syms[j].st_value;
+			symbol->size = syms[j].st_size;
+			if (symbol->name != NULL) {
+				sim->num_symbols++;
+			}
+		}
+		qsort(sim->symbols, sim->num_symbols, sizeof(elf_symbol_t), symbol_cmp);
+		return;
+	}
+}
+
+int load_elf(mu_sim_t *sim)
+{
+	int fd = open(sim->prog_file, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		printf("Error: Can't open program file %s\n", sim->prog_file);
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	size_t size = st.st_size;
+	const uint8_t *image = size >= sizeof(Elf32_Ehdr) ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (image == MAP_FAILED) {
+		printf("Error: Can't map program file %s\n", sim->prog_file);
+		return -1;
+	}
+
+	const Elf32_Ehdr *ehdr = (const Elf32_Ehdr *)image;
+	const char *error = NULL;
+	if (ehdr->e_ident[EI_CLASS] != ELFCLASS32 || ehdr->e_ident[EI_DATA] != ELFDATA2LSB) {
+		error = "not a little-endian ELF32 file";
+	} else if (ehdr->e_machine != EM_RISCV) {
+		error = "not a RISC-V executable";
+	} else if (ehdr->e_type != ET_EXEC) {
+		error = "not a statically linked executable";
+	} else if (ehdr->e_phentsize != sizeof(Elf32_Phdr) ||
+			ehdr->e_phoff + (size_t)ehdr->e_phnum * sizeof(Elf32_Phdr) > size) {
+		error = "program headers are truncated";
+	}
+
+	const Elf32_Phdr *phdrs = (const Elf32_Phdr *)(image + ehdr->e_phoff);
+	uint32_t text_end = MEM_TEXT_BEGIN, loaded = 0, i;
+	for (i = 0; error == NULL && i < ehdr->e_phnum; i++) {
+		const Elf32_Phdr *ph = &phdrs[i];
+		if (ph->p_type != PT_LOAD || ph->p_memsz == 0) {
+			continue;
+		}
+		if (ph->p_filesz > ph->p_memsz || (size_t)ph->p_offset + ph->p_filesz > size) {
+			error = "segment is truncated";
+		} else if (!elf_range_mapped(sim->mem, ph->p_vaddr, ph->p_memsz)) {
+			error = "segment lies outside the MU-RISCV memory map (link text at 0x00400000, data at 0x10010000)";
+		} else {
+			mem_write_block(sim->mem, ph->p_vaddr, image + ph->p_offset, ph->p_filesz);
+			mem_write_block(sim->mem, ph->p_vaddr + ph->p_filesz, NULL, ph->p_memsz - ph->p_filesz);
+			if ((ph->p_flags & PF_X) && ph->p_vaddr >= MEM_TEXT_BEGIN && ph->p_vaddr + ph->p_memsz > text_end &&
+					ph->p_vaddr + ph->p_memsz - 1 <= MEM_TEXT_END) {
+				text_end = ph->p_vaddr + ph->p_memsz;
+			}
+			loaded += ph->p_memsz;
+			if (sim->TRACE_LEVEL >= TRACE_SUMMARY) {
+				printf("Segment 0x%08x-0x%08x %c%c%c (%u bytes from file)\n", ph->p_vaddr,
+						ph->p_vaddr + ph->p_memsz - 1, (ph->p_flags & PF_R) ? 'r' : '-',
+						(ph->p_flags & PF_W) ? 'w' : '-', (ph->p_flags & PF_X) ? 'x' : '-', ph->p_filesz);
+			}
+		}
+	}
+	if (error == NULL && !elf_range_mapped(sim->mem, ehdr->e_entry, 4)) {
+		error = "entry point lies outside the MU-RISCV memory map";
+	}
+	if (error != NULL) {
+		printf("Error: %s: %s\n", sim->prog_file, error);
+		munmap((void *)image, size);
+		return -1;
+	}
+
+	uint32_t entry = ehdr->e_entry;
+	free_symbols(sim);
+	elf_load_symbols(sim, image, size, ehdr);
+	munmap((void *)image, size);
+
+	sim->PROGRAM_SIZE = (text_end - MEM_TEXT_BEGIN + 3) / 4;
+	memset(&sim->INITIAL_STATE, 0, sizeof(sim->INITIAL_STATE));
+	sim->INITIAL_STATE.PC = entry;
+	sim->INITIAL_STATE.REGS[2] = (MEM_STACK_BEGIN & ~0xFu) - 16;	// sp, 16-byte aligned below the top
+	const elf_symbol_t *gp = find_symbol(sim, "__global_pointer$");
+	if (gp != NULL) {
+		sim->INITIAL_STATE.REGS[3] = gp->value;
+	}
+	if (sim->TRACE_LEVEL >= TRACE_SUMMARY) {
+		printf("ELF program loaded into memory.\n%u bytes in %u text words, entry 0x%08x, %u symbols.\n\n",
+				loaded, sim->PROGRAM_SIZE, entry, sim->num_symbols);
+	}
+	return 0;
+}
+
+void free_symbols(mu_sim_t *sim)
+{
+	uint32_t i;
+	for (i = 0; i < sim->num_symbols; i++) {
+		free(sim->symbols[i].name);
+	}
+	free(sim->symbols);
+	sim->symbols = NULL;
+	sim->num_symbols = 0;
+}
+
+const elf_symbol_t *find_symbol(mu_sim_t *sim, const char *name)
+{
+	uint32_t i;
+	for (i = 0; i < sim->num_symbols; i++) {
+		if (strcmp(sim->symbols[i].name, name) == 0) {
+			return &sim->symbols[i];
+		}
+	}
+	return NULL;
+}
+
+/* first symbol whose value is exactly address, NULL if there is none */
+const elf_symbol_t *symbol_at(mu_sim_t *sim, uint32_t address)
+{
+	uint32_t low = 0, high = sim->num_symbols;
+	while (low < high) {
+		uint32_t mid = low + (high - low) / 2;
+		if (sim->symbols[mid].value < address) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low < sim->num_symbols && sim->symbols[low].value == address ? &sim->symbols[low] : NULL;
+}
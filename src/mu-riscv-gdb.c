@@ -0,0 +1,509 @@
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* GDB remote serial protocol stub                                                    */
+/***************************************************************/
+/*
+	Serves one debugger at a time on a TCP port or a Unix socket path:
+		riscv32-unknown-elf-gdb prog.elf -ex 'target remote :1234'
+	Supported: registers (g/G/p/P, x0-x31 and pc), memory (m/M), c and s on
+	the cycle-accurate pipeline, software/hardware breakpoints (Z0/Z1) and
+	write/read/access watchpoints (Z2/Z3/Z4), Ctrl-C, detach and kill.
+	Other packets get the empty reply, which tells GDB they are unsupported.
+	Changing registers or memory squashes the pipeline so in-flight
+	instructions see the new values.
+*/
+
+#define GDB_PACKET_SIZE 4096
+#define GDB_NUM_REGS 33	/* x0-x31, pc */
+
+typedef struct {
+	int fd;
+	char in[GDB_PACKET_SIZE + 4];	/* received bytes; in[in_pos..in_len) not consumed yet */
+	size_t in_pos, in_len;
+	bool interrupted;	/* 0x03 seen while the target was running */
+} gdb_conn_t;
+
+static const char gdb_hex[] = "0123456789abcdef";
+
+static const char gdb_target_xml[] =
+	"<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+	"<target version=\"1.0\"><architecture>riscv:rv32</architecture>"
+	"<feature name=\"org.gnu.gdb.riscv.cpu\">"
+	"<reg name=\"zero\" bitsize=\"32\" type=\"int\" regnum=\"0\"/>"
+	"<reg name=\"ra\" bitsize=\"32\" type=\"code_ptr\"/><reg name=\"sp\" bitsize=\"32\" type=\"data_ptr\"/>"
+	"<reg name=\"gp\" bitsize=\"32\" type=\"data_ptr\"/><reg name=\"tp\" bitsize=\"32\" type=\"data_ptr\"/>"
+	"<reg name=\"t0\" bitsize=\"32\" type=\"int\"/><reg name=\"t1\" bitsize=\"32\" type=\"int\"/>"
+	"<reg name=\"t2\" bitsize=\"32\" type=\"int\"/><reg name=\"fp\" bitsize=\"32\" type=\"data_ptr\"/>"
+	"<reg name=\"s1\" bitsize=\"32\" type=\"int\"/><reg name=\"a0\" bitsize=\"32\" type=\"int\"/>"
+	"<reg name=\"a1\" bitsize=\"32\" type=\"int\"/><reg name=\"a2\" bitsize=\"32\" type=\"int\"/>"
+	"<reg name=\"a3\" bitsize=\"32\" type=\"int\"/><reg name=\"a4\" bitsize=\"32\" type=\"int\"/>"
+	"<reg name=\"a5\" bitsize=\"32\" type=\"int\"/><reg name=\"a6\" bitsize=\"32\" type=\"int\"/>"
+	"<reg name=\"a7\" bitsize=\"32\" type=\"int\"/><reg name=\"s2\" bitsize=\"32\" type=\"int\"/>"
+	"<reg name=\"s3\" bitsize=\"32\" type=\"int\"/><reg name=\"s4\" bitsize=\"32\" type=\"int\"/>"
+	"<reg name=\"s5\" bitsize=\"32\" type=\"int\"/><reg name=\"s6\" bitsize=\"32\" type=\"int\"/>"
+	"<reg name=\"s7\" bitsize=\"32\" type=\"int\"/><reg name=\"s8\" bitsize=\"32\" type=\"int\"/>"
+	"<reg name=\"s9\" bitsize=\"32\" type=\"int\"/><reg name=\"s10\" bitsize=\"32\" type=\"int\"/>"
+	"<reg name=\"s11\" bitsize=\"32\" type=\"int\"/><reg name=\"t3\" bitsize=\"32\" type=\"int\"/>"
+	"<reg name=\"t4\" bitsize=\"32\" type=\"int\"/><reg name=\"t5\" bitsize=\"32\" type=\"int\"/>"
+	"<reg name=\"t6\" bitsize=\"32\" type=\"int\"/><reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/>"
+	"</feature></target>";
+
+static int gdb_hex_digit(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+/* little-endian hex word as GDB sends registers */
+static bool gdb_parse_reg(const char *text, uint32_t *value)
+{
+	int i;
+	*value = 0;
+	for (i = 0; i < 8; i++) {
+		int digit = gdb_hex_digit(text[i]);
+		if (digit < 0) {
+			return false;
+		}
+		*value |= (uint32_t)digit << ((i / 2) * 8 + (i % 2 ? 0 : 4));
+	}
+	return true;
+}
+
+static char *gdb_put_reg(char *out, uint32_t value)
+{
+	int i;
+	for (i = 0; i < 4; i++) {
+		*out++ = gdb_hex[(value >> (8 * i + 4)) & 0xF];
+		*out++ = gdb_hex[(value >> (8 * i)) & 0xF];
+	}
+	return out;
+}
+
+static uint32_t gdb_read_reg(mu_sim_t *sim, int reg)
+{
+	return reg == 32 ? debug_pc(sim) : debug_reg(sim, reg);
+}
+
+static void gdb_write_reg(mu_sim_t *sim, int reg, uint32_t value)
+{
+	debug_squash(sim);
+	if (reg == 32) {
+		if (value != sim->CURRENT_STATE.PC) {
+			sim->debug.skip = false;	// a new PC is not resuming from the stop
+		}
+		sim->CURRENT_STATE.PC = value;
+	} else if (reg != 0) {
+		sim->CURRENT_STATE.REGS[reg] = value;
+	}
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+}
+
+static uint8_t gdb_read_byte(mu_sim_t *sim, uint32_t address)
+{
+	return mem_read_8(sim->mem, address);
+}
+
+static void gdb_write_byte(mu_sim_t *sim, uint32_t address, uint8_t value)
+{
+	mem_write_8(sim->mem, address, value);
+}
+
+/***************************************************************/
+/* Packet framing: $<data>#<checksum>, acknowledged with + or -    */
+/***************************************************************/
+static bool gdb_write_all(gdb_conn_t *conn, const char *data, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(conn->fd, data, len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+/* next byte from the debugger, -1 when it went away */
+static int gdb_getc(gdb_conn_t *conn)
+{
+	if (conn->in_pos == conn->in_len) {
+		ssize_t n;
+		do {
+			n = read(conn->fd, conn->in, sizeof(conn->in));
+		} while (n < 0 && errno == EINTR);
+		if (n <= 0) {
+			return -1;
+		}
+		conn->in_pos = 0;
+		conn->in_len = n;
+	}
+	return (uint8_t)conn->in[conn->in_pos++];
+}
+
+static bool gdb_send(gdb_conn_t *conn, const char *data)
+{
+	size_t len = strlen(data);
+	char *packet = malloc(len + 5);
+	uint8_t sum = 0;
+	size_t i;
+	int c;
+	if (packet == NULL) {
+		return false;
+	}
+	packet[0] = '$';
+	for (i = 0; i < len; i++) {
+		packet[i + 1] = data[i];
+		sum += (uint8_t)data[i];
+	}
+	packet[len + 1] = '#';
+	packet[len + 2] = gdb_hex[sum >> 4];
+	packet[len + 3] = gdb_hex[sum & 0xF];
+	do {
+		if (!gdb_write_all(conn, packet, len + 4)) {
+			free(packet);
+			return false;
+		}
+		while ((c = gdb_getc(conn)) != '+' && c != '-' && c >= 0)
+			;
+	} while (c == '-');
+	free(packet);
+	return c == '+';
+}
+
+/* one packet's payload into buf, NUL terminated; false when the connection closed */
+static bool gdb_receive(gdb_conn_t *conn, char *buf)
+{
+	for (;;) {
+		int c;
+		size_t len = 0;
+		uint8_t sum = 0;
+		while ((c = gdb_getc(conn)) != '$') {
+			if (c < 0) {
+				return false;
+			}
+		}
+		while ((c = gdb_getc(conn)) != '#') {
+			if (c < 0) {
+				return false;
+			}
+			if (len < GDB_PACKET_SIZE) {
+				buf[len++] = c;
+			}
+			sum += c;
+		}
+		int high = gdb_hex_digit(gdb_getc(conn)), low = gdb_hex_digit(gdb_getc(conn));
+		buf[len] = '\0';
+		if (high >= 0 && low >= 0 && ((high << 4) | low) == sum) {
+			return gdb_write_all(conn, "+", 1);
+		}
+		if (!gdb_write_all(conn, "-", 1)) {
+			return false;
+		}
+	}
+}
+
+/* polled while the target runs: did the debugger send Ctrl-C? */
+static bool gdb_poll_interrupt(void *arg)
+{
+	gdb_conn_t *conn = arg;
+	struct pollfd pfd = { conn->fd, POLLIN, 0 };
+	char c;
+	while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+		if (read(conn->fd, &c, 1) != 1) {
+			return true;	// gone: stop so the session can end
+		}
+		if (c == 0x03) {
+			conn->interrupted = true;
+			return true;
+		}
+	}
+	return false;
+}
+
+/***************************************************************/
+/* Packet handlers                                                                                               */
+/***************************************************************/
+static void gdb_stop_reply(mu_sim_t *sim, stop_reason_t reason, char *reply)
+{
+	if (reason == STOP_EXITED) {
+		sprintf(reply, "W%02x", sim->EXIT_CODE >= 0 ? sim->EXIT_CODE & 0xFF : 0);
+	} else if (reason == STOP_WATCHPOINT) {
+		watch_hit_t *hit = &sim->mem->watch_hit;
+		const char *kind = hit->kind == (MURISCV_WATCH_READ | MURISCV_WATCH_WRITE) ? "awatch" :
+				hit->write ? "watch" : "rwatch";
+		sprintf(reply, "T05%s:%x;", kind, hit->address);
+	} else if (reason == STOP_INTERRUPT) {
+		strcpy(reply, "S02");
+	} else {
+		strcpy(reply, "S05");
+	}
+}
+
+/* Z/z packets: <type>,<addr>,<kind> */
+static void gdb_breakpoint(mu_sim_t *sim, const char *packet, char *reply)
+{
+	bool insert = packet[0] == 'Z';
+	unsigned type, address, len;
+	static const int watch_kinds[] = { 0, 0, MURISCV_WATCH_WRITE, MURISCV_WATCH_READ,
+		MURISCV_WATCH_READ | MURISCV_WATCH_WRITE };
+	int result;
+	if (sscanf(packet + 1, "%x,%x,%x", &type, &address, &len) != 3 || type > 4) {
+		reply[0] = '\0';
+		return;
+	}
+	if (type <= 1) {
+		result = insert ? breakpoint_add(sim, address) : breakpoint_remove(sim, address);
+	} else {
+		result = insert ? watchpoint_add(sim->mem, address, len, watch_kinds[type]) :
+				watchpoint_remove(sim->mem, address, len, watch_kinds[type]);
+	}
+	strcpy(reply, result < 0 ? "E01" : "OK");
+}
+
+/* handles one packet; returns false when the session is over */
+static bool gdb_handle(mu_sim_t *sim, gdb_conn_t *conn, char *packet, char *reply)
+{
+	unsigned address, len, offset, i;
+	char *p;
+	int reg;
+	uint32_t value;
+
+	reply[0] = '\0';
+	switch (packet[0]) {
+		case '?':
+			gdb_stop_reply(sim, sim->RUN_FLAG ? STOP_BREAKPOINT : STOP_EXITED, reply);
+			break;
+		case 'g':
+			for (p = reply, reg = 0; reg < GDB_NUM_REGS; reg++) {
+				p = gdb_put_reg(p, gdb_read_reg(sim, reg));
+			}
+			*p = '\0';
+			break;
+		case 'G':
+			if (strlen(packet + 1) < GDB_NUM_REGS * 8) {
+				strcpy(reply, "E01");
+				break;
+			}
+			for (reg = 0; reg < GDB_NUM_REGS; reg++) {
+				if (gdb_parse_reg(packet + 1 + 8 * reg, &value)) {
+					gdb_write_reg(sim, reg, value);
+				}
+			}
+			strcpy(reply, "OK");
+			break;
+		case 'p':
+			reg = strtol(packet + 1, NULL, 16);
+			if (reg < 0 || reg >= GDB_NUM_REGS) {
+				strcpy(reply, "E01");
+				break;
+			}
+			*gdb_put_reg(reply, gdb_read_reg(sim, reg)) = '\0';
+			break;
+		case 'P':
+			reg = strtol(packet + 1, &p, 16);
+			if (reg < 0 || reg >= GDB_NUM_REGS || *p != '=' || !gdb_parse_reg(p + 1, &value)) {
+				strcpy(reply, "E01");
+				break;
+			}
+			gdb_write_reg(sim, reg, value);
+			strcpy(reply, "OK");
+			break;
+		case 'm':
+			if (sscanf(packet + 1, "%x,%x", &address, &len) != 2 || len > GDB_PACKET_SIZE / 2) {
+				strcpy(reply, "E01");
+				break;
+			}
+			for (i = 0; i < len; i++) {
+				uint8_t byte = gdb_read_byte(sim, address + i);
+				reply[2 * i] = gdb_hex[byte >> 4];
+				reply[2 * i + 1] = gdb_hex[byte & 0xF];
+			}
+			reply[2 * len] = '\0';
+			break;
+		case 'M':
+			if (sscanf(packet + 1, "%x,%x:%n", &address, &len, &offset) != 2 || strlen(packet + 1 + offset) < 2 * len) {
+				strcpy(reply, "E01");
+				break;
+			}
+			for (i = 0, p = packet + 1 + offset; i < len; i++, p += 2) {
+				int high = gdb_hex_digit(p[0]), low = gdb_hex_digit(p[1]);
+				if (high < 0 || low < 0) {
+					break;
+				}
+				gdb_write_byte(sim, address + i, (high << 4) | low);
+			}
+			debug_squash(sim);
+			strcpy(reply, i == len ? "OK" : "E01");
+			break;
+		case 'c':
+		case 's':
+			if (packet[1] != '\0' && sscanf(packet + 1, "%x", &address) == 1) {
+				gdb_write_reg(sim, 32, address);
+			}
+			conn->interrupted = false;
+			gdb_stop_reply(sim, debug_resume(sim, packet[0] == 's', gdb_poll_interrupt, conn), reply);
+			break;
+		case 'Z':
+		case 'z':
+			gdb_breakpoint(sim, packet, reply);
+			break;
+		case 'H':
+		case 'T':
+			strcpy(reply, "OK");	// there is one thread
+			break;
+		case 'D':
+			gdb_send(conn, "OK");
+			return false;
+		case 'k':
+			return false;
+		case 'q':
+			if (strncmp(packet, "qSupported", 10) == 0) {
+				sprintf(reply, "PacketSize=%x;qXfer:features:read+", GDB_PACKET_SIZE);
+			} else if (strcmp(packet, "qAttached") == 0) {
+				strcpy(reply, "1");
+			} else if (strcmp(packet, "qC") == 0) {
+				strcpy(reply, "QC1");
+			} else if (strcmp(packet, "qfThreadInfo") == 0) {
+				strcpy(reply, "m1");
+			} else if (strcmp(packet, "qsThreadInfo") == 0) {
+				strcpy(reply, "l");
+			} else if (sscanf(packet, "qXfer:features:read:target.xml:%x,%x", &offset, &len) == 2) {
+				size_t size = sizeof(gdb_target_xml) - 1;
+				if (len > GDB_PACKET_SIZE - 2) {
+					len = GDB_PACKET_SIZE - 2;
+				}
+				if (offset >= size) {
+					strcpy(reply, "l");
+				} else {
+					size_t chunk = size - offset < len ? size - offset : len;
+					reply[0] = offset + chunk < size ? 'm' : 'l';
+					memcpy(reply + 1, gdb_target_xml + offset, chunk);
+					reply[chunk + 1] = '\0';
+				}
+			}
+			break;
+	}
+	return true;
+}
+
+/***************************************************************/
+/* Listen on <port>, <host>:<port> or a Unix socket path and serve */
+/* one session.                                                                                                   */
+/***************************************************************/
+static int gdb_listen(const char *where)
+{
+	int fd = -1;
+	bool tcp = strspn(where, "0123456789") == strlen(where) || strchr(where, ':') != NULL;
+	if (tcp) {
+		char host[256] = "127.0.0.1";
+		const char *port = where, *colon = strrchr(where, ':');
+		struct addrinfo hints, *info, *ai;
+		if (colon != NULL) {
+			if (colon != where) {
+				snprintf(host, sizeof(host), "%.*s", (int)(colon - where), where);
+			}
+			port = colon + 1;
+		}
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		if (getaddrinfo(host, port, &hints, &info) != 0) {
+			printf("Error: Can't resolve %s\n", where);
+			return -1;
+		}
+		for (ai = info; ai != NULL; ai = ai->ai_next) {
+			int one = 1;
+			fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+			if (fd < 0) {
+				continue;
+			}
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+			if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+				break;
+			}
+			close(fd);
+			fd = -1;
+		}
+		freeaddrinfo(info);
+	} else {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (strlen(where) >= sizeof(addr.sun_path)) {
+			printf("Error: Socket path too long: %s\n", where);
+			return -1;
+		}
+		strcpy(addr.sun_path, where);
+		unlink(where);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd >= 0 && bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	if (fd < 0 || listen(fd, 1) != 0) {
+		printf("Error: Can't listen on %s: %s\n", where, strerror(errno));
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int gdb_serve(mu_sim_t *sim, const char *where)
+{
+	if (sim->smp != NULL) {
+		printf("Error: The GDB stub debugs a single hart\n");
+		return -1;
+	}
+	int listener = gdb_listen(where);
+	char *packet, *reply;
+	gdb_conn_t conn;
+	if (listener < 0) {
+		return -1;
+	}
+	printf("Waiting for GDB on %s...\n", where);
+	fflush(stdout);
+	memset(&conn, 0, sizeof(conn));
+	do {
+		conn.fd = accept(listener, NULL, NULL);
+	} while (conn.fd < 0 && errno == EINTR);
+	close(listener);
+	if (strchr(where, ':') == NULL && strspn(where, "0123456789") != strlen(where)) {
+		unlink(where);
+	}
+	if (conn.fd < 0) {
+		printf("Error: accept failed: %s\n", strerror(errno));
+		return -1;
+	}
+	signal(SIGPIPE, SIG_IGN);	// a vanished debugger shows up as a failed write
+
+	packet = malloc(GDB_PACKET_SIZE + 1);
+	reply = malloc(GDB_PACKET_SIZE + 1);
+	if (packet == NULL || reply == NULL) {
+		printf("Error: Out of memory for the GDB stub\n");
+	} else {
+		printf("GDB connected\n");
+		while (gdb_receive(&conn, packet) && gdb_handle(sim, &conn, packet, reply) && gdb_send(&conn, reply))
+			;
+		printf("GDB session ended after %u cycles, %u instructions\n", sim->CYCLE_COUNT, sim->INSTRUCTION_COUNT);
+	}
+	free(packet);
+	free(reply);
+	close(conn.fd);
+	return 0;
+}
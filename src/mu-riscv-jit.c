@@ -0,0 +1,514 @@
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Basic-block translator to x86-64 for the functional engine       */
+/***************************************************************/
+/*
+	Guest basic blocks are translated on first execution into host code in
+	one RWX code cache. Generated code keeps the guest register file in
+	memory (rbx points at CURRENT_STATE.REGS), the remaining instruction
+	budget in r12 and the jit_ctx_t in r13. Loads call mem_read_8/16/32() and
+	stores jit_store(). Under the trap policy a misaligned halfword or word
+	access leaves the block before it is made, for the stepper to report.
+
+	A block ends at a branch, a jump, JIT_MAX_BLOCK instructions, the end
+	of the text, the ff-until stop PC or the first instruction it does not
+	translate (system instructions, invalid or all-zero words). Each exit
+	goes through a stub that returns to jit_run() with the next PC and the
+	address of the jump that led to it. Once the target is translated,
+	that jump is patched to go straight to it, which chains the blocks.
+	A block checks the budget on entry and leaves untouched when fewer
+	instructions remain than it holds. The threaded core or the stepper
+	finishes those, so counts stay exact.
+
+	A store that changes the text exits the block; everything is then
+	thrown away and retranslated, as is the whole cache when it fills up.
+*/
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#define JIT_CACHE_SIZE		(16 << 20)
+#define JIT_MAX_BLOCK		64	/* guest instructions */
+#define JIT_MAX_BLOCK_BYTES	(JIT_MAX_BLOCK * 128 + 256)
+#define JIT_OUT_OF_BUDGET	((uint8_t *)1)	/* patch value the budget stub returns */
+#define JIT_MISALIGNED		((uint8_t *)2)	/* patch value of a trapping access's exit */
+
+/* shared between jit_run() and generated code; offsets are baked into the code */
+typedef struct {
+	uint32_t *regs;
+	mu_mem_t *mem;
+	mu_sim_t *sim;
+	uint64_t budget;
+	uint8_t *patch;		/* rel32 of the jump to redirect to the next block, NULL for none */
+	uint32_t pc;
+} jit_ctx_t;
+
+struct jit_state {
+	uint8_t *cache;
+	size_t used;
+	uint8_t *epilogue;
+	void (*enter)(jit_ctx_t *ctx, uint8_t *entry);
+	uint8_t **blocks;	/* host entry per text word, NULL until translated */
+	uint32_t num_blocks;
+	uint32_t version;	/* mem->text_version the blocks were translated from */
+	uint32_t stop_pc;	/* blocks end before it; UINT32_MAX for none */
+	bool trap_misaligned;	/* blocks check alignment */
+};
+
+/* a store that rewrites translated text has to leave the block */
+static int jit_store(mu_sim_t *sim, uint32_t address, uint32_t value, uint32_t size)
+{
+	uint32_t version = sim->mem->text_version;
+	switch (size) {
+		case 1:		mem_write_8(sim->mem, address, value); break;
+		case 2:		mem_write_16(sim->mem, address, value); break;
+		default:	mem_write_32(sim->mem, address, value); break;
+	}
+	return sim->mem->text_version != version;
+}
+
+/* x86-64 emitters */
+static void emit8(uint8_t **p, uint8_t b) { *(*p)++ = b; }
+static void emit32(uint8_t **p, uint32_t v) { memcpy(*p, &v, 4); *p += 4; }
+static void emit64(uint8_t **p, uint64_t v) { memcpy(*p, &v, 8); *p += 8; }
+static void emit_bytes(uint8_t **p, const char *bytes, int n) { memcpy(*p, bytes, n); *p += n; }
+
+/* rel32 field at site jumps to target */
+static void patch_rel32(uint8_t *site, uint8_t *target)
+{
+	int32_t rel = (int32_t)(target - (site + 4));
+	memcpy(site, &rel, 4);
+}
+
+/* eax (modrm reg 0), ecx (1) or edx (2) <- guest register */
+static void emit_load_reg(uint8_t **p, int host, uint8_t guest)
+{
+	if (guest == 0) {
+		emit8(p, 0x31);			/* xor host, host */
+		emit8(p, 0xC0 | host << 3 | host);
+	} else {
+		emit8(p, 0x8B);			/* mov host, [rbx + 4*guest] */
+		emit8(p, 0x43 | host << 3);
+		emit8(p, 4 * guest);
+	}
+}
+
+/* guest register <- eax */
+static void emit_store_eax(uint8_t **p, uint8_t guest)
+{
+	emit8(p, 0x89);				/* mov [rbx + 4*guest], eax */
+	emit8(p, 0x43);
+	emit8(p, 4 * guest);
+}
+
+/* guest register <- constant */
+static void emit_store_imm(uint8_t **p, uint8_t guest, uint32_t value)
+{
+	emit8(p, 0xC7);				/* mov dword [rbx + 4*guest], imm32 */
+	emit8(p, 0x43);
+	emit8(p, 4 * guest);
+	emit32(p, value);
+}
+
+static void emit_call(uint8_t **p, void *function)
+{
+	emit_bytes(p, "\x48\xB8", 2);		/* mov rax, imm64 */
+	emit64(p, (uint64_t)(uintptr_t)function);
+	emit_bytes(p, "\xFF\xD0", 2);		/* call rax */
+}
+
+/* eax = pc, rdx = patch; return to jit_run() */
+static void emit_exit(jit_state_t *jit, uint8_t **p, uint32_t pc, uint8_t *patch)
+{
+	emit8(p, 0xB8);				/* mov eax, pc */
+	emit32(p, pc);
+	emit_bytes(p, "\x48\xBA", 2);		/* mov rdx, patch */
+	emit64(p, (uint64_t)(uintptr_t)patch);
+	emit8(p, 0xE9);				/* jmp epilogue */
+	emit32(p, 0);
+	patch_rel32(*p - 4, jit->epilogue);
+}
+
+/* jmp (or jcc when cc != 0) to a chainable exit stub for pc, placed at *stubs */
+static void emit_branch_to(jit_state_t *jit, uint8_t **p, uint8_t **stubs, uint8_t cc, uint32_t pc)
+{
+	if (cc != 0) {
+		emit8(p, 0x0F);
+		emit8(p, cc);
+	} else {
+		emit8(p, 0xE9);
+	}
+	emit32(p, 0);
+	uint8_t *site = *p - 4;
+	patch_rel32(site, *stubs);
+	emit_exit(jit, stubs, pc, site);
+}
+
+/* eax = guest address of a load or store; leave before it when it is misaligned and traps */
+static void emit_alignment_check(jit_state_t *jit, uint8_t **p, const decoded_inst_t *dec, uint32_t pc,
+		uint32_t unexecuted)
+{
+	if (!jit->trap_misaligned || dec->size == 1) {
+		return;
+	}
+	emit8(p, 0xA8);				/* test al, size - 1 */
+	emit8(p, dec->size - 1);
+	emit8(p, 0x74);				/* jz over the exit */
+	uint8_t *skip = (*p)++;
+	emit_bytes(p, "\x49\x81\xC4", 3);		/* add r12, refund for it and the rest of the block */
+	emit32(p, unexecuted);
+	emit_exit(jit, p, pc, JIT_MISALIGNED);
+	*skip = (uint8_t)(*p - (skip + 1));
+}
+
+/* can this instruction be part of a block? */
+static bool jit_translatable(const decoded_inst_t *dec)
+{
+	return dec->op != OP_NOP && dec->op != OP_INVALID && dec->cls != CLASS_SYSTEM && dec->cls != CLASS_ATOMIC;
+}
+
+static void jit_flush(mu_sim_t *sim)
+{
+	jit_state_t *jit = sim->jit;
+	free(jit->blocks);
+	jit->num_blocks = sim->PROGRAM_SIZE;
+	jit->blocks = calloc(jit->num_blocks ? jit->num_blocks : 1, sizeof(uint8_t *));
+	if (jit->blocks == NULL) {
+		printf("Error: Out of memory for the translation table\n");
+		exit(-1);
+	}
+	jit->used = jit->epilogue - jit->cache + 32;	/* keep the entry/exit code */
+	jit->version = sim->mem->text_version;
+}
+
+/* prologue jit->enter(ctx, entry) and the shared epilogue at the start of the cache */
+static void jit_emit_glue(jit_state_t *jit)
+{
+	uint8_t *p = jit->cache;
+	jit->enter = (void (*)(jit_ctx_t *, uint8_t *))p;
+	emit_bytes(&p, "\x53\x41\x54\x41\x55", 5);	/* push rbx; push r12; push r13 */
+	emit_bytes(&p, "\x49\x89\xFD", 3);		/* mov r13, rdi */
+	emit_bytes(&p, "\x48\x8B\x5F", 3);		/* mov rbx, [rdi + regs] */
+	emit8(&p, offsetof(jit_ctx_t, regs));
+	emit_bytes(&p, "\x4C\x8B\x67", 3);		/* mov r12, [rdi + budget] */
+	emit8(&p, offsetof(jit_ctx_t, budget));
+	emit_bytes(&p, "\xFF\xE6", 2);			/* jmp rsi */
+
+	jit->epilogue = p;
+	emit_bytes(&p, "\x41\x89\x45", 3);		/* mov [r13 + pc], eax */
+	emit8(&p, offsetof(jit_ctx_t, pc));
+	emit_bytes(&p, "\x49\x89\x55", 3);		/* mov [r13 + patch], rdx */
+	emit8(&p, offsetof(jit_ctx_t, patch));
+	emit_bytes(&p, "\x4D\x89\x65", 3);		/* mov [r13 + budget], r12 */
+	emit8(&p, offsetof(jit_ctx_t, budget));
+	emit_bytes(&p, "\x41\x5D\x41\x5C\x5B\xC3", 6);	/* pop r13; pop r12; pop rbx; ret */
+}
+
+static jit_state_t *jit_create(mu_sim_t *sim)
+{
+	jit_state_t *jit = calloc(1, sizeof(*jit));
+	if (jit == NULL) {
+		return NULL;
+	}
+	jit->cache = mmap(NULL, JIT_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (jit->cache == MAP_FAILED) {
+		printf("Error: Can't map an executable code cache, using the threaded engine\n");
+		sim->ENGINE = ENGINE_THREADED;
+		free(jit);
+		return NULL;
+	}
+	jit_emit_glue(jit);
+	sim->jit = jit;
+	jit->stop_pc = UINT32_MAX;
+	jit_flush(sim);
+	return jit;
+}
+
+void jit_free(mu_sim_t *sim)
+{
+	if (sim->jit != NULL) {
+		munmap(sim->jit->cache, JIT_CACHE_SIZE);
+		free(sim->jit->blocks);
+		free(sim->jit);
+		sim->jit = NULL;
+	}
+}
+
+/* translate the block at pc; NULL if its first instruction is not translatable */
+static uint8_t *jit_translate(mu_sim_t *sim, uint32_t pc)
+{
+	jit_state_t *jit = sim->jit;
+	decoded_inst_t decs[JIT_MAX_BLOCK];
+	uint32_t n, i, start = pc;
+
+	for (n = 0; n < JIT_MAX_BLOCK && pc_in_program(sim, pc) && (n == 0 || pc != jit->stop_pc); n++, pc += 4) {
+		decs[n] = decode_fetched(sim->mem, pc, mem_read_32(sim->mem, pc));
+		if (!jit_translatable(&decs[n])) {
+			break;
+		}
+		if (decs[n].flags & (DEC_BRANCH | DEC_JUMP)) {
+			n++;
+			break;
+		}
+	}
+	if (n == 0) {
+		return NULL;
+	}
+	if (jit->used + JIT_MAX_BLOCK_BYTES > JIT_CACHE_SIZE) {
+		jit_flush(sim);
+	}
+
+	uint8_t *entry = jit->cache + jit->used, *p = entry;
+	uint8_t *budget_jump;
+	uint32_t exit_pcs[2], exit_cc[2], num_exits = 0;
+
+	emit_bytes(&p, "\x49\x81\xFC", 3);		/* cmp r12, n */
+	emit32(&p, n);
+	emit_bytes(&p, "\x0F\x82", 2);			/* jb out_of_budget */
+	emit32(&p, 0);
+	budget_jump = p - 4;
+	emit_bytes(&p, "\x49\x81\xEC", 3);		/* sub r12, n */
+	emit32(&p, n);
+
+	for (i = 0, pc = start; i < n; i++, pc += 4) {
+		const decoded_inst_t *dec = &decs[i];
+		bool writes = (dec->flags & DEC_WRITES_RD) != 0;
+		switch (dec->op) {
+			case OP_ADD: case OP_SUB: case OP_XOR: case OP_OR: case OP_AND:
+			case OP_SLL: case OP_SRL: case OP_SRA: case OP_SLT: case OP_SLTU:
+				if (!writes) break;
+				emit_load_reg(&p, 0, dec->rs1);
+				emit_load_reg(&p, 1, dec->rs2);
+				switch (dec->op) {
+					case OP_ADD:	emit_bytes(&p, "\x01\xC8", 2); break;	/* add eax, ecx */
+					case OP_SUB:	emit_bytes(&p, "\x29\xC8", 2); break;
+					case OP_XOR:	emit_bytes(&p, "\x31\xC8", 2); break;
+					case OP_OR:	emit_bytes(&p, "\x09\xC8", 2); break;
+					case OP_AND:	emit_bytes(&p, "\x21\xC8", 2); break;
+					case OP_SLL:	emit_bytes(&p, "\xD3\xE0", 2); break;	/* shl eax, cl (masks to 5 bits) */
+					case OP_SRL:	emit_bytes(&p, "\xD3\xE8", 2); break;
+					case OP_SRA:	emit_bytes(&p, "\xD3\xF8", 2); break;
+					case OP_SLT:	emit_bytes(&p, "\x39\xC8\x0F\x9C\xC0\x0F\xB6\xC0", 8); break;	/* cmp; setl al; movzx */
+					case OP_SLTU:	emit_bytes(&p, "\x39\xC8\x0F\x92\xC0\x0F\xB6\xC0", 8); break;	/* cmp; setb al; movzx */
+				}
+				emit_store_eax(&p, dec->rd);
+				break;
+			case OP_MUL: case OP_MULH: case OP_MULHU:
+				if (!writes) break;
+				emit_load_reg(&p, 0, dec->rs1);
+				emit_load_reg(&p, 1, dec->rs2);
+				switch (dec->op) {
+					case OP_MUL:	emit_bytes(&p, "\x0F\xAF\xC1", 3); break;		/* imul eax, ecx */
+					case OP_MULH:	emit_bytes(&p, "\xF7\xE9\x89\xD0", 4); break;	/* imul ecx; mov eax, edx */
+					case OP_MULHU:	emit_bytes(&p, "\xF7\xE1\x89\xD0", 4); break;	/* mul ecx; mov eax, edx */
+				}
+				emit_store_eax(&p, dec->rd);
+				break;
+			case OP_MULHSU: case OP_DIV: case OP_DIVU: case OP_REM: case OP_REMU:	/* zero divisor and overflow rules */
+				if (!writes) break;
+				emit_load_reg(&p, 0, dec->rs1);
+				emit_bytes(&p, "\x89\xC6", 2);		/* mov esi, eax */
+				emit_load_reg(&p, 2, dec->rs2);		/* edx = b */
+				emit8(&p, 0xBF);			/* mov edi, op */
+				emit32(&p, dec->op);
+				emit_call(&p, (void *)muldiv_execute);
+				emit_store_eax(&p, dec->rd);
+				break;
+			case OP_ADDI: case OP_XORI: case OP_ORI: case OP_ANDI: case OP_SLTI: case OP_SLTIU:
+				if (!writes) break;
+				emit_load_reg(&p, 0, dec->rs1);
+				switch (dec->op) {
+					case OP_ADDI:	emit8(&p, 0x05); emit32(&p, dec->imm); break;	/* add eax, imm32 */
+					case OP_XORI:	emit8(&p, 0x35); emit32(&p, dec->imm); break;
+					case OP_ORI:	emit8(&p, 0x0D); emit32(&p, dec->imm); break;
+					case OP_ANDI:	emit8(&p, 0x25); emit32(&p, dec->imm); break;
+					case OP_SLTI:	emit8(&p, 0x3D); emit32(&p, dec->imm); emit_bytes(&p, "\x0F\x9C\xC0\x0F\xB6\xC0", 6); break;
+					case OP_SLTIU:	emit8(&p, 0x3D); emit32(&p, dec->imm); emit_bytes(&p, "\x0F\x92\xC0\x0F\xB6\xC0", 6); break;
+				}
+				emit_store_eax(&p, dec->rd);
+				break;
+			case OP_SLLI: case OP_SRLI: case OP_SRAI:
+				if (!writes) break;
+				emit_load_reg(&p, 0, dec->rs1);
+				emit8(&p, 0xC1);			/* shl/shr/sar eax, imm8 */
+				emit8(&p, dec->op == OP_SLLI ? 0xE0 : dec->op == OP_SRLI ? 0xE8 : 0xF8);
+				emit8(&p, dec->imm);
+				emit_store_eax(&p, dec->rd);
+				break;
+			case OP_LUI:
+				if (writes) emit_store_imm(&p, dec->rd, dec->imm);
+				break;
+			case OP_AUIPC:
+				if (writes) emit_store_imm(&p, dec->rd, pc + dec->imm);
+				break;
+			case OP_LB: case OP_LH: case OP_LW: case OP_LBU: case OP_LHU: {
+				static void *const readers[] = { [1] = (void *)mem_read_8, [2] = (void *)mem_read_16,
+					[4] = (void *)mem_read_32 };
+				emit_load_reg(&p, 0, dec->rs1);
+				emit8(&p, 0x05);			/* add eax, imm32 */
+				emit32(&p, dec->imm);
+				emit_alignment_check(jit, &p, dec, pc, n - i);
+				if (!writes) break;
+				emit_bytes(&p, "\x89\xC6", 2);		/* mov esi, eax */
+				emit_bytes(&p, "\x49\x8B\x7D", 3);	/* mov rdi, [r13 + mem] */
+				emit8(&p, offsetof(jit_ctx_t, mem));
+				emit_call(&p, readers[dec->size]);
+				if (dec->op == OP_LB) {
+					emit_bytes(&p, "\x0F\xBE\xC0", 3);	/* movsx eax, al */
+				} else if (dec->op == OP_LH) {
+					emit_bytes(&p, "\x0F\xBF\xC0", 3);	/* movsx eax, ax */
+				}
+				emit_store_eax(&p, dec->rd);
+				break;
+			}
+			case OP_SB: case OP_SH: case OP_SW: {
+				emit_load_reg(&p, 0, dec->rs1);
+				emit8(&p, 0x05);			/* add eax, imm32 */
+				emit32(&p, dec->imm);
+				emit_alignment_check(jit, &p, dec, pc, n - i);
+				emit_load_reg(&p, 2, dec->rs2);		/* edx = value */
+				emit_bytes(&p, "\x89\xC6", 2);		/* mov esi, eax */
+				emit8(&p, 0xB9);			/* mov ecx, size */
+				emit32(&p, dec->size);
+				emit_bytes(&p, "\x49\x8B\x7D", 3);	/* mov rdi, [r13 + sim] */
+				emit8(&p, offsetof(jit_ctx_t, sim));
+				emit_call(&p, (void *)jit_store);
+				emit_bytes(&p, "\x85\xC0", 2);		/* test eax, eax */
+				emit_bytes(&p, "\x74", 1);		/* jz over the exit */
+				uint8_t *skip = p++;
+				emit_bytes(&p, "\x49\x81\xC4", 3);	/* add r12, refund for the rest of the block */
+				emit32(&p, n - i - 1);
+				emit_exit(jit, &p, pc + 4, NULL);
+				*skip = (uint8_t)(p - (skip + 1));
+				break;
+			}
+			case OP_BEQ: case OP_BNE: case OP_BLT: case OP_BGE: case OP_BLTU: case OP_BGEU: {
+				static const uint8_t cc[NUM_OPS] = {
+					[OP_BEQ] = 0x84, [OP_BNE] = 0x85, [OP_BLT] = 0x8C,
+					[OP_BGE] = 0x8D, [OP_BLTU] = 0x82, [OP_BGEU] = 0x83
+				};
+				emit_load_reg(&p, 0, dec->rs1);
+				emit_load_reg(&p, 1, dec->rs2);
+				emit_bytes(&p, "\x39\xC8", 2);		/* cmp eax, ecx */
+				exit_cc[num_exits] = cc[dec->op];
+				exit_pcs[num_exits++] = pc + dec->imm;
+				break;
+			}
+			case OP_JAL:
+				if (writes) emit_store_imm(&p, dec->rd, pc + 4);
+				exit_cc[num_exits] = 0;
+				exit_pcs[num_exits++] = pc + dec->imm;
+				break;
+			case OP_JALR:
+				emit_load_reg(&p, 0, dec->rs1);
+				emit8(&p, 0x05);			/* add eax, imm32 */
+				emit32(&p, dec->imm);
+				emit_bytes(&p, "\x83\xE0\xFE", 3);	/* and eax, ~1 */
+				if (writes) emit_store_imm(&p, dec->rd, pc + 4);
+				emit_bytes(&p, "\x31\xD2", 2);		/* xor edx, edx */
+				emit8(&p, 0xE9);			/* jmp epilogue */
+				emit32(&p, 0);
+				patch_rel32(p - 4, jit->epilogue);
+				break;
+		}
+	}
+	/* fall through (not taken, or the block just ended) */
+	if (decs[n - 1].op != OP_JALR && decs[n - 1].op != OP_JAL) {
+		exit_cc[num_exits] = 0;
+		exit_pcs[num_exits++] = start + 4 * n;
+	}
+
+	/* the exit jumps, then their stubs, then the budget stub */
+	uint8_t *stub = p;
+	for (i = 0; i < num_exits; i++) {
+		stub += exit_cc[i] ? 6 : 5;
+	}
+	for (i = 0; i < num_exits; i++) {
+		emit_branch_to(jit, &p, &stub, exit_cc[i], exit_pcs[i]);
+	}
+	p = stub;
+	patch_rel32(budget_jump, p);
+	emit_exit(jit, &p, start, JIT_OUT_OF_BUDGET);
+
+	jit->used = p - jit->cache;
+	jit->blocks[(start - MEM_TEXT_BEGIN) >> 2] = entry;
+	return entry;
+}
+
+bool jit_available(mu_sim_t *sim)
+{
+	return sim->jit != NULL || jit_create(sim) != NULL;
+}
+
+/*
+	Execute up to max_steps instructions from CURRENT_STATE.PC in translated
+	code, stopping before stop_pc (when until_pc), when the PC leaves the
+	text segment and before anything the JIT does not translate. Returns the
+	number of instructions executed.
+*/
+uint32_t jit_run(mu_sim_t *sim, uint32_t max_steps, bool until_pc, uint32_t stop_pc)
+{
+	jit_state_t *jit = sim->jit;
+	jit_ctx_t ctx = { sim->CURRENT_STATE.REGS, sim->mem, sim, max_steps, NULL, sim->CURRENT_STATE.PC };
+	uint8_t *patch = NULL;
+
+	if (!until_pc) {
+		stop_pc = UINT32_MAX;
+	}
+	if (jit->version != sim->mem->text_version || jit->num_blocks != sim->PROGRAM_SIZE || jit->stop_pc != stop_pc ||
+			jit->trap_misaligned != (sim->MISALIGNED == MISALIGNED_TRAP)) {
+		jit->stop_pc = stop_pc;
+		jit->trap_misaligned = sim->MISALIGNED == MISALIGNED_TRAP;
+		jit_flush(sim);
+	}
+	while ((ctx.pc & 3) == 0 && pc_in_program(sim, ctx.pc) && ctx.pc != stop_pc) {
+		uint32_t index = (ctx.pc - MEM_TEXT_BEGIN) >> 2;
+		uint8_t *entry = jit->blocks[index];
+		if (entry == NULL) {
+			size_t used = jit->used;
+			entry = jit_translate(sim, ctx.pc);
+			if (entry == NULL) {
+				break;
+			}
+			if (jit->used < used) {
+				patch = NULL;	/* the cache was flushed under the pending jump */
+			}
+		}
+		if (patch != NULL) {
+			patch_rel32(patch, entry);
+		}
+		jit->enter(&ctx, entry);
+		patch = ctx.patch;
+		if (patch == JIT_OUT_OF_BUDGET || patch == JIT_MISALIGNED) {
+			break;
+		}
+		if (jit->version != sim->mem->text_version) {
+			jit_flush(sim);
+			patch = NULL;
+		}
+	}
+	sim->CURRENT_STATE.PC = ctx.pc;
+	sim->INSTRUCTION_COUNT += max_steps - ctx.budget;
+	return max_steps - ctx.budget;
+}
+
+#else
+
+bool jit_available(mu_sim_t *sim)
+{
+	return false;
+}
+
+uint32_t jit_run(mu_sim_t *sim, uint32_t max_steps, bool until_pc, uint32_t stop_pc)
+{
+	return 0;
+}
+
+void jit_free(mu_sim_t *sim)
+{
+}
+
+#endif
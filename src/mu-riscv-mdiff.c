@@ -0,0 +1,268 @@
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Memory comparison and sparse memory images                                        */
+/***************************************************************/
+/*
+	mem_diff() compares the simulator's memory with a reference read
+	from a checkpoint or from a memory image written by mem_image_save()
+	and prints only the words that differ. The reference is loaded into a
+	memory of its own, so both sides are page tables and only pages one of
+	them ever committed need looking at: a page is skipped when it is
+	identical on both sides or zero on one side and never committed on the
+	other. Pages are compared 64 bytes at a time with vector XOR/OR and no
+	early exit inside a block, and only blocks that differ are scanned
+	word by word, so a megabyte-sized result that matches costs a few
+	hundred microseconds.
+
+	A memory image keeps only the non-zero words of a range, as runs
+	within one page. A run takes up to MEM_IMAGE_GAP zero words into it
+	rather than end, since starting a new one costs two words. Layout
+	(little-endian 32-bit words):
+
+		magic[8] "MURVMEM1"
+		per run: address, word count, words
+
+	up to the end of the file.
+*/
+#define MEM_IMAGE_GAP 2
+#define DIFF_BLOCK 64	/* bytes compared per step */
+
+typedef uint64_t diff_vec_t __attribute__((vector_size(16)));
+
+static const uint8_t zero_page[MEM_PAGE_SIZE];
+
+static bool block_differs(const uint8_t *a, const uint8_t *b)
+{
+	diff_vec_t acc = { 0, 0 };
+	uint32_t i;
+	for (i = 0; i < DIFF_BLOCK; i += sizeof(diff_vec_t)) {
+		diff_vec_t x, y;
+		memcpy(&x, a + i, sizeof(x));
+		memcpy(&y, b + i, sizeof(y));
+		acc |= x ^ y;
+	}
+	return (acc[0] | acc[1]) != 0;
+}
+
+static bool page_differs(const uint8_t *a, const uint8_t *b)
+{
+	uint32_t offset;
+	for (offset = 0; offset < MEM_PAGE_SIZE; offset += DIFF_BLOCK) {
+		if (block_differs(a + offset, b + offset)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static inline uint32_t page_word(const uint8_t *page, uint32_t offset)
+{
+	uint32_t word;
+	memcpy(&word, page + offset, sizeof(word));
+	return word;
+}
+
+static int address_compare(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static bool page_in_range(uint32_t base, uint32_t start, uint32_t stop)
+{
+	return base <= stop && base + MEM_PAGE_MASK >= start;
+}
+
+/***************************************************************/
+/* Read a checkpoint's or memory image's memory into mem              */
+/***************************************************************/
+static int mem_image_read(const char *path, mu_mem_t *mem)
+{
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL) {
+		printf("Error: Can't open memory file %s\n", path);
+		return -1;
+	}
+	char magic[8];
+	if (fread(magic, sizeof(magic), 1, fp) != 1 ||
+			(memcmp(magic, MEM_IMAGE_MAGIC, sizeof(magic)) != 0 && memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0)) {
+		printf("Error: %s is neither a memory image nor a checkpoint\n", path);
+		fclose(fp);
+		return -1;
+	}
+	if (memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) == 0) {
+		fclose(fp);
+		return checkpoint_read_memory(path, mem);
+	}
+
+	uint32_t words[MEM_PAGE_SIZE / 4], run[2];
+	bool ok = true;
+	while (ok && fread(run, sizeof(run), 1, fp) == 1) {
+		uint32_t offset = run[0] & MEM_PAGE_MASK;
+		ok = (run[0] & 3) == 0 && run[1] > 0 && offset + run[1] * 4 <= MEM_PAGE_SIZE &&
+				fread(words, 4, run[1], fp) == run[1];
+		if (ok) {
+			mem_write_block(mem, run[0], (const uint8_t *)words, run[1] * 4);
+		}
+	}
+	ok = ok && !ferror(fp);
+	fclose(fp);
+	if (!ok) {
+		printf("Error: Memory image %s is truncated or corrupt\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+/***************************************************************/
+/* Print the words in [start, stop] that differ from the reference    */
+/* in path; returns how many there are. The first max_report are       */
+/* printed.                                                                                                  */
+/***************************************************************/
+int mem_diff(mu_sim_t *sim, const char *path, uint32_t start, uint32_t stop, uint32_t max_report)
+{
+	mu_mem_t *live = sim->mem, *ref = malloc(sizeof(*ref));
+	if (ref == NULL || mem_init(ref) != 0) {
+		printf("Error: Can't allocate reference memory\n");
+		free(ref);
+		return -1;
+	}
+	if (mem_image_read(path, ref) != 0) {
+		mem_free(ref);
+		free(ref);
+		return -1;
+	}
+
+	/* pages that differ; a page is on at most one of the two lists below */
+	uint32_t *pages = malloc((live->num_committed_pages + ref->num_committed_pages + 1) * sizeof(uint32_t));
+	if (pages == NULL) {
+		printf("Error: Out of memory comparing memory\n");
+		exit(-1);
+	}
+	uint32_t num_pages = 0, compared = 0, i;
+	for (i = 0; i < live->num_committed_pages; i++) {
+		uint32_t base = live->committed_pages[i];
+		const uint8_t *other = mem_peek_page(ref, base);
+		if (page_in_range(base, start, stop)) {
+			compared++;
+			if (page_differs(mem_peek_page(live, base), other != NULL ? other : zero_page)) {
+				pages[num_pages++] = base;
+			}
+		}
+	}
+	for (i = 0; i < ref->num_committed_pages; i++) {
+		uint32_t base = ref->committed_pages[i];
+		if (page_in_range(base, start, stop) && mem_peek_page(live, base) == NULL) {
+			compared++;
+			if (page_differs(mem_peek_page(ref, base), zero_page)) {
+				pages[num_pages++] = base;
+			}
+		}
+	}
+	qsort(pages, num_pages, sizeof(uint32_t), address_compare);
+
+	if (max_report > 0) {
+		printf("-------------------------------------------------------------\n");
+		printf("Memory differences [0x%08x..0x%08x] against %s :\n", start, stop, path);
+		printf("-------------------------------------------------------------\n");
+		printf("\t[Address in Hex]\t[Value]\t\t[Reference]\n");
+	}
+	uint32_t differences = 0, differing_pages = 0;
+	for (i = 0; i < num_pages; i++) {
+		const uint8_t *a = mem_peek_page(live, pages[i]), *b = mem_peek_page(ref, pages[i]);
+		uint32_t block, offset, before = differences;
+		a = a != NULL ? a : zero_page;
+		b = b != NULL ? b : zero_page;
+		for (block = 0; block < MEM_PAGE_SIZE; block += DIFF_BLOCK) {
+			if (!block_differs(a + block, b + block)) {
+				continue;
+			}
+			for (offset = block; offset < block + DIFF_BLOCK; offset += 4) {
+				uint32_t address = pages[i] + offset;
+				if (address >= start && address <= stop && page_word(a, offset) != page_word(b, offset)) {
+					if (differences++ < max_report) {
+						printf("\t0x%08x :\t\t0x%08x\t0x%08x\n", address, page_word(a, offset), page_word(b, offset));
+					}
+				}
+			}
+		}
+		differing_pages += differences != before;
+	}
+	if (differences > max_report && max_report > 0) {
+		printf("\t... %u more\n", differences - max_report);
+	}
+	if (max_report > 0 || sim->TRACE_LEVEL >= TRACE_SUMMARY) {
+		printf("%u words differ in %u of %u pages\n\n", differences, differing_pages, compared);
+	}
+
+	free(pages);
+	mem_free(ref);
+	free(ref);
+	return differences;
+}
+
+/***************************************************************/
+/* Write the non-zero words in [start, stop] as a memory image        */
+/***************************************************************/
+int mem_image_save(mu_sim_t *sim, const char *path, uint32_t start, uint32_t stop)
+{
+	mu_mem_t *mem = sim->mem;
+	uint32_t *pages = malloc((mem->num_committed_pages + 1) * sizeof(uint32_t));
+	if (pages == NULL) {
+		printf("Error: Out of memory saving memory image\n");
+		exit(-1);
+	}
+	uint32_t num_pages = 0, i;
+	for (i = 0; i < mem->num_committed_pages; i++) {
+		if (page_in_range(mem->committed_pages[i], start, stop)) {
+			pages[num_pages++] = mem->committed_pages[i];
+		}
+	}
+	qsort(pages, num_pages, sizeof(uint32_t), address_compare);
+
+	FILE *fp = fopen(path, "wb");
+	if (fp == NULL) {
+		printf("Error: Can't open memory image file %s\n", path);
+		free(pages);
+		return -1;
+	}
+	uint32_t runs = 0, words = 0;
+	bool ok = fwrite(MEM_IMAGE_MAGIC, 8, 1, fp) == 1;
+	for (i = 0; ok && i < num_pages; i++) {
+		const uint8_t *data = mem_peek_page(mem, pages[i]);
+		uint32_t first = start > pages[i] ? start - pages[i] : 0;
+		uint32_t last = stop - pages[i] < MEM_PAGE_MASK ? stop - pages[i] : MEM_PAGE_MASK;
+		uint32_t offset = first & ~3u, end;
+		if (!page_differs(data, zero_page)) {
+			continue;
+		}
+		while (ok && offset <= last) {
+			/* a run starts at a non-zero word and ends before MEM_IMAGE_GAP + 1 zero words */
+			if (page_word(data, offset) == 0) {
+				offset += 4;
+				continue;
+			}
+			uint32_t zeros = 0, run[2];
+			for (end = offset; end <= last && zeros <= MEM_IMAGE_GAP; end += 4) {
+				zeros = page_word(data, end) == 0 ? zeros + 1 : 0;
+			}
+			end -= 4 * zeros;
+			run[0] = pages[i] + offset;
+			run[1] = (end - offset) / 4;
+			ok = fwrite(run, sizeof(run), 1, fp) == 1 && fwrite(data + offset, 4, run[1], fp) == run[1];
+			runs++;
+			words += run[1];
+			offset = end;
+		}
+	}
+	free(pages);
+	if (fclose(fp) != 0 || !ok) {
+		printf("Error: Can't write memory image file %s\n", path);
+		return -1;
+	}
+	if (sim->TRACE_LEVEL >= TRACE_SUMMARY) {
+		printf("Memory image saved to %s (%u words in %u runs)\n\n", path, words, runs);
+	}
+	return 0;
+}
@@ -0,0 +1,123 @@
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Host-side profile of the simulator itself: where the time of     */
+/* each simulated cycle goes. Built with make PROFILE=1 (MU_PROFILE);  */
+/* otherwise the PROF_* macros are empty and nothing is collected.   */
+/***************************************************************/
+/*
+	Stages are timed with the TSC on x86 hosts and clock_gettime elsewhere.
+	Ticks are converted to nanoseconds against the wall clock elapsed since
+	the last reset. Every PROF_SAMPLE_PERIOD-th cycle also goes into a
+	log2 histogram of cycle cost, which shows the slow tail (cache misses
+	in the host, page commits, trace output) that the averages hide.
+*/
+
+#ifdef MU_PROFILE
+__thread prof_t *prof_current;
+
+static const char *prof_point_names[NUM_PROF_POINTS] = {
+	"cycle", "WB", "MEM", "EX", "ID", "hazard/fwd", "IF", "trace output", "fast-forward", "region scan"
+};
+
+static uint64_t prof_wall_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+
+void prof_reset(mu_sim_t *sim)
+{
+	memset(&sim->prof, 0, sizeof(sim->prof));
+#ifdef MU_PROFILE
+	sim->prof.start_ticks = prof_now();
+	sim->prof.start_ns = prof_wall_ns();
+#endif
+}
+
+#ifdef MU_PROFILE
+/* prof_now() ticks per nanosecond; spins briefly if too little time has passed since the reset */
+static double prof_ticks_per_ns(mu_sim_t *sim)
+{
+	uint64_t start_ticks = sim->prof.start_ticks, start_ns = sim->prof.start_ns;
+	if (prof_wall_ns() - start_ns < 10000000) {
+		start_ticks = prof_now();
+		start_ns = prof_wall_ns();
+		while (prof_wall_ns() - start_ns < 10000000)
+			;
+	}
+	return (double)(prof_now() - start_ticks) / (prof_wall_ns() - start_ns);
+}
+
+static void prof_line(const char *name, const prof_counter_t *counter, double ticks_per_ns, uint64_t cycle_ticks)
+{
+	double ns = counter->ticks / ticks_per_ns;
+	printf("%-16s %12llu %12.3f %10.1f", name, (unsigned long long)counter->calls, ns / 1e6,
+			counter->calls ? ns / counter->calls : 0.0);
+	if (cycle_ticks > 0) {
+		printf(" %7.1f%%", 100.0 * counter->ticks / cycle_ticks);
+	}
+	printf("\n");
+}
+#endif
+
+/***************************************************************/
+/* prof command: per-stage host time and the cycle-cost histogram    */
+/***************************************************************/
+int show_profile(mu_sim_t *sim)
+{
+#ifndef MU_PROFILE
+	(void)sim;
+	printf("Error: Profiling is not compiled in (rebuild with make clean && make PROFILE=1)\n");
+	return -1;
+#else
+	prof_t *prof = &sim->prof;
+	double ticks_per_ns = prof_ticks_per_ns(sim);
+	uint64_t cycle_ticks = prof->points[PROF_CYCLE].ticks, staged = 0, samples = 0;
+	int i;
+
+	printf("-------------------------------------------------------------\n");
+	printf("Host profile (%s, %.3f ticks/ns)\n", PROF_CLOCK_NAME, ticks_per_ns);
+	printf("-------------------------------------------------------------\n");
+	printf("%-16s %12s %12s %10s %8s\n", "", "calls", "total ms", "ns/call", "% cycle");
+	prof_line(prof_point_names[PROF_CYCLE], &prof->points[PROF_CYCLE], ticks_per_ns, cycle_ticks);
+	for (i = PROF_WB; i <= PROF_TRACE; i++) {
+		char name[32];
+		snprintf(name, sizeof(name), i == PROF_HAZARD ? "    %s" : "  %s", prof_point_names[i]);
+		prof_line(name, &prof->points[i], ticks_per_ns, cycle_ticks);
+		if (i != PROF_HAZARD) {
+			staged += prof->points[i].ticks;
+		}
+	}
+	if (cycle_ticks > 0) {
+		/* stalls that freeze the pipeline, state copy, counters and the timer itself */
+		prof_counter_t other = { prof->points[PROF_CYCLE].calls, cycle_ticks > staged ? cycle_ticks - staged : 0 };
+		prof_line("  other", &other, ticks_per_ns, cycle_ticks);
+	}
+	prof_line(prof_point_names[PROF_REGION_SCAN], &prof->points[PROF_REGION_SCAN], ticks_per_ns, 0);
+	prof_line(prof_point_names[PROF_FAST_FORWARD], &prof->points[PROF_FAST_FORWARD], ticks_per_ns, 0);
+	printf("(region scan counts the memory accesses of cycles and fast-forward, inside both)\n");
+
+	for (i = 0; i < PROF_HIST_BUCKETS; i++) {
+		samples += prof->cycle_hist[i];
+	}
+	if (samples > 0) {
+		printf("\nCycle cost, 1 in %d cycles sampled (%llu samples)\n", PROF_SAMPLE_PERIOD,
+				(unsigned long long)samples);
+		for (i = 0; i < PROF_HIST_BUCKETS; i++) {
+			if (prof->cycle_hist[i] == 0) {
+				continue;
+			}
+			double share = (double)prof->cycle_hist[i] / samples;
+			int bar = (int)(share * 40 + 0.5);
+			printf("  %9.1f - %9.1f ns %12llu %6.2f%% %.*s\n", (double)(1ull << i) / ticks_per_ns,
+					(double)(2ull << i) / ticks_per_ns, (unsigned long long)prof->cycle_hist[i], 100 * share,
+					bar, "########################################");
+		}
+	}
+	printf("\n");
+	return 0;
+#endif
+}
@@ -0,0 +1,838 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "muriscv.h"
+
+/***************************************************************/
+/* mu-riscv: interactive front end over libmuriscv                         */
+/***************************************************************/
+
+static muriscv_t *sim;
+
+/* --script / -e: commands come from input instead of the terminal, with no
+ * prompts or banners, and stdout is written in OUTPUT_BUFFER blocks */
+#define OUTPUT_BUFFER (1 << 20)
+static FILE *input;
+static bool batch;
+
+/* --json: rdump, mdump, mdiff and the run commands print one JSON object per line */
+static bool json;
+
+/* commands that failed; a batch session exits with 1 if there were any */
+static int failures;
+
+/***************************************************************/
+/* Print out a list of commands available                                                                  */
+/***************************************************************/
+//test
+void help() {
+	printf("------------------------------------------------------------------\n\n");
+	printf("\t**********MU-RISCV Help MENU**********\n\n");
+	printf("sim\t-- simulate program to completion \n");
+	printf("run <n>\t-- simulate program for <n> instructions\n");
+	printf("rdump\t-- dump register values\n");
+	printf("reset\t-- clears all registers/memory and re-loads the program\n");
+	printf("input <reg> <val>\t-- set GPR <reg> to <val>\n");
+	printf("mdump <start> <stop>\t-- dump memory from <start> to <stop> address\n");
+	printf("high <val>\t-- set the HI register to <val>\n");
+	printf("harts [<n> [<quantum>]]\t-- show the harts, or simulate <n> harts sharing memory, synchronized every <quantum> cycles (resets)\n");
+	printf("low <val>\t-- set the LO register to <val>\n");
+	printf("print\t-- print the program loaded into memory\n");
+	printf("show\t-- print the current content of the pipeline registers\n");
+	printf("stats\t-- print the performance counters\n");
+	printf("prof [reset]\t-- host time per pipeline stage (builds with make PROFILE=1), or clear it\n");
+	printf("f [0 | 1]\t-- Enable/disable forwarding.\n");
+	printf("break [<pc | symbol>]\t-- stop when the program reaches <pc>; without arguments list breakpoints and watchpoints\n");
+	printf("delete <pc | symbol | all>\t-- remove a breakpoint\n");
+	printf("watch <address | symbol> [<bytes>] [r | w | rw]\t-- stop after the program reads or writes <bytes> (default 4) at <address>\n");
+	printf("unwatch <address | symbol | all>\t-- remove watchpoints\n");
+	printf("gdb <port | [host]:port | socket path>\t-- serve a GDB remote session until the debugger detaches\n");
+	printf("ff <n>\t-- execute <n> instructions functionally (no pipeline), then resume cycle-accurate simulation\n");
+	printf("ff-until <pc | symbol>\t-- execute functionally until the PC reaches <pc> (hex) or an ELF symbol\n");
+	printf("engine [step | threaded | jit]\t-- show or select the functional engine used by ff\n");
+	printf("trace <level>\t-- set trace level: none, summary, retire, cycle\n");
+	printf("bp [<kind> [<bits>] [<btb>]]\t-- branch predictor statistics, or select not-taken, btfn, bimodal or gshare\n");
+	printf("latency [<class> <cycles>]\t-- EX latency per instruction class, or set it (mul, div, alu, load, ...)\n");
+	printf("misaligned [allow | penalty[:<cycles>] | trap]\t-- show or set how loads and stores not aligned to their size are handled\n");
+	printf("cache [<level> <spec | off>]\t-- cache statistics, or configure l1i/l1d/l2 as <size>:<assoc>:<line>[:lru|fifo|random[:wb|wt[:<miss latency>]]]\n");
+	printf("btrace <file | off>\t-- write a binary pipeline trace to <file> (decode with mu-riscv-trace)\n");
+	printf("bbv <file> [<interval>]\t-- profile the program functionally, writing SimPoint basic-block vectors per <interval> instructions (resets)\n");
+	printf("simpoints <bb file> <k> <prefix>\t-- pick at most <k> simulation points, writing <prefix>.simpoints and <prefix>.weights\n");
+	printf("sample <prefix> [<interval> [<warmup>]]\t-- estimate CPI by simulating only the simulation points in detail (resets)\n");
+	printf("split [<n> [<file>]]\t-- run <n> instructions (default: to the end) with execution and pipeline timing on separate threads, saving the records to <file>\n");
+	printf("record <file> [<n>]\t-- execute <n> instructions (default: to the end) functionally, saving their records to <file>\n");
+	printf("replay <file>\t-- reset and model the pipeline over saved records with the current predictor, cache and latency settings\n");
+	printf("msave <file> [<start> <stop>]\t-- write the non-zero memory words (default: all of memory) as a sparse binary image\n");
+	printf("mdiff <file> [<start> <stop>]\t-- print the memory words that differ from a memory image or checkpoint\n");
+	printf("save <file>\t-- write a checkpoint of the whole simulator state\n");
+	printf("restore <file>\t-- continue from a checkpoint written by save\n");
+	printf("?\t-- display help menu\n");
+	printf("quit\t-- exit the simulator\n\n");
+	printf("------------------------------------------------------------------\n\n");
+}
+
+
+/* <pc> in hex or an ELF symbol */
+static int parse_address(const char *text, uint32_t *address) {
+	char *end;
+	if (muriscv_lookup_symbol(sim, text, address) == 0) {
+		return 0;
+	}
+	*address = strtoul(text, &end, 16);
+	if (*end != '\0' || end == text) {
+		printf("Unknown symbol %s\n", text);
+		return -1;
+	}
+	return 0;
+}
+
+/* --json: while the session runs, stdout is a memory stream that catches whatever the
+ * commands print, and the JSON results go straight to out, the real standard output.
+ * After each command the text it printed becomes {"cmd", "error"} objects if it
+ * failed and {"cmd", "output"} objects if not, so nothing is copied for commands
+ * that only produce JSON. */
+static FILE *out;
+static char *captured;
+static size_t captured_size;
+
+static void capture_begin() {
+	if ((stdout = open_memstream(&captured, &captured_size)) == NULL) {
+		stdout = out;
+		printf("Error: Can't capture command output\n");
+		exit(1);
+	}
+}
+
+static void capture_line(const char *cmd, const char *key, const char *text) {
+	fprintf(out, "{\"cmd\": ");
+	muriscv_json_string(out, cmd);
+	fprintf(out, ", \"%s\": ", key);
+	muriscv_json_string(out, strncmp(text, "Error: ", 7) == 0 ? text + 7 : text);
+	fprintf(out, "}\n");
+}
+
+static void capture_end(const char *cmd, bool failed) {
+	char *line, *end;
+	bool reported = false;
+	if (!json) {
+		return;
+	}
+	fflush(stdout);
+	for (line = captured; line < captured + captured_size; line = end + 1) {
+		end = memchr(line, '\n', captured + captured_size - line);
+		if (end == NULL) {
+			end = captured + captured_size;
+		}
+		if (end > line) {
+			char saved = *end;
+			*end = '\0';
+			capture_line(cmd, failed ? "error" : "output", line);
+			*end = saved;
+			reported |= failed;
+		}
+	}
+	if (failed && !reported) {
+		capture_line(cmd, "error", "failed");
+	}
+	rewind(stdout);
+}
+
+/* output printed on the way out, by quit or the atexit handlers */
+static void capture_at_exit() {
+	capture_end("exit", false);
+	fflush(out);
+}
+
+/* --json results */
+static void json_regs() {
+	int i;
+	fprintf(out, "{\"cmd\": \"rdump\", \"pc\": %u, \"regs\": [", muriscv_read_reg(sim, MURISCV_REG_PC));
+	for (i = 0; i < 32; i++) {
+		fprintf(out, i ? ", %u" : "%u", muriscv_read_reg(sim, i));
+	}
+	fprintf(out, "], \"hi\": %u, \"lo\": %u, \"cycles\": %u, \"instructions\": %u}\n", muriscv_read_reg(sim, MURISCV_REG_HI),
+			muriscv_read_reg(sim, MURISCV_REG_LO), muriscv_cycles(sim), muriscv_instructions(sim));
+}
+
+static void json_mem(uint32_t start, uint32_t stop) {
+	uint32_t address;
+	fprintf(out, "{\"cmd\": \"mdump\", \"start\": %u, \"stop\": %u, \"words\": [", start, stop);
+	for (address = start; address <= stop && address >= start; address += 4) {
+		fprintf(out, address != start ? ", %u" : "%u", muriscv_read_mem(sim, address));
+	}
+	fprintf(out, "]}\n");
+}
+
+static void json_run(const char *cmd, uint32_t start_cycles, uint32_t start_instructions) {
+	uint32_t cycles = muriscv_cycles(sim) - start_cycles;
+	uint32_t instructions = muriscv_instructions(sim) - start_instructions;
+	fprintf(out, "{\"cmd\": \"%s\", \"cycles\": %u, \"instructions\": %u, \"cpi\": %.4f, \"pc\": %u, \"running\": %s, "
+			"\"exit_code\": %d, \"total_cycles\": %u, \"total_instructions\": %u}\n", cmd, cycles, instructions,
+			instructions ? (double)cycles / instructions : 0.0, muriscv_read_reg(sim, MURISCV_REG_PC),
+			muriscv_running(sim) ? "true" : "false", muriscv_exit_code(sim), muriscv_cycles(sim),
+			muriscv_instructions(sim));
+}
+
+/* a command whose arguments are missing or malformed */
+static int bad_arguments(const char *cmd) {
+	printf("Error: Bad arguments for %s (? lists the commands)\n", cmd);
+	return -1;
+}
+
+/***************************************************************/
+/* Read a command from standard input.                                                               */
+/***************************************************************/
+void handle_command() {
+	char buffer[256];
+	uint32_t start, stop, cycles;
+	uint32_t register_no;
+	int register_value;
+	int hi_reg_value, lo_reg_value;
+	uint32_t start_cycles = muriscv_cycles(sim), start_instructions = muriscv_instructions(sim);
+	const char *ran = NULL;	/* run command to report with --json */
+	char cmd[32];
+	int status = 0;	/* -1 if the command failed */
+
+	if (!batch) {
+		fprintf(out, "MU-RISCV SIM:> ");
+	}
+
+	if (fscanf(input, "%255s", buffer) == EOF){
+		exit(batch && failures > 0);
+	}
+	if (buffer[0] == '#') {
+		fgets(buffer, sizeof(buffer), input);	// comment to the end of the line
+		return;
+	}
+	snprintf(cmd, sizeof(cmd), "%.31s", buffer);
+
+	switch(buffer[0]) {
+		case 'S':
+		case 's':
+			if (strcasecmp(buffer, "simpoints") == 0) {
+				char line[256], bbv[128], prefix[100], points[128], weights[128];
+				int k;
+				if (fgets(line, sizeof(line), input) != NULL &&
+						sscanf(line, "%127s %d %99s", bbv, &k, prefix) == 3) {
+					snprintf(points, sizeof(points), "%s.simpoints", prefix);
+					snprintf(weights, sizeof(weights), "%s.weights", prefix);
+					status = muriscv_simpoints(bbv, k, points, weights) < 0 ? -1 : 0;
+				} else {
+					status = bad_arguments(cmd);
+				}
+				break;
+			}
+			if (strcasecmp(buffer, "split") == 0) {
+				char line[256], path[128];
+				uint32_t n = 0;
+				int fields = 0;
+				if (fgets(line, sizeof(line), input) != NULL) {
+					fields = sscanf(line, "%u %127s", &n, path);
+				}
+				status = muriscv_split(sim, fields >= 1 ? n : 0, fields == 2 ? path : NULL);
+				ran = "split";
+				break;
+			}
+			if (strcasecmp(buffer, "sample") == 0) {
+				char line[256], prefix[100], points[128], weights[128];
+				uint32_t interval = MURISCV_SIMPOINT_INTERVAL, warmup = MURISCV_SIMPOINT_WARMUP;
+				double cpi;
+				if (fgets(line, sizeof(line), input) != NULL &&
+						sscanf(line, "%99s %u %u", prefix, &interval, &warmup) >= 1) {
+					snprintf(points, sizeof(points), "%s.simpoints", prefix);
+					snprintf(weights, sizeof(weights), "%s.weights", prefix);
+					status = muriscv_sample(sim, points, weights, interval, warmup, &cpi);
+				} else {
+					status = bad_arguments(cmd);
+				}
+				break;
+			}
+			if (buffer[1] == 'h' || buffer[1] == 'H'){
+				muriscv_show_pipeline(sim);
+			}else if (buffer[1] == 't' || buffer[1] == 'T'){
+				muriscv_show_stats(sim);
+			}else if (strcasecmp(buffer, "save") == 0){
+				status = fscanf(input, "%255s", buffer) == 1 ? muriscv_save(sim, buffer) : bad_arguments(cmd);
+			}else {
+				muriscv_run(sim);
+				ran = "sim";
+			}
+			break;
+		case 'M':
+		case 'm':
+			if (strcasecmp(buffer, "misaligned") == 0) {
+				char line[256], policy[32];
+				if (fgets(line, sizeof(line), input) == NULL || sscanf(line, "%31s", policy) != 1) {
+					muriscv_show_misaligned(sim);
+				} else if ((status = muriscv_set_misaligned(sim, policy)) == 0) {
+					muriscv_show_misaligned(sim);
+				}
+				break;
+			}
+			if (strcasecmp(buffer, "mdiff") == 0 || strcasecmp(buffer, "msave") == 0) {
+				/* <file> [<start> <stop>]: the whole address space by default */
+				char line[256], path[128];
+				start = 0;
+				stop = UINT32_MAX;
+				if (fgets(line, sizeof(line), input) == NULL || sscanf(line, "%127s %x %x", path, &start, &stop) < 1) {
+					status = bad_arguments(cmd);
+				} else if (strcasecmp(buffer, "msave") == 0) {
+					status = muriscv_save_mem(sim, path, start, stop);
+				} else if (json) {
+					int differences = muriscv_diff_mem(sim, path, start, stop, 0);
+					if (differences >= 0) {
+						fprintf(out, "{\"cmd\": \"mdiff\", \"start\": %u, \"stop\": %u, \"differences\": %d}\n", start,
+								stop, differences);
+					}
+					status = differences < 0 ? -1 : 0;
+				} else {
+					status = muriscv_diff_mem(sim, path, start, stop, UINT32_MAX) < 0 ? -1 : 0;
+				}
+				break;
+			}
+			if (fscanf(input, "%x %x", &start, &stop) != 2){
+				status = bad_arguments(cmd);
+				break;
+			}
+			if (json) {
+				json_mem(start, stop);
+			} else {
+				muriscv_dump_mem(sim, start, stop);
+			}
+			break;
+		case '?':
+			help();
+			break;
+		case 'Q':
+		case 'q':
+			if (!batch) {
+				printf("**************************\n");
+				printf("Exiting MU-RISCV! Good Bye...\n");
+				printf("**************************\n");
+			}
+			exit(batch && failures > 0);
+		case 'R':
+		case 'r':
+			if (buffer[1] == 'd' || buffer[1] == 'D'){
+				if (json) {
+					json_regs();
+				} else {
+					muriscv_dump_regs(sim);
+				}
+			}else if (strcasecmp(buffer, "record") == 0){
+				char line[256], path[128];
+				uint32_t n = 0;
+				if (fgets(line, sizeof(line), input) != NULL && sscanf(line, "%127s %u", path, &n) >= 1) {
+					status = muriscv_record(sim, path, n);
+				} else {
+					status = bad_arguments(cmd);
+				}
+			}else if (strcasecmp(buffer, "replay") == 0){
+				if (fscanf(input, "%255s", buffer) != 1) {
+					status = bad_arguments(cmd);
+				} else if ((status = muriscv_replay(sim, buffer)) == 0) {
+					start_cycles = start_instructions = 0;	// replay starts from a reset
+					ran = "replay";
+				}
+			}else if (strcasecmp(buffer, "restore") == 0){
+				status = fscanf(input, "%255s", buffer) == 1 ? muriscv_restore(sim, buffer) : bad_arguments(cmd);
+			}else if(buffer[1] == 'e' || buffer[1] == 'E'){
+				muriscv_reset(sim);
+			}
+			else {
+				if (fscanf(input, "%d", &cycles) != 1) {
+					status = bad_arguments(cmd);
+					break;
+				}
+				muriscv_step(sim, cycles);
+				ran = "run";
+			}
+			break;
+		case 'I':
+		case 'i':
+			if (fscanf(input, "%u %i", &register_no, &register_value) != 2){
+				status = bad_arguments(cmd);
+				break;
+			}
+			if (register_no >= 32) {
+				printf("Invalid register %u\n", register_no);
+				status = -1;
+				break;
+			}
+			muriscv_write_reg(sim, register_no, register_value);
+			break;
+		case 'H':
+		case 'h':
+			if (strcasecmp(buffer, "harts") == 0) {
+				char line[256];
+				int harts, quantum = MURISCV_QUANTUM, n = 0;
+				if (fgets(line, sizeof(line), input) != NULL) {
+					n = sscanf(line, "%d %d", &harts, &quantum);
+				}
+				if (n <= 0 || (status = muriscv_set_harts(sim, harts, quantum)) == 0) {
+					muriscv_show_harts(sim);
+				}
+				break;
+			}
+			if (fscanf(input, "%i", &hi_reg_value) != 1){
+				status = bad_arguments(cmd);
+				break;
+			}
+			muriscv_write_reg(sim, MURISCV_REG_HI, hi_reg_value);
+			break;
+		case 'L':
+		case 'l':
+			if (strcasecmp(buffer, "latency") == 0) {
+				char line[256], cls[16];
+				int cycles, n = 0;
+				if (fgets(line, sizeof(line), input) != NULL) {
+					n = sscanf(line, "%15s %d", cls, &cycles);
+				}
+				if (n <= 0) {
+					muriscv_show_latencies(sim);
+				} else if (n == 1) {
+					printf("Usage: latency <class> <cycles>\n");
+					status = -1;
+				} else if ((status = muriscv_set_latency(sim, cls, cycles)) == 0) {
+					printf("EX latency of %s: %d cycle%s\n", cls, cycles, cycles == 1 ? "" : "s");
+				}
+				break;
+			}
+			if (fscanf(input, "%i", &lo_reg_value) != 1){
+				status = bad_arguments(cmd);
+				break;
+			}
+			muriscv_write_reg(sim, MURISCV_REG_LO, lo_reg_value);
+			break;
+		case 'P':
+		case 'p':
+			if (strcasecmp(buffer, "prof") == 0) {
+				char what[16];
+				if (fgets(buffer, sizeof(buffer), input) != NULL && sscanf(buffer, "%15s", what) == 1 &&
+						strcasecmp(what, "reset") == 0) {
+					muriscv_reset_profile(sim);
+				} else {
+					status = muriscv_show_profile(sim);
+				}
+				break;
+			}
+			muriscv_print_program(sim);
+			break;
+		case 'F':
+		case 'f':
+			if (buffer[1] == 'f' || buffer[1] == 'F') {
+				if (strcmp(buffer + 2, "-until") == 0) {
+					if (fscanf(input, "%255s", buffer) != 1 || parse_address(buffer, &start) != 0) {
+						status = -1;
+						break;
+					}
+					muriscv_fast_forward_until(sim, start);
+					ran = "ff-until";
+				} else {
+					if (fscanf(input, "%u", &cycles) != 1) {
+						status = bad_arguments(cmd);
+						break;
+					}
+					muriscv_fast_forward(sim, cycles);
+					ran = "ff";
+				}
+				break;
+			}
+			if(fscanf(input, "%d", &register_value) != 1) {
+				status = bad_arguments(cmd);
+				break;
+			}
+			else {
+				muriscv_set_forwarding(sim, register_value);
+				register_value == 0 ? printf("Forwarding OFF\n") : printf("Forwarding ON\n");
+				break;
+			}
+		case 'B':
+		case 'b':
+			if (strcasecmp(buffer, "bbv") == 0) {
+				char line[256], path[128];
+				uint32_t interval = MURISCV_SIMPOINT_INTERVAL;
+				if (fgets(line, sizeof(line), input) != NULL && sscanf(line, "%127s %u", path, &interval) >= 1) {
+					status = muriscv_bbv_profile(sim, path, interval) < 0 ? -1 : 0;
+				} else {
+					status = bad_arguments(cmd);
+				}
+				break;
+			}
+			if (strcasecmp(buffer, "break") == 0) {
+				char line[256], where[128];
+				if (fgets(line, sizeof(line), input) == NULL || sscanf(line, "%127s", where) != 1) {
+					muriscv_show_breakpoints(sim);
+				} else if ((status = parse_address(where, &start)) == 0 && (status = muriscv_add_breakpoint(sim, start)) == 0) {
+					printf("Breakpoint at 0x%08x\n", start);
+				}
+				break;
+			}
+			if (buffer[1] == 'p' || buffer[1] == 'P') {
+				char line[256], kind[32];
+				int bits = MURISCV_BP_TABLE_BITS, btb = 0, n = 0;
+				if (fgets(line, sizeof(line), input) != NULL) {
+					n = sscanf(line, "%31s %d %d", kind, &bits, &btb);
+				}
+				if (n <= 0) {
+					muriscv_show_branch_stats(sim);
+				} else if ((status = muriscv_set_predictor(sim, kind, bits, btb)) == 0) {
+					printf("Branch predictor: %s\n", kind);
+				}
+				break;
+			}
+			if (strcasecmp(buffer, "btrace") != 0) {
+				printf("Invalid Command.\n");
+				status = -1;
+				break;
+			}
+			if (fscanf(input, "%255s", buffer) != 1) {
+				status = bad_arguments(cmd);
+				break;
+			}
+			if (strcmp(buffer, "off") == 0) {
+				muriscv_trace_file(sim, NULL);
+			} else if ((status = muriscv_trace_file(sim, buffer)) == 0) {
+				printf("Binary trace written to %s\n", buffer);
+			}
+			break;
+		case 'C':
+		case 'c': {
+			char line[256], level[16], spec[128];
+			int n = 0;
+			if (fgets(line, sizeof(line), input) != NULL) {
+				n = sscanf(line, "%15s %127s", level, spec);
+			}
+			if (n <= 0) {
+				muriscv_show_cache_stats(sim);
+			} else if (n == 1) {
+				printf("Usage: cache <l1i | l1d | l2> <spec | off>\n");
+				status = -1;
+			} else {
+				status = muriscv_set_cache(sim, level, spec);
+			}
+			break;
+		}
+		case 'D':
+		case 'd':
+			if (fscanf(input, "%255s", buffer) != 1) {
+				status = bad_arguments(cmd);
+				break;
+			}
+			if (strcasecmp(buffer, "all") == 0) {
+				muriscv_clear_breakpoints(sim);
+			} else if ((status = parse_address(buffer, &start)) == 0 &&
+					(status = muriscv_remove_breakpoint(sim, start)) != 0) {
+				printf("No breakpoint at 0x%08x\n", start);
+			}
+			break;
+		case 'W':
+		case 'w': {
+			char line[256], where[128], kind[8] = "w";
+			uint32_t len = 4;
+			if (fgets(line, sizeof(line), input) == NULL || sscanf(line, "%127s %u %7s", where, &len, kind) < 1) {
+				muriscv_show_breakpoints(sim);
+				break;
+			}
+			int watch = (strchr(kind, 'r') ? MURISCV_WATCH_READ : 0) | (strchr(kind, 'w') ? MURISCV_WATCH_WRITE : 0);
+			if ((status = parse_address(where, &start)) == 0 && (status = muriscv_add_watchpoint(sim, start, len, watch)) == 0) {
+				printf("Watchpoint on 0x%08x..0x%08x\n", start, start + len - 1);
+			}
+			break;
+		}
+		case 'U':
+		case 'u':
+			if (fscanf(input, "%255s", buffer) != 1) {
+				status = bad_arguments(cmd);
+				break;
+			}
+			if (strcasecmp(buffer, "all") == 0) {
+				muriscv_clear_watchpoints(sim);
+			} else if ((status = parse_address(buffer, &start)) == 0 &&
+					(status = muriscv_remove_watchpoint(sim, start)) != 0) {
+				printf("No watchpoint at 0x%08x\n", start);
+			}
+			break;
+		case 'G':
+		case 'g':
+			status = fscanf(input, "%255s", buffer) == 1 ? muriscv_gdb_serve(sim, buffer) : bad_arguments(cmd);
+			break;
+		case 'E':
+		case 'e': {
+			char engine[32];
+			if (fgets(buffer, sizeof(buffer), input) != NULL && sscanf(buffer, "%31s", engine) == 1 &&
+					(status = muriscv_set_engine(sim, engine)) != 0) {
+				break;
+			}
+			printf("Engine: %s\n", muriscv_engine(sim));
+			break;
+		}
+		case 'T':
+		case 't':
+			if (fscanf(input, "%255s", buffer) != 1) {
+				status = bad_arguments(cmd);
+				break;
+			}
+			if ((register_value = muriscv_parse_trace_level(buffer)) < 0) {
+				printf("Unknown trace level %s (none, summary, retire, cycle)\n", buffer);
+				status = -1;
+				break;
+			}
+			muriscv_set_trace_level(sim, register_value);
+			break;
+		default:
+			printf("Invalid Command.\n");
+			status = -1;
+			break;
+	}
+	capture_end(cmd, status != 0);
+	if (json && ran != NULL && status == 0) {
+		json_run(ran, start_cycles, start_instructions);
+	}
+	failures += status != 0;
+}
+
+
+/* -s <file>: checkpoint whatever state the session ends in */
+static char save_file[256];
+
+static void save_at_exit(){
+	muriscv_save(sim, save_file);
+}
+
+/* --stats-json <file>: counters as they are when the session ends */
+static char stats_file[256];
+
+static void stats_at_exit(){
+	muriscv_write_stats_json(sim, stats_file);
+}
+
+static void destroy_at_exit(){
+	muriscv_destroy(sim);
+}
+
+/***************************************************************/
+/* main                                                                                                                                   */
+/***************************************************************/
+int main(int argc, char *argv[]) {
+	static struct option long_options[] = {
+		{ "trace", required_argument, NULL, 't' },
+		{ "trace-file", required_argument, NULL, 'b' },
+		{ "restore", required_argument, NULL, 'r' },
+		{ "save", required_argument, NULL, 's' },
+		{ "predictor", required_argument, NULL, 'p' },
+		{ "btb", required_argument, NULL, 'B' },
+		{ "l1i", required_argument, NULL, 'I' },
+		{ "l1d", required_argument, NULL, 'D' },
+		{ "l2", required_argument, NULL, '2' },
+		{ "stats-json", required_argument, NULL, 'S' },
+		{ "engine", required_argument, NULL, 'E' },
+		{ "gdb", required_argument, NULL, 'g' },
+		{ "latency", required_argument, NULL, 'L' },
+		{ "misaligned", required_argument, NULL, 'M' },
+		{ "harts", required_argument, NULL, 'H' },
+		{ "script", required_argument, NULL, 'x' },
+		{ "json", no_argument, NULL, 'J' },
+		{ NULL, 0, NULL, 0 }
+	};
+	const char *trace_file = NULL;
+	char predictor[32] = "not-taken";
+	int predictor_bits = MURISCV_BP_TABLE_BITS, btb_entries = 0;
+	const char *cache_specs[3] = { NULL, NULL, NULL };	/* l1i, l1d, l2 */
+	static const char *cache_levels[3] = { "l1i", "l1d", "l2" };
+	const char *restore_file = NULL;
+	const char *engine = NULL;
+	const char *gdb = NULL;
+	const char *latencies[16];	/* <class>:<cycles> */
+	int num_latencies = 0;
+	const char *misaligned = NULL;
+	int harts = 1, quantum = MURISCV_QUANTUM;
+	const char *script = NULL;
+	char *commands = NULL;
+	int opt, level = -1;
+	while ((opt = getopt_long(argc, argv, "t:b:r:s:p:e:", long_options, NULL)) != -1) {
+		switch (opt) {
+			case 'x':
+				script = optarg;
+				break;
+			case 'e': {
+				/* <cmd>;<cmd>...: one command per line, after those of earlier -e options */
+				size_t used = commands != NULL ? strlen(commands) : 0;
+				commands = realloc(commands, used + strlen(optarg) + 2);
+				if (commands == NULL) {
+					printf("Error: Out of memory reading -e\n");
+					exit(1);
+				}
+				sprintf(commands + used, "%s\n", optarg);
+				for (char *c = commands + used; *c != '\0'; c++) {
+					if (*c == ';') {
+						*c = '\n';
+					}
+				}
+				break;
+			}
+			case 'J':
+				json = true;
+				break;
+			case 'p':
+				/* <kind>[:<table bits>] */
+				if (sscanf(optarg, "%31[^:]:%d", predictor, &predictor_bits) < 1) {
+					exit(1);
+				}
+				break;
+			case 'B':
+				btb_entries = atoi(optarg);
+				break;
+			case 'E':
+				engine = optarg;
+				break;
+			case 'g':
+				gdb = optarg;
+				break;
+			case 'L':
+				if (num_latencies == 16) {
+					printf("Error: Too many --latency options\n");
+					exit(1);
+				}
+				latencies[num_latencies++] = optarg;
+				break;
+			case 'M':
+				misaligned = optarg;
+				break;
+			case 'H':
+				/* <n>[:<quantum>] */
+				if (sscanf(optarg, "%d:%d", &harts, &quantum) < 1) {
+					printf("Error: Bad harts %s (expected <n>[:<quantum>])\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'S':
+				snprintf(stats_file, sizeof(stats_file), "%s", optarg);
+				break;
+			case 'I':
+			case 'D':
+			case '2':
+				cache_specs[opt == 'I' ? 0 : opt == 'D' ? 1 : 2] = optarg;
+				break;
+			case 'r':
+				restore_file = optarg;
+				break;
+			case 's':
+				snprintf(save_file, sizeof(save_file), "%s", optarg);
+				break;
+			case 'b':
+				trace_file = optarg;
+				break;
+			case 't':
+				if ((level = muriscv_parse_trace_level(optarg)) < 0) {
+					printf("Error: Unknown trace level %s (none, summary, retire, cycle)\n", optarg);
+					exit(1);
+				}
+				break;
+			default:
+				exit(1);
+		}
+	}
+
+	if (optind >= argc) {
+		printf("Error: You should provide input file.\nUsage: %s [-t none|summary|retire|cycle] [-b <trace file>] [-r <checkpoint>] [-s <checkpoint>] [-p <predictor>[:<bits>]] [--btb <entries>] [--l1i|--l1d|--l2 <cache spec>] [--latency <class>:<cycles>] [--misaligned allow|penalty[:<cycles>]|trap] [--harts <n>[:<quantum>]] [--stats-json <file>] [--engine step|threaded|jit] [--gdb <port | socket>] [--script <file> | -e \"<cmd>;<cmd>...\"] [--json] <input program> \n\n",  argv[0]);
+		exit(1);
+	}
+
+	out = stdout;
+	input = stdin;
+	if (script != NULL && commands != NULL) {
+		printf("Error: Give commands with --script or -e, not both\n");
+		exit(1);
+	}
+	if (script != NULL && (input = fopen(script, "r")) == NULL) {
+		printf("Error: Can't open script %s\n", script);
+		exit(1);
+	}
+	if (commands != NULL && (input = fmemopen(commands, strlen(commands), "r")) == NULL) {
+		printf("Error: Can't read commands from -e\n");
+		exit(1);
+	}
+	batch = input != stdin;
+	if (batch) {
+		setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER);
+	} else {
+		printf("\n**************************\n");
+		printf("Welcome to MU-RISCV SIM...\n");
+		printf("**************************\n\n");
+	}
+	if (level < 0) {
+		/* batch sessions default to run summaries, JSON ones to nothing but the JSON */
+		level = json ? MURISCV_TRACE_NONE : batch ? MURISCV_TRACE_SUMMARY : MURISCV_TRACE_CYCLE;
+	}
+
+	sim = muriscv_create();
+	if (sim == NULL) {
+		exit(1);
+	}
+	atexit(capture_at_exit);	/* first registered: runs after the handlers that print */
+	atexit(destroy_at_exit);
+	muriscv_set_trace_level(sim, level);
+	if (engine != NULL && muriscv_set_engine(sim, engine) != 0) {
+		exit(1);
+	}
+	if (muriscv_set_predictor(sim, predictor, predictor_bits, btb_entries) != 0) {
+		exit(1);
+	}
+	for (opt = 0; opt < 3; opt++) {
+		if (cache_specs[opt] != NULL && muriscv_set_cache(sim, cache_levels[opt], cache_specs[opt]) != 0) {
+			exit(1);
+		}
+	}
+	for (opt = 0; opt < num_latencies; opt++) {
+		char cls[16];
+		int cycles;
+		if (sscanf(latencies[opt], "%15[^:]:%d", cls, &cycles) != 2) {
+			printf("Error: Bad latency %s (expected <class>:<cycles>)\n", latencies[opt]);
+			exit(1);
+		}
+		if (muriscv_set_latency(sim, cls, cycles) != 0) {
+			exit(1);
+		}
+	}
+	if (misaligned != NULL && muriscv_set_misaligned(sim, misaligned) != 0) {
+		exit(1);
+	}
+	if (trace_file != NULL && muriscv_trace_file(sim, trace_file) != 0) {
+		exit(1);
+	}
+	if (muriscv_load(sim, argv[optind]) != 0) {
+		exit(1);
+	}
+	if (harts != 1 && muriscv_set_harts(sim, harts, quantum) != 0) {
+		exit(1);
+	}
+	if (restore_file != NULL && muriscv_restore(sim, restore_file) != 0) {
+		exit(1);
+	}
+	if (save_file[0] != '\0') {
+		atexit(save_at_exit);
+	}
+	if (stats_file[0] != '\0') {
+		atexit(stats_at_exit);
+	}
+	if (gdb != NULL && muriscv_gdb_serve(sim, gdb) != 0) {
+		exit(1);
+	}
+	if (!batch) {
+		help();
+	}
+	if (json) {
+		capture_begin();
+	}
+	while (1){
+		handle_command();
+	}
+	return 0;
+}
@@ -0,0 +1,524 @@
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Sampled simulation (SimPoint)                                                           */
+/***************************************************************/
+/*
+	bbv_profile() runs the program functionally and writes one basic-block
+	vector per interval of retired instructions in SimPoint's .bb format:
+
+		T:<block>:<instructions> :<block>:<instructions> ...
+
+	one line per interval, where <block> numbers the basic blocks from 1
+	in the order they were first entered and <instructions> is how many
+	instructions of the interval were spent in that block.
+
+	simpoint_pick() clusters the vectors the way SimPoint does: each vector
+	is normalized, randomly projected to SIMPOINT_DIMS dimensions and the
+	intervals are grouped with k-means (k-means++ seeding from a fixed
+	seed, so the choice is repeatable). The interval nearest each cluster's
+	centre represents it, weighted by the cluster's share of the program.
+	It writes SimPoint's .simpoints ("<interval> <cluster>") and .weights
+	("<weight> <cluster>") files, so points chosen by SimPoint itself can
+	be used instead.
+
+	simpoint_sample() simulates only the chosen intervals in detail. It
+	fast-forwards to warmup instructions before each one (caches are
+	warmed functionally on the way when configured), runs the warm-up
+	through the pipeline to fill it and the predictor, then measures the
+	interval's CPI. The estimate is the weighted sum of those CPIs.
+*/
+
+#define SIMPOINT_DIMS 15	/* random projection width, as in SimPoint */
+#define SIMPOINT_MAX_ITERATIONS 100
+#define SIMPOINT_SEED 0x2545F491u
+
+/***************************************************************/
+/* Basic-block vector collection                                                           */
+/***************************************************************/
+typedef struct {
+	uint32_t *block_of;	/* text word -> block number, 0 while not seen as a block start */
+	uint32_t num_blocks;
+	uint64_t *counts;	/* by block number, this interval */
+	uint32_t *touched;	/* blocks with a count this interval */
+	uint32_t num_touched, capacity;
+} bbv_t;
+
+static uint32_t bbv_block(bbv_t *bbv, uint32_t index)
+{
+	if (bbv->block_of[index] == 0) {
+		bbv->block_of[index] = ++bbv->num_blocks;
+	}
+	return bbv->block_of[index];
+}
+
+static void bbv_count(bbv_t *bbv, uint32_t block)
+{
+	if (bbv->counts[block]++ == 0) {
+		bbv->touched[bbv->num_touched++] = block;
+	}
+}
+
+/* one .bb line; clears the interval */
+static void bbv_write(bbv_t *bbv, FILE *fp)
+{
+	uint32_t i;
+	fputc('T', fp);
+	for (i = 0; i < bbv->num_touched; i++) {
+		uint32_t block = bbv->touched[i];
+		fprintf(fp, ":%u:%llu ", block, (unsigned long long)bbv->counts[block]);
+		bbv->counts[block] = 0;
+	}
+	fputc('\n', fp);
+	bbv->num_touched = 0;
+}
+
+/***************************************************************/
+/* Run the program from the start functionally, writing a basic-block */
+/* vector every interval instructions to path; the simulator is reset */
+/* again afterwards. Returns the number of intervals written, -1 on error */
+/***************************************************************/
+int bbv_profile(mu_sim_t *sim, const char *path, uint32_t interval)
+{
+	bbv_t bbv;
+	uint32_t in_interval = 0, block = 0, intervals = 0;
+	bool block_start = true;
+	FILE *fp;
+
+	if (sim->smp != NULL) {
+		printf("Error: Basic-block vectors are collected on a single hart\n");
+		return -1;
+	}
+	if (interval == 0 || sim->PROGRAM_SIZE == 0) {
+		printf("Error: Nothing to profile\n");
+		return -1;
+	}
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		printf("Error: Can't open basic-block vector file %s\n", path);
+		return -1;
+	}
+	memset(&bbv, 0, sizeof(bbv));
+	/* every word can start a block: numbers stay below PROGRAM_SIZE + 1 */
+	bbv.capacity = sim->PROGRAM_SIZE + 1;
+	bbv.block_of = calloc(sim->PROGRAM_SIZE, sizeof(uint32_t));
+	bbv.counts = calloc(bbv.capacity, sizeof(uint64_t));
+	bbv.touched = malloc(bbv.capacity * sizeof(uint32_t));
+	if (bbv.block_of == NULL || bbv.counts == NULL || bbv.touched == NULL) {
+		printf("Error: Out of memory for basic-block vectors\n");
+		free(bbv.block_of);
+		free(bbv.counts);
+		free(bbv.touched);
+		fclose(fp);
+		return -1;
+	}
+
+	reset(sim);
+	while (sim->RUN_FLAG && pc_in_program(sim, sim->CURRENT_STATE.PC)) {
+		uint32_t pc = sim->CURRENT_STATE.PC;
+		decoded_inst_t dec = decode_fetched(sim->mem, pc, mem_read_32(sim->mem, pc));
+		if (block_start) {
+			block = bbv_block(&bbv, (pc - MEM_TEXT_BEGIN) >> 2);
+		}
+		step_functional(sim);
+		bbv_count(&bbv, block);
+		/* a block ends at every control transfer, taken or not, and before a jump target */
+		block_start = (dec.flags & (DEC_BRANCH | DEC_JUMP)) || dec.cls == CLASS_SYSTEM ||
+				sim->CURRENT_STATE.PC != pc + 4;
+		if (++in_interval == interval) {
+			bbv_write(&bbv, fp);
+			intervals++;
+			in_interval = 0;
+		}
+	}
+	if (in_interval > 0) {
+		bbv_write(&bbv, fp);	// the partial last interval
+		intervals++;
+	}
+	uint32_t executed = sim->INSTRUCTION_COUNT;
+	free(bbv.block_of);
+	free(bbv.counts);
+	free(bbv.touched);
+	reset(sim);
+	if (fclose(fp) != 0) {
+		printf("Error: Can't write basic-block vector file %s\n", path);
+		return -1;
+	}
+	if (sim->TRACE_LEVEL >= TRACE_SUMMARY) {
+		printf("%u instructions, %u blocks, %u intervals of %u written to %s\n\n", executed, bbv.num_blocks,
+				intervals, interval, path);
+	}
+	return intervals;
+}
+
+/***************************************************************/
+/* Clustering                                                                                                */
+/***************************************************************/
+typedef struct {
+	double (*vectors)[SIMPOINT_DIMS];	/* projected, one per interval */
+	uint32_t num_intervals, capacity;
+} bbv_set_t;
+
+/* entry (block, dim) of the projection matrix, uniform in [-1, 1] */
+static double simpoint_projection(uint32_t block, uint32_t dim)
+{
+	uint32_t x = (block * SIMPOINT_DIMS + dim + 1) * 0x9E3779B1u;
+	x ^= x >> 16;
+	x *= 0x85EBCA6Bu;
+	x ^= x >> 13;
+	return x / 2147483647.5 - 1.0;
+}
+
+/* read a .bb file, normalizing and projecting each interval as it goes */
+static int bbv_read(const char *path, bbv_set_t *set)
+{
+	FILE *fp = fopen(path, "r");
+	int c;
+	if (fp == NULL) {
+		printf("Error: Can't open basic-block vector file %s\n", path);
+		return -1;
+	}
+	memset(set, 0, sizeof(*set));
+	while ((c = fgetc(fp)) != EOF) {
+		if (c != 'T') {
+			while (c != '\n' && c != EOF) {
+				c = fgetc(fp);
+			}
+			continue;
+		}
+		double vector[SIMPOINT_DIMS] = { 0 }, total = 0;
+		unsigned long long count;
+		uint32_t block, d;
+		if (set->num_intervals == set->capacity) {
+			set->capacity = set->capacity ? set->capacity * 2 : 256;
+			set->vectors = realloc(set->vectors, set->capacity * sizeof(*set->vectors));
+			if (set->vectors == NULL) {
+				printf("Error: Out of memory reading %s\n", path);
+				fclose(fp);
+				return -1;
+			}
+		}
+		while (fscanf(fp, " :%u:%llu", &block, &count) == 2) {
+			for (d = 0; d < SIMPOINT_DIMS; d++) {
+				vector[d] += count * simpoint_projection(block, d);
+			}
+			total += count;
+		}
+		for (d = 0; d < SIMPOINT_DIMS; d++) {
+			set->vectors[set->num_intervals][d] = total > 0 ? vector[d] / total : 0;
+		}
+		set->num_intervals++;
+	}
+	fclose(fp);
+	if (set->num_intervals == 0) {
+		printf("Error: No intervals in %s\n", path);
+		free(set->vectors);
+		return -1;
+	}
+	return 0;
+}
+
+static double simpoint_distance(const double *a, const double *b)
+{
+	double sum = 0;
+	uint32_t d;
+	for (d = 0; d < SIMPOINT_DIMS; d++) {
+		sum += (a[d] - b[d]) * (a[d] - b[d]);
+	}
+	return sum;
+}
+
+static uint32_t simpoint_random(uint32_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+/***************************************************************/
+/* Cluster the intervals of a .bb file into at most max_k groups and    */
+/* write SimPoint .simpoints/.weights files; returns the number of points */
+/***************************************************************/
+int simpoint_pick(const char *bbv_path, uint32_t max_k, const char *simpoints_path, const char *weights_path)
+{
+	bbv_set_t set;
+	uint32_t n, k, i, j, iteration, rng = SIMPOINT_SEED, points = 0;
+	if (max_k == 0) {
+		printf("Error: Need at least one simulation point\n");
+		return -1;
+	}
+	if (bbv_read(bbv_path, &set) != 0) {
+		return -1;
+	}
+	n = set.num_intervals;
+	k = max_k < n ? max_k : n;
+	double (*centres)[SIMPOINT_DIMS] = calloc(k, sizeof(*centres));
+	double *nearest = malloc(n * sizeof(double));
+	uint32_t *cluster = malloc(n * sizeof(uint32_t));
+	uint32_t *size = calloc(k, sizeof(uint32_t));
+	uint32_t *representative = malloc(k * sizeof(uint32_t));
+	if (centres == NULL || nearest == NULL || cluster == NULL || size == NULL || representative == NULL) {
+		printf("Error: Out of memory clustering %u intervals\n", n);
+		points = -1;
+		goto done;
+	}
+
+	/* k-means++: each further centre is an interval picked with probability
+	 * proportional to its squared distance from the nearest centre so far */
+	memcpy(centres[0], set.vectors[simpoint_random(&rng) % n], sizeof(centres[0]));
+	for (i = 0; i < n; i++) {
+		nearest[i] = simpoint_distance(set.vectors[i], centres[0]);
+	}
+	for (j = 1; j < k; j++) {
+		double total = 0, target;
+		for (i = 0; i < n; i++) {
+			total += nearest[i];
+		}
+		if (total == 0) {
+			break;	// fewer distinct vectors than clusters
+		}
+		target = total * (simpoint_random(&rng) / 4294967296.0);
+		for (i = 0; i < n - 1 && target >= nearest[i]; i++) {
+			target -= nearest[i];
+		}
+		memcpy(centres[j], set.vectors[i], sizeof(centres[j]));
+		for (i = 0; i < n; i++) {
+			double distance = simpoint_distance(set.vectors[i], centres[j]);
+			nearest[i] = distance < nearest[i] ? distance : nearest[i];
+		}
+	}
+	k = j;
+
+	/* Lloyd iterations until no interval changes cluster */
+	for (i = 0; i < n; i++) {
+		cluster[i] = UINT32_MAX;
+	}
+	for (iteration = 0; iteration < SIMPOINT_MAX_ITERATIONS; iteration++) {
+		bool changed = false;
+		for (i = 0; i < n; i++) {
+			uint32_t best = 0;
+			double best_distance = simpoint_distance(set.vectors[i], centres[0]);
+			for (j = 1; j < k; j++) {
+				double distance = simpoint_distance(set.vectors[i], centres[j]);
+				if (distance < best_distance) {
+					best = j;
+					best_distance = distance;
+				}
+			}
+			changed |= cluster[i] != best;
+			cluster[i] = best;
+		}
+		if (!changed) {
+			break;
+		}
+		memset(centres, 0, k * sizeof(*centres));
+		memset(size, 0, k * sizeof(uint32_t));
+		for (i = 0; i < n; i++) {
+			uint32_t d;
+			for (d = 0; d < SIMPOINT_DIMS; d++) {
+				centres[cluster[i]][d] += set.vectors[i][d];
+			}
+			size[cluster[i]]++;
+		}
+		for (j = 0; j < k; j++) {
+			uint32_t d;
+			for (d = 0; d < SIMPOINT_DIMS && size[j] > 0; d++) {
+				centres[j][d] /= size[j];
+			}
+		}
+	}
+
+	/* the interval nearest each centre stands for its cluster */
+	memset(size, 0, k * sizeof(uint32_t));
+	for (i = 0; i < n; i++) {
+		double distance = simpoint_distance(set.vectors[i], centres[cluster[i]]);
+		if (size[cluster[i]]++ == 0 || distance < nearest[representative[cluster[i]]]) {
+			representative[cluster[i]] = i;
+		}
+		nearest[i] = distance;
+	}
+
+	FILE *simpoints = fopen(simpoints_path, "w"), *weights = fopen(weights_path, "w");
+	if (simpoints == NULL || weights == NULL) {
+		printf("Error: Can't open %s\n", simpoints == NULL ? simpoints_path : weights_path);
+		points = -1;
+	}
+	for (j = 0; points != (uint32_t)-1 && j < k; j++) {
+		if (size[j] > 0) {
+			fprintf(simpoints, "%u %u\n", representative[j], points);
+			fprintf(weights, "%.6f %u\n", (double)size[j] / n, points);
+			points++;
+		}
+	}
+	if ((simpoints != NULL && fclose(simpoints) != 0) | (weights != NULL && fclose(weights) != 0)) {
+		printf("Error: Can't write simulation points\n");
+		points = -1;
+	}
+	if (points != (uint32_t)-1) {
+		printf("%u simulation points for %u intervals written to %s and %s\n\n", points, n, simpoints_path,
+				weights_path);
+	}
+done:
+	free(set.vectors);
+	free(centres);
+	free(nearest);
+	free(cluster);
+	free(size);
+	free(representative);
+	return points;
+}
+
+/***************************************************************/
+/* Sampled detailed simulation                                                                  */
+/***************************************************************/
+typedef struct {
+	uint32_t interval;
+	uint32_t cluster;
+	double weight;
+} simpoint_t;
+
+static int simpoint_compare(const void *a, const void *b)
+{
+	const simpoint_t *x = a, *y = b;
+	return x->interval < y->interval ? -1 : x->interval > y->interval;
+}
+
+/* the points of a .simpoints file with the weights of their clusters; count or -1 */
+static int simpoint_read(const char *simpoints_path, const char *weights_path, simpoint_t **points)
+{
+	FILE *fp = fopen(simpoints_path, "r");
+	uint32_t interval, cluster, n = 0, capacity = 0, i;
+	double weight;
+	*points = NULL;
+	if (fp == NULL) {
+		printf("Error: Can't open simulation points %s\n", simpoints_path);
+		return -1;
+	}
+	while (fscanf(fp, "%u %u", &interval, &cluster) == 2) {
+		if (n == capacity) {
+			capacity = capacity ? capacity * 2 : 16;
+			*points = realloc(*points, capacity * sizeof(simpoint_t));
+			if (*points == NULL) {
+				printf("Error: Out of memory reading %s\n", simpoints_path);
+				fclose(fp);
+				return -1;
+			}
+		}
+		(*points)[n].interval = interval;
+		(*points)[n].cluster = cluster;
+		(*points)[n].weight = -1;
+		n++;
+	}
+	fclose(fp);
+	fp = fopen(weights_path, "r");
+	if (fp == NULL) {
+		printf("Error: Can't open weights %s\n", weights_path);
+		free(*points);
+		return -1;
+	}
+	while (fscanf(fp, "%lf %u", &weight, &cluster) == 2) {
+		for (i = 0; i < n; i++) {
+			if ((*points)[i].cluster == cluster) {
+				(*points)[i].weight = weight;
+			}
+		}
+	}
+	fclose(fp);
+	for (i = 0; i < n; i++) {
+		if ((*points)[i].weight < 0) {
+			printf("Error: No weight for cluster %u in %s\n", (*points)[i].cluster, weights_path);
+			free(*points);
+			return -1;
+		}
+	}
+	if (n == 0) {
+		printf("Error: No simulation points in %s\n", simpoints_path);
+		free(*points);
+		return -1;
+	}
+	qsort(*points, n, sizeof(simpoint_t), simpoint_compare);
+	return n;
+}
+
+/* cycle the pipeline until instruction count reaches target or the program ends */
+static void simpoint_detail(mu_sim_t *sim, uint32_t target)
+{
+	while (sim->RUN_FLAG && sim->INSTRUCTION_COUNT < target) {
+		cycle(sim);
+	}
+}
+
+/***************************************************************/
+/* Estimate whole-program CPI from detailed runs of the chosen intervals */
+/***************************************************************/
+int simpoint_sample(mu_sim_t *sim, const char *simpoints_path, const char *weights_path, uint32_t interval,
+		uint32_t warmup, double *cpi)
+{
+	simpoint_t *points;
+	trace_level_t level = sim->TRACE_LEVEL;
+	double estimate = 0, total_weight = 0;
+	struct timespec start, stop;
+	int n, i;
+
+	if (sim->smp != NULL) {
+		printf("Error: Sampled simulation runs a single hart\n");
+		return -1;
+	}
+	if (interval == 0) {
+		printf("Error: The interval must be at least one instruction\n");
+		return -1;
+	}
+	n = simpoint_read(simpoints_path, weights_path, &points);
+	if (n < 0) {
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	reset(sim);
+	sim->TRACE_LEVEL = TRACE_NONE;
+	if (level >= TRACE_SUMMARY) {
+		printf("%-10s %8s %12s %12s %8s\n", "interval", "weight", "instructions", "cycles", "CPI");
+	}
+	for (i = 0; i < n && sim->RUN_FLAG; i++) {
+		uint64_t begin = (uint64_t)points[i].interval * interval;
+		uint64_t warm = begin > warmup ? begin - warmup : 0;
+		if (begin + interval > UINT32_MAX) {
+			printf("Error: Interval %u is past the instruction counter\n", points[i].interval);
+			break;
+		}
+		if (warm > sim->INSTRUCTION_COUNT) {
+			fast_forward(sim, warm - sim->INSTRUCTION_COUNT);
+		}
+		simpoint_detail(sim, begin);
+		uint32_t cycles = sim->CYCLE_COUNT, instructions = sim->INSTRUCTION_COUNT;
+		simpoint_detail(sim, begin + interval);
+		cycles = sim->CYCLE_COUNT - cycles;
+		instructions = sim->INSTRUCTION_COUNT - instructions;
+		if (instructions == 0) {
+			printf("Error: The program ended before interval %u\n", points[i].interval);
+			break;
+		}
+		double point_cpi = (double)cycles / instructions;
+		estimate += points[i].weight * point_cpi;
+		total_weight += points[i].weight;
+		if (level >= TRACE_SUMMARY) {
+			printf("%-10u %8.4f %12u %12u %8.3f\n", points[i].interval, points[i].weight, instructions, cycles,
+					point_cpi);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	sim->TRACE_LEVEL = level;
+	free(points);
+	if (i < n || total_weight == 0) {
+		reset(sim);
+		return -1;
+	}
+	*cpi = estimate / total_weight;	// weights of the chosen points need not add up to exactly 1
+	if (level >= TRACE_SUMMARY) {
+		printf("Estimated CPI: %.3f from %d simulation points (%.1f s host time)\n\n", *cpi, n,
+				(stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9);
+	}
+	reset(sim);
+	return 0;
+}
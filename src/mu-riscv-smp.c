@@ -0,0 +1,530 @@
+#include <pthread.h>
+
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Multi-hart machines                                                                                   */
+/***************************************************************/
+/*
+	Every hart is a full simulator context: its own register file, 5-stage
+	pipeline, branch predictor and caches. All of them share the memory of
+	hart 0, the context the machine was created on, and each runs on its
+	own host thread.
+
+	Harts advance in quanta of smp->quantum cycles and meet at a barrier
+	between quanta. During a quantum shared memory is read-only: a hart's
+	stores go into its private store buffer, which its own loads see, and
+	the other harts see them only after the barrier. At the barrier one
+	thread commits the buffers in hart order, hart 0 first, and performs
+	each hart's pending atomic right after that hart's stores. A quantum
+	therefore depends only on the memory committed before it and on the
+	hart's own state, and a run produces the same cycles and results
+	whatever the host scheduler does.
+
+	An atomic (LR.W, SC.W, AMO*.W) reaching MEM ends its hart's quantum:
+	the hart sits out the rest of it without simulated time passing, the
+	barrier performs the atomic, and the hart picks up in the next quantum
+	with the result in MEM/WB. An atomic therefore costs its EX latency
+	plus a cycle, not the wait, and harts drift apart in simulated time by
+	at most what they spent before their atomics. LR.W reserves a word; a
+	store or AMO by another hart committed to that word cancels the
+	reservation and the following SC.W fails.
+
+	Hart n starts at the program entry with a0 = n and its stack
+	SMP_HART_STACK * n bytes below hart 0's. Traces, breakpoints,
+	watchpoints, fast-forward and checkpoints are single-hart features.
+*/
+
+#define SMP_MIN_STORES 64	/* initial store buffer slots, a power of two */
+
+/* one word of a hart's store buffer */
+typedef struct {
+	uint32_t word;		/* address >> 2 */
+	uint32_t value;
+	uint8_t mask;		/* bytes of value written, bit i = byte i; 0: free slot */
+} smp_store_t;
+
+typedef struct {
+	smp_store_t *stores;	/* open-addressed by word, capacity a power of two */
+	uint32_t capacity, count;
+	uint32_t *used;		/* slots in use, to commit and clear them without a scan */
+
+	/* the atomic in MEM, performed at the next barrier */
+	bool atomic_pending, atomic_done;
+	decoded_inst_t atomic;
+	uint32_t atomic_address, atomic_operand, atomic_result;
+} smp_hart_t;
+
+struct smp {
+	uint32_t num_harts;
+	uint32_t quantum;
+	mu_sim_t *harts[SMP_MAX_HARTS];	/* harts[0] is the context the machine was created on */
+	smp_hart_t hart[SMP_MAX_HARTS];
+
+	pthread_barrier_t barrier;
+	uint32_t slice;		/* cycles every hart runs before the next barrier */
+	uint32_t remaining;	/* cycles left in this run after the slice */
+	uint32_t quanta;	/* barriers passed */
+	bool done;
+};
+
+static uint32_t smp_slot(uint32_t word, uint32_t capacity)
+{
+	return (word * 0x9E3779B1u) & (capacity - 1);
+}
+
+/* expand a 4-bit byte mask to the bits it covers */
+static uint32_t smp_byte_mask(uint8_t mask)
+{
+	return (mask & 1 ? 0xFFu : 0) | (mask & 2 ? 0xFF00u : 0) | (mask & 4 ? 0xFF0000u : 0) | (mask & 8 ? 0xFF000000u : 0);
+}
+
+static smp_store_t *smp_find(smp_hart_t *hart, uint32_t word)
+{
+	uint32_t slot;
+	for (slot = smp_slot(word, hart->capacity); hart->stores[slot].mask != 0; slot = (slot + 1) & (hart->capacity - 1)) {
+		if (hart->stores[slot].word == word) {
+			return &hart->stores[slot];
+		}
+	}
+	return NULL;
+}
+
+static void smp_grow(smp_hart_t *hart)
+{
+	uint32_t capacity = hart->capacity ? hart->capacity * 2 : SMP_MIN_STORES;
+	smp_store_t *stores = calloc(capacity, sizeof(smp_store_t));
+	uint32_t *used = malloc(capacity / 2 * sizeof(uint32_t));
+	uint32_t i;
+	if (stores == NULL || used == NULL) {
+		printf("Error: Out of memory for a hart's store buffer\n");
+		exit(-1);
+	}
+	for (i = 0; i < hart->count; i++) {
+		smp_store_t *store = &hart->stores[hart->used[i]];
+		uint32_t slot = smp_slot(store->word, capacity);
+		while (stores[slot].mask != 0) {
+			slot = (slot + 1) & (capacity - 1);
+		}
+		stores[slot] = *store;
+		used[i] = slot;
+	}
+	free(hart->stores);
+	free(hart->used);
+	hart->stores = stores;
+	hart->used = used;
+	hart->capacity = capacity;
+}
+
+/* the buffer entry for word, added if there is none (kept at most half full) */
+static smp_store_t *smp_buffer(smp_hart_t *hart, uint32_t word)
+{
+	smp_store_t *store = hart->capacity ? smp_find(hart, word) : NULL;
+	uint32_t slot;
+	if (store != NULL) {
+		return store;
+	}
+	if (2 * (hart->count + 1) > hart->capacity) {
+		smp_grow(hart);
+	}
+	for (slot = smp_slot(word, hart->capacity); hart->stores[slot].mask != 0; slot = (slot + 1) & (hart->capacity - 1));
+	hart->used[hart->count++] = slot;
+	hart->stores[slot].word = word;
+	hart->stores[slot].value = 0;
+	return &hart->stores[slot];
+}
+
+/* a load seen by sim: committed memory with its own buffered stores on top */
+uint32_t smp_load(mu_sim_t *sim, uint32_t address, uint32_t size)
+{
+	smp_hart_t *hart = &sim->smp->hart[sim->HART_ID];
+	uint32_t value, i;
+	if (hart->count == 0) {
+		switch (size) {
+			case 1:		return mem_read_8(sim->mem, address);
+			case 2:		return mem_read_16(sim->mem, address);
+			default:	return mem_read_32(sim->mem, address);
+		}
+	}
+	if (address & (size - 1)) {
+		for (value = 0, i = 0; i < size; i++) {
+			value |= smp_load(sim, address + i, 1) << (8 * i);
+		}
+		return value;
+	}
+	value = mem_read_32(sim->mem, address & ~3u);
+	smp_store_t *store = smp_find(hart, address >> 2);
+	if (store != NULL) {
+		uint32_t mask = smp_byte_mask(store->mask);
+		value = (value & ~mask) | (store->value & mask);
+	}
+	value >>= 8 * (address & 3);
+	return size == 4 ? value : value & ((1u << (8 * size)) - 1);
+}
+
+/* a store by sim: buffered until the next barrier */
+void smp_store(mu_sim_t *sim, uint32_t address, uint32_t size, uint32_t value)
+{
+	smp_hart_t *hart = &sim->smp->hart[sim->HART_ID];
+	uint32_t i;
+	if (address & (size - 1)) {
+		for (i = 0; i < size; i++) {
+			smp_store(sim, address + i, 1, value >> (8 * i));
+		}
+		return;
+	}
+	smp_store_t *store = smp_buffer(hart, address >> 2);
+	uint8_t bytes = ((1u << size) - 1) << (address & 3);
+	uint32_t mask = smp_byte_mask(bytes);
+	store->value = (store->value & ~mask) | ((value << (8 * (address & 3))) & mask);
+	store->mask |= bytes;
+}
+
+/* MEM reached an atomic: true once the barrier has performed it, otherwise it is queued */
+bool smp_atomic_done(mu_sim_t *sim, uint32_t address, uint32_t operand)
+{
+	smp_hart_t *hart = &sim->smp->hart[sim->HART_ID];
+	if (hart->atomic_done) {
+		return true;
+	}
+	if (!hart->atomic_pending) {
+		hart->atomic_pending = true;
+		hart->atomic = sim->EX_MEM.dec;
+		hart->atomic_address = address;
+		hart->atomic_operand = operand;
+		sim->perf.atomic_waits++;
+	}
+	return false;
+}
+
+/* what rd gets from the atomic smp_atomic_done() reported performed */
+uint32_t smp_atomic_result(mu_sim_t *sim)
+{
+	smp_hart_t *hart = &sim->smp->hart[sim->HART_ID];
+	hart->atomic_pending = false;
+	hart->atomic_done = false;
+	return hart->atomic_result;
+}
+
+/* a write by hart id to the word at address cancels the other harts' reservations of it */
+static void smp_cancel_reservations(smp_t *smp, uint32_t id, uint32_t address)
+{
+	uint32_t i;
+	for (i = 0; i < smp->num_harts; i++) {
+		mu_sim_t *hart = smp->harts[i];
+		if (i != id && hart->RESERVED && (hart->RESERVATION & ~3u) == (address & ~3u)) {
+			hart->RESERVED = false;
+		}
+	}
+}
+
+/* make hart id's buffered stores and pending atomic visible to every hart */
+static void smp_commit(smp_t *smp, uint32_t id)
+{
+	smp_hart_t *hart = &smp->hart[id];
+	mu_sim_t *sim = smp->harts[id];
+	uint32_t i, byte;
+	for (i = 0; i < hart->count; i++) {
+		smp_store_t *store = &hart->stores[hart->used[i]];
+		uint32_t address = store->word << 2;
+		if (store->mask == 0xF) {
+			mem_write_32(sim->mem, address, store->value);
+		} else {
+			for (byte = 0; byte < 4; byte++) {
+				if (store->mask & (1u << byte)) {
+					mem_write_8(sim->mem, address + byte, store->value >> (8 * byte));
+				}
+			}
+		}
+		smp_cancel_reservations(smp, id, address);
+		store->mask = 0;
+	}
+	hart->count = 0;
+
+	if (hart->atomic_pending && !hart->atomic_done) {
+		hart->atomic_result = amo_execute(sim, &hart->atomic, hart->atomic_address, hart->atomic_operand);
+		if (hart->atomic.op != OP_LR_W && (hart->atomic.op != OP_SC_W || hart->atomic_result == 0)) {
+			smp_cancel_reservations(smp, id, hart->atomic_address);
+		}
+		hart->atomic_done = true;
+		sim->mem_wait = false;
+	}
+}
+
+bool smp_running(mu_sim_t *sim)
+{
+	smp_t *smp = sim->smp;
+	uint32_t i;
+	for (i = 0; i < smp->num_harts; i++) {
+		if (smp->harts[i]->RUN_FLAG) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* size the next quantum; done once every hart has stopped or the run is over */
+static void smp_next_slice(smp_t *smp)
+{
+	smp->slice = smp->remaining < smp->quantum ? smp->remaining : smp->quantum;
+	smp->remaining -= smp->slice;
+	smp->done = smp->slice == 0 || !smp_running(smp->harts[0]);
+}
+
+/* the work of the last hart to reach the barrier */
+static void smp_barrier(smp_t *smp)
+{
+	uint32_t i;
+	for (i = 0; i < smp->num_harts; i++) {
+		smp_commit(smp, i);
+	}
+	smp->quanta++;
+	smp_next_slice(smp);
+}
+
+static void *smp_thread(void *arg)
+{
+	mu_sim_t *sim = arg;
+	smp_t *smp = sim->smp;
+	uint32_t i;
+	while (!smp->done) {
+		for (i = 0; i < smp->slice && sim->RUN_FLAG && !sim->mem_wait; i++) {
+			cycle(sim);
+		}
+		if (pthread_barrier_wait(&smp->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+			smp_barrier(smp);
+		}
+		pthread_barrier_wait(&smp->barrier);	// everyone sees the committed memory and the next slice
+	}
+	return NULL;
+}
+
+/***************************************************************/
+/* Run every hart for up to num_cycles cycles, one host thread each; */
+/* returns the cycles of the hart that simulated the most                       */
+/***************************************************************/
+uint32_t smp_run(mu_sim_t *sim, uint32_t num_cycles)
+{
+	smp_t *smp = sim->smp;
+	mu_sim_t *first = smp->harts[0];
+	pthread_t threads[SMP_MAX_HARTS];
+	uint32_t start_instructions[SMP_MAX_HARTS], start_cycles[SMP_MAX_HARTS];
+	uint32_t i, cycles = 0, instructions = 0;
+
+	if (!smp_running(sim)) {
+		if (first->TRACE_LEVEL >= TRACE_SUMMARY) printf("Simulation Stopped.\n\n");
+		return 0;
+	}
+	if (first->TRACE_LEVEL >= TRACE_SUMMARY) {
+		printf("Running %u harts (quantum %u cycles)...\n\n", smp->num_harts, smp->quantum);
+	}
+	for (i = 0; i < smp->num_harts; i++) {
+		start_instructions[i] = smp->harts[i]->INSTRUCTION_COUNT;
+		start_cycles[i] = smp->harts[i]->CYCLE_COUNT;
+	}
+
+	smp->remaining = num_cycles;
+	smp_next_slice(smp);
+	pthread_barrier_init(&smp->barrier, NULL, smp->num_harts);
+	for (i = 1; i < smp->num_harts; i++) {
+		if (pthread_create(&threads[i], NULL, smp_thread, smp->harts[i]) != 0) {
+			printf("Error: Can't start a thread for hart %u\n", i);
+			exit(-1);
+		}
+	}
+	smp_thread(first);
+	for (i = 1; i < smp->num_harts; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_barrier_destroy(&smp->barrier);
+
+	for (i = 0; i < smp->num_harts; i++) {
+		uint32_t hart_cycles = smp->harts[i]->CYCLE_COUNT - start_cycles[i];
+		cycles = hart_cycles > cycles ? hart_cycles : cycles;
+	}
+	if (first->TRACE_LEVEL >= TRACE_SUMMARY) {
+		printf(smp_running(sim) ? "Simulation Paused.\n\n" : "Simulation Finished.\n\n");
+		for (i = 0; i < smp->num_harts; i++) {
+			mu_sim_t *hart = smp->harts[i];
+			uint32_t hart_cycles = hart->CYCLE_COUNT - start_cycles[i];
+			uint32_t hart_instructions = hart->INSTRUCTION_COUNT - start_instructions[i];
+			instructions += hart_instructions;
+			printf("Hart %u: Cycles: %u | Instructions: %u | CPI: %.3f", i, hart_cycles, hart_instructions,
+					hart_instructions ? (double)hart_cycles / hart_instructions : 0.0);
+			if (hart->EXIT_CODE != -1) {
+				printf(" | Exit code: %d", hart->EXIT_CODE);
+			}
+			printf("\n");
+		}
+		printf("Machine: Cycles: %u | Instructions: %u | IPC: %.3f | Quanta: %u\n\n", cycles, instructions,
+				cycles ? (double)instructions / cycles : 0.0, smp->quanta);
+	}
+	return cycles;
+}
+
+/* a cache with the geometry and policies of from, empty */
+static int smp_copy_cache(cache_t *to, const cache_t *from)
+{
+	const char *name = to->name;
+	cache_free(to);
+	if (!from->enabled) {
+		return 0;
+	}
+	cache_line_t *lines = calloc(from->num_sets * from->assoc, sizeof(cache_line_t));
+	if (lines == NULL) {
+		printf("Error: Out of memory for %s\n", name);
+		return -1;
+	}
+	*to = *from;
+	to->name = name;
+	to->lines = lines;
+	cache_reset(to);
+	return 0;
+}
+
+/* give hart the configuration and program of hart 0 */
+static int smp_copy_config(mu_sim_t *hart, mu_sim_t *first)
+{
+	hart->ENABLE_FORWARDING = first->ENABLE_FORWARDING;
+	memcpy(hart->EX_LATENCY, first->EX_LATENCY, sizeof(hart->EX_LATENCY));
+	hart->MISALIGNED = first->MISALIGNED;
+	hart->MISALIGNED_PENALTY = first->MISALIGNED_PENALTY;
+	hart->ENGINE = first->ENGINE;
+	hart->TRACE_LEVEL = TRACE_NONE;
+	hart->PROGRAM_SIZE = first->PROGRAM_SIZE;
+	memcpy(hart->prog_file, first->prog_file, sizeof(hart->prog_file));
+	if (smp_copy_cache(&hart->l1i, &first->l1i) != 0 || smp_copy_cache(&hart->l1d, &first->l1d) != 0 ||
+			smp_copy_cache(&hart->l2, &first->l2) != 0) {
+		return -1;
+	}
+	cache_link(hart);
+	return bp_configure(hart, first->bp.kind, first->bp.table_bits, first->bp.btb_entries);
+}
+
+/***************************************************************/
+/* Restart every hart at the program entry with hart 0's configuration; */
+/* memory is left as it is                                                                          */
+/***************************************************************/
+void smp_reset(mu_sim_t *sim)
+{
+	smp_t *smp = sim->smp;
+	mu_sim_t *first = smp->harts[0];
+	uint32_t i;
+	for (i = 0; i < smp->num_harts; i++) {
+		mu_sim_t *hart = smp->harts[i];
+		smp->hart[i].count = 0;
+		if (smp->hart[i].capacity > 0) {
+			memset(smp->hart[i].stores, 0, smp->hart[i].capacity * sizeof(smp_store_t));
+		}
+		smp->hart[i].atomic_pending = false;
+		smp->hart[i].atomic_done = false;
+		if (i > 0) {
+			smp_copy_config(hart, first);
+			hart->INITIAL_STATE = first->INITIAL_STATE;
+			hart->INITIAL_STATE.REGS[10] = i;	// a0: hart id
+			if (hart->INITIAL_STATE.REGS[2] != 0) {
+				hart->INITIAL_STATE.REGS[2] -= i * SMP_HART_STACK;
+			}
+		}
+		reset_hart(hart);
+	}
+	smp->quanta = 0;
+}
+
+/***************************************************************/
+/* Turn sim into hart 0 of a machine with num_harts harts (1: back */
+/* to a single hart) and reset the simulation                                     */
+/***************************************************************/
+int smp_configure(mu_sim_t *sim, uint32_t num_harts, uint32_t quantum)
+{
+	uint32_t i;
+	if (sim->HART_ID != 0) {
+		printf("Error: Only hart 0 can change the number of harts\n");
+		return -1;
+	}
+	if (num_harts < 1 || num_harts > SMP_MAX_HARTS) {
+		printf("Error: Harts must be 1 to %d\n", SMP_MAX_HARTS);
+		return -1;
+	}
+	if (quantum < 1) {
+		printf("Error: The quantum must be at least 1 cycle\n");
+		return -1;
+	}
+	if (sim->smp != NULL) {
+		smp_free(sim);
+	}
+	if (num_harts > 1) {
+		smp_t *smp = calloc(1, sizeof(smp_t));
+		if (smp == NULL) {
+			printf("Error: Out of memory for %u harts\n", num_harts);
+			return -1;
+		}
+		smp->harts[0] = sim;
+		smp->quantum = quantum;
+		sim->smp = smp;
+		for (i = 1; i < num_harts; i++) {
+			mu_sim_t *hart = malloc(sizeof(*hart));
+			if (hart == NULL || initialize(hart, sim->mem) != 0) {
+				printf("Error: Can't allocate hart %u\n", i);
+				free(hart);
+				smp_free(sim);
+				return -1;
+			}
+			hart->HART_ID = i;
+			hart->smp = smp;
+			smp->harts[i] = hart;
+		}
+		smp->num_harts = num_harts;
+	}
+	reset(sim);
+	return 0;
+}
+
+/* release harts 1..n-1 and the machine, leaving hart 0 a single-hart simulator */
+void smp_free(mu_sim_t *sim)
+{
+	smp_t *smp = sim->smp;
+	uint32_t i;
+	for (i = 0; i < SMP_MAX_HARTS; i++) {
+		if (i > 0 && smp->harts[i] != NULL) {
+			finalize(smp->harts[i]);
+			free(smp->harts[i]);
+		}
+		free(smp->hart[i].stores);
+		free(smp->hart[i].used);
+	}
+	free(smp);
+	sim->smp = NULL;
+	sim->mem_wait = false;
+}
+
+uint32_t smp_num_harts(mu_sim_t *sim)
+{
+	return sim->smp != NULL ? sim->smp->num_harts : 1;
+}
+
+/* hart n of sim's machine, NULL if there is none */
+mu_sim_t *smp_hart(mu_sim_t *sim, uint32_t n)
+{
+	if (sim->smp == NULL) {
+		return n == 0 ? sim : NULL;
+	}
+	return n < sim->smp->num_harts ? sim->smp->harts[n] : NULL;
+}
+
+void show_harts(mu_sim_t *sim)
+{
+	uint32_t i;
+	if (sim->smp == NULL) {
+		printf("Harts: 1\n");
+		return;
+	}
+	printf("Harts: %u | Quantum: %u cycles | Quanta run: %u\n", sim->smp->num_harts, sim->smp->quantum,
+			sim->smp->quanta);
+	for (i = 0; i < sim->smp->num_harts; i++) {
+		mu_sim_t *hart = sim->smp->harts[i];
+		printf("  Hart %u: PC 0x%08x | %s | Cycles: %u | Instructions: %u | Atomic waits: %llu\n", i,
+				hart->CURRENT_STATE.PC, hart->RUN_FLAG ? "running" : "stopped", hart->CYCLE_COUNT,
+				hart->INSTRUCTION_COUNT, (unsigned long long)hart->perf.atomic_waits);
+	}
+}
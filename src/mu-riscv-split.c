@@ -0,0 +1,720 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Decoupled functional and timing simulation                                           */
+/***************************************************************/
+/*
+	split_run() executes the program on two host threads. The functional
+	thread runs each instruction with step_record() on a private copy of
+	the architectural state and pushes the retire_record_t describing it
+	into a single-producer/single-consumer ring. The timing thread (the
+	caller) pops the records and models the five stages the way
+	handle_pipeline() does: stage occupancy, load-use stalls, multi-cycle
+	EX, branch prediction and flushes, and both caches. It only needs
+	what the records say, so the two halves overlap on separate cores.
+
+	Fetch follows the records while the predictor agrees with them. After
+	a misprediction the model fetches down the predicted path from the
+	program text, as the pipeline does, until the branch resolves in EX;
+	those instructions cost fetch bandwidth, instruction cache accesses
+	and predictor lookups but never go past ID. Cycles, retired
+	instructions and every counter come out as handle_pipeline() would
+	give them, except that the few instructions fetched behind the exit
+	call are not executed, so a branch among them is not resolved.
+
+	The ring is lock-free: each side owns one index and publishes it
+	with a release store every SPLIT_BATCH records, or before it waits,
+	and reads the other's with an acquire load only when its cached copy
+	says the ring is full or empty. A waiting side yields its core.
+
+	The record stream can also be written to a file (split_run() with a
+	path, or split_record() without the timing half) and replayed later
+	by split_replay() against any predictor, cache and latency settings
+	without executing the program again. Layout:
+
+		magic[8] "MURVREC1", version, record size, PROGRAM_SIZE,
+		record count, exited (the stream ends with the call that ended
+		the program), the starting CPU_State (PC, REGS[32], HI, LO),
+		then the records, all in host byte order
+
+	A replay starts from that state with the program's text loaded for
+	the wrong-path fetches; it rebuilds the registers but not memory, so
+	the simulator is left stopped afterwards.
+
+	Breakpoints, watchpoints and tracing beyond summaries are not
+	checked, and a multi-hart machine can't be split.
+*/
+
+#define SPLIT_RING_RECORDS 8192	/* a power of two */
+#define SPLIT_BATCH 256		/* records between index updates, a power of two */
+#define SPLIT_REPLAY_BLOCK 4096	/* records read from a file at a time */
+
+#define RECORD_MAGIC "MURVREC1"
+#define RECORD_VERSION 1
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t program_size;
+	uint32_t num_records;
+	uint32_t exited;
+	CPU_State start;
+} record_file_header_t;
+
+typedef struct {
+	retire_record_t records[SPLIT_RING_RECORDS];
+	alignas(64) atomic_uint tail;	/* records written by the functional thread */
+	alignas(64) atomic_uint head;	/* records read by the timing thread */
+	alignas(64) atomic_bool done;	/* the functional thread wrote its last record */
+	atomic_bool stop;	/* the timing thread gave up early */
+
+	/* functional thread */
+	mu_sim_t *func;		/* its copy of the simulator; shares sim->mem */
+	uint32_t num_instructions;
+	FILE *file;		/* NULL, or where the stream is saved */
+	record_file_header_t header;
+	bool write_failed;
+	bool exited;
+	uint64_t full_waits;
+
+	/* timing thread */
+	uint64_t empty_waits;
+} split_t;
+
+/* where the timing model gets its records */
+typedef struct {
+	split_t *split;		/* live: from the functional thread */
+	uint32_t head, tail;	/* the timing thread's copies of the ring indices */
+
+	FILE *file;		/* replay: from a file */
+	retire_record_t *buf;
+	uint32_t pos, len, left;
+
+	bool over;		/* every record has been read */
+	bool exited;		/* and the last one ended the program */
+} record_source_t;
+
+/***************************************************************/
+/* Record files                                                                                                  */
+/***************************************************************/
+static FILE *record_open(mu_sim_t *sim, const char *path, record_file_header_t *header)
+{
+	FILE *fp = fopen(path, "wb");
+	if (fp == NULL) {
+		printf("Error: Can't open record file %s\n", path);
+		return NULL;
+	}
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, RECORD_MAGIC, sizeof(header->magic));
+	header->version = RECORD_VERSION;
+	header->record_size = sizeof(retire_record_t);
+	header->program_size = sim->PROGRAM_SIZE;
+	header->start = sim->CURRENT_STATE;
+	fwrite(header, sizeof(*header), 1, fp);	// rewritten with the count when the stream ends
+	return fp;
+}
+
+static int record_close(FILE *fp, record_file_header_t *header, bool ok, const char *path)
+{
+	ok = ok && fseek(fp, 0, SEEK_SET) == 0 && fwrite(header, sizeof(*header), 1, fp) == 1;
+	if (fclose(fp) != 0 || !ok) {
+		printf("Error: Can't write record file %s\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+/***************************************************************/
+/* Functional half                                                                                               */
+/***************************************************************/
+/* make records [from, to) visible to the timing thread, saving them first */
+static void split_publish(split_t *split, uint32_t from, uint32_t to)
+{
+	while (split->file != NULL && from != to) {
+		uint32_t slot = from & (SPLIT_RING_RECORDS - 1);
+		uint32_t n = to - from < SPLIT_RING_RECORDS - slot ? to - from : SPLIT_RING_RECORDS - slot;
+		split->write_failed |= fwrite(&split->records[slot], sizeof(retire_record_t), n, split->file) != n;
+		from += n;
+	}
+	atomic_store_explicit(&split->tail, to, memory_order_release);
+}
+
+static void *split_functional(void *arg)
+{
+	split_t *split = arg;
+	mu_sim_t *func = split->func;
+	uint32_t head = 0, tail = 0, published = 0, i;
+	bool trapped = false;
+
+	for (i = 0; i < split->num_instructions && func->RUN_FLAG && pc_in_program(func, func->CURRENT_STATE.PC); i++) {
+		if (tail - head == SPLIT_RING_RECORDS) {
+			split_publish(split, published, tail);
+			published = tail;
+			while ((head = atomic_load_explicit(&split->head, memory_order_acquire)) + SPLIT_RING_RECORDS == tail) {
+				if (atomic_load_explicit(&split->stop, memory_order_relaxed)) {
+					goto done;
+				}
+				split->full_waits++;
+				sched_yield();
+			}
+		}
+		if (!step_record(func, &split->records[tail & (SPLIT_RING_RECORDS - 1)])) {
+			trapped = true;
+			break;
+		}
+		if (++tail - published == SPLIT_BATCH) {
+			split_publish(split, published, tail);
+			published = tail;
+		}
+	}
+done:
+	split_publish(split, published, tail);
+	split->header.num_records = tail;
+	split->exited = !func->RUN_FLAG && !trapped;
+	split->header.exited = split->exited;
+	atomic_store_explicit(&split->done, true, memory_order_release);
+	return NULL;
+}
+
+/* the next record in program order; false once the stream is over */
+static bool record_next(record_source_t *src, retire_record_t *rec)
+{
+	if (src->over) {
+		return false;
+	}
+	if (src->file != NULL) {
+		if (src->pos == src->len) {
+			uint32_t want = src->left < SPLIT_REPLAY_BLOCK ? src->left : SPLIT_REPLAY_BLOCK;
+			src->len = fread(src->buf, sizeof(retire_record_t), want, src->file);
+			src->left -= src->len;
+			src->pos = 0;
+			if (src->len == 0) {
+				src->over = true;
+				return false;
+			}
+		}
+		*rec = src->buf[src->pos++];
+		return true;
+	}
+
+	split_t *split = src->split;
+	while (src->head == src->tail) {
+		atomic_store_explicit(&split->head, src->head, memory_order_release);
+		src->tail = atomic_load_explicit(&split->tail, memory_order_acquire);
+		if (src->head != src->tail) {
+			break;
+		}
+		if (atomic_load_explicit(&split->done, memory_order_acquire)) {
+			// the final tail was published before done
+			src->tail = atomic_load_explicit(&split->tail, memory_order_acquire);
+			if (src->head == src->tail) {
+				src->over = true;
+				src->exited = split->exited;
+				return false;
+			}
+			break;
+		}
+		split->empty_waits++;
+		sched_yield();
+	}
+	*rec = split->records[src->head & (SPLIT_RING_RECORDS - 1)];
+	if ((++src->head & (SPLIT_BATCH - 1)) == 0) {
+		atomic_store_explicit(&split->head, src->head, memory_order_release);
+	}
+	return true;
+}
+
+/***************************************************************/
+/* Timing half: the pipeline of handle_pipeline() without the values */
+/***************************************************************/
+typedef struct {
+	retire_record_t rec;	/* rec.ir == 0: bubble */
+	uint32_t npc;		/* where fetch continued after it */
+	bool junk;		/* off the recorded path: never resolves or retires */
+} timing_slot_t;
+
+typedef struct {
+	timing_slot_t if_id, id_ex, ex_mem, mem_wb;
+	retire_record_t next;	/* taken from the stream, fetched once the instruction cache allows */
+	bool have_next;
+	uint32_t fetch_pc;
+	bool wrong_path;	/* a mispredicted branch is in flight */
+	bool bubble, flush;
+	uint32_t fetch_stall, mem_stall, ex_busy;
+	bool lost;		/* the records don't follow the program */
+} timing_t;
+
+static void timing_wb(mu_sim_t *sim, timing_t *t)
+{
+	timing_slot_t *slot = &t->mem_wb;
+	decoded_inst_t *dec = &slot->rec.dec;
+	if (slot->rec.ir == 0 || slot->junk) {
+		sim->perf.bubbles++;
+		return;
+	}
+	// the registers are rebuilt from the records so system calls see a7 and a0
+	if (dec->flags & DEC_WRITES_RD) {
+		sim->CURRENT_STATE.REGS[dec->rd] = slot->rec.result;
+	}
+	sim->CURRENT_STATE.PC = slot->rec.next_pc;
+	sim->INSTRUCTION_COUNT++;
+	sim->perf.retired[dec->cls]++;
+	if (dec->cls == CLASS_SYSTEM) {
+		system_call(sim, &sim->CURRENT_STATE, dec);
+	}
+}
+
+static void timing_mem(mu_sim_t *sim, timing_t *t)
+{
+	timing_slot_t *slot = &t->ex_mem;
+	decoded_inst_t *dec = &slot->rec.dec;
+	uint32_t address = slot->rec.address;
+	if ((dec->flags & (DEC_LOAD | DEC_STORE)) && !slot->junk) {
+		t->mem_stall = cache_access(&sim->l1d, address, dec->flags & DEC_STORE);
+		if (address & (dec->size - 1)) {
+			sim->perf.misaligned++;
+			if (sim->MISALIGNED == MISALIGNED_PENALTY) {
+				t->mem_stall += sim->MISALIGNED_PENALTY;
+			}
+		}
+		sim->perf.loads += (dec->flags & DEC_LOAD) != 0;
+		sim->perf.stores += (dec->flags & DEC_STORE) != 0;
+	}
+	t->mem_wb = t->ex_mem;
+}
+
+static void timing_ex(mu_sim_t *sim, timing_t *t)
+{
+	timing_slot_t *slot = &t->id_ex;
+	decoded_inst_t *dec = &slot->rec.dec;
+
+	if (sim->EX_LATENCY[dec->cls] > 1 && slot->rec.ir != 0) {
+		if (t->ex_busy == 0) {
+			t->ex_busy = sim->EX_LATENCY[dec->cls];
+		}
+		if (--t->ex_busy > 0) {
+			memset(&t->ex_mem, 0, sizeof(t->ex_mem));
+			sim->perf.ex_busy_stalls++;
+			return;
+		}
+	}
+
+	if ((dec->flags & (DEC_BRANCH | DEC_JUMP)) && !slot->junk) {
+		uint32_t pc = slot->rec.pc;
+		bool taken = (dec->flags & DEC_JUMP) || slot->rec.result;
+		uint32_t target = dec->op == OP_JALR ? slot->rec.next_pc : pc + dec->imm;
+		uint32_t actual = taken ? target : pc + 4;
+		bool mispredicted = actual != slot->npc;
+
+		bp_update(sim, pc, dec, taken, target);
+		if (dec->flags & DEC_BRANCH) {
+			sim->bp.branches++;
+			sim->bp.branch_mispredicts += mispredicted;
+		} else {
+			sim->bp.jumps++;
+			sim->bp.jump_mispredicts += mispredicted;
+		}
+		if (mispredicted) {
+			t->flush = true;
+			t->fetch_pc = actual;
+			t->wrong_path = false;
+			sim->bp.flush_cycles += BRANCH_PENALTY;
+		}
+	}
+	t->ex_mem = t->id_ex;
+}
+
+/* DetectHazardsAndForward() on the decoded fields alone */
+static void timing_hazards(mu_sim_t *sim, timing_t *t)
+{
+	decoded_inst_t *id_ex = &t->id_ex.rec.dec;
+	bool reads_rs1 = id_ex->flags & DEC_READS_RS1;
+	bool reads_rs2 = id_ex->flags & DEC_READS_RS2;
+	bool mem_wb_rs1 = false, mem_wb_rs2 = false;
+	if (!reads_rs1 && !reads_rs2) {
+		return;
+	}
+	if (!sim->ENABLE_FORWARDING) {
+		if (reads_result_of(id_ex, &t->ex_mem.rec.dec) || reads_result_of(id_ex, &t->mem_wb.rec.dec)) {
+			t->bubble = true;
+			sim->perf.writeback_stalls++;
+			memset(&t->id_ex, 0, sizeof(t->id_ex));
+		}
+		return;
+	}
+	decoded_inst_t *mem_wb = &t->mem_wb.rec.dec;
+	if (mem_wb->flags & DEC_WRITES_RD) {
+		mem_wb_rs1 = reads_rs1 && mem_wb->rd == id_ex->rs1;
+		mem_wb_rs2 = reads_rs2 && mem_wb->rd == id_ex->rs2;
+	}
+	decoded_inst_t *ex_mem = &t->ex_mem.rec.dec;
+	if (ex_mem->flags & DEC_WRITES_RD) {
+		bool hazard_rs1 = reads_rs1 && ex_mem->rd == id_ex->rs1;
+		bool hazard_rs2 = reads_rs2 && ex_mem->rd == id_ex->rs2;
+		if ((hazard_rs1 || hazard_rs2) && (ex_mem->flags & DEC_LOAD)) {
+			t->bubble = true;
+			sim->perf.load_use_stalls++;
+			memset(&t->id_ex, 0, sizeof(t->id_ex));
+			return;
+		}
+		sim->perf.forwarded_ex_mem += hazard_rs1 + hazard_rs2;
+		mem_wb_rs1 &= !hazard_rs1;
+		mem_wb_rs2 &= !hazard_rs2;
+	}
+	sim->perf.forwarded_mem_wb += mem_wb_rs1 + mem_wb_rs2;
+}
+
+static void timing_id(mu_sim_t *sim, timing_t *t)
+{
+	if (t->flush) {
+		memset(&t->id_ex, 0, sizeof(t->id_ex));
+		return;
+	}
+	if (t->ex_busy > 0) {
+		t->bubble = true;
+		return;
+	}
+	t->id_ex = t->if_id;
+	timing_hazards(sim, t);
+}
+
+static void timing_if(mu_sim_t *sim, timing_t *t, record_source_t *src)
+{
+	timing_slot_t *slot = &t->if_id;
+	if (t->flush || !pc_in_program(sim, t->fetch_pc)) {
+		memset(slot, 0, sizeof(*slot));
+		t->fetch_stall = 0;
+		return;
+	}
+
+	// on the recorded path the next record is what sits at fetch_pc; past
+	// the exit call fetch goes on from the text like a wrong path
+	if (!t->wrong_path && !t->have_next) {
+		t->have_next = record_next(src, &t->next);
+		if (t->have_next && t->next.pc != t->fetch_pc) {
+			printf("Error: The records go to 0x%08x where the program goes to 0x%08x\n", t->next.pc, t->fetch_pc);
+			t->lost = true;
+			return;
+		}
+		if (!t->have_next && !src->exited) {
+			memset(slot, 0, sizeof(*slot));
+			return;
+		}
+	}
+
+	if (t->fetch_stall == 0) {
+		t->fetch_stall = cache_access(&sim->l1i, t->fetch_pc, false);
+	} else {
+		t->fetch_stall--;
+	}
+	if (t->fetch_stall > 0) {
+		memset(slot, 0, sizeof(*slot));
+		sim->perf.icache_stall_cycles++;
+		return;
+	}
+	sim->perf.fetches++;
+
+	if (t->have_next) {
+		slot->rec = t->next;
+		slot->junk = false;
+		t->have_next = false;
+	} else {
+		memset(&slot->rec, 0, sizeof(slot->rec));
+		slot->rec.pc = t->fetch_pc;
+		slot->rec.ir = mem_read_32(sim->mem, t->fetch_pc);
+		slot->rec.dec = decode(slot->rec.ir);
+		slot->junk = true;
+	}
+	slot->npc = bp_predict(sim, t->fetch_pc, &slot->rec.dec);
+	if (!slot->junk && slot->npc != slot->rec.next_pc) {
+		t->wrong_path = true;
+	}
+	t->fetch_pc = slot->npc;
+}
+
+static void timing_cycle(mu_sim_t *sim, timing_t *t, record_source_t *src)
+{
+	if (t->mem_stall > 0) {
+		t->mem_stall--;
+		sim->perf.dcache_stall_cycles++;
+		if (t->fetch_stall > 0) {
+			t->fetch_stall--;
+		}
+		return;
+	}
+	timing_wb(sim, t);
+	if (!sim->RUN_FLAG) {
+		return;
+	}
+	timing_mem(sim, t);
+	timing_ex(sim, t);
+	timing_id(sim, t);
+	if (!t->bubble) {
+		timing_if(sim, t, src);
+	} else if (t->fetch_stall > 0) {
+		t->fetch_stall--;
+	}
+	t->bubble = false;
+	t->flush = false;
+}
+
+static bool timing_in_flight(timing_slot_t *slot)
+{
+	return slot->rec.ir != 0 && !slot->junk;
+}
+
+/* model the pipeline over the whole stream, starting empty at sim->CURRENT_STATE.PC; false if lost */
+static bool timing_run(mu_sim_t *sim, record_source_t *src)
+{
+	timing_t t;
+	memset(&t, 0, sizeof(t));
+	t.fetch_pc = sim->CURRENT_STATE.PC;
+	while (sim->RUN_FLAG) {
+		timing_cycle(sim, &t, src);
+		if (t.lost) {
+			return false;
+		}
+		sim->CYCLE_COUNT++;
+		if (!t.have_next && !timing_in_flight(&t.if_id) && !timing_in_flight(&t.id_ex) &&
+				!timing_in_flight(&t.ex_mem) && !timing_in_flight(&t.mem_wb)) {
+			if (!pc_in_program(sim, t.fetch_pc)) {
+				sim->RUN_FLAG = false;	// fetch left the program, as in handle_pipeline()
+			}
+			if (src->over || !sim->RUN_FLAG) {
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+static void split_summary(mu_sim_t *sim, const char *what, uint32_t start_cycles, uint32_t start_instructions,
+		struct timespec *start)
+{
+	struct timespec stop;
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	double seconds = (stop.tv_sec - start->tv_sec) + (stop.tv_nsec - start->tv_nsec) / 1e9;
+	uint32_t executed = sim->INSTRUCTION_COUNT - start_instructions;
+	if (sim->RUN_FLAG == FALSE) {
+		printf("Simulation Stopped.\n\n");
+	}
+	show_run_summary(sim, start_cycles, start_instructions);
+	if (sim->bp.branches + sim->bp.jumps > 0) {
+		show_branch_stats(sim);
+	}
+	if (sim->l1i.enabled || sim->l1d.enabled || sim->l2.enabled) {
+		show_cache_stats(sim);
+	}
+	printf("%s: %u instructions in %.3f s", what, executed, seconds);
+	if (seconds > 0) {
+		printf(" (%.1f MIPS)", executed / seconds / 1e6);
+	}
+	printf("\n");
+}
+
+/***************************************************************/
+/* Run num_instructions (UINT32_MAX: to the end) with the functional  */
+/* and timing halves on separate threads, saving the records to path  */
+/* unless it is NULL                                                                                         */
+/***************************************************************/
+int split_run(mu_sim_t *sim, uint32_t num_instructions, const char *path)
+{
+	if (sim->smp != NULL) {
+		printf("Error: A split run simulates a single hart\n");
+		return -1;
+	}
+	if (sim->RUN_FLAG == FALSE) {
+		if (sim->TRACE_LEVEL >= TRACE_SUMMARY) printf("Simulation Stopped.\n\n");
+		return 0;
+	}
+	split_t *split = aligned_alloc(alignof(split_t), sizeof(split_t));
+	mu_sim_t *func = malloc(sizeof(mu_sim_t));
+	if (split == NULL || func == NULL) {
+		printf("Error: Out of memory for a split run\n");
+		free(split);
+		free(func);
+		return -1;
+	}
+	memset(split, 0, sizeof(*split));
+
+	drain_pipeline(sim);
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+	*func = *sim;
+	split->func = func;
+	split->num_instructions = num_instructions;
+	if (path != NULL && (split->file = record_open(sim, path, &split->header)) == NULL) {
+		free(split);
+		free(func);
+		return -1;
+	}
+
+	uint32_t start_cycles = sim->CYCLE_COUNT, start_instructions = sim->INSTRUCTION_COUNT;
+	struct timespec start;
+	pthread_t thread;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (pthread_create(&thread, NULL, split_functional, split) != 0) {
+		printf("Error: Can't start the functional thread\n");
+		exit(-1);
+	}
+	record_source_t src;
+	memset(&src, 0, sizeof(src));
+	src.split = split;
+	bool ok = timing_run(sim, &src);
+	atomic_store_explicit(&split->stop, true, memory_order_relaxed);
+	pthread_join(thread, NULL);
+
+	// the functional half holds the architectural state; the timing half the counters
+	sim->CURRENT_STATE = func->CURRENT_STATE;
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+	sim->RESERVED = func->RESERVED;
+	sim->RESERVATION = func->RESERVATION;
+	if (!func->RUN_FLAG) {
+		sim->RUN_FLAG = FALSE;
+		sim->EXIT_CODE = func->EXIT_CODE;
+	}
+	if (split->file != NULL && record_close(split->file, &split->header, !split->write_failed, path) != 0) {
+		ok = false;
+	}
+	if (ok && sim->TRACE_LEVEL >= TRACE_SUMMARY) {
+		split_summary(sim, "Split run", start_cycles, start_instructions, &start);
+		printf("Functional thread waited on a full ring %llu times, timing thread on an empty one %llu times\n",
+				(unsigned long long)split->full_waits, (unsigned long long)split->empty_waits);
+		if (path != NULL) {
+			printf("%u records saved to %s\n", split->header.num_records, path);
+		}
+		printf("\n");
+	}
+	free(func);
+	free(split);
+	return ok ? 0 : -1;
+}
+
+/***************************************************************/
+/* Execute num_instructions (UINT32_MAX: to the end) functionally,       */
+/* saving their records to path for split_replay()                                */
+/***************************************************************/
+int split_record(mu_sim_t *sim, const char *path, uint32_t num_instructions)
+{
+	record_file_header_t header;
+	retire_record_t *buf;
+	uint32_t len = 0, i;
+	bool ok = true, trapped = false;
+	FILE *fp;
+
+	if (sim->smp != NULL) {
+		printf("Error: Records are made from a single hart\n");
+		return -1;
+	}
+	if (sim->RUN_FLAG == FALSE) {
+		if (sim->TRACE_LEVEL >= TRACE_SUMMARY) printf("Simulation Stopped.\n\n");
+		return 0;
+	}
+	buf = malloc(SPLIT_REPLAY_BLOCK * sizeof(retire_record_t));
+	if (buf == NULL) {
+		printf("Error: Out of memory for records\n");
+		return -1;
+	}
+	drain_pipeline(sim);
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+	if ((fp = record_open(sim, path, &header)) == NULL) {
+		free(buf);
+		return -1;
+	}
+	for (i = 0; i < num_instructions && sim->RUN_FLAG && pc_in_program(sim, sim->CURRENT_STATE.PC); i++) {
+		if (!step_record(sim, &buf[len])) {
+			trapped = true;
+			break;
+		}
+		if (++len == SPLIT_REPLAY_BLOCK) {
+			ok = ok && fwrite(buf, sizeof(retire_record_t), len, fp) == len;
+			len = 0;
+		}
+	}
+	ok = ok && fwrite(buf, sizeof(retire_record_t), len, fp) == len;
+	free(buf);
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+	header.num_records = i;
+	header.exited = !sim->RUN_FLAG && !trapped;
+	if (record_close(fp, &header, ok, path) != 0) {
+		return -1;
+	}
+	if (sim->TRACE_LEVEL >= TRACE_SUMMARY) {
+		printf("%u records saved to %s, PC: 0x%08x\n", i, path, sim->CURRENT_STATE.PC);
+		if (sim->RUN_FLAG == FALSE) {
+			printf("Simulation Stopped.\n");
+		}
+		printf("\n");
+	}
+	return 0;
+}
+
+/***************************************************************/
+/* Model the pipeline over a saved record stream with the current     */
+/* timing settings; the simulator is reset first and left stopped          */
+/***************************************************************/
+int split_replay(mu_sim_t *sim, const char *path)
+{
+	record_file_header_t header;
+	record_source_t src;
+	struct timespec start;
+
+	if (sim->smp != NULL) {
+		printf("Error: Records are replayed on a single hart\n");
+		return -1;
+	}
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL) {
+		printf("Error: Can't open record file %s\n", path);
+		return -1;
+	}
+	if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, RECORD_MAGIC, sizeof(header.magic)) != 0) {
+		printf("Error: %s is not a mu-riscv record file\n", path);
+		fclose(fp);
+		return -1;
+	}
+	if (header.version != RECORD_VERSION || header.record_size != sizeof(retire_record_t)) {
+		printf("Error: Unsupported record file version %u\n", header.version);
+		fclose(fp);
+		return -1;
+	}
+	if (header.program_size != sim->PROGRAM_SIZE) {
+		printf("Error: %s was recorded from another program (%u words, this one has %u)\n", path,
+				header.program_size, sim->PROGRAM_SIZE);
+		fclose(fp);
+		return -1;
+	}
+	memset(&src, 0, sizeof(src));
+	src.file = fp;
+	src.left = header.num_records;
+	src.exited = header.exited;
+	src.buf = malloc(SPLIT_REPLAY_BLOCK * sizeof(retire_record_t));
+	if (src.buf == NULL) {
+		printf("Error: Out of memory for records\n");
+		fclose(fp);
+		return -1;
+	}
+
+	reset(sim);
+	sim->CURRENT_STATE = header.start;
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	bool ok = timing_run(sim, &src);
+	if (ok && src.left > 0) {
+		printf("Error: Record file %s is truncated\n", path);
+		ok = false;
+	}
+	free(src.buf);
+	fclose(fp);
+	if (ok && sim->TRACE_LEVEL >= TRACE_SUMMARY) {
+		split_summary(sim, "Replay", 0, 0, &start);
+		printf("\n");
+	}
+	sim->RUN_FLAG = FALSE;	// memory was not replayed: reset to run the program again
+	return ok ? 0 : -1;
+}
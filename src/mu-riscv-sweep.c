@@ -0,0 +1,417 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "muriscv.h"
+
+/***************************************************************/
+/* mu-riscv-sweep: run every program under every configuration   */
+/* on a pool of threads (one simulator per job) and print the     */
+/* final state of each run as CSV or JSON.                                       */
+/***************************************************************/
+/*
+	A configuration file holds one configuration per line:
+
+		<name> [f=0|1] [x<n>=<val>] [hi=<val>] [lo=<val>] [cycles=<n>]
+		       [bp=<kind>[:<bits>]] [btb=<entries>] [l1i|l1d|l2=<cache spec>]
+		       [mul=<cycles>] [div=<cycles>]
+
+	f sets forwarding (default on), x<n>/hi/lo preset registers the same way
+	the input/high/low commands do, cycles bounds the run (default: run
+	to completion), bp/btb select the branch predictor (default:
+	not-taken, no BTB), l1i/l1d/l2 add caches (default: none) and mul/div
+	set the EX latency of multiplies and divides. Blank lines and lines
+	starting with # are ignored.
+
+	With --replay every configuration models the pipeline over a record
+	file saved by the split or record command instead of running the
+	program, which then only supplies the text; register presets and
+	cycle limits don't apply.
+*/
+
+#define SWEEP_MAX_PRESETS 35
+#define SWEEP_CACHE_LEVELS 3
+
+static const char *cache_levels[SWEEP_CACHE_LEVELS] = { "l1i", "l1d", "l2" };
+
+typedef struct {
+	char name[64];
+	int forwarding;
+	uint32_t max_cycles;	/* 0 = to completion */
+	char predictor[32];
+	int predictor_bits;
+	int btb_entries;
+	int mul_latency, div_latency;
+	char cache_spec[SWEEP_CACHE_LEVELS][64];	/* empty: level off */
+	int num_presets;
+	int preset_reg[SWEEP_MAX_PRESETS];
+	uint32_t preset_value[SWEEP_MAX_PRESETS];
+} sweep_config_t;
+
+typedef struct {
+	int ok;
+	uint32_t cycles;
+	uint32_t instructions;
+	uint32_t pc;
+	uint32_t regs[32];
+	uint32_t hi, lo;
+	muriscv_branch_stats_t branch;
+	muriscv_cache_stats_t cache[SWEEP_CACHE_LEVELS];
+} sweep_result_t;
+
+static sweep_config_t *configs;
+static int num_configs;
+static char **programs;
+static int num_programs;
+static sweep_result_t *results;
+static const char *replay;	/* record file, or NULL to run the programs */
+static atomic_int next_job;
+
+void usage(const char *prog) {
+	printf("Usage: %s [-c <config file>] [-j <threads>] [-o <output>] [-r <records>] [--json] <program>...\n", prog);
+	printf("  -c\tconfigurations to run each program under (default: forwarding on)\n");
+	printf("  -j\tworker threads (default: one per online core)\n");
+	printf("  -o\twrite results to <output> instead of stdout\n");
+	printf("  -r\treplay a record file of the program under each configuration instead of running it\n");
+	printf("  --json\twrite results as JSON instead of CSV\n");
+}
+
+int parse_setting(sweep_config_t *config, const char *setting) {
+	const char *eq = strchr(setting, '=');
+	char *end;
+	int reg;
+	if (eq == NULL || eq[1] == '\0') {
+		return -1;
+	}
+	if (strncmp(setting, "bp=", 3) == 0) {
+		return sscanf(eq + 1, "%31[^:]:%d", config->predictor, &config->predictor_bits) >= 1 ? 0 : -1;
+	}
+	for (reg = 0; reg < SWEEP_CACHE_LEVELS; reg++) {
+		size_t len = strlen(cache_levels[reg]);
+		if (strncmp(setting, cache_levels[reg], len) == 0 && setting[len] == '=') {
+			snprintf(config->cache_spec[reg], sizeof(config->cache_spec[reg]), "%s", eq + 1);
+			return 0;
+		}
+	}
+	uint32_t value = strtoul(eq + 1, &end, 0);
+	if (*end != '\0') {
+		return -1;
+	}
+	if (strncmp(setting, "f=", 2) == 0) {
+		config->forwarding = value != 0;
+		return 0;
+	}
+	if (strncmp(setting, "cycles=", 7) == 0) {
+		config->max_cycles = value;
+		return 0;
+	}
+	if (strncmp(setting, "btb=", 4) == 0) {
+		config->btb_entries = value;
+		return 0;
+	}
+	if (strncmp(setting, "mul=", 4) == 0 || strncmp(setting, "div=", 4) == 0) {
+		if (value < 1) {
+			return -1;
+		}
+		*(setting[0] == 'm' ? &config->mul_latency : &config->div_latency) = value;
+		return 0;
+	}
+	if (strncmp(setting, "hi=", 3) == 0) {
+		reg = MURISCV_REG_HI;
+	} else if (strncmp(setting, "lo=", 3) == 0) {
+		reg = MURISCV_REG_LO;
+	} else if (setting[0] == 'x') {
+		reg = strtol(setting + 1, &end, 10);
+		if (end != eq || end == setting + 1 || reg < 0 || reg >= 32) {
+			return -1;
+		}
+	} else {
+		return -1;
+	}
+	if (config->num_presets == SWEEP_MAX_PRESETS) {
+		return -1;
+	}
+	config->preset_reg[config->num_presets] = reg;
+	config->preset_value[config->num_presets] = value;
+	config->num_presets++;
+	return 0;
+}
+
+int load_configs(const char *path) {
+	FILE *fp = fopen(path, "r");
+	char line[1024];
+	int line_no = 0, cap = 0;
+	if (fp == NULL) {
+		printf("Error: Can't open config file %s\n", path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		char *token = strtok(line, " \t\r\n");
+		line_no++;
+		if (token == NULL || token[0] == '#') {
+			continue;
+		}
+		if (num_configs == cap) {
+			cap = cap ? cap * 2 : 16;
+			configs = realloc(configs, cap * sizeof(sweep_config_t));
+			if (configs == NULL) {
+				printf("Error: Out of memory reading %s\n", path);
+				exit(1);
+			}
+		}
+		sweep_config_t *config = &configs[num_configs++];
+		memset(config, 0, sizeof(*config));
+		config->forwarding = 1;
+		strcpy(config->predictor, "not-taken");
+		config->predictor_bits = MURISCV_BP_TABLE_BITS;
+		config->mul_latency = MURISCV_MUL_LATENCY;
+		config->div_latency = MURISCV_DIV_LATENCY;
+		snprintf(config->name, sizeof(config->name), "%s", token);
+		while ((token = strtok(NULL, " \t\r\n")) != NULL) {
+			if (parse_setting(config, token) != 0) {
+				printf("Error: %s:%d: bad setting %s\n", path, line_no, token);
+				fclose(fp);
+				return -1;
+			}
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+/* job j runs programs[j / num_configs] under configs[j % num_configs] */
+void run_job(muriscv_t *sim, int job) {
+	sweep_config_t *config = &configs[job % num_configs];
+	sweep_result_t *result = &results[job];
+	int i;
+
+	if (muriscv_load(sim, programs[job / num_configs]) != 0) {
+		return;
+	}
+	if (muriscv_set_predictor(sim, config->predictor, config->predictor_bits, config->btb_entries) != 0) {
+		return;
+	}
+	for (i = 0; i < SWEEP_CACHE_LEVELS; i++) {
+		const char *spec = config->cache_spec[i][0] ? config->cache_spec[i] : NULL;
+		if (muriscv_set_cache(sim, cache_levels[i], spec) != 0) {
+			return;
+		}
+	}
+	if (muriscv_set_latency(sim, "mul", config->mul_latency) != 0 ||
+			muriscv_set_latency(sim, "div", config->div_latency) != 0) {
+		return;
+	}
+	muriscv_reset(sim);
+	muriscv_set_forwarding(sim, config->forwarding);
+	for (i = 0; i < config->num_presets; i++) {
+		muriscv_write_reg(sim, config->preset_reg[i], config->preset_value[i]);
+	}
+	if (replay != NULL) {
+		if (muriscv_replay(sim, replay) != 0) {
+			return;
+		}
+	} else if (config->max_cycles > 0) {
+		muriscv_step(sim, config->max_cycles);
+	} else {
+		muriscv_run(sim);
+	}
+
+	result->cycles = muriscv_cycles(sim);
+	result->instructions = muriscv_instructions(sim);
+	result->pc = muriscv_read_reg(sim, MURISCV_REG_PC);
+	for (i = 0; i < 32; i++) {
+		result->regs[i] = muriscv_read_reg(sim, i);
+	}
+	result->hi = muriscv_read_reg(sim, MURISCV_REG_HI);
+	result->lo = muriscv_read_reg(sim, MURISCV_REG_LO);
+	muriscv_branch_stats(sim, &result->branch);
+	for (i = 0; i < SWEEP_CACHE_LEVELS; i++) {
+		muriscv_cache_stats(sim, cache_levels[i], &result->cache[i]);
+	}
+	result->ok = 1;
+}
+
+/* each worker reuses one simulator and pulls jobs until none are left */
+void *worker(void *arg) {
+	int num_jobs = num_programs * num_configs;
+	int job;
+	muriscv_t *sim = muriscv_create();
+	if (sim == NULL) {
+		return NULL;
+	}
+	muriscv_set_trace_level(sim, MURISCV_TRACE_NONE);
+	while ((job = atomic_fetch_add(&next_job, 1)) < num_jobs) {
+		run_job(sim, job);
+	}
+	muriscv_destroy(sim);
+	return NULL;
+}
+
+/* one CSV field (RFC 4180): quoted, with quotes doubled, if it holds a comma, quote or line break */
+void csv_field(FILE *out, const char *text) {
+	if (strpbrk(text, ",\"\r\n") == NULL) {
+		fputs(text, out);
+		return;
+	}
+	fputc('"', out);
+	for (; *text != '\0'; text++) {
+		if (*text == '"') {
+			fputc('"', out);
+		}
+		fputc(*text, out);
+	}
+	fputc('"', out);
+}
+
+void write_csv(FILE *out) {
+	int job, i;
+	fprintf(out, "program,config,ok,cycles,instructions,cpi,branches,branch_mispredicts,jumps,jump_mispredicts,flush_cycles,"
+			"l1i_misses,l1d_misses,l2_misses,pc");
+	for (i = 0; i < 32; i++) {
+		fprintf(out, ",x%d", i);
+	}
+	fprintf(out, ",hi,lo\n");
+	for (job = 0; job < num_programs * num_configs; job++) {
+		sweep_result_t *r = &results[job];
+		csv_field(out, programs[job / num_configs]);
+		fputc(',', out);
+		csv_field(out, configs[job % num_configs].name);
+		fprintf(out, ",%d,%u,%u,%.4f,%u,%u,%u,%u,%u", r->ok, r->cycles, r->instructions,
+				r->instructions ? (double)r->cycles / r->instructions : 0.0, r->branch.branches,
+				r->branch.branch_mispredicts, r->branch.jumps, r->branch.jump_mispredicts, r->branch.flush_cycles);
+		for (i = 0; i < SWEEP_CACHE_LEVELS; i++) {
+			fprintf(out, ",%u", r->cache[i].read_misses + r->cache[i].write_misses);
+		}
+		fprintf(out, ",0x%08x", r->pc);
+		for (i = 0; i < 32; i++) {
+			fprintf(out, ",0x%08x", r->regs[i]);
+		}
+		fprintf(out, ",0x%08x,0x%08x\n", r->hi, r->lo);
+	}
+}
+
+void write_json(FILE *out) {
+	int job, i;
+	fprintf(out, "[\n");
+	for (job = 0; job < num_programs * num_configs; job++) {
+		sweep_result_t *r = &results[job];
+		fprintf(out, "  {\"program\": ");
+		muriscv_json_string(out, programs[job / num_configs]);
+		fprintf(out, ", \"config\": ");
+		muriscv_json_string(out, configs[job % num_configs].name);
+		fprintf(out, ", \"ok\": %s, \"cycles\": %u, \"instructions\": %u, "
+				"\"cpi\": %.4f, \"branches\": %u, \"branch_mispredicts\": %u, \"jumps\": %u, "
+				"\"jump_mispredicts\": %u, \"flush_cycles\": %u, ",
+				r->ok ? "true" : "false", r->cycles, r->instructions,
+				r->instructions ? (double)r->cycles / r->instructions : 0.0,
+				r->branch.branches, r->branch.branch_mispredicts, r->branch.jumps, r->branch.jump_mispredicts,
+				r->branch.flush_cycles);
+		for (i = 0; i < SWEEP_CACHE_LEVELS; i++) {
+			fprintf(out, "\"%s_misses\": %u, ", cache_levels[i], r->cache[i].read_misses + r->cache[i].write_misses);
+		}
+		fprintf(out, "\"pc\": %u, \"regs\": [", r->pc);
+		for (i = 0; i < 32; i++) {
+			fprintf(out, i ? ", %u" : "%u", r->regs[i]);
+		}
+		fprintf(out, "], \"hi\": %u, \"lo\": %u}%s\n", r->hi, r->lo, job + 1 < num_programs * num_configs ? "," : "");
+	}
+	fprintf(out, "]\n");
+}
+
+int main(int argc, char *argv[]) {
+	static struct option long_options[] = {
+		{ "config", required_argument, NULL, 'c' },
+		{ "jobs", required_argument, NULL, 'j' },
+		{ "output", required_argument, NULL, 'o' },
+		{ "replay", required_argument, NULL, 'r' },
+		{ "json", no_argument, NULL, 'J' },
+		{ NULL, 0, NULL, 0 }
+	};
+	const char *output = NULL;
+	bool json = false;
+	long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int opt, i;
+
+	while ((opt = getopt_long(argc, argv, "c:j:o:r:h", long_options, NULL)) != -1) {
+		switch (opt) {
+			case 'c':
+				if (load_configs(optarg) != 0) {
+					exit(1);
+				}
+				break;
+			case 'j':
+				num_threads = strtol(optarg, NULL, 0);
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			case 'r':
+				replay = optarg;
+				break;
+			case 'J':
+				json = true;
+				break;
+			default:
+				usage(argv[0]);
+				exit(opt == 'h' ? 0 : 1);
+		}
+	}
+	if (optind >= argc) {
+		usage(argv[0]);
+		exit(1);
+	}
+	programs = &argv[optind];
+	num_programs = argc - optind;
+	if (num_configs == 0) {
+		static sweep_config_t default_config = { "default", 1, 0, "not-taken", MURISCV_BP_TABLE_BITS, 0,
+				MURISCV_MUL_LATENCY, MURISCV_DIV_LATENCY, { "" }, 0, { 0 }, { 0 } };
+		configs = &default_config;
+		num_configs = 1;
+	}
+
+	int num_jobs = num_programs * num_configs;
+	if (num_threads < 1) {
+		num_threads = 1;
+	}
+	if (num_threads > num_jobs) {
+		num_threads = num_jobs;
+	}
+	results = calloc(num_jobs, sizeof(sweep_result_t));
+	pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+	if (results == NULL || threads == NULL) {
+		printf("Error: Out of memory for %d jobs\n", num_jobs);
+		exit(1);
+	}
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&threads[i], NULL, worker, NULL) != 0) {
+			printf("Error: Can't start worker thread %d\n", i);
+			exit(1);
+		}
+	}
+	for (i = 0; i < num_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	FILE *out = stdout;
+	if (output != NULL && (out = fopen(output, "w")) == NULL) {
+		printf("Error: Can't open output file %s\n", output);
+		exit(1);
+	}
+	if (json) {
+		write_json(out);
+	} else {
+		write_csv(out);
+	}
+	if (out != stdout) {
+		fclose(out);
+	}
+	free(threads);
+	free(results);
+	return 0;
+}
@@ -0,0 +1,281 @@
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Direct-threaded functional core                                                       */
+/***************************************************************/
+/*
+	The text segment is translated into one threaded_inst_t per word: the
+	address of the handler for that exact operation plus its operands,
+	already extracted. Every handler ends by jumping straight to the next
+	entry's handler (GCC computed goto), so there is no central decode or
+	dispatch switch and each handler's indirect jump is predicted on its own.
+
+	Architectural results are the same as step_functional(), which still
+	executes what this core hands back: system instructions, atomics,
+	misaligned PCs, misaligned accesses under the trap policy and anything
+	when an L1 cache is configured (the stepper warms caches, this core
+	does not model them).
+	The JIT hands its leftovers to this core one instruction at a time.
+*/
+
+#define THREADED_SINK RISCV_REGS	/* rd of instructions whose result is discarded */
+#define THREADED_NO_TARGET UINT32_MAX	/* taken target is outside the text segment */
+
+struct threaded_inst {
+	const void *handler;
+	uint32_t target;	/* branches and JAL: index of the taken target */
+	int32_t imm;		/* AUIPC: the final value */
+	uint8_t rd, rs1, rs2;
+};
+
+static const char *engine_names[NUM_ENGINES] = { "step", "threaded", "jit" };
+
+int parse_engine(const char *name)
+{
+	int i;
+	for (i = 0; i < NUM_ENGINES; i++) {
+		if (strcmp(name, engine_names[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+const char *engine_name(engine_t engine)
+{
+	return engine_names[engine];
+}
+
+/*
+	Execute functionally with the selected engine; returns the number of
+	instructions executed, 0 when step_functional() has to take the next one.
+*/
+uint32_t engine_run(mu_sim_t *sim, uint32_t max_steps, bool until_pc, uint32_t stop_pc)
+{
+	if (sim->ENGINE == ENGINE_STEP || sim->l1i.enabled || sim->l1d.enabled) {
+		return 0;
+	}
+	if (sim->ENGINE == ENGINE_JIT && jit_available(sim)) {
+		uint32_t steps = jit_run(sim, max_steps, until_pc, stop_pc);
+		return steps > 0 ? steps : threaded_run(sim, 1, until_pc, stop_pc);
+	}
+	return threaded_run(sim, max_steps, until_pc, stop_pc);
+}
+
+void threaded_free(mu_sim_t *sim)
+{
+	free(sim->threaded);
+	sim->threaded = NULL;
+}
+
+/* (re)build the handler stream from the current text; entry PROGRAM_SIZE leaves the core */
+static void threaded_translate(mu_sim_t *sim, const void *const *handlers, const void *leave)
+{
+	uint32_t i, size = sim->PROGRAM_SIZE;
+	threaded_inst_t *code = realloc(sim->threaded, (size + 1) * sizeof(threaded_inst_t));
+	if (code == NULL) {
+		printf("Error: Out of memory translating the program\n");
+		exit(-1);
+	}
+	for (i = 0; i < size; i++) {
+		uint32_t pc = MEM_TEXT_BEGIN + 4 * i;
+		decoded_inst_t dec = decode_fetched(sim->mem, pc, mem_read_32(sim->mem, pc));
+		threaded_inst_t *t = &code[i];
+		t->handler = handlers[dec.op];
+		t->rd = (dec.flags & DEC_WRITES_RD) ? dec.rd : THREADED_SINK;
+		t->rs1 = dec.rs1;
+		t->rs2 = dec.rs2;
+		t->imm = dec.op == OP_AUIPC ? pc + dec.imm : dec.imm;
+		t->target = THREADED_NO_TARGET;
+		if ((dec.flags & DEC_BRANCH) || dec.op == OP_JAL) {
+			uint32_t target = pc + dec.imm;
+			if ((target & 3) == 0 && pc_in_program(sim, target)) {
+				t->target = (target - MEM_TEXT_BEGIN) >> 2;
+			}
+		}
+	}
+	memset(&code[size], 0, sizeof(code[size]));
+	code[size].handler = leave;
+	sim->threaded = code;
+	sim->threaded_version = sim->mem->text_version;
+}
+
+/*
+	Execute up to max_steps instructions from CURRENT_STATE.PC, stopping
+	before stop_pc (when until_pc), when the PC leaves the text segment and
+	before anything step_functional() has to execute. Returns the number of
+	instructions executed, 0 if the first one has to be stepped.
+*/
+uint32_t threaded_run(mu_sim_t *sim, uint32_t max_steps, bool until_pc, uint32_t stop_pc)
+{
+	static const void *const handlers[NUM_OPS] = {
+		[OP_NOP] = &&op_zero,
+		[OP_ADD] = &&op_add, [OP_SUB] = &&op_sub, [OP_SLL] = &&op_sll, [OP_SLT] = &&op_slt,
+		[OP_SLTU] = &&op_sltu, [OP_XOR] = &&op_xor, [OP_SRL] = &&op_srl, [OP_SRA] = &&op_sra,
+		[OP_OR] = &&op_or, [OP_AND] = &&op_and,
+		[OP_MUL] = &&op_mul, [OP_MULH] = &&op_mulh, [OP_MULHSU] = &&op_mulhsu, [OP_MULHU] = &&op_mulhu,
+		[OP_DIV] = &&op_div, [OP_DIVU] = &&op_divu, [OP_REM] = &&op_rem, [OP_REMU] = &&op_remu,
+		[OP_ADDI] = &&op_addi, [OP_SLTI] = &&op_slti, [OP_SLTIU] = &&op_sltiu, [OP_XORI] = &&op_xori,
+		[OP_ORI] = &&op_ori, [OP_ANDI] = &&op_andi, [OP_SLLI] = &&op_slli, [OP_SRLI] = &&op_srli,
+		[OP_SRAI] = &&op_srai,
+		[OP_LB] = &&op_lb, [OP_LH] = &&op_lh, [OP_LW] = &&op_lw, [OP_LBU] = &&op_lbu, [OP_LHU] = &&op_lhu,
+		[OP_SB] = &&op_sb, [OP_SH] = &&op_sh, [OP_SW] = &&op_sw,
+		[OP_BEQ] = &&op_beq, [OP_BNE] = &&op_bne, [OP_BLT] = &&op_blt, [OP_BGE] = &&op_bge,
+		[OP_BLTU] = &&op_bltu, [OP_BGEU] = &&op_bgeu,
+		[OP_JAL] = &&op_jal, [OP_JALR] = &&op_jalr,
+		[OP_LUI] = &&op_lui, [OP_AUIPC] = &&op_lui,
+		[OP_LR_W] = &&op_step, [OP_SC_W] = &&op_step, [OP_AMOSWAP_W] = &&op_step,
+		[OP_AMOADD_W] = &&op_step, [OP_AMOXOR_W] = &&op_step, [OP_AMOAND_W] = &&op_step,
+		[OP_AMOOR_W] = &&op_step, [OP_AMOMIN_W] = &&op_step, [OP_AMOMAX_W] = &&op_step,
+		[OP_AMOMINU_W] = &&op_step, [OP_AMOMAXU_W] = &&op_step,
+		[OP_ECALL] = &&op_step, [OP_EBREAK] = &&op_step,
+		[OP_INVALID] = &&op_nop,
+	};
+	uint32_t regs[RISCV_REGS + 1];
+	uint32_t pc = sim->CURRENT_STATE.PC;
+	uint32_t left = max_steps, uncounted = 0, stop_index = 0;
+	const void *stop_handler = NULL;
+	threaded_inst_t *base, *ip;
+	bool taken, trap_misaligned = sim->MISALIGNED == MISALIGNED_TRAP;
+
+	if (sim->PROGRAM_SIZE == 0) {
+		return 0;
+	}
+	memcpy(regs, sim->CURRENT_STATE.REGS, sizeof(sim->CURRENT_STATE.REGS));
+	regs[THREADED_SINK] = 0;
+
+#define PC_OF(p)	(MEM_TEXT_BEGIN + 4 * (uint32_t)((p) - base))
+#define DISPATCH()	do { if (left == 0) { pc = PC_OF(ip); goto out; } left--; goto *ip->handler; } while (0)
+#define NEXT()		do { ip++; DISPATCH(); } while (0)
+#define JUMP(t)		do { ip = base + (t); DISPATCH(); } while (0)
+#define BRANCH(cond)	do { taken = (cond); goto branch; } while (0)
+#define ADDRESS()	(regs[ip->rs1] + ip->imm)
+#define TRAPS(size)	((ADDRESS() & ((size) - 1)) && trap_misaligned)
+
+enter:
+	if (sim->threaded == NULL || sim->threaded_version != sim->mem->text_version) {
+		threaded_translate(sim, handlers, &&op_leave);
+	}
+	base = sim->threaded;
+	if (until_pc && (stop_pc & 3) == 0 && pc_in_program(sim, stop_pc)) {
+		stop_index = (stop_pc - MEM_TEXT_BEGIN) >> 2;
+		stop_handler = base[stop_index].handler;
+		base[stop_index].handler = &&op_stop;
+	}
+	if ((pc & 3) != 0 || !pc_in_program(sim, pc)) {
+		goto out;
+	}
+	ip = base + ((pc - MEM_TEXT_BEGIN) >> 2);
+	DISPATCH();
+
+op_add:		regs[ip->rd] = regs[ip->rs1] + regs[ip->rs2]; NEXT();
+op_sub:		regs[ip->rd] = regs[ip->rs1] - regs[ip->rs2]; NEXT();
+op_sll:		regs[ip->rd] = regs[ip->rs1] << (regs[ip->rs2] & 0x1F); NEXT();
+op_slt:		regs[ip->rd] = (int32_t)regs[ip->rs1] < (int32_t)regs[ip->rs2]; NEXT();
+op_sltu:	regs[ip->rd] = regs[ip->rs1] < regs[ip->rs2]; NEXT();
+op_xor:		regs[ip->rd] = regs[ip->rs1] ^ regs[ip->rs2]; NEXT();
+op_srl:		regs[ip->rd] = regs[ip->rs1] >> (regs[ip->rs2] & 0x1F); NEXT();
+op_sra:		regs[ip->rd] = (int32_t)regs[ip->rs1] >> (regs[ip->rs2] & 0x1F); NEXT();
+op_or:		regs[ip->rd] = regs[ip->rs1] | regs[ip->rs2]; NEXT();
+op_and:		regs[ip->rd] = regs[ip->rs1] & regs[ip->rs2]; NEXT();
+op_mul:		regs[ip->rd] = regs[ip->rs1] * regs[ip->rs2]; NEXT();
+op_mulh:	regs[ip->rd] = muldiv_execute(OP_MULH, regs[ip->rs1], regs[ip->rs2]); NEXT();
+op_mulhsu:	regs[ip->rd] = muldiv_execute(OP_MULHSU, regs[ip->rs1], regs[ip->rs2]); NEXT();
+op_mulhu:	regs[ip->rd] = muldiv_execute(OP_MULHU, regs[ip->rs1], regs[ip->rs2]); NEXT();
+op_div:		regs[ip->rd] = muldiv_execute(OP_DIV, regs[ip->rs1], regs[ip->rs2]); NEXT();
+op_divu:	regs[ip->rd] = muldiv_execute(OP_DIVU, regs[ip->rs1], regs[ip->rs2]); NEXT();
+op_rem:		regs[ip->rd] = muldiv_execute(OP_REM, regs[ip->rs1], regs[ip->rs2]); NEXT();
+op_remu:	regs[ip->rd] = muldiv_execute(OP_REMU, regs[ip->rs1], regs[ip->rs2]); NEXT();
+op_addi:	regs[ip->rd] = regs[ip->rs1] + ip->imm; NEXT();
+op_slti:	regs[ip->rd] = (int32_t)regs[ip->rs1] < ip->imm; NEXT();
+op_sltiu:	regs[ip->rd] = regs[ip->rs1] < (uint32_t)ip->imm; NEXT();
+op_xori:	regs[ip->rd] = regs[ip->rs1] ^ ip->imm; NEXT();
+op_ori:		regs[ip->rd] = regs[ip->rs1] | ip->imm; NEXT();
+op_andi:	regs[ip->rd] = regs[ip->rs1] & ip->imm; NEXT();
+op_slli:	regs[ip->rd] = regs[ip->rs1] << ip->imm; NEXT();
+op_srli:	regs[ip->rd] = regs[ip->rs1] >> ip->imm; NEXT();
+op_srai:	regs[ip->rd] = (int32_t)regs[ip->rs1] >> ip->imm; NEXT();
+op_lui:		regs[ip->rd] = ip->imm; NEXT();
+/* a misaligned access that traps is left to step_functional() to report */
+op_lb:		regs[ip->rd] = (int8_t)mem_read_8(sim->mem, ADDRESS()); NEXT();
+op_lbu:		regs[ip->rd] = mem_read_8(sim->mem, ADDRESS()); NEXT();
+op_lh:		if (TRAPS(2)) goto op_step; regs[ip->rd] = (int16_t)mem_read_16(sim->mem, ADDRESS()); NEXT();
+op_lhu:		if (TRAPS(2)) goto op_step; regs[ip->rd] = mem_read_16(sim->mem, ADDRESS()); NEXT();
+op_lw:		if (TRAPS(4)) goto op_step; regs[ip->rd] = mem_read_32(sim->mem, ADDRESS()); NEXT();
+op_sb:		mem_write_8(sim->mem, ADDRESS(), regs[ip->rs2]); goto stored;
+op_sh:		if (TRAPS(2)) goto op_step; mem_write_16(sim->mem, ADDRESS(), regs[ip->rs2]); goto stored;
+op_sw:		if (TRAPS(4)) goto op_step; mem_write_32(sim->mem, ADDRESS(), regs[ip->rs2]); goto stored;
+stored:
+	if (sim->mem->text_version != sim->threaded_version) {
+		/* the store rewrote part of the text: retranslate and carry on after it */
+		pc = PC_OF(ip) + 4;
+		if (stop_handler != NULL) {
+			base[stop_index].handler = stop_handler;
+			stop_handler = NULL;
+		}
+		goto enter;
+	}
+	NEXT();
+
+op_beq:		BRANCH(regs[ip->rs1] == regs[ip->rs2]);
+op_bne:		BRANCH(regs[ip->rs1] != regs[ip->rs2]);
+op_blt:		BRANCH((int32_t)regs[ip->rs1] < (int32_t)regs[ip->rs2]);
+op_bge:		BRANCH((int32_t)regs[ip->rs1] >= (int32_t)regs[ip->rs2]);
+op_bltu:	BRANCH(regs[ip->rs1] < regs[ip->rs2]);
+op_bgeu:	BRANCH(regs[ip->rs1] >= regs[ip->rs2]);
+branch:
+	if (!taken) {
+		NEXT();
+	}
+	if (ip->target != THREADED_NO_TARGET) {
+		JUMP(ip->target);
+	}
+	pc = PC_OF(ip) + ip->imm;
+	goto out;
+op_jal:
+	regs[ip->rd] = PC_OF(ip) + 4;
+	if (ip->target != THREADED_NO_TARGET) {
+		JUMP(ip->target);
+	}
+	pc = PC_OF(ip) + ip->imm;
+	goto out;
+op_jalr: {
+	uint32_t target = (regs[ip->rs1] + ip->imm) & ~1u;
+	regs[ip->rd] = PC_OF(ip) + 4;
+	if ((target & 3) == 0 && pc_in_program(sim, target)) {
+		JUMP((target - MEM_TEXT_BEGIN) >> 2);
+	}
+	pc = target;
+	goto out;
+}
+
+op_zero:	/* an all-zero word is skipped without retiring */
+	uncounted++;
+	NEXT();
+op_nop:
+	NEXT();
+
+op_step:	/* not executed here: hand it back to step_functional() */
+op_stop:
+op_leave:
+	left++;
+	pc = PC_OF(ip);
+	goto out;
+
+#undef PC_OF
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef BRANCH
+#undef ADDRESS
+#undef TRAPS
+
+out:
+	if (stop_handler != NULL) {
+		base[stop_index].handler = stop_handler;
+	}
+	memcpy(sim->CURRENT_STATE.REGS, regs, sizeof(sim->CURRENT_STATE.REGS));
+	sim->CURRENT_STATE.PC = pc;
+	sim->INSTRUCTION_COUNT += max_steps - left - uncounted;
+	return max_steps - left;
+}
@@ -0,0 +1,182 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "mu-riscv-trace.h"
+
+/***************************************************************/
+/* mu-riscv-trace: decode a binary pipeline trace written by     */
+/* mu-riscv -b <file> (or the btrace command) and print the      */
+/* cycles that pass the cycle / PC filters.                                   */
+/***************************************************************/
+
+static uint32_t first_cycle = 0, last_cycle = UINT32_MAX;
+static uint32_t low_pc = 0, high_pc = UINT32_MAX;
+static bool pc_filter = false;
+
+void usage(const char *prog) {
+	printf("Usage: %s [-c <first>:<last>] [-p <low>:<high>] [-s] <trace file>\n", prog);
+	printf("  -c\tonly print cycles first..last (either side may be empty)\n");
+	printf("  -p\tonly print cycles where some pipeline register holds a PC in low..high\n");
+	printf("  -s\tprint a summary of the trace instead of the cycles\n");
+}
+
+/* parse "a:b" where a or b may be omitted, keeping the defaults */
+int parse_range(const char *arg, uint32_t *low, uint32_t *high) {
+	const char *colon = strchr(arg, ':');
+	char *end;
+	if (colon == NULL) {
+		*low = *high = strtoul(arg, &end, 0);
+		return *end == '\0' ? 0 : -1;
+	}
+	if (colon != arg) {
+		*low = strtoul(arg, &end, 0);
+		if (end != colon) return -1;
+	}
+	if (colon[1] != '\0') {
+		*high = strtoul(colon + 1, &end, 0);
+		if (*end != '\0') return -1;
+	}
+	return 0;
+}
+
+bool read32(FILE *fp, uint32_t *value) {
+	return fread(value, sizeof(*value), 1, fp) == 1;
+}
+
+bool pc_in_range(uint32_t *fields) {
+	int reg;
+	for (reg = 0; reg < TRACE_NUM_REGS; reg++) {
+		uint32_t pc = fields[TRACE_FIELD(reg, TRACE_PC)];
+		uint32_t ir = fields[TRACE_FIELD(reg, TRACE_IR)];
+		if (ir != 0 && pc >= low_pc && pc <= high_pc) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* same layout as show_pipeline() in the simulator */
+void show_cycle(uint32_t cycle, uint32_t *f) {
+	uint32_t *if_id = &f[TRACE_FIELD(TRACE_IF_ID, 0)];
+	uint32_t *id_ex = &f[TRACE_FIELD(TRACE_ID_EX, 0)];
+	uint32_t *ex_mem = &f[TRACE_FIELD(TRACE_EX_MEM, 0)];
+	uint32_t *mem_wb = &f[TRACE_FIELD(TRACE_MEM_WB, 0)];
+
+	printf("--------------------------------------------------\n");
+	printf("Cycle: %u\n", cycle);
+	printf("--------------------------------------------------\n");
+	printf("IF/ID:\n");
+	printf("  PC: 0x%08X | IR: 0x%08X\n", if_id[TRACE_PC], if_id[TRACE_IR]);
+	printf("ID/EX:\n");
+	printf("  PC: 0x%08X | IR: 0x%08X | A: 0x%08X | B: 0x%08X | imm: 0x%08X\n",
+			id_ex[TRACE_PC], id_ex[TRACE_IR], id_ex[TRACE_A], id_ex[TRACE_B], id_ex[TRACE_IMM]);
+	printf("EX/MEM:\n");
+	printf("  PC: 0x%08X | IR: 0x%08X | ALUOutput: 0x%08X | B: 0x%08X\n",
+			ex_mem[TRACE_PC], ex_mem[TRACE_IR], ex_mem[TRACE_ALU_OUTPUT], ex_mem[TRACE_B]);
+	printf("MEM/WB:\n");
+	printf("  PC: 0x%08X | IR: 0x%08X | ALUOutput: 0x%08X | LMD: 0x%08X\n",
+			mem_wb[TRACE_PC], mem_wb[TRACE_IR], mem_wb[TRACE_ALU_OUTPUT], mem_wb[TRACE_LMD]);
+	printf("--------------------------------------------------\n");
+}
+
+int main(int argc, char *argv[]) {
+	bool summary = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:p:sh")) != -1) {
+		switch (opt) {
+			case 'c':
+				if (parse_range(optarg, &first_cycle, &last_cycle) != 0) {
+					printf("Error: Bad cycle range %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'p':
+				if (parse_range(optarg, &low_pc, &high_pc) != 0) {
+					printf("Error: Bad PC range %s\n", optarg);
+					exit(1);
+				}
+				pc_filter = true;
+				break;
+			case 's':
+				summary = true;
+				break;
+			default:
+				usage(argv[0]);
+				exit(opt == 'h' ? 0 : 1);
+		}
+	}
+	if (optind >= argc) {
+		usage(argv[0]);
+		exit(1);
+	}
+
+	FILE *fp = fopen(argv[optind], "rb");
+	if (fp == NULL) {
+		printf("Error: Can't open trace file %s\n", argv[optind]);
+		exit(1);
+	}
+	static char io_buf[1 << 20];
+	setvbuf(fp, io_buf, _IOFBF, sizeof(io_buf));
+
+	trace_file_header_t header;
+	if (fread(&header, sizeof(header), 1, fp) != 1 ||
+			memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+		printf("Error: %s is not a mu-riscv trace\n", argv[optind]);
+		exit(1);
+	}
+	if (header.version != TRACE_VERSION || header.num_fields != TRACE_NUM_FIELDS) {
+		printf("Error: Unsupported trace version %u (%u fields)\n", header.version, header.num_fields);
+		exit(1);
+	}
+
+	uint32_t fields[TRACE_NUM_FIELDS] = { 0 };
+	uint32_t mask, cycle = 0;
+	uint64_t records = 0, keyframes = 0, values = 0, shown = 0;
+	bool synced = false;
+	int i;
+
+	while (read32(fp, &mask)) {
+		if (mask & TRACE_RECORD_KEYFRAME) {
+			if (!read32(fp, &cycle)) break;
+			keyframes++;
+			synced = true;
+		} else if (!synced) {
+			printf("Error: Trace does not start with a keyframe\n");
+			exit(1);
+		} else {
+			cycle++;
+		}
+		for (i = 0; i < TRACE_NUM_FIELDS; i++) {
+			if ((mask & (1u << i)) && !read32(fp, &fields[i])) {
+				printf("Error: Truncated record at cycle %u\n", cycle);
+				exit(1);
+			}
+			values += (mask >> i) & 1;
+		}
+		records++;
+
+		if (summary || cycle < first_cycle || cycle > last_cycle) {
+			continue;
+		}
+		if (pc_filter && !pc_in_range(fields)) {
+			continue;
+		}
+		show_cycle(cycle, fields);
+		shown++;
+	}
+	fclose(fp);
+
+	if (summary) {
+		printf("Records: %llu | Keyframes: %llu | Last cycle: %u | Avg fields/record: %.2f\n",
+				(unsigned long long)records, (unsigned long long)keyframes, cycle,
+				records ? (double)values / records : 0.0);
+	} else if (shown == 0) {
+		printf("No cycles matched.\n");
+	}
+	return 0;
+}
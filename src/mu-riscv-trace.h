@@ -0,0 +1,45 @@
+#ifndef MU_RISCV_TRACE_H
+#define MU_RISCV_TRACE_H
+
+#include <stdint.h>
+
+/***************************************************************/
+/* Binary pipeline trace format                                                                               */
+/***************************************************************/
+/*
+ * A trace file starts with a trace_file_header_t and is followed by one
+ * record per simulated cycle. Every cycle snapshots the same fixed set of
+ * TRACE_NUM_FIELDS 32-bit words: the seven fields of IF_ID, ID_EX, EX_MEM
+ * and MEM_WB, in that order (PC, IR, A, B, imm, ALUOutput, LMD).
+ *
+ * A record is a 32-bit mask followed by the fields it names:
+ *   - bit i (i < TRACE_NUM_FIELDS) set: field i changed, its new value follows
+ *   - TRACE_RECORD_KEYFRAME set: the cycle number follows the mask and every
+ *     field is present, so a reader can resynchronise there
+ * Records without a keyframe belong to the cycle after the previous record.
+ * Values follow in ascending field order, little-endian.
+ */
+#define TRACE_MAGIC "MURVTRC1"
+#define TRACE_VERSION 1
+
+#define TRACE_NUM_REGS 4
+#define TRACE_REG_FIELDS 7
+#define TRACE_NUM_FIELDS (TRACE_NUM_REGS * TRACE_REG_FIELDS)
+#define TRACE_ALL_FIELDS ((1u << TRACE_NUM_FIELDS) - 1)
+#define TRACE_RECORD_KEYFRAME (1u << 31)
+
+/* a full snapshot is forced at least this often */
+#define TRACE_KEYFRAME_INTERVAL 4096
+
+/* field index of a pipeline register field */
+#define TRACE_FIELD(reg, field) ((reg) * TRACE_REG_FIELDS + (field))
+enum { TRACE_IF_ID, TRACE_ID_EX, TRACE_EX_MEM, TRACE_MEM_WB };
+enum { TRACE_PC, TRACE_IR, TRACE_A, TRACE_B, TRACE_IMM, TRACE_ALU_OUTPUT, TRACE_LMD };
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_fields;
+} trace_file_header_t;
+
+#endif
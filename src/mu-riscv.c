@@ -1,115 +1,399 @@
+#include <time.h>
+
 #include "mu-riscv.h"
 
 /***************************************************************/
-/* Print out a list of commands available                                                                  */
+/* Find the memory region holding an address (NULL if unmapped)              */
 /***************************************************************/
-//test
-void help() {
-	printf("------------------------------------------------------------------\n\n");
-	printf("\t**********MU-RISCV Help MENU**********\n\n");
-	printf("sim\t-- simulate program to completion \n");
-	printf("run <n>\t-- simulate program for <n> instructions\n");
-	printf("rdump\t-- dump register values\n");
-	printf("reset\t-- clears all registers/memory and re-loads the program\n");
-	printf("input <reg> <val>\t-- set GPR <reg> to <val>\n");
-	printf("mdump <start> <stop>\t-- dump memory from <start> to <stop> address\n");
-	printf("high <val>\t-- set the HI register to <val>\n");
-	printf("low <val>\t-- set the LO register to <val>\n");
-	printf("print\t-- print the program loaded into memory\n");
-	printf("show\t-- print the current content of the pipeline registers\n");
-	printf("f [0 | 1]\t-- Enable/disable forwarding.\n");
-	printf("?\t-- display help menu\n");
-	printf("quit\t-- exit the simulator\n\n");
-	printf("------------------------------------------------------------------\n\n");
+/* region_index maps the top address nibble to the one region overlapping it,
+ * so the lookup is one table load and a bounds check instead of a scan */
+static mem_region_t *mem_region(mu_mem_t *mem, uint32_t address)
+{
+	int i = mem->region_index[address >> MEM_INDEX_SHIFT];
+	if (i >= 0) {
+		mem_region_t *region = &mem->regions[i];
+		return address >= region->begin && address <= region->end ? region : NULL;
+	}
+	if (i == MEM_INDEX_NONE) {
+		return NULL;
+	}
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		if ( (address >= mem->regions[i].begin) && (address <= mem->regions[i].end) ) {
+			return &mem->regions[i];
+		}
+	}
+	return NULL;
+}
+
+static void mem_build_region_index(mu_mem_t *mem)
+{
+	uint32_t n;
+	int i;
+	for (n = 0; n < MEM_INDEX_SIZE; n++) {
+		uint32_t first = n << MEM_INDEX_SHIFT, last = first | ((1u << MEM_INDEX_SHIFT) - 1);
+		mem->region_index[n] = MEM_INDEX_NONE;
+		for (i = 0; i < NUM_MEM_REGION; i++) {
+			if (mem->regions[i].begin <= last && first <= mem->regions[i].end) {
+				mem->region_index[n] = mem->region_index[n] == MEM_INDEX_NONE ? i : MEM_INDEX_SCAN;
+			}
+		}
+	}
 }
 
 /***************************************************************/
-/* Read a 32-bit word from memory                                                                            */
+/* Host page backing an address. Untouched pages read as NULL;   */
+/* for a write the page is committed (zero-filled) and marked dirty. */
 /***************************************************************/
-uint32_t mem_read_32(uint32_t address)
+static uint8_t *mem_page(mu_mem_t *mem, uint32_t address, bool write)
 {
-	int i;
-	for (i = 0; i < NUM_MEM_REGION; i++) {
-		if ( (address >= MEM_REGIONS[i].begin) &&  ( address <= MEM_REGIONS[i].end) ) {
-			uint32_t offset = address - MEM_REGIONS[i].begin;
-			return (MEM_REGIONS[i].mem[offset+3] << 24) |
-					(MEM_REGIONS[i].mem[offset+2] << 16) |
-					(MEM_REGIONS[i].mem[offset+1] <<  8) |
-					(MEM_REGIONS[i].mem[offset+0] <<  0);
+	PROF_START(scan);
+	mem_region_t *region = mem_region(mem, address);
+	PROF_STOP_CURRENT(PROF_REGION_SCAN, scan);
+	if (region == NULL) {
+		return NULL;
+	}
+	mem_page_t *page = &region->pages[(address - region->begin) >> MEM_PAGE_SHIFT];
+	if (write && !page->dirty) {
+		if (page->data == NULL) {
+			page->data = calloc(1, MEM_PAGE_SIZE);
+			if (page->data == NULL) {
+				printf("Error: Out of memory committing page at 0x%08x\n", address);
+				exit(-1);
+			}
+			if (mem->num_committed_pages == mem->committed_pages_cap) {
+				mem->committed_pages_cap = mem->committed_pages_cap ? mem->committed_pages_cap * 2 : 64;
+				mem->committed_pages = realloc(mem->committed_pages, mem->committed_pages_cap * sizeof(uint32_t));
+				if (mem->committed_pages == NULL) {
+					printf("Error: Out of memory tracking committed pages\n");
+					exit(-1);
+				}
+			}
+			mem->committed_pages[mem->num_committed_pages++] = address & ~MEM_PAGE_MASK;
 		}
+		if (mem->num_dirty_pages == mem->dirty_pages_cap) {
+			mem->dirty_pages_cap = mem->dirty_pages_cap ? mem->dirty_pages_cap * 2 : 64;
+			mem->dirty_pages = realloc(mem->dirty_pages, mem->dirty_pages_cap * sizeof(mem_page_t *));
+			if (mem->dirty_pages == NULL) {
+				printf("Error: Out of memory tracking dirty pages\n");
+				exit(-1);
+			}
+		}
+		mem->dirty_pages[mem->num_dirty_pages++] = page;
+		page->dirty = true;
 	}
-	return 0;
+	return page->data;
+}
+
+/* the page holding address for reading, NULL if it was never written */
+const uint8_t *mem_peek_page(mu_mem_t *mem, uint32_t address)
+{
+	return mem_page(mem, address, false);
 }
 
 /***************************************************************/
-/* Write a 32-bit word to memory                                                                                */
+/* Keep a copy of every page the loader wrote so reset can restore    */
+/* them without re-reading the program file.                                    */
 /***************************************************************/
-void mem_write_32(uint32_t address, uint32_t value)
+void mem_snapshot_pristine(mu_mem_t *mem)
 {
-	int i;
-	uint32_t offset;
-	for (i = 0; i < NUM_MEM_REGION; i++) {
-		if ( (address >= MEM_REGIONS[i].begin) && (address <= MEM_REGIONS[i].end) ) {
-			offset = address - MEM_REGIONS[i].begin;
+	uint32_t i;
+	for (i = 0; i < mem->num_dirty_pages; i++) {
+		mem_page_t *page = mem->dirty_pages[i];
+		if (page->pristine == NULL) {
+			page->pristine = malloc(MEM_PAGE_SIZE);
+			if (page->pristine == NULL) {
+				printf("Error: Out of memory saving program image\n");
+				exit(-1);
+			}
+		}
+		memcpy(page->pristine, page->data, MEM_PAGE_SIZE);
+		page->dirty = false;
+	}
+	mem->num_dirty_pages = 0;
+}
 
-			MEM_REGIONS[i].mem[offset+3] = (value >> 24) & 0xFF;
-			MEM_REGIONS[i].mem[offset+2] = (value >> 16) & 0xFF;
-			MEM_REGIONS[i].mem[offset+1] = (value >>  8) & 0xFF;
-			MEM_REGIONS[i].mem[offset+0] = (value >>  0) & 0xFF;
+/***************************************************************/
+/* Return memory to its post-load state, touching only the pages     */
+/* written since then.                                                                              */
+/***************************************************************/
+void mem_restore_pristine(mu_mem_t *mem)
+{
+	uint32_t i;
+	for (i = 0; i < mem->num_dirty_pages; i++) {
+		mem_page_t *page = mem->dirty_pages[i];
+		if (page->pristine != NULL) {
+			memcpy(page->data, page->pristine, MEM_PAGE_SIZE);
+		} else {
+			memset(page->data, 0, MEM_PAGE_SIZE);
 		}
+		page->dirty = false;
+	}
+	mem->num_dirty_pages = 0;
+}
+
+/***************************************************************/
+/* 8/16/32-bit accessors. An aligned access never crosses a page,  */
+/* so it is one page lookup and a native load or store (guest memory */
+/* is little-endian, like the host on x86 and most ARM). Misaligned   */
+/* accesses go byte by byte through mem_read_slow/mem_write_slow.    */
+/***************************************************************/
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define MEM_LE16(x) __builtin_bswap16(x)
+#define MEM_LE32(x) __builtin_bswap32(x)
+#else
+#define MEM_LE16(x) (x)
+#define MEM_LE32(x) (x)
+#endif
+
+static uint32_t mem_read_slow(mu_mem_t *mem, uint32_t address, uint32_t size)
+{
+	uint32_t value = 0, i;
+	for (i = 0; i < size; i++) {
+		uint8_t *page = mem_page(mem, address + i, false);
+		if (page != NULL) {
+			value |= page[(address + i) & MEM_PAGE_MASK] << (8 * i);
+		}
+	}
+	return value;
+}
+
+static void mem_write_slow(mu_mem_t *mem, uint32_t address, uint32_t size, uint32_t value)
+{
+	uint32_t i;
+	for (i = 0; i < size; i++) {
+		uint8_t *page = mem_page(mem, address + i, true);
+		if (page != NULL) {
+			page[(address + i) & MEM_PAGE_MASK] = (value >> (8 * i)) & 0xFF;
+		}
+	}
+}
+
+uint32_t mem_read_8(mu_mem_t *mem, uint32_t address)
+{
+	uint8_t *page = mem_page(mem, address, false);
+	return page != NULL ? page[address & MEM_PAGE_MASK] : 0;
+}
+
+uint32_t mem_read_16(mu_mem_t *mem, uint32_t address)
+{
+	if (address & 1) {
+		return mem_read_slow(mem, address, 2);
+	}
+	uint8_t *page = mem_page(mem, address, false);
+	uint16_t value;
+	if (page == NULL) {
+		return 0;
+	}
+	memcpy(&value, page + (address & MEM_PAGE_MASK), sizeof(value));
+	return MEM_LE16(value);
+}
+
+uint32_t mem_read_32(mu_mem_t *mem, uint32_t address)
+{
+	if (address & 3) {
+		return mem_read_slow(mem, address, 4);
+	}
+	uint8_t *page = mem_page(mem, address, false);
+	uint32_t value;
+	if (page == NULL) {
+		return 0;
+	}
+	memcpy(&value, page + (address & MEM_PAGE_MASK), sizeof(value));
+	return MEM_LE32(value);
+}
+
+/* a store into the predecoded text makes those entries stale */
+static inline void mem_write_check_text(mu_mem_t *mem, uint32_t address, uint32_t size)
+{
+	if (mem->decoded_text != NULL && address + size - 1 >= MEM_TEXT_BEGIN &&
+			address < MEM_TEXT_BEGIN + 4 * mem->decoded_words) {
+		invalidate_decoded(mem, address, size);
+	}
+}
+
+void mem_write_8(mu_mem_t *mem, uint32_t address, uint32_t value)
+{
+	mem_write_check_text(mem, address, 1);
+	uint8_t *page = mem_page(mem, address, true);
+	if (page != NULL) {
+		page[address & MEM_PAGE_MASK] = value & 0xFF;
+	}
+}
+
+void mem_write_16(mu_mem_t *mem, uint32_t address, uint32_t value)
+{
+	mem_write_check_text(mem, address, 2);
+	if (address & 1) {
+		mem_write_slow(mem, address, 2, value);
+		return;
+	}
+	uint8_t *page = mem_page(mem, address, true);
+	uint16_t half = MEM_LE16((uint16_t)value);
+	if (page != NULL) {
+		memcpy(page + (address & MEM_PAGE_MASK), &half, sizeof(half));
+	}
+}
+
+void mem_write_32(mu_mem_t *mem, uint32_t address, uint32_t value)
+{
+	mem_write_check_text(mem, address, 4);
+	if (address & 3) {
+		mem_write_slow(mem, address, 4, value);
+		return;
+	}
+	uint8_t *page = mem_page(mem, address, true);
+	uint32_t word = MEM_LE32(value);
+	if (page != NULL) {
+		memcpy(page + (address & MEM_PAGE_MASK), &word, sizeof(word));
+	}
+}
+
+/***************************************************************/
+/* Copy a block into memory (zeros when data is NULL); the loader   */
+/* predecodes afterwards, so nothing is invalidated here.                  */
+/***************************************************************/
+void mem_write_block(mu_mem_t *mem, uint32_t address, const uint8_t *data, uint32_t len)
+{
+	while (len > 0) {
+		uint32_t offset = address & MEM_PAGE_MASK;
+		uint32_t chunk = MEM_PAGE_SIZE - offset < len ? MEM_PAGE_SIZE - offset : len;
+		uint8_t *page = mem_page(mem, address, true);
+		if (page != NULL) {
+			if (data != NULL) {
+				memcpy(page + offset, data, chunk);
+			} else {
+				memset(page + offset, 0, chunk);
+			}
+		}
+		if (data != NULL) {
+			data += chunk;
+		}
+		address += chunk;
+		len -= chunk;
 	}
 }
 
 /***************************************************************/
 /* Execute one cycle                                                                                                              */
 /***************************************************************/
-void cycle() {
-	handle_pipeline();
-	CURRENT_STATE = NEXT_STATE;
-	CYCLE_COUNT++;
+void cycle(mu_sim_t *sim) {
+	PROF_START(start);
+	PROF_ENTER(sim);
+	handle_pipeline(sim);
+	sim->CURRENT_STATE = sim->NEXT_STATE;
+	sim->CYCLE_COUNT++;
+	PROF_CYCLE_END(sim, start);
+	PROF_LEAVE();
+}
+
+/***************************************************************/
+/* Execute one cycle and report it at the current trace level   */
+/***************************************************************/
+void cycle_traced(mu_sim_t *sim) {
+	PROF_START(start);
+	PROF_ENTER(sim);
+	CPU_Pipeline_Reg retiring = sim->MEM_WB;
+	uint32_t retired = sim->INSTRUCTION_COUNT;
+
+	handle_pipeline(sim);
+	PROF_START(output);
+	if (sim->INSTRUCTION_COUNT != retired && sim->TRACE_LEVEL >= TRACE_RETIRE) {
+		show_retired(sim, &retiring);
+	}
+	if (sim->TRACE_LEVEL >= TRACE_CYCLE) {
+		show_pipeline(sim);
+	}
+	if (sim->btrace.file != NULL) {
+		btrace_cycle(sim);
+	}
+	PROF_STOP(sim->prof.points[PROF_TRACE], output);
+	sim->CURRENT_STATE = sim->NEXT_STATE;
+	sim->CYCLE_COUNT++;
+	PROF_CYCLE_END(sim, start);
+	PROF_LEAVE();
 }
 
 /***************************************************************/
 /* Simulate RISCV for n cycles                                                                                       */
 /***************************************************************/
-void run(int num_cycles) {
+void run(mu_sim_t *sim, int num_cycles) {
 
-	if (RUN_FLAG == FALSE) {
-		printf("Simulation Stopped\n\n");
+	if (sim->RUN_FLAG == FALSE) {
+		if (sim->TRACE_LEVEL >= TRACE_SUMMARY) printf("Simulation Stopped\n\n");
 		return;
 	}
 
-	printf("Running simulator for %d cycles...\n\n", num_cycles);
+	if (sim->TRACE_LEVEL >= TRACE_SUMMARY) printf("Running simulator for %d cycles...\n\n", num_cycles);
+	uint32_t start_cycles = sim->CYCLE_COUNT;
+	uint32_t start_instructions = sim->INSTRUCTION_COUNT;
 	int i;
-	for (i = 0; i < num_cycles; i++) {
-		if (RUN_FLAG == FALSE) {
+	/* the level is checked once here so the untraced loop stays free of it */
+	if (sim->TRACE_LEVEL <= TRACE_SUMMARY && sim->btrace.file == NULL && !debug_armed(sim)) {
+		for (i = 0; i < num_cycles && sim->RUN_FLAG; i++) {
+			cycle(sim);
+		}
+	} else {
+		for (i = 0; i < num_cycles && sim->RUN_FLAG; i++) {
+			if (debug_break(sim)) {
+				break;
+			}
+			cycle_traced(sim);
+			if (debug_watch(sim)) {
+				break;
+			}
+		}
+	}
+	if (sim->TRACE_LEVEL >= TRACE_SUMMARY) {
+		if (sim->RUN_FLAG == FALSE) {
 			printf("Simulation Stopped.\n\n");
-			break;
 		}
-		cycle();
+		show_run_summary(sim, start_cycles, start_instructions);
 	}
 }
 
 /***************************************************************/
 /* simulate to completion                                                                                               */
 /***************************************************************/
-void runAll() {
-	if (RUN_FLAG == FALSE) {
-		printf("Simulation Stopped.\n\n");
+void runAll(mu_sim_t *sim) {
+	if (sim->RUN_FLAG == FALSE) {
+		if (sim->TRACE_LEVEL >= TRACE_SUMMARY) printf("Simulation Stopped.\n\n");
 		return;
 	}
 
-	printf("Simulation Started...\n\n");
-	while (RUN_FLAG){
-		cycle();
+	if (sim->TRACE_LEVEL >= TRACE_SUMMARY) printf("Simulation Started...\n\n");
+	uint32_t start_cycles = sim->CYCLE_COUNT;
+	uint32_t start_instructions = sim->INSTRUCTION_COUNT;
+	if (sim->TRACE_LEVEL <= TRACE_SUMMARY && sim->btrace.file == NULL && !debug_armed(sim)) {
+		while (sim->RUN_FLAG){
+			cycle(sim);
+		}
+	} else {
+		while (sim->RUN_FLAG){
+			if (debug_break(sim)) {
+				break;
+			}
+			cycle_traced(sim);
+			if (debug_watch(sim)) {
+				break;
+			}
+		}
+	}
+	if (sim->TRACE_LEVEL >= TRACE_SUMMARY) {
+		printf(sim->RUN_FLAG ? "Simulation Paused.\n\n" : "Simulation Finished.\n\n");
+		show_run_summary(sim, start_cycles, start_instructions);
+		if (sim->bp.branches + sim->bp.jumps > 0) {
+			show_branch_stats(sim);
+		}
+		if (sim->l1i.enabled || sim->l1d.enabled || sim->l2.enabled) {
+			show_cache_stats(sim);
+		}
 	}
-	printf("Simulation Finished.\n\n");
 }
 
 /***************************************************************/
 /* Dump a word-aligned region of memory to the terminal                              */
 /***************************************************************/
-void mdump(uint32_t start, uint32_t stop) {
+void mdump(mu_sim_t *sim, uint32_t start, uint32_t stop) {
 	uint32_t address;
 
 	printf("-------------------------------------------------------------\n");
@@ -117,7 +401,7 @@ void mdump(uint32_t start, uint32_t stop) {
 	printf("-------------------------------------------------------------\n");
 	printf("\t[Address in Hex (Dec) ]\t[Value]\n");
 	for (address = start; address <= stop; address += 4){
-		printf("\t0x%08x (%d) :\t0x%08x\n", address, address, mem_read_32(address));
+		printf("\t0x%08x (%d) :\t0x%08x\n", address, address, mem_read_32(sim->mem, address));
 	}
 	printf("\n");
 }
@@ -125,577 +409,1590 @@ void mdump(uint32_t start, uint32_t stop) {
 /***************************************************************/
 /* Dump current values of registers to the teminal                                              */
 /***************************************************************/
-void rdump() {
+void rdump(mu_sim_t *sim) {
 	int i;
 	printf("-------------------------------------\n");
 	printf("Dumping Register Content\n");
 	printf("-------------------------------------\n");
-	printf("# Instructions Executed\t: %u\n", INSTRUCTION_COUNT);
-	printf("PC\t: 0x%08x\n", CURRENT_STATE.PC);
+	printf("# Instructions Executed\t: %u\n", sim->INSTRUCTION_COUNT);
+	printf("PC\t: 0x%08x\n", sim->CURRENT_STATE.PC);
 	printf("-------------------------------------\n");
 	printf("[Register]\t[Value]\n");
 	printf("-------------------------------------\n");
 	for (i = 0; i < RISCV_REGS; i++){
-		printf("[R%d]\t: 0x%08x\n", i, CURRENT_STATE.REGS[i]);
+		printf("[R%d]\t: 0x%08x\n", i, sim->CURRENT_STATE.REGS[i]);
 	}
 	printf("-------------------------------------\n");
-	printf("[HI]\t: 0x%08x\n", CURRENT_STATE.HI);
-	printf("[LO]\t: 0x%08x\n", CURRENT_STATE.LO);
+	printf("[HI]\t: 0x%08x\n", sim->CURRENT_STATE.HI);
+	printf("[LO]\t: 0x%08x\n", sim->CURRENT_STATE.LO);
 	printf("-------------------------------------\n");
 }
 
 /***************************************************************/
-/* Read a command from standard input.                                                               */
+/* reset registers/memory to the loaded program                                                    */
 /***************************************************************/
-void handle_command() {
-	char buffer[20];
-	uint32_t start, stop, cycles;
-	uint32_t register_no;
-	int register_value;
-	int hi_reg_value, lo_reg_value;
-
-	printf("MU-RISCV SIM:> ");
-
-	if (scanf("%s", buffer) == EOF){
-		exit(0);
+void reset(mu_sim_t *sim) {
+	/*restore the pages written since the program was loaded*/
+	mem_restore_pristine(sim->mem);
+	predecode_program(sim);
+
+	reset_hart(sim);
+	if (sim->smp != NULL) {
+		smp_reset(sim);
 	}
+}
 
-	switch(buffer[0]) {
-		case 'S':
-		case 's':
-			if (buffer[1] == 'h' || buffer[1] == 'H'){
-				show_pipeline();
-			}else {
-				runAll();
-			}
-			break;
-		case 'M':
-		case 'm':
-			if (scanf("%x %x", &start, &stop) != 2){
-				break;
-			}
-			mdump(start, stop);
-			break;
-		case '?':
-			help();
-			break;
-		case 'Q':
-		case 'q':
-			printf("**************************\n");
-			printf("Exiting MU-RISCV! Good Bye...\n");
-			printf("**************************\n");
-			exit(0);
-		case 'R':
-		case 'r':
-			if (buffer[1] == 'd' || buffer[1] == 'D'){
-				rdump();
-			}else if(buffer[1] == 'e' || buffer[1] == 'E'){
-				reset();
-			}
-			else {
-				if (scanf("%d", &cycles) != 1) {
-					break;
-				}
-				run(cycles);
-			}
-			break;
-		case 'I':
-		case 'i':
-			if (scanf("%u %i", &register_no, &register_value) != 2){
-				break;
-			}
-			CURRENT_STATE.REGS[register_no] = register_value;
-			NEXT_STATE.REGS[register_no] = register_value;
-			break;
-		case 'H':
-		case 'h':
-			if (scanf("%i", &hi_reg_value) != 1){
-				break;
-			}
-			CURRENT_STATE.HI = hi_reg_value;
-			NEXT_STATE.HI = hi_reg_value;
-			break;
-		case 'L':
-		case 'l':
-			if (scanf("%i", &lo_reg_value) != 1){
-				break;
-			}
-			CURRENT_STATE.LO = lo_reg_value;
-			NEXT_STATE.LO = lo_reg_value;
-			break;
-		case 'P':
-		case 'p':
-			print_program();
-			break;
-		case 'F':
-		case 'f':
-			if(scanf("%d", &ENABLE_FORWARDING) != 1) {
-				break;
-			}
-			else {
-				ENABLE_FORWARDING == 0 ? printf("Forwarding OFF\n") : printf("Forwarding ON\n");
-				break;
-			}
-		default:
-			printf("Invalid Command.\n");
-			break;
-	}
+/***************************************************************/
+/* Return one hart's registers, pipeline and counters to where the */
+/* loader left them; memory is untouched                                  */
+/***************************************************************/
+void reset_hart(mu_sim_t *sim) {
+	/*reset registers and PC to where the loader left them*/
+	sim->CURRENT_STATE = sim->INITIAL_STATE;
+
+	/*drain the pipeline so a re-run does not retire stale instructions*/
+	memset(&sim->IF_ID, 0, sizeof(sim->IF_ID));
+	memset(&sim->ID_EX, 0, sizeof(sim->ID_EX));
+	memset(&sim->EX_MEM, 0, sizeof(sim->EX_MEM));
+	memset(&sim->MEM_WB, 0, sizeof(sim->MEM_WB));
+	sim->bubble = false;
+	sim->flush = false;
+	sim->fetch_stall = 0;
+	sim->mem_stall = 0;
+	sim->ex_busy = 0;
+	sim->mem_wait = false;
+	sim->RESERVED = false;
+	memset(&sim->perf, 0, sizeof(sim->perf));
+	prof_reset(sim);
+	debug_reset(sim);
+	bp_reset(sim);
+	cache_reset(&sim->l1i);
+	cache_reset(&sim->l1d);
+	cache_reset(&sim->l2);
+
+	sim->INSTRUCTION_COUNT = 0;
+	sim->CYCLE_COUNT = 0;
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+	sim->EXIT_CODE = -1;
+	sim->RUN_FLAG = TRUE;
 }
 
 /***************************************************************/
-/* reset registers/memory and reload program                                                    */
+/* Allocate the (empty) page tables; pages are committed on first write */
 /***************************************************************/
-void reset() {
+int mem_init(mu_mem_t *mem) {
+	static const mem_region_t layout[NUM_MEM_REGION] = {
+		{ MEM_TEXT_BEGIN, MEM_TEXT_END, NULL },
+		{ MEM_DATA_BEGIN, MEM_DATA_END, NULL },
+		{ MEM_KDATA_BEGIN, MEM_KDATA_END, NULL },
+		{ MEM_KTEXT_BEGIN, MEM_KTEXT_END, NULL }
+	};
 	int i;
-	/*reset registers*/
-	for (i = 0; i < RISCV_REGS; i++){
-		CURRENT_STATE.REGS[i] = 0;
+	memset(mem, 0, sizeof(*mem));
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		mem->regions[i] = layout[i];
 	}
-	CURRENT_STATE.HI = 0;
-	CURRENT_STATE.LO = 0;
-
+	mem_build_region_index(mem);
 	for (i = 0; i < NUM_MEM_REGION; i++) {
-		uint32_t region_size = MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1;
-		memset(MEM_REGIONS[i].mem, 0, region_size);
+		uint32_t num_pages = (mem->regions[i].end - mem->regions[i].begin + 1) >> MEM_PAGE_SHIFT;
+		mem->regions[i].pages = calloc(num_pages, sizeof(mem_page_t));
+		if (mem->regions[i].pages == NULL) {
+			printf("Error: Can't allocate page table for region 0x%08x\n", mem->regions[i].begin);
+			mem_free(mem);
+			return -1;
+		}
 	}
-
-	/*load program*/
-	load_program();
-
-	/*reset PC*/
-	INSTRUCTION_COUNT = 0;
-	CURRENT_STATE.PC =  MEM_TEXT_BEGIN;
-	NEXT_STATE = CURRENT_STATE;
-	RUN_FLAG = TRUE;
+	return 0;
 }
 
 /***************************************************************/
-/* Allocate and set memory to zero                                                                            */
+/* Release every page and table owned by a memory                        */
 /***************************************************************/
-void init_memory() {
-	int i;
+void mem_free(mu_mem_t *mem) {
+	uint32_t i;
+	for (i = 0; i < mem->num_committed_pages; i++) {
+		mem_region_t *region = mem_region(mem, mem->committed_pages[i]);
+		mem_page_t *page = &region->pages[(mem->committed_pages[i] - region->begin) >> MEM_PAGE_SHIFT];
+		free(page->data);
+		free(page->pristine);
+	}
 	for (i = 0; i < NUM_MEM_REGION; i++) {
-		uint32_t region_size = MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1;
-		MEM_REGIONS[i].mem = malloc(region_size);
-		memset(MEM_REGIONS[i].mem, 0, region_size);
+		free(mem->regions[i].pages);
 	}
+	free(mem->dirty_pages);
+	free(mem->committed_pages);
+	free(mem->decoded_text);
+	free(mem->watchpoints);
+	memset(mem, 0, sizeof(*mem));
 }
 
 /**************************************************************/
-/* load program into memory                                                                                      */
+/* load program into memory: an ELF32 executable or a hex listing     */
 /**************************************************************/
-void load_program() {
+int load_program(mu_sim_t *sim) {
 	FILE * fp;
 	int i, word;
 	uint32_t address;
+	char magic[4];
 
 	/* Open program file. */
-	fp = fopen(prog_file, "r");
+	fp = fopen(sim->prog_file, "r");
 	if (fp == NULL) {
-		printf("Error: Can't open program file %s\n", prog_file);
-		exit(-1);
+		printf("Error: Can't open program file %s\n", sim->prog_file);
+		return -1;
 	}
 
+	if (fread(magic, 1, 4, fp) == 4 && memcmp(magic, "\177ELF", 4) == 0) {
+		fclose(fp);
+		if (load_elf(sim) != 0) {
+			return -1;
+		}
+		goto loaded;
+	}
+	rewind(fp);
+
 	/* Read in the program. */
+	free_symbols(sim);
+	memset(&sim->INITIAL_STATE, 0, sizeof(sim->INITIAL_STATE));
+	sim->INITIAL_STATE.PC = MEM_TEXT_BEGIN;
 
 	i = 0;
 	while( fscanf(fp, "%x\n", &word) != EOF ) {
 		address = MEM_TEXT_BEGIN + i;
-		mem_write_32(address, word);
-		printf("writing 0x%08x into address 0x%08x (%d)\n", word, address, address);
+		mem_write_32(sim->mem, address, word);
+		if (sim->TRACE_LEVEL >= TRACE_CYCLE) {
+			printf("writing 0x%08x into address 0x%08x (%d)\n", word, address, address);
+		}
 		i += 4;
 	}
-	PROGRAM_SIZE = i/4;
-	printf("Program loaded into memory.\n%d words written into memory.\n\n", PROGRAM_SIZE);
+	sim->PROGRAM_SIZE = i/4;
+	if (sim->TRACE_LEVEL >= TRACE_SUMMARY) {
+		printf("Program loaded into memory.\n%d words written into memory.\n\n", sim->PROGRAM_SIZE);
+	}
 	fclose(fp);
+
+loaded:
+	mem_snapshot_pristine(sim->mem);
+	predecode_program(sim);
+	sim->CURRENT_STATE = sim->INITIAL_STATE;
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+	if (sim->smp != NULL) {
+		smp_reset(sim);
+	}
+	return 0;
 }
 
 /************************************************************/
 /* maintain the pipeline                                                                                           */
 /************************************************************/
-void handle_pipeline()
+void handle_pipeline(mu_sim_t *sim)
 {
-	/*INSTRUCTION_COUNT should be incremented when instruction is done*/
-	/*Since we do not have branch/jump instructions, INSTRUCTION_COUNT should be incremented in WB stage */
+	// a data cache miss freezes every stage; the fetch in progress keeps going
+	if (sim->mem_stall > 0) {
+		sim->mem_stall--;
+		sim->perf.dcache_stall_cycles++;
+		if (sim->fetch_stall > 0) {
+			sim->fetch_stall--;
+		}
+		return;
+	}
+
+	/*sim->INSTRUCTION_COUNT is incremented in WB stage when an instruction is done*/
 	/* Work backwards because otherwise we would just be running instructions in sequential order, no pipeline. This allows for that "offset"*/
-	WB();
-	MEM();
-	EX();
-	ID();
-	if(!bubble) {
-		IF();
+	PROF_START(lap);
+	WB(sim);
+	PROF_LAP(sim->prof.points[PROF_WB], lap);
+	if (!sim->RUN_FLAG) {
+		return;	// the program exited; younger instructions never complete
+	}
+	MEM(sim);
+	PROF_LAP(sim->prof.points[PROF_MEM], lap);
+	if (!sim->RUN_FLAG || sim->mem_wait) {
+		return;	// a misaligned access trapped or an atomic waits; the pipeline stays as it was
+	}
+	EX(sim);
+	PROF_LAP(sim->prof.points[PROF_EX], lap);
+	ID(sim);
+	PROF_LAP(sim->prof.points[PROF_ID], lap);
+	if(!sim->bubble) {
+		IF(sim);
+	} else if (sim->fetch_stall > 0) {
+		sim->fetch_stall--;
+	}
+	PROF_LAP(sim->prof.points[PROF_IF], lap);
+	sim->bubble = false;
+	sim->flush = false;
+
+	//end the simulation once fetch has left the program and everything in flight has retired
+	if (!sim->IF_ID.IR && !sim->ID_EX.IR && !sim->EX_MEM.IR && !sim->MEM_WB.IR &&
+			!pc_in_program(sim, sim->NEXT_STATE.PC)) {
+		sim->RUN_FLAG = false;
 	}
-	bubble = false;
-	show_pipeline();
 }
 /************************************************************/
-/* Forwarding Unit
+/* Forwarding Unit                                                                                                 */
 /************************************************************/
-void DetectHazardsAndForward()
+static void stall_and_flush_id_ex(mu_sim_t *sim)
 {
-	uint8_t id_ex_opcode = GET_OPCODE(ID_EX.IR);
-	if (id_ex_opcode == R_OPCODE || id_ex_opcode == IMM_ALU_OPCODE ||       // id_ex has an rs1 or rs2
-		id_ex_opcode == LOAD_OPCODE || id_ex_opcode == STORE_OPCODE ||
-		id_ex_opcode == BRANCH_OPCODE)
+	sim->bubble = true;  // Stall -> sim->IF_ID wont update
+	// Flush sim->ID_EX
+	sim->ID_EX.PC = 0;
+	sim->ID_EX.IR = 0;
+	sim->ID_EX.A = 0;
+	sim->ID_EX.B = 0;
+	sim->ID_EX.imm = 0;
+	memset(&sim->ID_EX.dec, 0, sizeof(sim->ID_EX.dec));
+}
+
+void DetectHazardsAndForward(mu_sim_t *sim)
+{
+	decoded_inst_t *id_ex = &sim->ID_EX.dec;
+	bool reads_rs1 = id_ex->flags & DEC_READS_RS1;
+	bool reads_rs2 = id_ex->flags & DEC_READS_RS2;
+	bool mem_wb_rs1 = false, mem_wb_rs2 = false;
+	if (!reads_rs1 && !reads_rs2) {
+		return;
+	}
+
+	// Forwarding off: wait until the producer has been written back (WB runs before ID)
+	if (!sim->ENABLE_FORWARDING) {
+		if (reads_result_of(id_ex, &sim->EX_MEM.dec) || reads_result_of(id_ex, &sim->MEM_WB.dec)) {
+			stall_and_flush_id_ex(sim);
+			sim->perf.writeback_stalls++;
+		}
+		return;
+	}
+
+	// Data hazard between instructions in MEM and ID stages
+	decoded_inst_t *mem_wb = &sim->MEM_WB.dec;
+	if (mem_wb->flags & DEC_WRITES_RD)
 	{
-		uint8_t id_ex_rs1 = (ID_EX.IR >> 15) & BIT_MASK_5;
-		uint8_t id_ex_rs2 = (ID_EX.IR >> 20) & BIT_MASK_5;
-
-		// Data hazard between instructions in MEM and ID stages
-		uint8_t mem_wb_opcode = GET_OPCODE(MEM_WB.IR);
-		
-		if ((mem_wb_opcode == LOAD_OPCODE || mem_wb_opcode == R_OPCODE ||        // mem_wb has an rd
-			mem_wb_opcode == IMM_ALU_OPCODE || mem_wb_opcode == JUMP_OPCODE))
+		// Forward word from MEM, or the ALU output
+		uint32_t value = (mem_wb->flags & DEC_LOAD) ? sim->MEM_WB.LMD : sim->MEM_WB.ALUOutput;
+		if (reads_rs1 && mem_wb->rd == id_ex->rs1)
 		{
-			uint8_t mem_wb_rd = (MEM_WB.IR >> 7) & BIT_MASK_5;
-			// Hazard on rs1
-			if (mem_wb_rd == id_ex_rs1)
-			{
-				if (mem_wb_opcode == LOAD_OPCODE)
-				{
-					ID_EX.A = MEM_WB.LMD;  // Forward word from MEM to rs1
-				}
-				else
-				{
-					ID_EX.A = MEM_WB.ALUOutput; // Forward ALU output to rs1
-				}
+			sim->ID_EX.A = value;
+			mem_wb_rs1 = true;
+		}
+		if (reads_rs2 && mem_wb->rd == id_ex->rs2)
+		{
+			sim->ID_EX.B = value;
+			mem_wb_rs2 = true;
+		}
+	}
+
+	// Data hazard between instructions in EX and ID stages
+	decoded_inst_t *ex_mem = &sim->EX_MEM.dec;
+	if (ex_mem->flags & DEC_WRITES_RD)
+	{
+		bool hazard_rs1 = reads_rs1 && ex_mem->rd == id_ex->rs1;
+		bool hazard_rs2 = reads_rs2 && ex_mem->rd == id_ex->rs2;
+		if ((hazard_rs1 || hazard_rs2) && (ex_mem->flags & DEC_LOAD))
+		{
+			// load-use hazard: the word is not read until next cycle
+			stall_and_flush_id_ex(sim);
+			sim->perf.load_use_stalls++;
+			return;
+		}
+		if (hazard_rs1)
+		{
+			sim->ID_EX.A = sim->EX_MEM.ALUOutput;
+			sim->perf.forwarded_ex_mem++;
+			mem_wb_rs1 = false;
+		}
+		if (hazard_rs2)
+		{
+			sim->ID_EX.B = sim->EX_MEM.ALUOutput;  // Forward ALU output to EX rs2
+			sim->perf.forwarded_ex_mem++;
+			mem_wb_rs2 = false;
+		}
+	}
+	// the newer EX/MEM value wins when both match
+	sim->perf.forwarded_mem_wb += mem_wb_rs1 + mem_wb_rs2;
+}
+/************************************************************/
+/* writeback (WB) pipeline stage:                                                                          */
+/************************************************************/
+void WB(mu_sim_t *sim)
+{
+	/*
+	for register-register instruction: REGS[rd] <= ALUOutput
+	for register-immediate instruction: REGS[rd] <= ALUOutput
+	for load instruction: REGS[rd] <= LMD
+	*/
+	if (sim->MEM_WB.IR == 0) {  // No-op if the instruction is empty
+		sim->perf.bubbles++;
+		return;
+	}
+
+	decoded_inst_t *dec = &sim->MEM_WB.dec;
+	if (dec->flags & DEC_WRITES_RD) {
+		sim->NEXT_STATE.REGS[dec->rd] = (dec->flags & DEC_LOAD) ? sim->MEM_WB.LMD : sim->MEM_WB.ALUOutput;
+	}
+
+	// Increment the instruction count after successful execution
+	sim->INSTRUCTION_COUNT++;
+	sim->perf.retired[dec->cls]++;
+	if (dec->cls == CLASS_SYSTEM) {
+		system_call(sim, &sim->NEXT_STATE, dec);
+	}
+}
+
+/* ecall a7=93 exits with a0; ebreak stops the run. Other calls are no-ops */
+void system_call(mu_sim_t *sim, CPU_State *state, const decoded_inst_t *dec)
+{
+	if (dec->op == OP_ECALL && state->REGS[17] == ECALL_EXIT) {
+		sim->EXIT_CODE = (int32_t)state->REGS[10];
+		sim->RUN_FLAG = false;
+	} else if (dec->op == OP_EBREAK) {
+		sim->RUN_FLAG = false;
+	}
+}
+
+/************************************************************/
+/* memory access (MEM) pipeline stage:                                                          */
+/************************************************************/
+void MEM(mu_sim_t *sim)
+{
+	//For immediate: sim->bubble
+
+	/*
+	for load: LMD <= MEM[ALUOutput]
+	for store: MEM[ALUOutput] <= B 
+	*/
+
+	decoded_inst_t *dec = &sim->EX_MEM.dec;
+	uint32_t address = sim->EX_MEM.ALUOutput;
+	if (dec->flags & (DEC_LOAD | DEC_STORE)) {
+		if ((address & (dec->size - 1)) && misaligned_trap(sim, sim->EX_MEM.PC, address, dec)) {
+			memset(&sim->MEM_WB, 0, sizeof(sim->MEM_WB));
+			return;
+		}
+		// on a multi-hart machine atomics are performed at the next quantum barrier
+		if (dec->cls == CLASS_ATOMIC && sim->smp != NULL && !smp_atomic_done(sim, address, sim->EX_MEM.B)) {
+			sim->mem_wait = true;
+			memset(&sim->MEM_WB, 0, sizeof(sim->MEM_WB));
+			return;
+		}
+		sim->mem_stall = cache_access(&sim->l1d, address, dec->flags & DEC_STORE);
+		if (address & (dec->size - 1)) {
+			sim->perf.misaligned++;
+			if (sim->MISALIGNED == MISALIGNED_PENALTY) {
+				sim->mem_stall += sim->MISALIGNED_PENALTY;
 			}
-			// Hazard on rs2
-			if (id_ex_opcode != IMM_ALU_OPCODE && id_ex_opcode != LOAD_OPCODE && mem_wb_rd == id_ex_rs2)
-			{
-				if (mem_wb_opcode == LOAD_OPCODE)
-				{
-					ID_EX.B = MEM_WB.LMD;   // Forward word from MEM to EX rs2
-				}
-				else
-				{
-					ID_EX.B = MEM_WB.ALUOutput;  // Forward ALU output to rs2
+		}
+	}
+	if (dec->cls == CLASS_ATOMIC) {
+		// Atomic read-modify-write: rd gets the old word (SC: 0 on success)
+		sim->MEM_WB.LMD = sim->smp != NULL ? smp_atomic_result(sim) : amo_execute(sim, dec, address, sim->EX_MEM.B);
+		sim->perf.loads++;
+		sim->perf.stores++;
+	} else if (dec->flags & DEC_LOAD) {
+		// Load instruction: Read from memory
+		sim->MEM_WB.LMD = load_extend(dec->op, sim->smp != NULL ? smp_load(sim, address, dec->size) :
+				mem_load(sim->mem, address, dec->size));
+		sim->perf.loads++;
+	} else if (dec->flags & DEC_STORE) {
+		// Store instruction: Write to memory
+		sim->perf.stores++;
+		if (sim->smp != NULL) {
+			smp_store(sim, address, dec->size, sim->EX_MEM.B);
+		} else {
+			mem_store(sim->mem, address, dec->size, sim->EX_MEM.B);
+		}
+	}
+
+	// Pass values to sim->MEM_WB pipeline register
+	sim->MEM_WB.IR = sim->EX_MEM.IR;
+	sim->MEM_WB.PC = sim->EX_MEM.PC;
+	sim->MEM_WB.ALUOutput = sim->EX_MEM.ALUOutput;
+	sim->MEM_WB.NPC = sim->EX_MEM.NPC;
+	sim->MEM_WB.dec = sim->EX_MEM.dec;
+}
+
+/************************************************************/
+/* ALU: result of a decoded instruction given its operands                                   */
+/************************************************************/
+/*
+	i) Memory Reference (load/store):
+		ALUOutput <= A + imm
+	ii) Register-register Operation
+		ALUOutput <= A op B
+	iii) Register-Immediate Operation
+		ALUOutput <= A op imm
+	iv) Jumps: ALUOutput <= PC + 4 (the link value); LUI/AUIPC: imm / PC + imm
+*/
+uint32_t alu_execute(const decoded_inst_t *dec, uint32_t pc, uint32_t a, uint32_t b)
+{
+	uint32_t imm = dec->imm;
+	switch (dec->op) {
+		case OP_ADD:	return a + b;
+		case OP_SUB:	return a - b;
+		case OP_SLL:	return a << (b & 0x1F);
+		case OP_SLT:	return ((int32_t)a < (int32_t)b) ? 1 : 0;
+		case OP_SLTU:	return (a < b) ? 1 : 0;
+		case OP_XOR:	return a ^ b;
+		case OP_SRL:	return a >> (b & 0x1F);
+		case OP_SRA:	return (int32_t)a >> (b & 0x1F);
+		case OP_OR:	return a | b;
+		case OP_AND:	return a & b;
+		case OP_ADDI:	return a + imm;
+		case OP_SLTI:	return ((int32_t)a < (int32_t)imm) ? 1 : 0;
+		case OP_SLTIU:	return (a < imm) ? 1 : 0;
+		case OP_XORI:	return a ^ imm;
+		case OP_ORI:	return a | imm;
+		case OP_ANDI:	return a & imm;
+		case OP_SLLI:	return a << imm;
+		case OP_SRLI:	return a >> imm;
+		case OP_SRAI:	return (int32_t)a >> imm;
+		case OP_LB: case OP_LH: case OP_LW: case OP_LBU: case OP_LHU:
+		case OP_SB: case OP_SH: case OP_SW:
+		case OP_LR_W: case OP_SC_W: case OP_AMOSWAP_W: case OP_AMOADD_W: case OP_AMOXOR_W:
+		case OP_AMOAND_W: case OP_AMOOR_W: case OP_AMOMIN_W: case OP_AMOMAX_W: case OP_AMOMINU_W:
+		case OP_AMOMAXU_W:
+			return a + imm;
+		case OP_JAL: case OP_JALR:
+			return pc + 4;
+		case OP_LUI:	return imm;
+		case OP_AUIPC:	return pc + imm;
+		case OP_MUL: case OP_MULH: case OP_MULHSU: case OP_MULHU:
+		case OP_DIV: case OP_DIVU: case OP_REM: case OP_REMU:
+			return muldiv_execute(dec->op, a, b);
+		default:	return 0;
+	}
+}
+
+/* RV32M. Division never traps: x/0 gives all ones (x%0 gives x) and
+ * INT32_MIN/-1 overflows to INT32_MIN (remainder 0), as the spec requires */
+uint32_t muldiv_execute(uint8_t op, uint32_t a, uint32_t b)
+{
+	int32_t sa = (int32_t)a, sb = (int32_t)b;
+	switch (op) {
+		case OP_MUL:	return a * b;
+		case OP_MULH:	return (uint64_t)((int64_t)sa * sb) >> 32;
+		case OP_MULHSU:	return (uint64_t)((int64_t)sa * (uint64_t)b) >> 32;
+		case OP_MULHU:	return ((uint64_t)a * b) >> 32;
+		case OP_DIV:
+			if (b == 0) return UINT32_MAX;
+			if (sa == INT32_MIN && sb == -1) return a;
+			return (uint32_t)(sa / sb);
+		case OP_DIVU:	return b == 0 ? UINT32_MAX : a / b;
+		case OP_REM:
+			if (b == 0) return a;
+			if (sa == INT32_MIN && sb == -1) return 0;
+			return (uint32_t)(sa % sb);
+		case OP_REMU:	return b == 0 ? a : a % b;
+		default:	return 0;
+	}
+}
+
+/* RV32A on the word at address: returns what rd gets. LR.W reserves the word,
+ * SC.W stores only while it is still reserved and gives 0 if it did, 1 if not;
+ * every AMO returns the old word and stores it combined with operand */
+uint32_t amo_execute(mu_sim_t *sim, const decoded_inst_t *dec, uint32_t address, uint32_t operand)
+{
+	uint32_t old, value;
+	if (dec->op == OP_SC_W) {
+		bool reserved = sim->RESERVED && sim->RESERVATION == address;
+		sim->RESERVED = false;
+		if (!reserved) {
+			return 1;
+		}
+		mem_store(sim->mem, address, 4, operand);
+		return 0;
+	}
+	old = mem_load(sim->mem, address, 4);
+	switch (dec->op) {
+		case OP_LR_W:
+			sim->RESERVED = true;
+			sim->RESERVATION = address;
+			return old;
+		case OP_AMOSWAP_W:	value = operand; break;
+		case OP_AMOADD_W:	value = old + operand; break;
+		case OP_AMOXOR_W:	value = old ^ operand; break;
+		case OP_AMOAND_W:	value = old & operand; break;
+		case OP_AMOOR_W:	value = old | operand; break;
+		case OP_AMOMIN_W:	value = (int32_t)old < (int32_t)operand ? old : operand; break;
+		case OP_AMOMAX_W:	value = (int32_t)old > (int32_t)operand ? old : operand; break;
+		case OP_AMOMINU_W:	value = old < operand ? old : operand; break;
+		case OP_AMOMAXU_W:	value = old > operand ? old : operand; break;
+		default:	return old;
+	}
+	mem_store(sim->mem, address, 4, value);
+	return old;
+}
+
+/************************************************************/
+/* execution (EX) pipeline stage:                                                                          */
+/************************************************************/
+
+/*
+	Pull these from ID/EX:
+	ID/EX.IR
+	ID/EX.A
+	ID/EX.B
+	ID/EX.imm 
+
+	Fill these into EX/MEM:
+	EX/MEM.IR
+	EX/MEM.A
+	EX/MEM.B
+	EX/MEM.ALUOutput 
+
+	Branches and jumps are resolved here. If the PC fetch continued at
+	(ID/EX.NPC) is not where the instruction actually goes, the two younger
+	instructions in IF and ID are squashed and fetch restarts at the target.
+
+	An instruction whose class has an EX_LATENCY above one occupies EX for
+	that many cycles. Its operands were settled when it entered ID/EX, and
+	whatever depends on it is held in IF/ID, so it reads the result through
+	the usual EX/MEM forward the cycle the instruction moves on.
+*/
+void EX(mu_sim_t *sim)
+{	
+	decoded_inst_t *dec = &sim->ID_EX.dec;
+
+	// Multi-cycle unit (MUL/DIV by default): the instruction stays in ID/EX and
+	// MEM gets bubbles until its last cycle; ID holds everything behind it
+	if (sim->EX_LATENCY[dec->cls] > 1 && sim->ID_EX.IR != 0) {
+		if (sim->ex_busy == 0) {
+			sim->ex_busy = sim->EX_LATENCY[dec->cls];
+		}
+		if (--sim->ex_busy > 0) {
+			memset(&sim->EX_MEM, 0, sizeof(sim->EX_MEM));
+			sim->perf.ex_busy_stalls++;
+			return;
+		}
+	}
+
+	sim->EX_MEM.ALUOutput = alu_execute(dec, sim->ID_EX.PC, sim->ID_EX.A, sim->ID_EX.B);
+
+	if (dec->flags & (DEC_BRANCH | DEC_JUMP)) {
+		uint32_t pc = sim->ID_EX.PC;
+		bool taken = true;
+		uint32_t target = pc + dec->imm;
+		if (dec->flags & DEC_BRANCH) {
+			taken = branch_taken(dec, sim->ID_EX.A, sim->ID_EX.B);
+		} else if (dec->op == OP_JALR) {
+			target = (sim->ID_EX.A + dec->imm) & ~1u;
+		}
+		uint32_t actual = taken ? target : pc + 4;
+		bool mispredicted = actual != sim->ID_EX.NPC;
+
+		bp_update(sim, pc, dec, taken, target);
+		if (dec->flags & DEC_BRANCH) {
+			sim->bp.branches++;
+			sim->bp.branch_mispredicts += mispredicted;
+		} else {
+			sim->bp.jumps++;
+			sim->bp.jump_mispredicts += mispredicted;
+		}
+		if (mispredicted) {
+			sim->flush = true;
+			sim->NEXT_STATE.PC = actual;
+			sim->bp.flush_cycles += BRANCH_PENALTY;
+		}
+	}
+
+	//Update registers
+	sim->EX_MEM.IR = sim->ID_EX.IR;
+	sim->EX_MEM.A = sim->ID_EX.A;
+	sim->EX_MEM.B = sim->ID_EX.B;
+	sim->EX_MEM.PC = sim->ID_EX.PC;
+	sim->EX_MEM.NPC = sim->ID_EX.NPC;
+	sim->EX_MEM.dec = sim->ID_EX.dec;
+}
+
+/************************************************************/
+/* instruction decode (ID) pipeline stage:                                                         */
+/************************************************************/
+void ID(mu_sim_t *sim)
+{
+	// Wrong-path instruction behind a mispredicted branch: send a bubble instead
+	if (sim->flush) {
+		memset(&sim->ID_EX, 0, sizeof(sim->ID_EX));
+		return;
+	}
+
+	// EX is still working on the instruction in ID/EX: hold this one and fetch
+	if (sim->ex_busy > 0) {
+		sim->bubble = true;
+		return;
+	}
+
+	// The instruction was decoded when it was fetched
+	decoded_inst_t *dec = &sim->IF_ID.dec;
+
+	// Read values from the register file
+	sim->ID_EX.A = sim->NEXT_STATE.REGS[dec->rs1];  // Read first source register
+	sim->ID_EX.B = sim->NEXT_STATE.REGS[dec->rs2];  // Read second source register (0 if unused)
+	sim->ID_EX.imm = dec->imm;
+
+	// Pass PC to next pipeline stage
+	sim->ID_EX.PC = sim->IF_ID.PC;
+	sim->ID_EX.IR = sim->IF_ID.IR;  // Pass instruction forward for debugging or later stages
+	sim->ID_EX.NPC = sim->IF_ID.NPC;
+	sim->ID_EX.dec = sim->IF_ID.dec;
+	PROF_START(hazard);
+	DetectHazardsAndForward(sim);
+	PROF_STOP(sim->prof.points[PROF_HAZARD], hazard);
+}
+
+/************************************************************/
+/* instruction fetch (IF) pipeline stage:                                                              */
+/************************************************************/
+void IF(mu_sim_t *sim)
+{
+	// Squashed by a mispredict (EX already set the new PC), or nothing left to fetch
+	if (sim->flush || !pc_in_program(sim, sim->CURRENT_STATE.PC)) {
+		memset(&sim->IF_ID, 0, sizeof(sim->IF_ID));
+		sim->fetch_stall = 0;	// a wrong-path miss is abandoned
+		return;
+	}
+
+	// Instruction cache miss: send bubbles until the line arrives
+	if (sim->fetch_stall == 0) {
+		sim->fetch_stall = cache_access(&sim->l1i, sim->CURRENT_STATE.PC, false);
+	} else {
+		sim->fetch_stall--;
+	}
+	if (sim->fetch_stall > 0) {
+		memset(&sim->IF_ID, 0, sizeof(sim->IF_ID));
+		sim->perf.icache_stall_cycles++;
+		return;
+	}
+	sim->perf.fetches++;
+
+	// Fetch the instruction from memory at the current PC
+	sim->IF_ID.IR = mem_read_32(sim->mem, sim->CURRENT_STATE.PC);
+	sim->IF_ID.dec = decode_fetched(sim->mem, sim->CURRENT_STATE.PC, sim->IF_ID.IR);
+
+	// Store the PC of the fetched instruction for later stages
+	sim->IF_ID.PC = sim->CURRENT_STATE.PC;
+
+	// Continue at the predicted next PC; EX checks it when the instruction resolves
+	sim->IF_ID.NPC = bp_predict(sim, sim->CURRENT_STATE.PC, &sim->IF_ID.dec);
+	sim->NEXT_STATE.PC = sim->IF_ID.NPC;
+}
+
+/************************************************************/
+/* Decode an instruction word                                                                                 */
+/************************************************************/
+decoded_inst_t decode(uint32_t instruction)
+{
+	decoded_inst_t dec;
+	uint8_t opcode = GET_OPCODE(instruction);
+	uint8_t funct3 = GET_FUNCT3(instruction);
+	uint8_t funct7 = (instruction >> 25) & BIT_MASK_7;
+	uint8_t rd = (instruction >> 7) & BIT_MASK_5;
+	uint8_t rs1 = (instruction >> 15) & BIT_MASK_5;
+	uint8_t rs2 = (instruction >> 20) & BIT_MASK_5;
+
+	memset(&dec, 0, sizeof(dec));
+	dec.flags = DEC_VALID;
+	dec.cls = CLASS_OTHER;
+	if (instruction == 0) {
+		return dec;
+	}
+	dec.op = OP_INVALID;
+
+	switch (opcode) {
+		case R_OPCODE:
+			if (funct7 == M_FUNCT7) {
+				static const uint8_t m_ops[8] = {
+					OP_MUL, OP_MULH, OP_MULHSU, OP_MULHU, OP_DIV, OP_DIVU, OP_REM, OP_REMU
+				};
+				dec.op = m_ops[funct3];
+				dec.flags |= DEC_READS_RS1 | DEC_READS_RS2 | DEC_WRITES_RD;
+				dec.cls = funct3 < 4 ? CLASS_MUL : CLASS_DIV;
+				break;
+			}
+			switch (funct3) {
+				case 0x0: dec.op = funct7 == 0x20 ? OP_SUB : funct7 == 0x00 ? OP_ADD : OP_INVALID; break;
+				case 0x1: dec.op = OP_SLL; break;
+				case 0x2: dec.op = OP_SLT; break;
+				case 0x3: dec.op = OP_SLTU; break;
+				case 0x4: dec.op = OP_XOR; break;
+				case 0x5: dec.op = funct7 == 0x20 ? OP_SRA : funct7 == 0x00 ? OP_SRL : OP_INVALID; break;
+				case 0x6: dec.op = OP_OR; break;
+				case 0x7: dec.op = OP_AND; break;
+			}
+			dec.flags |= DEC_READS_RS1 | DEC_READS_RS2 | DEC_WRITES_RD;
+			dec.cls = CLASS_ALU;
+			break;
+		case IMM_ALU_OPCODE:
+			dec.imm = (int32_t)instruction >> 20;
+			switch (funct3) {
+				case 0x0: dec.op = OP_ADDI; break;
+				case 0x1: dec.op = OP_SLLI; dec.imm &= 0x1F; break;
+				case 0x2: dec.op = OP_SLTI; break;
+				case 0x3: dec.op = OP_SLTIU; break;
+				case 0x4: dec.op = OP_XORI; break;
+				case 0x5: dec.op = funct7 == 0x20 ? OP_SRAI : funct7 == 0x00 ? OP_SRLI : OP_INVALID; dec.imm &= 0x1F; break;
+				case 0x6: dec.op = OP_ORI; break;
+				case 0x7: dec.op = OP_ANDI; break;
+			}
+			dec.flags |= DEC_READS_RS1 | DEC_WRITES_RD;
+			dec.cls = CLASS_ALU_IMM;
+			break;
+		case LOAD_OPCODE:
+			dec.imm = (int32_t)instruction >> 20;
+			switch (funct3) {
+				case 0x0: dec.op = OP_LB; break;
+				case 0x1: dec.op = OP_LH; break;
+				case 0x2: dec.op = OP_LW; break;
+				case 0x4: dec.op = OP_LBU; break;
+				case 0x5: dec.op = OP_LHU; break;
+			}
+			dec.size = 1 << (funct3 & 3);
+			dec.flags |= DEC_READS_RS1 | DEC_WRITES_RD | DEC_LOAD;
+			dec.cls = CLASS_LOAD;
+			break;
+		case STORE_OPCODE:
+			dec.imm = ((int32_t)(instruction & 0xFE000000) >> 20) | rd;
+			switch (funct3) {
+				case 0x0: dec.op = OP_SB; break;
+				case 0x1: dec.op = OP_SH; break;
+				case 0x2: dec.op = OP_SW; break;
+			}
+			dec.size = 1 << (funct3 & 3);
+			dec.flags |= DEC_READS_RS1 | DEC_READS_RS2 | DEC_STORE;
+			dec.cls = CLASS_STORE;
+			rd = 0;
+			break;
+		case BRANCH_OPCODE:
+			dec.imm = ((int32_t)(instruction & 0x80000000) >> 19) | ((instruction & 0x80) << 4) |
+					((instruction >> 20) & 0x7E0) | ((instruction >> 7) & 0x1E);
+			switch (funct3) {
+				case 0x0: dec.op = OP_BEQ; break;
+				case 0x1: dec.op = OP_BNE; break;
+				case 0x4: dec.op = OP_BLT; break;
+				case 0x5: dec.op = OP_BGE; break;
+				case 0x6: dec.op = OP_BLTU; break;
+				case 0x7: dec.op = OP_BGEU; break;
+			}
+			dec.flags |= DEC_READS_RS1 | DEC_READS_RS2 | DEC_BRANCH;
+			dec.cls = CLASS_BRANCH;
+			rd = 0;
+			break;
+		case JUMP_OPCODE:
+			dec.op = OP_JAL;
+			dec.imm = ((int32_t)(instruction & 0x80000000) >> 11) | (instruction & 0xFF000) |
+					((instruction >> 9) & 0x800) | ((instruction >> 20) & 0x7FE);
+			dec.flags |= DEC_WRITES_RD | DEC_JUMP;
+			dec.cls = CLASS_JUMP;
+			rs1 = rs2 = 0;
+			break;
+		case JALR_OPCODE:
+			if (funct3 == 0) dec.op = OP_JALR;
+			dec.imm = (int32_t)instruction >> 20;
+			dec.flags |= DEC_READS_RS1 | DEC_WRITES_RD | DEC_JUMP;
+			dec.cls = CLASS_JUMP;
+			break;
+		case LUI_OPCODE:
+		case AUIPC_OPCODE:
+			dec.op = opcode == LUI_OPCODE ? OP_LUI : OP_AUIPC;
+			dec.imm = instruction & 0xFFFFF000;
+			dec.flags |= DEC_WRITES_RD;
+			dec.cls = CLASS_UPPER;
+			rs1 = rs2 = 0;
+			break;
+		case AMO_OPCODE:
+			if (funct3 == 0x2) {
+				switch (funct7 >> 2) {
+					case 0x02: dec.op = rs2 == 0 ? OP_LR_W : OP_INVALID; break;
+					case 0x03: dec.op = OP_SC_W; break;
+					case 0x01: dec.op = OP_AMOSWAP_W; break;
+					case 0x00: dec.op = OP_AMOADD_W; break;
+					case 0x04: dec.op = OP_AMOXOR_W; break;
+					case 0x0C: dec.op = OP_AMOAND_W; break;
+					case 0x08: dec.op = OP_AMOOR_W; break;
+					case 0x10: dec.op = OP_AMOMIN_W; break;
+					case 0x14: dec.op = OP_AMOMAX_W; break;
+					case 0x18: dec.op = OP_AMOMINU_W; break;
+					case 0x1C: dec.op = OP_AMOMAXU_W; break;
 				}
 			}
+			// aq/rl are ignored: every access is already performed in program order
+			dec.size = 4;
+			dec.flags |= DEC_READS_RS1 | DEC_WRITES_RD | DEC_LOAD | DEC_STORE;
+			if (dec.op != OP_LR_W) {
+				dec.flags |= DEC_READS_RS2;
+			}
+			dec.cls = CLASS_ATOMIC;
+			break;
+		case SYSTEM_OPCODE:
+			if (instruction == 0x00000073) dec.op = OP_ECALL;
+			if (instruction == 0x00100073) dec.op = OP_EBREAK;
+			dec.cls = CLASS_SYSTEM;
+			rd = rs1 = rs2 = 0;
+			break;
+	}
+
+	if (dec.op == OP_INVALID) {
+		dec.flags = DEC_VALID;
+		dec.cls = CLASS_OTHER;
+		return dec;
+	}
+	if (!(dec.flags & DEC_READS_RS1)) rs1 = 0;
+	if (!(dec.flags & DEC_READS_RS2)) rs2 = 0;
+	if (rd == 0) dec.flags &= ~DEC_WRITES_RD;	// x0 is hardwired to zero
+	dec.rd = (dec.flags & DEC_WRITES_RD) ? rd : 0;
+	dec.rs1 = rs1;
+	dec.rs2 = rs2;
+	return dec;
+}
+
+/************************************************************/
+/* Decoded form of a fetched word, from the predecoded text when possible */
+/************************************************************/
+decoded_inst_t decode_fetched(mu_mem_t *mem, uint32_t pc, uint32_t instruction)
+{
+	uint32_t index = (pc - MEM_TEXT_BEGIN) >> 2;
+	if (pc < MEM_TEXT_BEGIN || index >= mem->decoded_words || (pc & 3)) {
+		return decode(instruction);
+	}
+	decoded_inst_t *dec = &mem->decoded_text[index];
+	if (!(dec->flags & DEC_VALID)) {
+		*dec = decode(instruction);
+	}
+	return *dec;
+}
+
+/************************************************************/
+/* Predecode the whole text segment after it is (re)loaded                                  */
+/************************************************************/
+void predecode_program(mu_sim_t *sim)
+{
+	uint32_t i;
+	free(sim->mem->decoded_text);
+	sim->mem->decoded_text = malloc((sim->PROGRAM_SIZE ? sim->PROGRAM_SIZE : 1) * sizeof(decoded_inst_t));
+	if (sim->mem->decoded_text == NULL) {
+		printf("Error: Out of memory predecoding the program\n");
+		exit(-1);
+	}
+	for (i = 0; i < sim->PROGRAM_SIZE; i++) {
+		sim->mem->decoded_text[i] = decode(mem_read_32(sim->mem, MEM_TEXT_BEGIN + 4 * i));
+	}
+	sim->mem->decoded_words = sim->PROGRAM_SIZE;
+	sim->mem->text_version++;
+}
+
+/************************************************************/
+/* A store overlapping the text segment makes those entries stale              */
+/************************************************************/
+void invalidate_decoded(mu_mem_t *mem, uint32_t address, uint32_t len)
+{
+	uint32_t first = (address - MEM_TEXT_BEGIN) >> 2;
+	uint32_t last = (address + len - 1 - MEM_TEXT_BEGIN) >> 2;
+	if (address >= MEM_TEXT_BEGIN && first < mem->decoded_words) {
+		mem->decoded_text[first].flags &= ~DEC_VALID;
+	}
+	if (address + len - 1 >= MEM_TEXT_BEGIN && last < mem->decoded_words) {
+		mem->decoded_text[last].flags &= ~DEC_VALID;
+	}
+	mem->text_version++;
+}
+
+
+/************************************************************/
+/* Functional execution: one instruction at a time, no pipeline registers */
+/************************************************************/
+bool pc_in_program(mu_sim_t *sim, uint32_t pc)
+{
+	return pc >= MEM_TEXT_BEGIN && ((pc - MEM_TEXT_BEGIN) >> 2) < sim->PROGRAM_SIZE;
+}
+
+bool branch_taken(const decoded_inst_t *dec, uint32_t a, uint32_t b)
+{
+	switch (dec->op) {
+		case OP_BEQ:	return a == b;
+		case OP_BNE:	return a != b;
+		case OP_BLT:	return (int32_t)a < (int32_t)b;
+		case OP_BGE:	return (int32_t)a >= (int32_t)b;
+		case OP_BLTU:	return a < b;
+		case OP_BGEU:	return a >= b;
+		default:	return false;
+	}
+}
+
+/* execute the instruction at sim->CURRENT_STATE.PC straight into sim->CURRENT_STATE and describe it
+ * in *rec; false if it trapped without executing. Nothing but architectural state is touched */
+bool step_record(mu_sim_t *sim, retire_record_t *rec)
+{
+	uint32_t pc = sim->CURRENT_STATE.PC;
+	uint32_t instruction = mem_read_32(sim->mem, pc);
+	decoded_inst_t *dec = &rec->dec;
+	*dec = decode_fetched(sim->mem, pc, instruction);
+	uint32_t a = sim->CURRENT_STATE.REGS[dec->rs1];
+	uint32_t b = sim->CURRENT_STATE.REGS[dec->rs2];
+	uint32_t result = alu_execute(dec, pc, a, b);
+	uint32_t next_pc = pc + 4;
+
+	rec->pc = pc;
+	rec->ir = instruction;
+	rec->address = 0;
+	if (dec->flags & (DEC_LOAD | DEC_STORE)) {
+		if ((result & (dec->size - 1)) && misaligned_trap(sim, pc, result, dec)) {
+			return false;
+		}
+		rec->address = result;
+	}
+	if (dec->cls == CLASS_ATOMIC) {
+		result = amo_execute(sim, dec, result, b);
+	} else if (dec->flags & DEC_LOAD) {
+		result = load_extend(dec->op, mem_load(sim->mem, result, dec->size));
+	} else if (dec->flags & DEC_STORE) {
+		mem_store(sim->mem, result, dec->size, b);
+		result = b;
+	} else if (dec->flags & DEC_BRANCH) {
+		result = branch_taken(dec, a, b);
+		if (result) {
+			next_pc = pc + dec->imm;
+		}
+	} else if (dec->op == OP_JAL) {
+		next_pc = pc + dec->imm;
+	} else if (dec->op == OP_JALR) {
+		next_pc = (a + dec->imm) & ~1u;
+	}
+	if (dec->flags & DEC_WRITES_RD) {
+		sim->CURRENT_STATE.REGS[dec->rd] = result;
+	}
+	rec->result = result;
+	rec->next_pc = next_pc;
+	sim->CURRENT_STATE.PC = next_pc;
+	if (instruction != 0) {
+		sim->INSTRUCTION_COUNT++;
+	}
+	if (dec->cls == CLASS_SYSTEM) {
+		system_call(sim, &sim->CURRENT_STATE, dec);
+	}
+	return true;
+}
+
+/* execute the instruction at sim->CURRENT_STATE.PC straight into sim->CURRENT_STATE; caches are warmed but cost nothing */
+void step_functional(mu_sim_t *sim)
+{
+	retire_record_t rec;
+	cache_access(&sim->l1i, sim->CURRENT_STATE.PC, false);
+	if (step_record(sim, &rec) && (rec.dec.flags & (DEC_LOAD | DEC_STORE))) {
+		cache_access(&sim->l1d, rec.address, rec.dec.flags & DEC_STORE);
+	}
+}
+
+/***************************************************************/
+/* Misaligned data accesses                                                                                  */
+/***************************************************************/
+static const char *misaligned_names[NUM_MISALIGNED_POLICIES] = { "allow", "penalty", "trap" };
+
+/* a load or store at pc is not aligned to its size: under the trap
+ * policy report it and stop the run before it takes effect */
+bool misaligned_trap(mu_sim_t *sim, uint32_t pc, uint32_t address, const decoded_inst_t *dec)
+{
+	if (sim->MISALIGNED != MISALIGNED_TRAP) {
+		return false;
+	}
+	printf("Error: Misaligned %s of %u bytes at 0x%08x by 0x%08x\n", (dec->flags & DEC_LOAD) ? "load" : "store",
+			dec->size, address, pc);
+	sim->RUN_FLAG = false;
+	return true;
+}
+
+/* "allow", "penalty[:<cycles>]" or "trap" */
+int set_misaligned_policy(mu_sim_t *sim, const char *policy)
+{
+	char *end;
+	if (strcasecmp(policy, "allow") == 0) {
+		sim->MISALIGNED = MISALIGNED_ALLOW;
+	} else if (strcasecmp(policy, "trap") == 0) {
+		sim->MISALIGNED = MISALIGNED_TRAP;
+	} else if (strncasecmp(policy, "penalty", 7) == 0 && (policy[7] == '\0' || policy[7] == ':')) {
+		uint32_t cycles = MISALIGNED_DEFAULT_PENALTY;
+		if (policy[7] == ':') {
+			cycles = strtoul(policy + 8, &end, 0);
+			if (policy[8] == '\0' || *end != '\0') {
+				printf("Error: Bad misaligned penalty %s\n", policy + 8);
+				return -1;
+			}
+		}
+		sim->MISALIGNED = MISALIGNED_PENALTY;
+		sim->MISALIGNED_PENALTY = cycles;
+	} else {
+		printf("Error: Unknown misaligned policy %s (allow, penalty[:<cycles>] or trap)\n", policy);
+		return -1;
+	}
+	return 0;
+}
+
+const char *misaligned_policy_name(mu_sim_t *sim)
+{
+	return misaligned_names[sim->MISALIGNED];
+}
+
+void show_misaligned_policy(mu_sim_t *sim)
+{
+	printf("Misaligned accesses: %s", misaligned_policy_name(sim));
+	if (sim->MISALIGNED == MISALIGNED_PENALTY) {
+		printf(" (%u cycle%s)", sim->MISALIGNED_PENALTY, sim->MISALIGNED_PENALTY == 1 ? "" : "s");
+	}
+	printf("\n");
+}
+
+/* retire everything in flight without fetching, leaving the pipeline empty */
+void drain_pipeline(mu_sim_t *sim)
+{
+	while (sim->RUN_FLAG && (sim->IF_ID.IR || sim->ID_EX.IR || sim->EX_MEM.IR || sim->MEM_WB.IR)) {
+		if (sim->mem_stall > 0) {
+			sim->mem_stall--;
+			sim->CYCLE_COUNT++;
+			continue;
+		}
+		WB(sim);
+		MEM(sim);
+		if (!sim->RUN_FLAG) {
+			return;	// trapped on a misaligned access
+		}
+		EX(sim);
+		ID(sim);
+		if (!sim->bubble) {
+			memset(&sim->IF_ID, 0, sizeof(sim->IF_ID));	// consumed by ID, nothing fetched behind it
+		}
+		sim->bubble = false;
+		sim->flush = false;
+		sim->CURRENT_STATE = sim->NEXT_STATE;
+		sim->CYCLE_COUNT++;
+	}
+	memset(&sim->IF_ID, 0, sizeof(sim->IF_ID));
+	memset(&sim->ID_EX, 0, sizeof(sim->ID_EX));
+	memset(&sim->EX_MEM, 0, sizeof(sim->EX_MEM));
+	memset(&sim->MEM_WB, 0, sizeof(sim->MEM_WB));
+	sim->fetch_stall = 0;
+	sim->mem_stall = 0;
+	sim->ex_busy = 0;
+}
+
+/* fast-forward n instructions (or up to stop_pc) functionally, then hand an empty pipeline back */
+static void fast_forward_to(mu_sim_t *sim, uint32_t num_instructions, bool until_pc, uint32_t stop_pc)
+{
+	if (sim->smp != NULL) {
+		printf("Error: Fast-forward runs a single hart\n");
+		return;
+	}
+	if (sim->RUN_FLAG == FALSE) {
+		if (sim->TRACE_LEVEL >= TRACE_SUMMARY) printf("Simulation Stopped.\n\n");
+		return;
+	}
+
+	uint32_t start_instructions = sim->INSTRUCTION_COUNT;
+	drain_pipeline(sim);
+	uint32_t drained = sim->INSTRUCTION_COUNT - start_instructions;
+	struct timespec start, stop;
+	uint32_t i;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	PROF_START(functional);
+	PROF_ENTER(sim);
+	for (i = 0; sim->RUN_FLAG && (until_pc || i < num_instructions); i++) {
+		if (!pc_in_program(sim, sim->CURRENT_STATE.PC)) {
+			sim->RUN_FLAG = FALSE;
+			break;
+		}
+		if (until_pc && sim->CURRENT_STATE.PC == stop_pc) {
+			break;
+		}
+		/* only the step engine checks breakpoints and watchpoints */
+		if (debug_armed(sim)) {
+			if (debug_break_at(sim, sim->CURRENT_STATE.PC)) {
+				break;
+			}
+			step_functional(sim);
+			if (debug_watch(sim)) {
+				break;
+			}
+			continue;
+		}
+		uint32_t steps = engine_run(sim, until_pc ? UINT32_MAX : num_instructions - i, until_pc, stop_pc);
+		if (steps > 0) {
+			i += steps - 1;
+			continue;
+		}
+		step_functional(sim);
+	}
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+	PROF_STOP(sim->prof.points[PROF_FAST_FORWARD], functional);
+	PROF_LEAVE();
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	if (sim->TRACE_LEVEL >= TRACE_SUMMARY) {
+		uint32_t executed = sim->INSTRUCTION_COUNT - start_instructions - drained;
+		double seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+		printf("Fast-forwarded %u instructions (%u drained from the pipeline), PC: 0x%08x\n",
+				executed, drained, sim->CURRENT_STATE.PC);
+		if (seconds > 0) {
+			printf("%s engine: %.1f MIPS\n", engine_name(sim->ENGINE), executed / seconds / 1e6);
+		}
+		if (sim->RUN_FLAG == FALSE) {
+			printf("Simulation Stopped.\n");
+		}
+		printf("\n");
+	}
+}
+
+void fast_forward(mu_sim_t *sim, uint32_t num_instructions)
+{
+	fast_forward_to(sim, num_instructions, false, 0);
+}
+
+void fast_forward_until(mu_sim_t *sim, uint32_t pc)
+{
+	fast_forward_to(sim, 0, true, pc);
+}
+
+/************************************************************/
+/* Branch prediction: direction from the selected predictor, target from   */
+/* the BTB if there is one, otherwise from the predecoded immediate.        */
+/************************************************************/
+static const char *bp_kind_names[NUM_BP_KINDS] = { "not-taken", "btfn", "bimodal", "gshare" };
+
+int parse_bp_kind(const char *name)
+{
+	int i;
+	for (i = 0; i < NUM_BP_KINDS; i++) {
+		if (strcmp(name, bp_kind_names[i]) == 0) {
+			return i;
+		}
+	}
+	return strcmp(name, "nt") == 0 ? BP_NOT_TAKEN : -1;
+}
+
+int bp_configure(mu_sim_t *sim, bp_kind_t kind, uint32_t table_bits, uint32_t btb_entries)
+{
+	if (table_bits < 1 || table_bits > BP_MAX_TABLE_BITS) {
+		printf("Error: Predictor table bits must be 1-%d\n", BP_MAX_TABLE_BITS);
+		return -1;
+	}
+	if (btb_entries > (1u << BP_MAX_TABLE_BITS)) {
+		printf("Error: At most %u BTB entries\n", 1u << BP_MAX_TABLE_BITS);
+		return -1;
+	}
+	bp_free(sim);
+	sim->bp.kind = kind;
+	sim->bp.table_bits = table_bits;
+	sim->bp.btb_entries = btb_entries;
+	if (kind == BP_BIMODAL || kind == BP_GSHARE) {
+		sim->bp.counters = malloc(1u << table_bits);
+	}
+	if (btb_entries > 0) {
+		sim->bp.btb = malloc(btb_entries * sizeof(btb_entry_t));
+	}
+	if (((kind == BP_BIMODAL || kind == BP_GSHARE) && sim->bp.counters == NULL) ||
+			(btb_entries > 0 && sim->bp.btb == NULL)) {
+		printf("Error: Out of memory for the branch predictor\n");
+		bp_free(sim);
+		return -1;
+	}
+	bp_reset(sim);
+	return 0;
+}
+
+/* forget everything learned and zero the statistics */
+void bp_reset(mu_sim_t *sim)
+{
+	branch_predictor_t *bp = &sim->bp;
+	if (bp->counters != NULL) {
+		memset(bp->counters, 1, 1u << bp->table_bits);	// weakly not-taken
+	}
+	if (bp->btb != NULL) {
+		memset(bp->btb, 0, bp->btb_entries * sizeof(btb_entry_t));
+	}
+	bp->history = 0;
+	bp->branches = bp->branch_mispredicts = 0;
+	bp->jumps = bp->jump_mispredicts = 0;
+	bp->btb_hits = bp->btb_lookups = 0;
+	bp->flush_cycles = 0;
+}
+
+void bp_free(mu_sim_t *sim)
+{
+	free(sim->bp.counters);
+	free(sim->bp.btb);
+	sim->bp.counters = NULL;
+	sim->bp.btb = NULL;
+}
+
+static uint32_t bp_index(branch_predictor_t *bp, uint32_t pc)
+{
+	uint32_t index = pc >> 2;
+	if (bp->kind == BP_GSHARE) {
+		index ^= bp->history;
+	}
+	return index & ((1u << bp->table_bits) - 1);
+}
+
+/* PC to fetch after the instruction at pc */
+uint32_t bp_predict(mu_sim_t *sim, uint32_t pc, const decoded_inst_t *dec)
+{
+	branch_predictor_t *bp = &sim->bp;
+	bool taken;
+
+	if (!(dec->flags & (DEC_BRANCH | DEC_JUMP))) {
+		return pc + 4;
+	}
+	if (dec->flags & DEC_JUMP) {
+		taken = true;
+	} else {
+		switch (bp->kind) {
+			case BP_BTFN:	taken = dec->imm < 0; break;
+			case BP_BIMODAL:
+			case BP_GSHARE:	taken = bp->counters[bp_index(bp, pc)] >= 2; break;
+			default:	taken = false; break;
+		}
+	}
+	if (!taken) {
+		return pc + 4;
+	}
+	if (bp->btb_entries > 0) {
+		btb_entry_t *entry = &bp->btb[(pc >> 2) % bp->btb_entries];
+		bp->btb_lookups++;
+		if (entry->valid && entry->tag == pc) {
+			bp->btb_hits++;
+			return entry->target;
 		}
-		
-		// Data hazard between instructions in EX and ID stages
-		uint8_t ex_mem_opcode = GET_OPCODE(EX_MEM.IR);
-		if (ex_mem_opcode == LOAD_OPCODE || ex_mem_opcode == R_OPCODE ||        // ex_mem has an rd
-			ex_mem_opcode == IMM_ALU_OPCODE || ex_mem_opcode == JUMP_OPCODE)
-		{
-			uint8_t ex_mem_rd = (EX_MEM.IR >> 7) & BIT_MASK_5;
-			
-			// Hazard on rs1
-			if (ex_mem_rd == id_ex_rs1)
-			{
-				if (ex_mem_opcode == LOAD_OPCODE)  // load-use hazard on rs1
-				{
-					bubble = true;  // Stall -> IF_ID wont update
-					// Flush ID_EX
-					ID_EX.PC = 0;
-					ID_EX.IR = 0;
-					ID_EX.A = 0;
-					ID_EX.B = 0;
-				}
-				else
-				{
-					ID_EX.A = EX_MEM.ALUOutput;
-				}
-			}
-			// Hazard on rs2
-			if (id_ex_opcode != IMM_ALU_OPCODE && id_ex_opcode != LOAD_OPCODE && ex_mem_rd == id_ex_rs2)
-			{
-				if (ex_mem_opcode == LOAD_OPCODE)  // load-use hazard on rs2
-				{
-					bubble = true;  // Stall -> IF_ID wont update
-					// Flush ID_EX
-					ID_EX.PC = 0;
-					ID_EX.IR = 0;
-					ID_EX.A = 0;
-					ID_EX.B = 0;
-				}
-				else
-				{
-					ID_EX.B = EX_MEM.ALUOutput;  // Forward ALU output to EX rs2
-				}
-			}
+		return pc + 4;
+	}
+	// without a BTB only direct targets are known at fetch
+	return dec->op == OP_JALR ? pc + 4 : pc + dec->imm;
+}
+
+/* train on the outcome resolved in EX (global history is updated at resolve time) */
+void bp_update(mu_sim_t *sim, uint32_t pc, const decoded_inst_t *dec, bool taken, uint32_t target)
+{
+	branch_predictor_t *bp = &sim->bp;
+	if ((dec->flags & DEC_BRANCH) && bp->counters != NULL) {
+		uint8_t *counter = &bp->counters[bp_index(bp, pc)];
+		if (taken && *counter < 3) {
+			(*counter)++;
+		} else if (!taken && *counter > 0) {
+			(*counter)--;
 		}
+		if (bp->kind == BP_GSHARE) {
+			bp->history = ((bp->history << 1) | taken) & ((1u << bp->table_bits) - 1);
+		}
+	}
+	if (taken && bp->btb_entries > 0) {
+		btb_entry_t *entry = &bp->btb[(pc >> 2) % bp->btb_entries];
+		entry->tag = pc;
+		entry->target = target;
+		entry->valid = true;
+	}
+}
 
+void show_branch_stats(mu_sim_t *sim)
+{
+	branch_predictor_t *bp = &sim->bp;
+	printf("Branch predictor: %s", bp_kind_names[bp->kind]);
+	if (bp->kind == BP_BIMODAL || bp->kind == BP_GSHARE) {
+		printf(" (%u counters)", 1u << bp->table_bits);
 	}
-	
+	if (bp->btb_entries > 0) {
+		printf(" | BTB: %u entries, %u/%u hits", bp->btb_entries, bp->btb_hits, bp->btb_lookups);
+	}
+	printf("\n");
+	printf("Branches: %u | Mispredicted: %u | Accuracy: %.2f%%\n", bp->branches, bp->branch_mispredicts,
+			bp->branches ? 100.0 * (bp->branches - bp->branch_mispredicts) / bp->branches : 100.0);
+	printf("Jumps: %u | Mispredicted: %u\n", bp->jumps, bp->jump_mispredicts);
+	printf("Flush cycles: %u | CPI added: %.3f\n\n", bp->flush_cycles,
+			sim->INSTRUCTION_COUNT ? (double)bp->flush_cycles / sim->INSTRUCTION_COUNT : 0.0);
 }
+
 /************************************************************/
-/* writeback (WB) pipeline stage:                                                                          
+/* Checkpoints: architectural + pipeline state and non-zero pages      */
 /************************************************************/
-void WB()
+/*
+	Layout (little-endian 32-bit words unless noted):
+	magic[8] "MURVCKP1", version
+	CURRENT_STATE, NEXT_STATE: PC, REGS[32], HI, LO
+	IF_ID, ID_EX, EX_MEM, MEM_WB: PC, IR, A, B, imm, ALUOutput, LMD, NPC
+	bubble, ENABLE_FORWARDING
+	flush
+	fetch_stall, mem_stall
+	EXIT_CODE
+	ex_busy
+	RESERVED, RESERVATION
+	RUN_FLAG, INSTRUCTION_COUNT, CYCLE_COUNT, PROGRAM_SIZE
+	page count, then per page: base address, MEM_PAGE_SIZE bytes
+
+	Predictor tables, cache contents, EX latencies and the performance counters are not
+	saved; a restored run keeps whatever the simulator's predictor and caches hold when
+	it is restored. A checkpoint is read in full before any of it is restored.
+*/
+#define CHECKPOINT_VERSION 6
+
+/* move one word to or from the checkpoint file */
+static bool ckpt_u32(FILE *fp, uint32_t *value, bool save)
 {
-	/*
-	for register-register instruction: REGS[rd] <= ALUOutput
-	for register-immediate instruction: REGS[rt] <= ALUOutput
-	for load instruction: REGS[rt] <= LMD 
-	*/
-	if (MEM_WB.IR == 0) return;  // No-op if the instruction is empty
-
-    uint8_t opcode = GET_OPCODE(MEM_WB.IR);
-    uint8_t rd = (MEM_WB.IR >> 7) & BIT_MASK_5;  // Destination register (rd)
-    uint8_t rt = (MEM_WB.IR >> 20) & BIT_MASK_5; // For I-type or Load
-
-    if (opcode == R_OPCODE || opcode == IMM_ALU_OPCODE) {
-        // Register-register or register-immediate instruction
-        NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-    } else if (opcode == LOAD_OPCODE) {
-        // Load instruction
-        NEXT_STATE.REGS[rt] = MEM_WB.LMD;
-    }
+	return save ? fwrite(value, sizeof(*value), 1, fp) == 1 : fread(value, sizeof(*value), 1, fp) == 1;
+}
 
-    // Increment the instruction count after successful execution
-    INSTRUCTION_COUNT++;
+static bool ckpt_bool(FILE *fp, bool *value, bool save)
+{
+	uint32_t word = *value;
+	bool ok = ckpt_u32(fp, &word, save);
+	*value = word != 0;
+	return ok;
+}
 
-	//end the simulation if all instructions are done
-	if (INSTRUCTION_COUNT >= PROGRAM_SIZE)
-	{
-		RUN_FLAG = false;
+static bool ckpt_cpu_state(FILE *fp, CPU_State *state, bool save)
+{
+	bool ok = ckpt_u32(fp, &state->PC, save);
+	int i;
+	for (i = 0; i < RISCV_REGS; i++) {
+		ok = ok && ckpt_u32(fp, &state->REGS[i], save);
 	}
+	return ok && ckpt_u32(fp, &state->HI, save) && ckpt_u32(fp, &state->LO, save);
 }
 
-/************************************************************/
-/* memory access (MEM) pipeline stage:                                                          */
-/************************************************************/
-void MEM()
+static bool ckpt_pipeline_reg(FILE *fp, CPU_Pipeline_Reg *reg, bool save)
 {
-	//For immediate: bubble
+	bool ok = ckpt_u32(fp, &reg->PC, save) && ckpt_u32(fp, &reg->IR, save) &&
+			ckpt_u32(fp, &reg->A, save) && ckpt_u32(fp, &reg->B, save) &&
+			ckpt_u32(fp, &reg->imm, save) && ckpt_u32(fp, &reg->ALUOutput, save) &&
+			ckpt_u32(fp, &reg->LMD, save) && ckpt_u32(fp, &reg->NPC, save);
+	if (!save) {
+		reg->dec = decode(reg->IR);
+	}
+	return ok;
+}
 
-	/*
-	for load: LMD <= MEM[ALUOutput]
-	for store: MEM[ALUOutput] <= B 
-	*/
+/* everything but memory, in the order documented above */
+static bool ckpt_state(mu_sim_t *sim, FILE *fp, bool save)
+{
+	uint32_t run_flag = sim->RUN_FLAG, forwarding = sim->ENABLE_FORWARDING, exit_code = sim->EXIT_CODE;
+	bool ok = ckpt_cpu_state(fp, &sim->CURRENT_STATE, save) && ckpt_cpu_state(fp, &sim->NEXT_STATE, save) &&
+			ckpt_pipeline_reg(fp, &sim->IF_ID, save) && ckpt_pipeline_reg(fp, &sim->ID_EX, save) &&
+			ckpt_pipeline_reg(fp, &sim->EX_MEM, save) && ckpt_pipeline_reg(fp, &sim->MEM_WB, save) &&
+			ckpt_bool(fp, &sim->bubble, save) && ckpt_u32(fp, &forwarding, save) &&
+			ckpt_bool(fp, &sim->flush, save) &&
+			ckpt_u32(fp, &sim->fetch_stall, save) && ckpt_u32(fp, &sim->mem_stall, save) &&
+			ckpt_u32(fp, &exit_code, save) &&
+			ckpt_u32(fp, &sim->ex_busy, save) &&
+			ckpt_bool(fp, &sim->RESERVED, save) && ckpt_u32(fp, &sim->RESERVATION, save) &&
+			ckpt_u32(fp, &run_flag, save) && ckpt_u32(fp, &sim->INSTRUCTION_COUNT, save) &&
+			ckpt_u32(fp, &sim->CYCLE_COUNT, save) && ckpt_u32(fp, &sim->PROGRAM_SIZE, save);
+	sim->RUN_FLAG = run_flag;
+	sim->ENABLE_FORWARDING = forwarding;
+	sim->EXIT_CODE = exit_code;
+	return ok;
+}
 
-	if (EX_MEM.IR != 0) // Instruction to execute
-    {
-		uint32_t opcode = GET_OPCODE(EX_MEM.IR);
-    
-		if (opcode == LOAD_OPCODE) {
-			// Load instruction: Read from memory
-			MEM_WB.LMD = mem_read_32(EX_MEM.ALUOutput);
-		} else if (opcode == STORE_OPCODE) {
-			// Store instruction: Write to memory
-			mem_write_32(EX_MEM.ALUOutput, EX_MEM.B);
+static bool page_is_zero(const uint8_t *data)
+{
+	const uint64_t *words = (const uint64_t *)data;
+	uint32_t i;
+	for (i = 0; i < MEM_PAGE_SIZE / sizeof(uint64_t); i++) {
+		if (words[i] != 0) {
+			return false;
 		}
 	}
-    
-    
-    // Pass values to MEM_WB pipeline register
-    MEM_WB.IR = EX_MEM.IR;
-    MEM_WB.PC = EX_MEM.PC;
-    MEM_WB.ALUOutput = EX_MEM.ALUOutput;
+	return true;
 }
 
-/************************************************************/
-/* execution (EX) pipeline stage:                                                                          */
-/************************************************************/
-
-/*
-	Pull these from ID/EX:
-	ID/EX.IR
-	ID/EX.A
-	ID/EX.B
-	ID/EX.imm 
+int checkpoint_save(mu_sim_t *sim, const char *path)
+{
+	if (sim->smp != NULL) {
+		printf("Error: Checkpoints hold a single hart\n");
+		return -1;
+	}
+	FILE *fp = fopen(path, "wb");
+	if (fp == NULL) {
+		printf("Error: Can't open checkpoint file %s\n", path);
+		return -1;
+	}
+	uint32_t version = CHECKPOINT_VERSION, num_pages = 0, i;
+	for (i = 0; i < sim->mem->num_committed_pages; i++) {
+		num_pages += !page_is_zero(mem_page(sim->mem, sim->mem->committed_pages[i], false));
+	}
 
-	Fill these into EX/MEM:
-	EX/MEM.IR
-	EX/MEM.A
-	EX/MEM.B
-	EX/MEM.ALUOutput 
-*/
-void EX()
-{	
-	uint32_t instruction = ID_EX.IR;  // Get instruction from the pipeline register
-	uint8_t opcode = GET_OPCODE(instruction);
-	uint8_t funct3 = GET_FUNCT3(instruction);
-	uint8_t funct7;
-	if(opcode == LOAD_OPCODE || opcode == STORE_OPCODE){
-		EX_MEM.ALUOutput = ID_EX.A + ID_EX.imm;
-	}
-	else if(opcode == R_OPCODE){	//reg-reg operation
-		//get funct7
-		uint8_t funct7 = (instruction >> 25) & 0x7F;
-		switch (funct3)
-		{
-		case 0x0:
-			switch(funct7){
-				case 0x00:	//ADD
-					EX_MEM.ALUOutput = ID_EX.A + ID_EX.B;
-				break;
-				case 0x20:	//SUB
-					EX_MEM.ALUOutput = ID_EX.A - ID_EX.B;
-				break;
-			}
-			break;
-		case 0x4:	//XOR
-			EX_MEM.ALUOutput = ID_EX.A ^ ID_EX.B;
-			break;
-		case 0x6:	//OR
-			EX_MEM.ALUOutput = ID_EX.A | ID_EX.B;
-			break;
-		case 0x7:	//AND
-			EX_MEM.ALUOutput = ID_EX.A & ID_EX.B;
-			break;
-		case 0x1:	//Shift left logical
-			EX_MEM.ALUOutput = ID_EX.A << ID_EX.B;
-			break;
-		case 0x5:
-			switch(funct7){
-				case 0x00:	//shift right logical
-					EX_MEM.ALUOutput = ID_EX.A >> ID_EX.B;
-					break;
-				case 0x20:	//shift right arithmetic
-					EX_MEM.ALUOutput = (int32_t)ID_EX.A >> (int32_t)ID_EX.B;
-					break;
-			}
-			break;
-		case 0x2:	//set less than
-			EX_MEM.ALUOutput = (ID_EX.A < ID_EX.B)?1:0;
-			break;
-		case 0x3:	//set less than (unsigned)
-			EX_MEM.ALUOutput = (ID_EX.A < ID_EX.B)?1:0;
-			break;
-		default:	//error
-			break;
+	bool ok = fwrite(CHECKPOINT_MAGIC, 8, 1, fp) == 1 && ckpt_u32(fp, &version, true) &&
+			ckpt_state(sim, fp, true) && ckpt_u32(fp, &num_pages, true);
+	for (i = 0; ok && i < sim->mem->num_committed_pages; i++) {
+		uint8_t *data = mem_page(sim->mem, sim->mem->committed_pages[i], false);
+		if (!page_is_zero(data)) {
+			ok = ckpt_u32(fp, &sim->mem->committed_pages[i], true) && fwrite(data, MEM_PAGE_SIZE, 1, fp) == 1;
 		}
 	}
-	else if(opcode == IMM_ALU_OPCODE){	//reg-immediate operation
-		switch(funct3){
-			case 0x0:	//Add immediate
-				EX_MEM.ALUOutput = ID_EX.A + ID_EX.imm;
-				break;
-			case 0x4:	//XOR Immediate
-				EX_MEM.ALUOutput = ID_EX.A ^ ID_EX.imm;
-				break;
-			case 0x6:	//OR Immediate
-				EX_MEM.ALUOutput = ID_EX.A | ID_EX.imm;
-				break;
-			case 0x7:	//AND immediate
-				EX_MEM.ALUOutput = ID_EX.A & ID_EX.imm;
-				break;
-			case 0x1:	//Left shift logical immediate
-				EX_MEM.ALUOutput = ID_EX.A << (ID_EX.imm & 0x1F);
-				break;
-			case 0x5:
-				funct7 = (ID_EX.imm >> 5) & 0x7F;
-				if(funct7 == 0x00){ //shift right logical imm
-					EX_MEM.ALUOutput = ID_EX.A >> (ID_EX.imm & 0x1F);
-				}
-				else if(funct7 == 0x20){	//shift right arithmetic immediate
-					EX_MEM.ALUOutput = (int32_t)ID_EX.A >> (ID_EX.imm & 0x1F);
-				}
-				break;
-			case 0x2:	//set less than immediate
-				EX_MEM.ALUOutput = (ID_EX.A < ID_EX.imm)?1:0;
-				break;
-			case 0x3:	//set less than immediate (unsigned)
-				EX_MEM.ALUOutput = (ID_EX.A < ID_EX.imm)?1:0;
-				break;
-			}
-	}
-	else if(opcode == 0110111){	//load upper immediate
-		EX_MEM.ALUOutput = ID_EX.imm << 12;
+	if (fclose(fp) != 0 || !ok) {
+		printf("Error: Can't write checkpoint file %s\n", path);
+		return -1;
 	}
-	else if(opcode == 0010111){ //add upper immediate to pc
-		EX_MEM.ALUOutput = ID_EX.PC + (ID_EX.imm << 12);
+	if (sim->TRACE_LEVEL >= TRACE_SUMMARY) {
+		printf("Checkpoint saved to %s (%u pages, cycle %u)\n\n", path, num_pages, sim->CYCLE_COUNT);
 	}
-	/*
-	i) Memory Reference (load/store):
-		ALUOutput <= A + imm
-		ALU adds two operands to form the effective address and stores the result into register called
-		ALUOutput.
-	ii) Register-register Operation
-		ALUOutput <= A op B
-		ALU performs the operation specified by the instruction on the values stored in temporary registers A
-		and B and places the result into ALUOutput.
-	iii) Register-Immediate Operation
-		ALUOutput <= A op imm
-		ALU performs the operation specified by the instruction on the value stored in temporary register A and
-		value in register imm and places the result into ALUOutput. 
-	
-	*/
-	//Update registers
-	EX_MEM.IR = ID_EX.IR;
-	EX_MEM.A = ID_EX.A;
-	EX_MEM.B = ID_EX.B;
-	EX_MEM.PC = ID_EX.PC;
+	return 0;
 }
 
-/************************************************************/
-/* instruction decode (ID) pipeline stage:                                                         */
-/************************************************************/
-void ID()
+/* read a whole checkpoint: the state into sim and the pages into mem */
+static int checkpoint_read(const char *path, mu_sim_t *sim, mu_mem_t *mem, uint32_t *num_pages)
 {
-	// Decode the fetched instruction
-    uint32_t instruction = IF_ID.IR;  // Get instruction from the pipeline register
-    uint8_t opcode = GET_OPCODE(instruction);
-    uint8_t funct3 = GET_FUNCT3(instruction);
-
-    // Extract register operands
-    uint8_t rs1 = (instruction >> 15) & BIT_MASK_5;
-    uint8_t rs2 = (instruction >> 20) & BIT_MASK_5;
-    uint8_t rd  = (instruction >> 7) & BIT_MASK_5;
-
-    // Read values from the register file
-    ID_EX.A = NEXT_STATE.REGS[rs1];  // Read first source register
-    ID_EX.B = NEXT_STATE.REGS[rs2];  // Read second source register (only for R-type and Store instructions)
-	
-    // Extract and sign-extend immediate field only for relevant instructions
-    if (opcode == IMM_ALU_OPCODE || opcode == LOAD_OPCODE) {
-        // I-type instruction: sign-extend 12-bit immediate
-        ID_EX.imm = (int32_t)(instruction >> 20);  
-    } 
-    else if (opcode == STORE_OPCODE) {
-        // S-type instruction: combine imm[11:5] and imm[4:0]
-        ID_EX.imm = ((int32_t)(instruction >> 25) << 5) | ((instruction >> 7) & BIT_MASK_5);
-    } 
-    else {
-        ID_EX.imm = 0;  // No immediate needed for R-type instructions
-    }
-
-    // Pass PC to next pipeline stage
-    ID_EX.PC = IF_ID.PC;
-    ID_EX.IR = IF_ID.IR;  // Pass instruction forward for debugging or later stages
-	DetectHazardsAndForward();
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL) {
+		printf("Error: Can't open checkpoint file %s\n", path);
+		return -1;
+	}
+	char magic[8];
+	uint32_t version, address, i;
+	if (fread(magic, sizeof(magic), 1, fp) != 1 || memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 ||
+			!ckpt_u32(fp, &version, false)) {
+		printf("Error: %s is not a mu-riscv checkpoint\n", path);
+		fclose(fp);
+		return -1;
+	}
+	if (version != CHECKPOINT_VERSION) {
+		printf("Error: Unsupported checkpoint version %u\n", version);
+		fclose(fp);
+		return -1;
+	}
+	bool ok = ckpt_state(sim, fp, false) && ckpt_u32(fp, num_pages, false);
+	for (i = 0; ok && i < *num_pages; i++) {
+		uint8_t *data;
+		ok = ckpt_u32(fp, &address, false) && (data = mem_page(mem, address, true)) != NULL &&
+				fread(data, MEM_PAGE_SIZE, 1, fp) == 1;
+	}
+	fclose(fp);
+	if (!ok) {
+		printf("Error: Checkpoint %s is truncated or corrupt\n", path);
+		return -1;
+	}
+	return 0;
 }
 
-/************************************************************/
-/* instruction fetch (IF) pipeline stage:                                                              */
-/************************************************************/
-void IF()
+int checkpoint_restore(mu_sim_t *sim, const char *path)
 {
-	// Fetch the instruction from memory at the current PC
-    IF_ID.IR = mem_read_32(CURRENT_STATE.PC);
-    
-    // Store the PC of the fetched instruction for later stages
-    IF_ID.PC = CURRENT_STATE.PC;
-    
-    // Increment PC to point to the next instruction (assuming no branch/jump yet)
-    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+	if (sim->smp != NULL) {
+		printf("Error: Checkpoints hold a single hart\n");
+		return -1;
+	}
+	/* read into a copy of the context and a memory of its own, so a bad file changes nothing */
+	mu_sim_t *scratch = malloc(sizeof(*scratch));
+	mu_mem_t *mem = malloc(sizeof(*mem));
+	if (scratch == NULL || mem == NULL || mem_init(mem) != 0) {
+		printf("Error: Out of memory reading checkpoint\n");
+		exit(-1);
+	}
+	*scratch = *sim;
+	uint32_t num_pages, i;
+	int status = checkpoint_read(path, scratch, mem, &num_pages);
+	if (status == 0) {
+		*sim = *scratch;
+		/* memory not in the checkpoint is zero */
+		for (i = 0; i < sim->mem->num_committed_pages; i++) {
+			memset(mem_page(sim->mem, sim->mem->committed_pages[i], true), 0, MEM_PAGE_SIZE);
+		}
+		for (i = 0; i < mem->num_committed_pages; i++) {
+			memcpy(mem_page(sim->mem, mem->committed_pages[i], true),
+					mem_page(mem, mem->committed_pages[i], false), MEM_PAGE_SIZE);
+		}
+		predecode_program(sim);
+	}
+	free(scratch);
+	mem_free(mem);
+	free(mem);
+	if (status == 0 && sim->TRACE_LEVEL >= TRACE_SUMMARY) {
+		printf("Checkpoint restored from %s (%u pages, cycle %u)\n\n", path, num_pages, sim->CYCLE_COUNT);
+	}
+	return status;
 }
 
+/* only the memory of a checkpoint, into a memory of its own (mdiff) */
+int checkpoint_read_memory(const char *path, mu_mem_t *mem)
+{
+	/* the state is read into a throwaway context */
+	mu_sim_t *scratch = calloc(1, sizeof(*scratch));
+	if (scratch == NULL) {
+		printf("Error: Out of memory reading checkpoint\n");
+		exit(-1);
+	}
+	uint32_t num_pages;
+	int status = checkpoint_read(path, scratch, mem, &num_pages);
+	free(scratch);
+	return status;
+}
 
 /************************************************************/
 /* Initialize Memory                                                                                                    */
 /************************************************************/
-void initialize() {
-	init_memory();
-	CURRENT_STATE.PC = MEM_TEXT_BEGIN;
-	NEXT_STATE = CURRENT_STATE;
-	RUN_FLAG = TRUE;
+int initialize(mu_sim_t *sim, mu_mem_t *mem) {
+	int i;
+	memset(sim, 0, sizeof(*sim));
+	if (mem == NULL) {
+		mem = malloc(sizeof(*mem));
+		if (mem == NULL || mem_init(mem) != 0) {
+			printf("Error: Can't allocate simulator memory\n");
+			free(mem);
+			return -1;
+		}
+		sim->owns_mem = true;
+	}
+	sim->mem = mem;
+	prof_reset(sim);
+	sim->INITIAL_STATE.PC = MEM_TEXT_BEGIN;
+	sim->CURRENT_STATE = sim->INITIAL_STATE;
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+	sim->EXIT_CODE = -1;
+	sim->RUN_FLAG = TRUE;
+	sim->ENABLE_FORWARDING = TRUE;
+	sim->TRACE_LEVEL = TRACE_CYCLE;
+	sim->ENGINE = ENGINE_THREADED;
+	for (i = 0; i < NUM_INST_CLASSES; i++) {
+		sim->EX_LATENCY[i] = 1;
+	}
+	sim->EX_LATENCY[CLASS_MUL] = MUL_DEFAULT_LATENCY;
+	sim->EX_LATENCY[CLASS_DIV] = DIV_DEFAULT_LATENCY;
+	sim->MISALIGNED = MISALIGNED_ALLOW;
+	sim->MISALIGNED_PENALTY = MISALIGNED_DEFAULT_PENALTY;
+	sim->l1i.name = "L1I";
+	sim->l1d.name = "L1D";
+	sim->l2.name = "L2";
+	return bp_configure(sim, BP_NOT_TAKEN, BP_DEFAULT_TABLE_BITS, 0);
+}
+
+/***************************************************************/
+/* Release everything initialize() and the run acquired.                  */
+/***************************************************************/
+void finalize(mu_sim_t *sim) {
+	btrace_close(sim);
+	free_symbols(sim);
+	threaded_free(sim);
+	jit_free(sim);
+	bp_free(sim);
+	breakpoints_clear(sim);
+	cache_free(&sim->l1i);
+	cache_free(&sim->l1d);
+	cache_free(&sim->l2);
+	if (sim->smp != NULL && sim->HART_ID == 0) {
+		smp_free(sim);
+	}
+	if (sim->owns_mem) {
+		mem_free(sim->mem);
+		free(sim->mem);
+	}
+	sim->mem = NULL;
 }
 
 /************************************************************/
 /* Print the program loaded into memory (in RISCV assembly format)    */
 /************************************************************/
-void print_program(){
+void print_program(mu_sim_t *sim){
 	/*IMPLEMENT THIS*/
-	/* execute one instruction at a time. Use/update CURRENT_STATE and and NEXT_STATE, as necessary.*/
+	/* execute one instruction at a time. Use/update sim->CURRENT_STATE and and sim->NEXT_STATE, as necessary.*/
 	
 	for(uint32_t mem_tracer = MEM_TEXT_BEGIN; 
-		mem_tracer < MEM_TEXT_BEGIN + PROGRAM_SIZE*4; 
+		mem_tracer < MEM_TEXT_BEGIN + sim->PROGRAM_SIZE*4; 
 		mem_tracer+=4) {
-		uint32_t cmd = mem_read_32(mem_tracer);
+		uint32_t cmd = mem_read_32(sim->mem, mem_tracer);
+		const elf_symbol_t *label = symbol_at(sim, mem_tracer);
+		if (label != NULL) {
+			printf("%s:\n", label->name);
+		}
 		print_command(cmd);
 		printf("\n");
 	}
@@ -726,6 +2023,12 @@ void print_command(uint32_t bincmd) {
 			case JUMP_OPCODE:
 				handle_j_print(bincmd);
 				break;
+			case AMO_OPCODE:
+				handle_a_print(bincmd);
+				break;
+			case SYSTEM_OPCODE:
+				printf(bincmd == 0x00100073 ? "ebreak" : bincmd == 0x00000073 ? "ecall" : "Unknown command!");
+				break;
 			default:
 				printf("Unknown command!");
 				break;
@@ -733,12 +2036,39 @@ void print_command(uint32_t bincmd) {
 	}
 }
 
+void handle_a_print(uint32_t bincmd) {
+	uint8_t rd = bincmd >> 7 & BIT_MASK_5;
+	uint8_t rs1 = bincmd >> 15 & BIT_MASK_5;
+	uint8_t rs2 = bincmd >> 20 & BIT_MASK_5;
+	decoded_inst_t dec = decode(bincmd);
+	switch (dec.op) {
+		case OP_LR_W:	printf("lr.w x%d, (x%d)", rd, rs1); return;
+		case OP_SC_W:	printf("sc.w x%d, x%d, (x%d)", rd, rs2, rs1); return;
+		case OP_AMOSWAP_W:	printf("amoswap.w"); break;
+		case OP_AMOADD_W:	printf("amoadd.w"); break;
+		case OP_AMOXOR_W:	printf("amoxor.w"); break;
+		case OP_AMOAND_W:	printf("amoand.w"); break;
+		case OP_AMOOR_W:	printf("amoor.w"); break;
+		case OP_AMOMIN_W:	printf("amomin.w"); break;
+		case OP_AMOMAX_W:	printf("amomax.w"); break;
+		case OP_AMOMINU_W:	printf("amominu.w"); break;
+		case OP_AMOMAXU_W:	printf("amomaxu.w"); break;
+		default:	printf("Unknown command!"); return;
+	}
+	printf(" x%d, x%d, (x%d)", rd, rs2, rs1);
+}
+
 void handle_r_print(uint32_t bincmd) {
 	uint8_t rd = bincmd >> 7 & BIT_MASK_5;
 	uint8_t funct3 = bincmd >> 12 & BIT_MASK_3;
 	uint8_t rs1 = bincmd >> 15 & BIT_MASK_5;
 	uint8_t rs2 = bincmd >> 20 & BIT_MASK_5;
 	uint8_t funct7 = bincmd >> 25 & BIT_MASK_7;
+	if (funct7 == M_FUNCT7) {
+		static char *m_names[8] = { "mul", "mulh", "mulhsu", "mulhu", "div", "divu", "rem", "remu" };
+		print_r_cmd(m_names[funct3], rd, rs1, rs2);
+		return;
+	}
 	switch(funct3) {
 		case 0x0:
 			switch(funct7){
@@ -966,52 +2296,304 @@ void print_b_cmd(char* cmd_name, uint8_t rs1, uint8_t rs2, uint16_t imm) {
 /************************************************************/
 /* Print the current pipeline                                                                                    */
 /************************************************************/
-void show_pipeline(){
+void show_pipeline(mu_sim_t *sim){
 	printf("--------------------------------------------------\n");
-    printf("Cycle: %d\n", CYCLE_COUNT);
+    printf("Cycle: %d\n", sim->CYCLE_COUNT);
     printf("--------------------------------------------------\n");
 
     // Print IF/ID pipeline register
     printf("IF/ID:\n");
-    printf("  PC: 0x%08X | IR: 0x%08X\n", IF_ID.PC, IF_ID.IR);
+    printf("  PC: 0x%08X | IR: 0x%08X\n", sim->IF_ID.PC, sim->IF_ID.IR);
 
     // Print ID/EX pipeline register
     printf("ID/EX:\n");
     printf("  PC: 0x%08X | IR: 0x%08X | A: 0x%08X | B: 0x%08X | imm: 0x%08X\n", 
-            ID_EX.PC, ID_EX.IR, ID_EX.A, ID_EX.B, ID_EX.imm);
+            sim->ID_EX.PC, sim->ID_EX.IR, sim->ID_EX.A, sim->ID_EX.B, sim->ID_EX.imm);
+    if (sim->ex_busy > 0) {
+        printf("  (in EX, %u more cycle%s)\n", sim->ex_busy, sim->ex_busy == 1 ? "" : "s");
+    }
 
     // Print EX/MEM pipeline register
     printf("EX/MEM:\n");
     printf("  PC: 0x%08X | IR: 0x%08X | ALUOutput: 0x%08X | B: 0x%08X\n", 
-            EX_MEM.PC, EX_MEM.IR, EX_MEM.ALUOutput, EX_MEM.B);
+            sim->EX_MEM.PC, sim->EX_MEM.IR, sim->EX_MEM.ALUOutput, sim->EX_MEM.B);
 
     // Print MEM/WB pipeline register
     printf("MEM/WB:\n");
     printf("  PC: 0x%08X | IR: 0x%08X | ALUOutput: 0x%08X | LMD: 0x%08X\n", 
-            MEM_WB.PC, MEM_WB.IR, MEM_WB.ALUOutput, MEM_WB.LMD);
+            sim->MEM_WB.PC, sim->MEM_WB.IR, sim->MEM_WB.ALUOutput, sim->MEM_WB.LMD);
 
     printf("--------------------------------------------------\n");
 }
 
-/***************************************************************/
-/* main                                                                                                                                   */
-/***************************************************************/
-int main(int argc, char *argv[]) {
-	printf("\n**************************\n");
-	printf("Welcome to MU-RISCV SIM...\n");
-	printf("**************************\n\n");
+/************************************************************/
+/* Print one retired instruction                                                                                */
+/************************************************************/
+void show_retired(mu_sim_t *sim, CPU_Pipeline_Reg *retired){
+	printf("[%u] retire PC: 0x%08X | IR: 0x%08X | ", sim->CYCLE_COUNT, retired->PC, retired->IR);
+	print_command(retired->IR);
+	printf("\n");
+}
+
+/************************************************************/
+/* Print cycles, instructions and CPI since a run started                                  */
+/************************************************************/
+void show_run_summary(mu_sim_t *sim, uint32_t start_cycles, uint32_t start_instructions){
+	uint32_t cycles = sim->CYCLE_COUNT - start_cycles;
+	uint32_t instructions = sim->INSTRUCTION_COUNT - start_instructions;
+	if (sim->EXIT_CODE != -1) {
+		printf("Program exited with code %d\n", sim->EXIT_CODE);
+	}
+	printf("Cycles: %u | Instructions: %u | CPI: %.3f\n\n", cycles, instructions,
+			instructions ? (double)cycles / instructions : 0.0);
+}
+
+/************************************************************/
+/* Performance counters                                                                                              */
+/************************************************************/
+static const char *inst_class_names[NUM_INST_CLASSES] = {
+	"alu", "alu_imm", "load", "store", "branch", "jump", "upper", "mul", "div", "atomic", "system", "other"
+};
+
+/* cycles instructions of class cls (alu, load, mul, div, ...) spend in EX */
+int set_ex_latency(mu_sim_t *sim, const char *cls, uint32_t cycles)
+{
+	int i;
+	if (cycles < 1 || cycles > 1024) {
+		printf("Error: EX latency must be 1 to 1024 cycles\n");
+		return -1;
+	}
+	for (i = 0; i < NUM_INST_CLASSES; i++) {
+		if (strcasecmp(cls, inst_class_names[i]) == 0) {
+			sim->EX_LATENCY[i] = cycles;
+			return 0;
+		}
+	}
+	printf("Error: Unknown instruction class %s (alu, alu_imm, load, store, branch, jump, upper, mul, div, atomic, system)\n", cls);
+	return -1;
+}
+
+void show_ex_latencies(mu_sim_t *sim)
+{
+	int i;
+	printf("EX latency (cycles):");
+	for (i = 0; i < NUM_INST_CLASSES; i++) {
+		if (i != CLASS_OTHER) {
+			printf(" %s %u", inst_class_names[i], sim->EX_LATENCY[i]);
+		}
+	}
+	printf("\n");
+}
+
+void show_stats(mu_sim_t *sim)
+{
+	perf_counters_t *perf = &sim->perf;
+	int i;
+	printf("-------------------------------------\n");
+	printf("Performance Counters\n");
+	printf("-------------------------------------\n");
+	printf("Cycles\t\t: %u\n", sim->CYCLE_COUNT);
+	printf("Instructions\t: %u\n", sim->INSTRUCTION_COUNT);
+	printf("CPI\t\t: %.3f\n", sim->INSTRUCTION_COUNT ? (double)sim->CYCLE_COUNT / sim->INSTRUCTION_COUNT : 0.0);
+	printf("-------------------------------------\n");
+	for (i = 0; i < NUM_INST_CLASSES; i++) {
+		printf("Retired %s\t: %llu\n", inst_class_names[i], (unsigned long long)perf->retired[i]);
+	}
+	printf("-------------------------------------\n");
+	printf("Load-use stalls\t: %llu\n", (unsigned long long)perf->load_use_stalls);
+	printf("No-fwd stalls\t: %llu\n", (unsigned long long)perf->writeback_stalls);
+	printf("EX busy stalls\t: %llu\n", (unsigned long long)perf->ex_busy_stalls);
+	printf("Flush cycles\t: %u\n", sim->bp.flush_cycles);
+	printf("I-cache stalls\t: %llu\n", (unsigned long long)perf->icache_stall_cycles);
+	printf("D-cache stalls\t: %llu\n", (unsigned long long)perf->dcache_stall_cycles);
+	printf("Bubbles (WB)\t: %llu\n", (unsigned long long)perf->bubbles);
+	printf("Fwd EX/MEM\t: %llu\n", (unsigned long long)perf->forwarded_ex_mem);
+	printf("Fwd MEM/WB\t: %llu\n", (unsigned long long)perf->forwarded_mem_wb);
+	printf("-------------------------------------\n");
+	printf("Fetches\t\t: %llu\n", (unsigned long long)perf->fetches);
+	printf("Loads\t\t: %llu\n", (unsigned long long)perf->loads);
+	printf("Stores\t\t: %llu\n", (unsigned long long)perf->stores);
+	printf("Misaligned\t: %llu (%s)\n", (unsigned long long)perf->misaligned, misaligned_policy_name(sim));
+	if (sim->smp != NULL) {
+		printf("Atomic waits\t: %llu\n", (unsigned long long)perf->atomic_waits);
+	}
+	printf("-------------------------------------\n");
+}
+
+static void json_cache(FILE *fp, cache_t *cache, bool last)
+{
+	fprintf(fp, "    \"%s\": ", cache->name);
+	if (!cache->enabled) {
+		fprintf(fp, "null%s\n", last ? "" : ",");
+		return;
+	}
+	fprintf(fp, "{\"size\": %u, \"assoc\": %u, \"line_size\": %u, \"reads\": %u, \"writes\": %u, "
+			"\"read_misses\": %u, \"write_misses\": %u, \"evictions\": %u, \"writebacks\": %u, "
+			"\"stall_cycles\": %u}%s\n", cache->size, cache->assoc, cache->line_size, cache->reads, cache->writes,
+			cache->read_misses, cache->write_misses, cache->evictions, cache->writebacks, cache->stall_cycles,
+			last ? "" : ",");
+}
+
+/* every counter as one JSON object, for scripts and dashboards */
+int write_stats_json(mu_sim_t *sim, const char *path)
+{
+	perf_counters_t *perf = &sim->perf;
+	branch_predictor_t *bp = &sim->bp;
+	FILE *fp = fopen(path, "w");
+	int i;
+	if (fp == NULL) {
+		printf("Error: Can't open stats file %s\n", path);
+		return -1;
+	}
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"program\": ");
+	muriscv_json_string(fp, sim->prog_file);
+	fprintf(fp, ",\n");
+	fprintf(fp, "  \"exit_code\": %d,\n", sim->EXIT_CODE);
+	fprintf(fp, "  \"cycles\": %u,\n", sim->CYCLE_COUNT);
+	fprintf(fp, "  \"instructions\": %u,\n", sim->INSTRUCTION_COUNT);
+	fprintf(fp, "  \"cpi\": %.6f,\n", sim->INSTRUCTION_COUNT ? (double)sim->CYCLE_COUNT / sim->INSTRUCTION_COUNT : 0.0);
+	fprintf(fp, "  \"retired\": {");
+	for (i = 0; i < NUM_INST_CLASSES; i++) {
+		fprintf(fp, "%s\"%s\": %llu", i ? ", " : "", inst_class_names[i], (unsigned long long)perf->retired[i]);
+	}
+	fprintf(fp, "},\n");
+	fprintf(fp, "  \"stalls\": {\"load_use\": %llu, \"writeback\": %llu, \"ex_busy\": %llu, \"flush\": %u, "
+			"\"icache\": %llu, \"dcache\": %llu},\n", (unsigned long long)perf->load_use_stalls,
+			(unsigned long long)perf->writeback_stalls, (unsigned long long)perf->ex_busy_stalls, bp->flush_cycles,
+			(unsigned long long)perf->icache_stall_cycles, (unsigned long long)perf->dcache_stall_cycles);
+	fprintf(fp, "  \"bubbles\": %llu,\n", (unsigned long long)perf->bubbles);
+	fprintf(fp, "  \"forwarded\": {\"ex_mem\": %llu, \"mem_wb\": %llu},\n",
+			(unsigned long long)perf->forwarded_ex_mem, (unsigned long long)perf->forwarded_mem_wb);
+	fprintf(fp, "  \"memory\": {\"fetches\": %llu, \"loads\": %llu, \"stores\": %llu, \"misaligned\": %llu},\n",
+			(unsigned long long)perf->fetches, (unsigned long long)perf->loads, (unsigned long long)perf->stores,
+			(unsigned long long)perf->misaligned);
+	fprintf(fp, "  \"branch\": {\"branches\": %u, \"branch_mispredicts\": %u, \"jumps\": %u, "
+			"\"jump_mispredicts\": %u, \"btb_lookups\": %u, \"btb_hits\": %u},\n", bp->branches,
+			bp->branch_mispredicts, bp->jumps, bp->jump_mispredicts, bp->btb_lookups, bp->btb_hits);
+	fprintf(fp, "  \"caches\": {\n");
+	json_cache(fp, &sim->l1i, false);
+	json_cache(fp, &sim->l1d, false);
+	json_cache(fp, &sim->l2, true);
+	fprintf(fp, "  }\n");
+	fprintf(fp, "}\n");
+	if (fclose(fp) != 0) {
+		printf("Error: Can't write stats file %s\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+/************************************************************/
+/* Map a trace level name (or 0-3) to a level, -1 if unknown                             */
+/************************************************************/
+int parse_trace_level(const char *name){
+	static const char *names[] = { "none", "summary", "retire", "cycle" };
+	int i;
+	for (i = TRACE_NONE; i <= TRACE_CYCLE; i++) {
+		if (strcmp(name, names[i]) == 0 || (name[0] == '0' + i && name[1] == '\0')) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/************************************************************/
+/* Binary pipeline trace writer                                                                                 */
+/************************************************************/
 
-	if (argc < 2) {
-		printf("Error: You should provide input file.\nUsage: %s <input program> \n\n",  argv[0]);
-		exit(1);
+static void btrace_flush(mu_sim_t *sim){
+	if (sim->btrace.len > 0 && fwrite(sim->btrace.buf, 1, sim->btrace.len, sim->btrace.file) != sim->btrace.len) {
+		printf("Error: Can't write binary trace, tracing stopped\n");
+		fclose(sim->btrace.file);
+		sim->btrace.file = NULL;
 	}
+	sim->btrace.len = 0;
+}
+
+static void btrace_put32(mu_sim_t *sim, uint32_t value){
+	memcpy(&sim->btrace.buf[sim->btrace.len], &value, sizeof(value));
+	sim->btrace.len += sizeof(value);
+}
+
+static void btrace_reg_fields(CPU_Pipeline_Reg *reg, uint32_t *fields){
+	fields[TRACE_PC] = reg->PC;
+	fields[TRACE_IR] = reg->IR;
+	fields[TRACE_A] = reg->A;
+	fields[TRACE_B] = reg->B;
+	fields[TRACE_IMM] = reg->imm;
+	fields[TRACE_ALU_OUTPUT] = reg->ALUOutput;
+	fields[TRACE_LMD] = reg->LMD;
+}
 
-	strcpy(prog_file, argv[1]);
-	initialize();
-	load_program();
-	help();
-	while (1){
-		handle_command();
+int btrace_open(mu_sim_t *sim, const char *path){
+	btrace_close(sim);
+	sim->btrace.file = fopen(path, "wb");
+	if (sim->btrace.file == NULL) {
+		printf("Error: Can't open trace file %s\n", path);
+		return -1;
 	}
+	trace_file_header_t header;
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	header.num_fields = TRACE_NUM_FIELDS;
+	fwrite(&header, sizeof(header), 1, sim->btrace.file);
+	sim->btrace.len = 0;
+	sim->btrace.since_keyframe = TRACE_KEYFRAME_INTERVAL;	/* first record is a keyframe */
 	return 0;
 }
+
+void btrace_close(mu_sim_t *sim){
+	if (sim->btrace.file == NULL) {
+		return;
+	}
+	btrace_flush(sim);
+	if (sim->btrace.file != NULL) {
+		fclose(sim->btrace.file);
+		sim->btrace.file = NULL;
+	}
+}
+
+/* append this cycle's pipeline registers, storing only fields that changed */
+void btrace_cycle(mu_sim_t *sim){
+	uint32_t fields[TRACE_NUM_FIELDS];
+	uint32_t mask = 0;
+	int i;
+
+	btrace_reg_fields(&sim->IF_ID, &fields[TRACE_FIELD(TRACE_IF_ID, 0)]);
+	btrace_reg_fields(&sim->ID_EX, &fields[TRACE_FIELD(TRACE_ID_EX, 0)]);
+	btrace_reg_fields(&sim->EX_MEM, &fields[TRACE_FIELD(TRACE_EX_MEM, 0)]);
+	btrace_reg_fields(&sim->MEM_WB, &fields[TRACE_FIELD(TRACE_MEM_WB, 0)]);
+
+	if (sim->btrace.len > sizeof(sim->btrace.buf) - (TRACE_NUM_FIELDS + 2) * sizeof(uint32_t)) {
+		btrace_flush(sim);
+		if (sim->btrace.file == NULL) {
+			return;
+		}
+	}
+
+	if (sim->CYCLE_COUNT != sim->btrace.next_cycle || sim->btrace.since_keyframe >= TRACE_KEYFRAME_INTERVAL) {
+		mask = TRACE_ALL_FIELDS | TRACE_RECORD_KEYFRAME;
+		sim->btrace.since_keyframe = 0;
+	} else {
+		for (i = 0; i < TRACE_NUM_FIELDS; i++) {
+			if (fields[i] != sim->btrace.prev[i]) {
+				mask |= 1u << i;
+			}
+		}
+		sim->btrace.since_keyframe++;
+	}
+
+	btrace_put32(sim, mask);
+	if (mask & TRACE_RECORD_KEYFRAME) {
+		btrace_put32(sim, sim->CYCLE_COUNT);
+	}
+	for (i = 0; i < TRACE_NUM_FIELDS; i++) {
+		if (mask & (1u << i)) {
+			btrace_put32(sim, fields[i]);
+		}
+	}
+	memcpy(sim->btrace.prev, fields, sizeof(fields));
+	sim->btrace.next_cycle = sim->CYCLE_COUNT + 1;
+}
+
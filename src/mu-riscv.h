@@ -1,10 +1,18 @@
+#ifndef MU_RISCV_H
+#define MU_RISCV_H
+
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 #include <assert.h>
 
+#include "muriscv.h"
+#include "mu-riscv-trace.h"
+
 #define FALSE 0
 #define TRUE  1
 
@@ -27,20 +35,172 @@
 #define MEM_STACK_BEGIN 0x7FFFFFFF
 #define MEM_STACK_END  0x10010000
 
+/* Guest memory is backed one page at a time. Each region only reserves a table
+ * of page pointers; a page is committed (zero-filled) the first time it is
+ * written, and reads of untouched pages return zero without committing them. */
+#define MEM_PAGE_SHIFT 12
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_SHIFT)
+#define MEM_PAGE_MASK (MEM_PAGE_SIZE - 1)
+
+typedef struct {
+	uint8_t *data;		/* NULL until the page is first written */
+	uint8_t *pristine;	/* contents right after load_program(), NULL if all zero */
+	bool dirty;		/* written since the program was loaded or reset */
+} mem_page_t;
+
 typedef struct {
 	uint32_t begin, end;
-	uint8_t *mem;
+	mem_page_t *pages;
 } mem_region_t;
 
-/* memory will be dynamically allocated at initialization */
-mem_region_t MEM_REGIONS[] = {
-	{ MEM_TEXT_BEGIN, MEM_TEXT_END, NULL },
-	{ MEM_DATA_BEGIN, MEM_DATA_END, NULL },
-	{ MEM_KDATA_BEGIN, MEM_KDATA_END, NULL },
-	{ MEM_KTEXT_BEGIN, MEM_KTEXT_END, NULL }
-};
-
 #define NUM_MEM_REGION 4
+
+/* mu_mem_t.region_index: region overlapping each 256MB slice of the address space */
+#define MEM_INDEX_SHIFT 28
+#define MEM_INDEX_SIZE (1 << (32 - MEM_INDEX_SHIFT))
+#define MEM_INDEX_NONE -1	/* no region */
+#define MEM_INDEX_SCAN -2	/* several regions: search them */
+
+/***************************************************************/
+/* Host-side profiling (make PROFILE=1, see mu-riscv-prof.c)           */
+/***************************************************************/
+typedef struct {
+	uint64_t calls;
+	uint64_t ticks;	/* prof_now() units */
+} prof_counter_t;
+
+typedef enum {
+	PROF_CYCLE,	/* all of cycle()/cycle_traced() */
+	PROF_WB,
+	PROF_MEM,
+	PROF_EX,
+	PROF_ID,
+	PROF_HAZARD,	/* DetectHazardsAndForward(), inside ID */
+	PROF_IF,
+	PROF_TRACE,	/* show_retired/show_pipeline/btrace output */
+	PROF_FAST_FORWARD,	/* functional execution, outside the cycle loop */
+	PROF_REGION_SCAN,	/* mem_region(), from cycles and fast-forward */
+	NUM_PROF_POINTS
+} prof_point_t;
+
+#define PROF_HIST_BUCKETS 32	/* bucket i: cycles costing [2^i, 2^(i+1)) ticks */
+#define PROF_SAMPLE_PERIOD 16	/* one cycle in this many goes into the histogram */
+
+typedef struct {
+	prof_counter_t points[NUM_PROF_POINTS];
+	uint64_t cycle_hist[PROF_HIST_BUCKETS];
+	uint64_t start_ticks;	/* prof_now() and wall clock at the last reset, for calibration */
+	uint64_t start_ns;
+} prof_t;
+
+#ifdef MU_PROFILE
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROF_CLOCK_NAME "rdtsc"
+static inline uint64_t prof_now(void) { return __rdtsc(); }
+#else
+#define PROF_CLOCK_NAME "clock_gettime"
+static inline uint64_t prof_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+static inline void prof_cycle(prof_t *prof, uint64_t ticks)
+{
+	if ((prof->points[PROF_CYCLE].calls++ & (PROF_SAMPLE_PERIOD - 1)) == 0) {
+		int bucket = 63 - __builtin_clzll(ticks | 1);
+		prof->cycle_hist[bucket < PROF_HIST_BUCKETS ? bucket : PROF_HIST_BUCKETS - 1]++;
+	}
+	prof->points[PROF_CYCLE].ticks += ticks;
+}
+/* PROF_START opens a timed section, PROF_STOP charges it to a counter and
+ * PROF_LAP charges it and restarts the clock for the next section */
+#define PROF_START(t) uint64_t t = prof_now()
+#define PROF_STOP(counter, t) do { (counter).calls++; (counter).ticks += prof_now() - (t); } while (0)
+#define PROF_LAP(counter, t) do { uint64_t now_ = prof_now(); (counter).calls++; (counter).ticks += now_ - (t); (t) = now_; } while (0)
+#define PROF_CYCLE_END(sim, t) prof_cycle(&(sim)->prof, prof_now() - (t))
+/* memory can be shared by harts on other threads, so a region scan is charged to
+ * the context this thread is simulating, if any: PROF_ENTER/PROF_LEAVE bracket it */
+extern __thread prof_t *prof_current;
+#define PROF_ENTER(sim) (prof_current = &(sim)->prof)
+#define PROF_LEAVE() (prof_current = NULL)
+#define PROF_STOP_CURRENT(point, t) do { if (prof_current != NULL) PROF_STOP(prof_current->points[point], t); } while (0)
+#else
+#define PROF_START(t) do { } while (0)
+#define PROF_STOP(counter, t) do { } while (0)
+#define PROF_LAP(counter, t) do { } while (0)
+#define PROF_CYCLE_END(sim, t) do { } while (0)
+#define PROF_ENTER(sim) do { } while (0)
+#define PROF_LEAVE() do { } while (0)
+#define PROF_STOP_CURRENT(point, t) do { } while (0)
+#endif
+
+/***************************************************************/
+/* Breakpoints and data watchpoints (see mu-riscv-debug.c)             */
+/***************************************************************/
+typedef struct {
+	uint32_t address, len;
+	int kind;	/* MURISCV_WATCH_READ and/or MURISCV_WATCH_WRITE */
+} watchpoint_t;
+
+typedef struct {
+	bool hit;	/* set by watch_access(), cleared when the run stops on it */
+	bool write;
+	uint32_t address, len;
+	int kind;	/* of the watchpoint that was hit */
+} watch_hit_t;
+
+/* one bit per page number modulo WATCH_FILTER_BITS: accesses to pages with a
+ * clear bit never look at the watchpoint list */
+#define WATCH_FILTER_BITS 4096
+
+typedef enum {
+	STOP_NONE,
+	STOP_BREAKPOINT,
+	STOP_WATCHPOINT,
+	STOP_STEP,
+	STOP_INTERRUPT,
+	STOP_EXITED
+} stop_reason_t;
+
+typedef struct {
+	uint32_t *breakpoints;	/* open-addressed hash set of PCs, capacity a power of two */
+	uint32_t capacity, num_breakpoints, used;	/* used counts deleted slots too */
+	bool skip;	/* resuming: don't stop again at skip_pc, where the last stop was */
+	uint32_t skip_pc;
+	stop_reason_t stop;	/* why the last run stopped */
+} debug_state_t;
+
+/* decoded_inst_t, used by the predecoded text below */
+typedef struct decoded_inst decoded_inst_t;
+
+/* Guest memory. A memory can be shared by several simulator contexts. */
+typedef struct mu_mem {
+	/* page tables are allocated by mem_init() */
+	mem_region_t regions[NUM_MEM_REGION];
+	int8_t region_index[MEM_INDEX_SIZE];
+
+	/* pages written since the last load/reset, so reset only restores those */
+	mem_page_t **dirty_pages;
+	uint32_t num_dirty_pages, dirty_pages_cap;
+
+	/* base address of every page ever committed, in commit order */
+	uint32_t *committed_pages;
+	uint32_t num_committed_pages, committed_pages_cap;
+
+	/* predecoded text segment: one entry per program word starting at MEM_TEXT_BEGIN */
+	decoded_inst_t *decoded_text;
+	uint32_t decoded_words;
+	uint32_t text_version;	/* bumped whenever decoded_text is rebuilt or invalidated */
+
+	watchpoint_t *watchpoints;
+	uint32_t num_watchpoints;
+	uint64_t watch_filter[WATCH_FILTER_BITS / 64];
+	watch_hit_t watch_hit;
+} mu_mem_t;
+
 #define RISCV_REGS 32
 
 typedef struct CPU_State_Struct {
@@ -50,6 +210,70 @@ typedef struct CPU_State_Struct {
   uint32_t HI, LO;                          /* special regs for mult/div. */
 } CPU_State;
 
+/***************************************************************/
+/* Decoded instructions                                                                                                */
+/***************************************************************/
+typedef enum {
+	OP_NOP = 0,	/* bubble */
+	OP_ADD, OP_SUB, OP_SLL, OP_SLT, OP_SLTU, OP_XOR, OP_SRL, OP_SRA, OP_OR, OP_AND,
+	OP_MUL, OP_MULH, OP_MULHSU, OP_MULHU, OP_DIV, OP_DIVU, OP_REM, OP_REMU,
+	OP_ADDI, OP_SLTI, OP_SLTIU, OP_XORI, OP_ORI, OP_ANDI, OP_SLLI, OP_SRLI, OP_SRAI,
+	OP_LB, OP_LH, OP_LW, OP_LBU, OP_LHU,
+	OP_SB, OP_SH, OP_SW,
+	OP_LR_W, OP_SC_W, OP_AMOSWAP_W, OP_AMOADD_W, OP_AMOXOR_W, OP_AMOAND_W, OP_AMOOR_W,
+	OP_AMOMIN_W, OP_AMOMAX_W, OP_AMOMINU_W, OP_AMOMAXU_W,
+	OP_BEQ, OP_BNE, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU,
+	OP_JAL, OP_JALR,
+	OP_LUI, OP_AUIPC,
+	OP_ECALL, OP_EBREAK,
+	OP_INVALID,
+	NUM_OPS
+} op_t;
+
+/* decoded_inst_t.flags */
+#define DEC_READS_RS1	0x01
+#define DEC_READS_RS2	0x02
+#define DEC_WRITES_RD	0x04	/* never set for rd == x0 */
+#define DEC_LOAD	0x08
+#define DEC_STORE	0x10
+#define DEC_BRANCH	0x20
+#define DEC_JUMP	0x40
+#define DEC_VALID	0x80	/* predecoded entry is up to date */
+
+/* decoded_inst_t.cls: what the retired-instruction counters group by */
+typedef enum {
+	CLASS_ALU,	/* register-register */
+	CLASS_ALU_IMM,	/* register-immediate */
+	CLASS_LOAD,
+	CLASS_STORE,
+	CLASS_BRANCH,
+	CLASS_JUMP,
+	CLASS_UPPER,	/* LUI, AUIPC */
+	CLASS_MUL,	/* MUL, MULH, MULHSU, MULHU */
+	CLASS_DIV,	/* DIV, DIVU, REM, REMU */
+	CLASS_ATOMIC,	/* LR.W, SC.W, AMO*.W: DEC_LOAD and DEC_STORE both set */
+	CLASS_SYSTEM,	/* ECALL, EBREAK */
+	CLASS_OTHER,	/* not a recognised instruction */
+	NUM_INST_CLASSES
+} inst_class_t;
+
+struct decoded_inst {
+	uint8_t op;		/* op_t */
+	uint8_t flags;		/* DEC_* */
+	uint8_t cls;		/* inst_class_t */
+	uint8_t rd, rs1, rs2;	/* unused fields are 0 */
+	uint8_t size;		/* loads and stores: bytes accessed */
+	int32_t imm;		/* sign-extended; U-type already shifted into place */
+};
+
+/* does consumer read the register producer writes? */
+static inline bool reads_result_of(const decoded_inst_t *consumer, const decoded_inst_t *producer)
+{
+	return (producer->flags & DEC_WRITES_RD) &&
+			(((consumer->flags & DEC_READS_RS1) && consumer->rs1 == producer->rd) ||
+			((consumer->flags & DEC_READS_RS2) && consumer->rs2 == producer->rd));
+}
+
 typedef struct CPU_Pipeline_Reg_Struct{
 	uint32_t PC;
 	uint32_t IR;
@@ -58,30 +282,10 @@ typedef struct CPU_Pipeline_Reg_Struct{
 	uint32_t imm;
 	uint32_t ALUOutput;
 	uint32_t LMD;
-	
+	uint32_t NPC;		/* where fetch continued after this instruction (the prediction) */
+	decoded_inst_t dec;	/* IR, already decoded */
 } CPU_Pipeline_Reg;
 
-/***************************************************************/
-/* CPU State info.                                                                                                               */
-/***************************************************************/
-
-CPU_State CURRENT_STATE, NEXT_STATE;
-int RUN_FLAG;	/* run flag*/
-uint32_t INSTRUCTION_COUNT;
-uint32_t CYCLE_COUNT;
-uint32_t PROGRAM_SIZE; /*in words*/
-
-
-/***************************************************************/
-/* Pipeline Registers.                                                                                                        */
-/***************************************************************/
-CPU_Pipeline_Reg IF_ID;
-CPU_Pipeline_Reg ID_EX;
-CPU_Pipeline_Reg EX_MEM;
-CPU_Pipeline_Reg MEM_WB;
-
-char prog_file[32];
-
 /***************************************************************/
 /* Opcodes.                                                                                                        */
 /***************************************************************/
@@ -91,6 +295,16 @@ char prog_file[32];
 #define STORE_OPCODE 0b0100011
 #define BRANCH_OPCODE 0b1100011
 #define JUMP_OPCODE 0b1101111
+#define JALR_OPCODE 0b1100111
+#define LUI_OPCODE 0b0110111
+#define AUIPC_OPCODE 0b0010111
+#define SYSTEM_OPCODE 0b1110011
+#define AMO_OPCODE 0b0101111
+
+#define M_FUNCT7 0b0000001	/* R_OPCODE with this funct7: multiply/divide */
+
+/* ecall numbers (a7) the simulator understands */
+#define ECALL_EXIT 93
 
 
 /***************************************************************/
@@ -112,45 +326,440 @@ char prog_file[32];
 #define GET_FUNCT3(inst) (((inst) >> 12) & BIT_MASK_3)
 
 /***************************************************************/
-/* Data Hazard Help                                                                                                              */
+/* Trace levels                                                                                                              */
+/***************************************************************/
+typedef enum {
+	TRACE_NONE = MURISCV_TRACE_NONE,		/* nothing from the cycle loop */
+	TRACE_SUMMARY = MURISCV_TRACE_SUMMARY,	/* one summary line per run/sim */
+	TRACE_RETIRE = MURISCV_TRACE_RETIRE,	/* one line per retired instruction */
+	TRACE_CYCLE = MURISCV_TRACE_CYCLE	/* pipeline registers every cycle */
+} trace_level_t;
+
+/* binary pipeline trace writer (see mu-riscv-trace.h) */
+typedef struct {
+	FILE *file;		/* NULL when off */
+	uint8_t buf[1 << 16];
+	size_t len;
+	uint32_t prev[TRACE_NUM_FIELDS];
+	uint32_t next_cycle;
+	uint32_t since_keyframe;
+} btrace_t;
+
+/***************************************************************/
+/* Branch prediction                                                                                                */
+/***************************************************************/
+typedef enum {
+	BP_NOT_TAKEN,	/* static: always fall through */
+	BP_BTFN,	/* static: backward taken, forward not taken */
+	BP_BIMODAL,	/* 2-bit counters indexed by PC */
+	BP_GSHARE,	/* 2-bit counters indexed by PC xor global history */
+	NUM_BP_KINDS
+} bp_kind_t;
+
+#define BP_DEFAULT_TABLE_BITS MURISCV_BP_TABLE_BITS
+#define BP_MAX_TABLE_BITS 20
+
+typedef struct {
+	uint32_t tag;		/* full PC of the control instruction */
+	uint32_t target;
+	bool valid;
+} btb_entry_t;
+
+typedef struct {
+	bp_kind_t kind;
+	uint32_t table_bits;
+	uint8_t *counters;	/* 1 << table_bits 2-bit counters (bimodal/gshare) */
+	uint32_t history;	/* global outcome history, newest in bit 0 (gshare) */
+	uint32_t btb_entries;	/* 0 = no BTB: direct targets come from predecode */
+	btb_entry_t *btb;
+
+	/* statistics */
+	uint32_t branches;
+	uint32_t branch_mispredicts;
+	uint32_t jumps;
+	uint32_t jump_mispredicts;
+	uint32_t btb_hits;
+	uint32_t btb_lookups;
+	uint32_t flush_cycles;
+} branch_predictor_t;
+
+#define BRANCH_PENALTY 2	/* instructions squashed when EX redirects fetch */
+
+/* default EX latencies of the multi-cycle classes; every other class takes one cycle */
+#define MUL_DEFAULT_LATENCY MURISCV_MUL_LATENCY	/* pipelined-array multiplier */
+#define DIV_DEFAULT_LATENCY MURISCV_DIV_LATENCY	/* radix-2 iterative divider: one quotient bit per cycle */
+
+/***************************************************************/
+/* Caches (tag-only timing model, see mu-riscv-cache.c)                              */
+/***************************************************************/
+typedef enum {
+	REPL_LRU,
+	REPL_FIFO,
+	REPL_RANDOM,
+	NUM_CACHE_REPL
+} cache_repl_t;
+
+#define CACHE_DEFAULT_MISS_LATENCY 10
+
+typedef struct {
+	uint32_t tag;		/* line address (address >> line_shift) */
+	uint32_t stamp;		/* last use (LRU) or fill (FIFO) */
+	bool valid;
+	bool dirty;
+} cache_line_t;
+
+typedef struct cache {
+	const char *name;
+	bool enabled;		/* off: accesses cost nothing */
+	uint32_t size, assoc, line_size, num_sets;
+	uint32_t line_shift;
+	cache_repl_t repl;
+	bool write_back;	/* else write-through, no write-allocate */
+	uint32_t miss_latency;	/* cycles to get a line from the next level */
+	cache_line_t *lines;	/* num_sets x assoc */
+	uint32_t clock;
+	uint32_t rng;
+	struct cache *next;	/* NULL: memory */
+
+	/* statistics */
+	uint32_t reads, writes;
+	uint32_t read_misses, write_misses;
+	uint32_t evictions, writebacks;
+	uint32_t stall_cycles;
+} cache_t;
+
+/***************************************************************/
+/* Misaligned data accesses (address not a multiple of the size)           */
+/***************************************************************/
+typedef enum {
+	MISALIGNED_ALLOW,	/* done byte by byte at no extra cost */
+	MISALIGNED_PENALTY,	/* done, and MEM stalls MISALIGNED_PENALTY more cycles */
+	MISALIGNED_TRAP,	/* not done: the run stops before the instruction */
+	NUM_MISALIGNED_POLICIES
+} misaligned_policy_t;
+
+#define MISALIGNED_DEFAULT_PENALTY MURISCV_MISALIGNED_PENALTY
+
+/***************************************************************/
+/* Performance counters                                                                                        */
+/***************************************************************/
+typedef struct {
+	uint64_t retired[NUM_INST_CLASSES];
+	uint64_t load_use_stalls;	/* cycles ID held an instruction behind a load */
+	uint64_t writeback_stalls;	/* cycles ID held an instruction until its operands were written back (forwarding off) */
+	uint64_t ex_busy_stalls;	/* cycles EX held a multi-cycle instruction */
+	uint64_t forwarded_ex_mem;	/* operands taken from EX/MEM */
+	uint64_t forwarded_mem_wb;	/* operands taken from MEM/WB */
+	uint64_t bubbles;		/* cycles WB had nothing to retire */
+	uint64_t icache_stall_cycles;	/* bubbles IF sent waiting for the instruction cache */
+	uint64_t dcache_stall_cycles;	/* cycles frozen waiting for the data cache */
+	uint64_t fetches;
+	uint64_t loads;
+	uint64_t stores;
+	uint64_t misaligned;	/* loads and stores not aligned to their size */
+	uint64_t atomic_waits;	/* atomics that ended the hart's quantum to wait for the barrier */
+} perf_counters_t;
+
+/***************************************************************/
+/* Retired-instruction records (see mu-riscv-split.c)                                     */
+/***************************************************************/
+typedef struct {
+	uint32_t pc;
+	uint32_t ir;
+	uint32_t address;	/* loads, stores and atomics: the address accessed */
+	uint32_t result;	/* what rd got; stores: the value stored; branches: 1 if taken */
+	uint32_t next_pc;	/* where execution went after it */
+	decoded_inst_t dec;
+} retire_record_t;
+
+/* first bytes of a checkpoint file (layout in mu-riscv.c) and of a sparse memory image (mu-riscv-mdiff.c) */
+#define CHECKPOINT_MAGIC "MURVCKP1"
+#define MEM_IMAGE_MAGIC "MURVMEM1"
+
+/***************************************************************/
+/* Functional execution engines (fast-forward)                                                */
 /***************************************************************/
-static int ENABLE_FORWARDING = 0;
-static uint8_t previous_rd = 0;
-static uint8_t double_previous_rd = 0;
-static bool last_lw = false;
-static bool double_last_lw = true;
-static bool bubble = false;
+typedef enum {
+	ENGINE_STEP,		/* step_functional(): decode_fetched + alu_execute per instruction */
+	ENGINE_THREADED,	/* direct-threaded handler stream, see mu-riscv-threaded.c */
+	ENGINE_JIT,		/* basic blocks translated to x86-64, see mu-riscv-jit.c */
+	NUM_ENGINES
+} engine_t;
+
+typedef struct threaded_inst threaded_inst_t;
+typedef struct jit_state jit_state_t;
+
+/***************************************************************/
+/* Multi-hart machines (see mu-riscv-smp.c)                                                  */
+/***************************************************************/
+typedef struct smp smp_t;
+
+#define SMP_MAX_HARTS MURISCV_MAX_HARTS
+#define SMP_DEFAULT_QUANTUM MURISCV_QUANTUM
+#define SMP_HART_STACK MURISCV_HART_STACK
+
+/***************************************************************/
+/* Symbols from an ELF program (see mu-riscv-elf.c)                                           */
+/***************************************************************/
+typedef struct {
+	char *name;
+	uint32_t value;
+	uint32_t size;
+} elf_symbol_t;
+
+/***************************************************************/
+/* Simulator context: everything one simulation owns                                              */
+/***************************************************************/
+typedef struct mu_sim {
+	/* CPU State info. */
+	CPU_State CURRENT_STATE, NEXT_STATE;
+	CPU_State INITIAL_STATE;	/* what load_program() set up; reset returns here */
+	int EXIT_CODE;	/* a0 of the exit ecall, -1 if the program did not exit */
+	int RUN_FLAG;	/* run flag*/
+	uint32_t INSTRUCTION_COUNT;
+	uint32_t CYCLE_COUNT;
+	uint32_t PROGRAM_SIZE; /*in words*/
+
+	/* Pipeline Registers. */
+	CPU_Pipeline_Reg IF_ID;
+	CPU_Pipeline_Reg ID_EX;
+	CPU_Pipeline_Reg EX_MEM;
+	CPU_Pipeline_Reg MEM_WB;
+
+	/* Data Hazard Help */
+	int ENABLE_FORWARDING;
+	bool bubble;
+	bool flush;	/* EX redirected fetch this cycle: squash IF and ID */
+
+	branch_predictor_t bp;
+
+	cache_t l1i, l1d, l2;
+	uint32_t fetch_stall;	/* bubbles IF still owes an instruction cache miss */
+	uint32_t mem_stall;	/* cycles the whole pipeline stays frozen on a data cache miss */
+
+	/* cycles an instruction of each class spends in EX (1: leaves after one cycle) */
+	uint32_t EX_LATENCY[NUM_INST_CLASSES];
+	uint32_t ex_busy;	/* cycles the instruction in ID/EX still needs in EX; 0: none started */
+
+	misaligned_policy_t MISALIGNED;
+	uint32_t MISALIGNED_PENALTY;
+
+	/* RV32A: word reserved by LR.W; an SC.W to it succeeds while RESERVED */
+	bool RESERVED;
+	uint32_t RESERVATION;
+
+	uint32_t HART_ID;
+	smp_t *smp;	/* the machine, on every hart of one with more than one */
+	bool mem_wait;	/* MEM holds an atomic until the quantum barrier performs it */
+
+	perf_counters_t perf;
+	prof_t prof;	/* host time per stage, only collected in MU_PROFILE builds */
+	debug_state_t debug;
+
+	engine_t ENGINE;	/* what fast_forward executes with */
+	threaded_inst_t *threaded;	/* translated text, PROGRAM_SIZE + 1 entries */
+	uint32_t threaded_version;	/* mem->text_version it was translated from */
+	jit_state_t *jit;	/* code cache, created on first use */
+
+	trace_level_t TRACE_LEVEL;
+	btrace_t btrace;
+
+	char prog_file[256];
+	elf_symbol_t *symbols;	/* sorted by address; NULL for hex programs */
+	uint32_t num_symbols;
+	mu_mem_t *mem;
+	bool owns_mem;
+} mu_sim_t;
 
 /***************************************************************/
 /* Function Declerations.                                                                                                */
 /***************************************************************/
-void help();
-uint32_t mem_read_32(uint32_t address);
-void mem_write_32(uint32_t address, uint32_t value);
-void cycle();
-void run(int num_cycles);
-void runAll();
-void mdump(uint32_t start, uint32_t stop) ;
-void rdump();
-void handle_command();
-void reset();
-void init_memory();
-void load_program();
-void handle_pipeline();
-void DetectHazardsAndForward();
-void WB();
-void MEM();
-void EX();
-void ID();
-void IF();
-void show_pipeline();/*IMPLEMENT THIS*/
-void initialize();
-void print_program();
+int mem_init(mu_mem_t *mem);
+void mem_free(mu_mem_t *mem);
+uint32_t mem_read_8(mu_mem_t *mem, uint32_t address);
+uint32_t mem_read_16(mu_mem_t *mem, uint32_t address);
+uint32_t mem_read_32(mu_mem_t *mem, uint32_t address);
+void mem_write_8(mu_mem_t *mem, uint32_t address, uint32_t value);
+void mem_write_16(mu_mem_t *mem, uint32_t address, uint32_t value);
+void mem_write_32(mu_mem_t *mem, uint32_t address, uint32_t value);
+const uint8_t *mem_peek_page(mu_mem_t *mem, uint32_t address);
+void mem_snapshot_pristine(mu_mem_t *mem);
+void mem_restore_pristine(mu_mem_t *mem);
+void invalidate_decoded(mu_mem_t *mem, uint32_t address, uint32_t len);
+decoded_inst_t decode_fetched(mu_mem_t *mem, uint32_t pc, uint32_t instruction);
+
+int initialize(mu_sim_t *sim, mu_mem_t *mem);
+void finalize(mu_sim_t *sim);
+void cycle(mu_sim_t *sim);
+void cycle_traced(mu_sim_t *sim);
+void run(mu_sim_t *sim, int num_cycles);
+void runAll(mu_sim_t *sim);
+void mdump(mu_sim_t *sim, uint32_t start, uint32_t stop) ;
+void rdump(mu_sim_t *sim);
+void reset(mu_sim_t *sim);
+void reset_hart(mu_sim_t *sim);
+int load_program(mu_sim_t *sim);
+int load_elf(mu_sim_t *sim);
+void free_symbols(mu_sim_t *sim);
+const elf_symbol_t *find_symbol(mu_sim_t *sim, const char *name);
+const elf_symbol_t *symbol_at(mu_sim_t *sim, uint32_t address);
+void mem_write_block(mu_mem_t *mem, uint32_t address, const uint8_t *data, uint32_t len);
+void handle_pipeline(mu_sim_t *sim);
+void DetectHazardsAndForward(mu_sim_t *sim);
+void WB(mu_sim_t *sim);
+void system_call(mu_sim_t *sim, CPU_State *state, const decoded_inst_t *dec);
+void MEM(mu_sim_t *sim);
+void EX(mu_sim_t *sim);
+void ID(mu_sim_t *sim);
+void IF(mu_sim_t *sim);
+decoded_inst_t decode(uint32_t instruction);
+void predecode_program(mu_sim_t *sim);
+uint32_t alu_execute(const decoded_inst_t *dec, uint32_t pc, uint32_t a, uint32_t b);
+uint32_t muldiv_execute(uint8_t op, uint32_t a, uint32_t b);
+uint32_t amo_execute(mu_sim_t *sim, const decoded_inst_t *dec, uint32_t address, uint32_t operand);
+int set_ex_latency(mu_sim_t *sim, const char *cls, uint32_t cycles);
+void show_ex_latencies(mu_sim_t *sim);
+bool branch_taken(const decoded_inst_t *dec, uint32_t a, uint32_t b);
+bool pc_in_program(mu_sim_t *sim, uint32_t pc);
+bool step_record(mu_sim_t *sim, retire_record_t *rec);
+void step_functional(mu_sim_t *sim);
+bool misaligned_trap(mu_sim_t *sim, uint32_t pc, uint32_t address, const decoded_inst_t *dec);
+int set_misaligned_policy(mu_sim_t *sim, const char *policy);
+const char *misaligned_policy_name(mu_sim_t *sim);
+void show_misaligned_policy(mu_sim_t *sim);
+void drain_pipeline(mu_sim_t *sim);
+int parse_engine(const char *name);
+const char *engine_name(engine_t engine);
+uint32_t engine_run(mu_sim_t *sim, uint32_t max_steps, bool until_pc, uint32_t stop_pc);
+uint32_t threaded_run(mu_sim_t *sim, uint32_t max_steps, bool until_pc, uint32_t stop_pc);
+void threaded_free(mu_sim_t *sim);
+bool jit_available(mu_sim_t *sim);
+uint32_t jit_run(mu_sim_t *sim, uint32_t max_steps, bool until_pc, uint32_t stop_pc);
+void jit_free(mu_sim_t *sim);
+void fast_forward(mu_sim_t *sim, uint32_t num_instructions);
+void fast_forward_until(mu_sim_t *sim, uint32_t pc);
+int checkpoint_save(mu_sim_t *sim, const char *path);
+int checkpoint_restore(mu_sim_t *sim, const char *path);
+int checkpoint_read_memory(const char *path, mu_mem_t *mem);
+void show_pipeline(mu_sim_t *sim);
+void show_retired(mu_sim_t *sim, CPU_Pipeline_Reg *retired);
+void show_run_summary(mu_sim_t *sim, uint32_t start_cycles, uint32_t start_instructions);
+int parse_trace_level(const char *name);
+int btrace_open(mu_sim_t *sim, const char *path);
+void btrace_close(mu_sim_t *sim);
+void btrace_cycle(mu_sim_t *sim);
+void print_program(mu_sim_t *sim);
+int bp_configure(mu_sim_t *sim, bp_kind_t kind, uint32_t table_bits, uint32_t btb_entries);
+void bp_reset(mu_sim_t *sim);
+void bp_free(mu_sim_t *sim);
+uint32_t bp_predict(mu_sim_t *sim, uint32_t pc, const decoded_inst_t *dec);
+void bp_update(mu_sim_t *sim, uint32_t pc, const decoded_inst_t *dec, bool taken, uint32_t target);
+int parse_bp_kind(const char *name);
+void show_branch_stats(mu_sim_t *sim);
+int cache_configure(cache_t *cache, const char *spec);
+void cache_reset(cache_t *cache);
+void cache_free(cache_t *cache);
+void cache_link(mu_sim_t *sim);
+cache_t *cache_by_name(mu_sim_t *sim, const char *name);
+uint32_t cache_access(cache_t *cache, uint32_t address, bool write);
+void show_cache_stats(mu_sim_t *sim);
+void show_stats(mu_sim_t *sim);
+void prof_reset(mu_sim_t *sim);
+int show_profile(mu_sim_t *sim);
+int breakpoint_add(mu_sim_t *sim, uint32_t pc);
+int breakpoint_remove(mu_sim_t *sim, uint32_t pc);
+void breakpoints_clear(mu_sim_t *sim);
+int watchpoint_add(mu_mem_t *mem, uint32_t address, uint32_t len, int kind);
+int watchpoint_remove(mu_mem_t *mem, uint32_t address, uint32_t len, int kind);
+void watchpoints_clear(mu_mem_t *mem);
+void watch_access(mu_mem_t *mem, uint32_t address, uint32_t len, bool write);
+void show_debug_points(mu_sim_t *sim);
+uint32_t debug_pc(mu_sim_t *sim);
+uint32_t debug_reg(mu_sim_t *sim, int reg);
+void debug_squash(mu_sim_t *sim);
+void debug_reset(mu_sim_t *sim);
+bool debug_break(mu_sim_t *sim);
+bool debug_break_at(mu_sim_t *sim, uint32_t pc);
+bool debug_watch(mu_sim_t *sim);
+stop_reason_t debug_resume(mu_sim_t *sim, bool step, bool (*interrupted)(void *), void *arg);
+int gdb_serve(mu_sim_t *sim, const char *where);
+int write_stats_json(mu_sim_t *sim, const char *path);
+int smp_configure(mu_sim_t *sim, uint32_t num_harts, uint32_t quantum);
+void smp_reset(mu_sim_t *sim);
+void smp_free(mu_sim_t *sim);
+uint32_t smp_run(mu_sim_t *sim, uint32_t num_cycles);
+bool smp_running(mu_sim_t *sim);
+uint32_t smp_num_harts(mu_sim_t *sim);
+mu_sim_t *smp_hart(mu_sim_t *sim, uint32_t n);
+uint32_t smp_load(mu_sim_t *sim, uint32_t address, uint32_t size);
+void smp_store(mu_sim_t *sim, uint32_t address, uint32_t size, uint32_t value);
+bool smp_atomic_done(mu_sim_t *sim, uint32_t address, uint32_t operand);
+uint32_t smp_atomic_result(mu_sim_t *sim);
+void show_harts(mu_sim_t *sim);
+int bbv_profile(mu_sim_t *sim, const char *path, uint32_t interval);
+int simpoint_pick(const char *bbv_path, uint32_t max_k, const char *simpoints_path, const char *weights_path);
+int simpoint_sample(mu_sim_t *sim, const char *simpoints_path, const char *weights_path, uint32_t interval,
+		uint32_t warmup, double *cpi);
+int split_run(mu_sim_t *sim, uint32_t num_instructions, const char *path);
+int split_record(mu_sim_t *sim, const char *path, uint32_t num_instructions);
+int split_replay(mu_sim_t *sim, const char *path);
+int mem_diff(mu_sim_t *sim, const char *path, uint32_t start, uint32_t stop, uint32_t max_report);
+int mem_image_save(mu_sim_t *sim, const char *path, uint32_t start, uint32_t stop);
+
+/* breakpoints or watchpoints set: runs take the checked loop */
+static inline bool debug_armed(mu_sim_t *sim)
+{
+	return sim->debug.num_breakpoints > 0 || sim->mem->num_watchpoints > 0;
+}
+
+static inline bool mem_watched(mu_mem_t *mem, uint32_t address, uint32_t len)
+{
+	uint32_t first = (address >> MEM_PAGE_SHIFT) % WATCH_FILTER_BITS;
+	uint32_t last = ((address + len - 1) >> MEM_PAGE_SHIFT) % WATCH_FILTER_BITS;
+	return ((mem->watch_filter[first / 64] >> (first % 64)) | (mem->watch_filter[last / 64] >> (last % 64))) & 1;
+}
+
+/* data accesses made by the program (size 1, 2 or 4 bytes) as seen by watchpoints.
+ * The loader, the debugger and instruction fetch use the plain functions. */
+static inline uint32_t mem_load(mu_mem_t *mem, uint32_t address, uint32_t size)
+{
+	if (mem_watched(mem, address, size)) {
+		watch_access(mem, address, size, false);
+	}
+	switch (size) {
+		case 1:		return mem_read_8(mem, address);
+		case 2:		return mem_read_16(mem, address);
+		default:	return mem_read_32(mem, address);
+	}
+}
+
+static inline void mem_store(mu_mem_t *mem, uint32_t address, uint32_t size, uint32_t value)
+{
+	if (mem_watched(mem, address, size)) {
+		watch_access(mem, address, size, true);
+	}
+	switch (size) {
+		case 1:		mem_write_8(mem, address, value); break;
+		case 2:		mem_write_16(mem, address, value); break;
+		default:	mem_write_32(mem, address, value); break;
+	}
+}
+
+/* register value of a loaded byte, halfword or word */
+static inline uint32_t load_extend(uint8_t op, uint32_t value)
+{
+	switch (op) {
+		case OP_LB:	return (int32_t)(int8_t)value;
+		case OP_LH:	return (int32_t)(int16_t)value;
+		default:	return value;
+	}
+}
 
 // print helpers
 void print_instruction(uint32_t);
 void print_command(uint32_t);
 void handle_r_print(uint32_t bincmd);
+void handle_a_print(uint32_t bincmd);
 void handle_s_print(uint32_t bincmd);
 void handle_i_print(uint32_t bincmd);
 void handle_b_print(uint32_t bincmd);
@@ -161,3 +770,4 @@ void print_i_type1_cmd(char* cmd_name, uint8_t rd, uint8_t rs1, uint16_t imm);
 void print_i_type2_cmd(char* cmd_name, uint8_t rd, uint8_t rs1, uint16_t imm);
 void print_b_cmd(char* cmd_name, uint8_t rs1, uint8_t rs2, uint16_t imm);
 
+#endif
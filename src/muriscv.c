@@ -0,0 +1,444 @@
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* libmuriscv: thin public wrappers over the simulator core          */
+/***************************************************************/
+
+muriscv_t *muriscv_create(void) {
+	muriscv_t *sim = malloc(sizeof(*sim));
+	if (sim == NULL) {
+		printf("Error: Can't allocate simulator\n");
+		return NULL;
+	}
+	if (initialize(sim, NULL) != 0) {
+		free(sim);
+		return NULL;
+	}
+	return sim;
+}
+
+void muriscv_destroy(muriscv_t *sim) {
+	if (sim == NULL) {
+		return;
+	}
+	finalize(sim);
+	free(sim);
+}
+
+int muriscv_load(muriscv_t *sim, const char *program) {
+	if (strlen(program) >= sizeof(sim->prog_file)) {
+		printf("Error: Program path too long: %s\n", program);
+		return -1;
+	}
+	if (sim->PROGRAM_SIZE == 0) {
+		strcpy(sim->prog_file, program);
+		return load_program(sim);
+	}
+
+	/* a second program goes into a scratch context with empty memory and replaces
+	 * the old one only once it has loaded; a failed load leaves the old one as it was */
+	mu_sim_t *scratch = malloc(sizeof(*scratch));
+	if (scratch == NULL || initialize(scratch, NULL) != 0) {
+		printf("Error: Can't allocate simulator\n");
+		free(scratch);
+		return -1;
+	}
+	scratch->TRACE_LEVEL = sim->TRACE_LEVEL;
+	strcpy(scratch->prog_file, program);
+	if (load_program(scratch) != 0) {
+		finalize(scratch);
+		free(scratch);
+		return -1;
+	}
+
+	/* the mu_mem_t itself stays (harts share it) and takes the new contents; the old
+	 * contents go to the scratch context and are freed with it. text_version carries
+	 * on so no translation of the old text can look current. */
+	mu_mem_t old = *sim->mem;
+	*sim->mem = *scratch->mem;
+	*scratch->mem = old;
+	sim->mem->text_version += old.text_version + 1;
+	/* breakpoints stay in sim->debug; the watchpoints move over with the memory */
+	sim->mem->watchpoints = old.watchpoints;
+	sim->mem->num_watchpoints = old.num_watchpoints;
+	memcpy(sim->mem->watch_filter, old.watch_filter, sizeof(old.watch_filter));
+	scratch->mem->watchpoints = NULL;
+	scratch->mem->num_watchpoints = 0;
+
+	free_symbols(sim);
+	sim->symbols = scratch->symbols;
+	sim->num_symbols = scratch->num_symbols;
+	scratch->symbols = NULL;
+	scratch->num_symbols = 0;
+	strcpy(sim->prog_file, program);
+	sim->PROGRAM_SIZE = scratch->PROGRAM_SIZE;
+	sim->INITIAL_STATE = scratch->INITIAL_STATE;
+	threaded_free(sim);
+	jit_free(sim);
+	finalize(scratch);
+	free(scratch);
+	reset(sim);
+	return 0;
+}
+
+void muriscv_reset(muriscv_t *sim) {
+	reset(sim);
+}
+
+uint32_t muriscv_step(muriscv_t *sim, uint32_t num_cycles) {
+	if (sim->smp != NULL) {
+		return smp_run(sim, num_cycles);
+	}
+	uint32_t start = sim->CYCLE_COUNT;
+	run(sim, num_cycles > INT32_MAX ? INT32_MAX : (int)num_cycles);
+	return sim->CYCLE_COUNT - start;
+}
+
+uint32_t muriscv_run(muriscv_t *sim) {
+	if (sim->smp != NULL) {
+		return smp_run(sim, UINT32_MAX);
+	}
+	uint32_t start = sim->CYCLE_COUNT;
+	runAll(sim);
+	return sim->CYCLE_COUNT - start;
+}
+
+int muriscv_running(muriscv_t *sim) {
+	return sim->smp != NULL ? smp_running(sim) : sim->RUN_FLAG;
+}
+
+void muriscv_fast_forward(muriscv_t *sim, uint32_t num_instructions) {
+	fast_forward(sim, num_instructions);
+}
+
+void muriscv_fast_forward_until(muriscv_t *sim, uint32_t pc) {
+	fast_forward_until(sim, pc);
+}
+
+uint32_t muriscv_read_reg(muriscv_t *sim, int reg) {
+	if (reg >= 0 && reg < RISCV_REGS) {
+		return sim->CURRENT_STATE.REGS[reg];
+	}
+	switch (reg) {
+		case MURISCV_REG_PC: return sim->CURRENT_STATE.PC;
+		case MURISCV_REG_HI: return sim->CURRENT_STATE.HI;
+		case MURISCV_REG_LO: return sim->CURRENT_STATE.LO;
+	}
+	return 0;
+}
+
+void muriscv_write_reg(muriscv_t *sim, int reg, uint32_t value) {
+	if (reg == 0) {
+		return;	// x0 is hardwired to zero
+	}
+	if (reg > 0 && reg < RISCV_REGS) {
+		sim->CURRENT_STATE.REGS[reg] = value;
+		sim->NEXT_STATE.REGS[reg] = value;
+		return;
+	}
+	switch (reg) {
+		case MURISCV_REG_PC:
+			sim->CURRENT_STATE.PC = value;
+			sim->NEXT_STATE.PC = value;
+			break;
+		case MURISCV_REG_HI:
+			sim->CURRENT_STATE.HI = value;
+			sim->NEXT_STATE.HI = value;
+			break;
+		case MURISCV_REG_LO:
+			sim->CURRENT_STATE.LO = value;
+			sim->NEXT_STATE.LO = value;
+			break;
+		default:
+			printf("Error: No register %d\n", reg);
+			break;
+	}
+}
+
+uint32_t muriscv_read_mem(muriscv_t *sim, uint32_t address) {
+	return mem_read_32(sim->mem, address);
+}
+
+void muriscv_write_mem(muriscv_t *sim, uint32_t address, uint32_t value) {
+	mem_write_32(sim->mem, address, value);
+}
+
+uint32_t muriscv_cycles(muriscv_t *sim) {
+	return sim->CYCLE_COUNT;
+}
+
+uint32_t muriscv_instructions(muriscv_t *sim) {
+	return sim->INSTRUCTION_COUNT;
+}
+
+int muriscv_exit_code(muriscv_t *sim) {
+	return sim->EXIT_CODE;
+}
+
+int muriscv_lookup_symbol(muriscv_t *sim, const char *name, uint32_t *address) {
+	const elf_symbol_t *symbol = find_symbol(sim, name);
+	if (symbol == NULL) {
+		return -1;
+	}
+	*address = symbol->value;
+	return 0;
+}
+
+void muriscv_set_forwarding(muriscv_t *sim, int enable) {
+	sim->ENABLE_FORWARDING = enable != 0;
+}
+
+int muriscv_forwarding(muriscv_t *sim) {
+	return sim->ENABLE_FORWARDING;
+}
+
+void muriscv_set_trace_level(muriscv_t *sim, int level) {
+	sim->TRACE_LEVEL = level;
+}
+
+int muriscv_parse_trace_level(const char *name) {
+	return parse_trace_level(name);
+}
+
+int muriscv_trace_file(muriscv_t *sim, const char *path) {
+	if (path == NULL) {
+		btrace_close(sim);
+		return 0;
+	}
+	return btrace_open(sim, path);
+}
+
+int muriscv_set_engine(muriscv_t *sim, const char *engine) {
+	int kind = parse_engine(engine);
+	if (kind < 0) {
+		printf("Error: Unknown engine %s (step, threaded, jit)\n", engine);
+		return -1;
+	}
+	sim->ENGINE = kind;
+	return 0;
+}
+
+const char *muriscv_engine(muriscv_t *sim) {
+	return engine_name(sim->ENGINE);
+}
+
+int muriscv_add_breakpoint(muriscv_t *sim, uint32_t pc) {
+	return breakpoint_add(sim, pc);
+}
+
+int muriscv_remove_breakpoint(muriscv_t *sim, uint32_t pc) {
+	return breakpoint_remove(sim, pc);
+}
+
+void muriscv_clear_breakpoints(muriscv_t *sim) {
+	breakpoints_clear(sim);
+}
+
+int muriscv_add_watchpoint(muriscv_t *sim, uint32_t address, uint32_t len, int kind) {
+	return watchpoint_add(sim->mem, address, len, kind);
+}
+
+int muriscv_remove_watchpoint(muriscv_t *sim, uint32_t address) {
+	return watchpoint_remove(sim->mem, address, 0, 0) < 0 ? -1 : 0;
+}
+
+void muriscv_clear_watchpoints(muriscv_t *sim) {
+	watchpoints_clear(sim->mem);
+}
+
+void muriscv_show_breakpoints(muriscv_t *sim) {
+	show_debug_points(sim);
+}
+
+int muriscv_gdb_serve(muriscv_t *sim, const char *where) {
+	return gdb_serve(sim, where);
+}
+
+int muriscv_set_predictor(muriscv_t *sim, const char *kind, int table_bits, int btb_entries) {
+	int bp_kind = parse_bp_kind(kind);
+	if (bp_kind < 0) {
+		printf("Error: Unknown branch predictor %s (not-taken, btfn, bimodal, gshare)\n", kind);
+		return -1;
+	}
+	if (table_bits < 0 || btb_entries < 0) {
+		printf("Error: Bad branch predictor size\n");
+		return -1;
+	}
+	return bp_configure(sim, bp_kind, table_bits, btb_entries);
+}
+
+void muriscv_branch_stats(muriscv_t *sim, muriscv_branch_stats_t *stats) {
+	stats->branches = sim->bp.branches;
+	stats->branch_mispredicts = sim->bp.branch_mispredicts;
+	stats->jumps = sim->bp.jumps;
+	stats->jump_mispredicts = sim->bp.jump_mispredicts;
+	stats->flush_cycles = sim->bp.flush_cycles;
+}
+
+int muriscv_set_cache(muriscv_t *sim, const char *level, const char *spec) {
+	cache_t *cache = cache_by_name(sim, level);
+	if (cache == NULL) {
+		printf("Error: Unknown cache level %s (l1i, l1d, l2)\n", level);
+		return -1;
+	}
+	if (spec == NULL || strcmp(spec, "off") == 0) {
+		cache_free(cache);
+	} else if (cache_configure(cache, spec) != 0) {
+		return -1;
+	}
+	cache_link(sim);
+	return 0;
+}
+
+int muriscv_cache_stats(muriscv_t *sim, const char *level, muriscv_cache_stats_t *stats) {
+	cache_t *cache = cache_by_name(sim, level);
+	if (cache == NULL) {
+		return -1;
+	}
+	stats->reads = cache->reads;
+	stats->writes = cache->writes;
+	stats->read_misses = cache->read_misses;
+	stats->write_misses = cache->write_misses;
+	stats->evictions = cache->evictions;
+	stats->writebacks = cache->writebacks;
+	stats->stall_cycles = cache->stall_cycles;
+	return 0;
+}
+
+int muriscv_set_latency(muriscv_t *sim, const char *cls, int cycles) {
+	if (cycles < 1) {
+		printf("Error: EX latency must be at least 1 cycle\n");
+		return -1;
+	}
+	return set_ex_latency(sim, cls, cycles);
+}
+
+void muriscv_show_latencies(muriscv_t *sim) {
+	show_ex_latencies(sim);
+}
+
+int muriscv_set_misaligned(muriscv_t *sim, const char *policy) {
+	return set_misaligned_policy(sim, policy);
+}
+
+void muriscv_show_misaligned(muriscv_t *sim) {
+	show_misaligned_policy(sim);
+}
+
+int muriscv_set_harts(muriscv_t *sim, int num_harts, int quantum) {
+	if (num_harts < 1 || quantum < 1) {
+		printf("Error: Bad number of harts or quantum\n");
+		return -1;
+	}
+	return smp_configure(sim, num_harts, quantum);
+}
+
+int muriscv_harts(muriscv_t *sim) {
+	return smp_num_harts(sim);
+}
+
+muriscv_t *muriscv_hart(muriscv_t *sim, int hart) {
+	return hart < 0 ? NULL : smp_hart(sim, hart);
+}
+
+void muriscv_show_harts(muriscv_t *sim) {
+	show_harts(sim);
+}
+
+int muriscv_bbv_profile(muriscv_t *sim, const char *path, uint32_t interval) {
+	return bbv_profile(sim, path, interval);
+}
+
+int muriscv_simpoints(const char *bbv_path, int max_k, const char *simpoints_path, const char *weights_path) {
+	return simpoint_pick(bbv_path, max_k < 1 ? 0 : max_k, simpoints_path, weights_path);
+}
+
+int muriscv_sample(muriscv_t *sim, const char *simpoints_path, const char *weights_path, uint32_t interval,
+		uint32_t warmup, double *cpi) {
+	return simpoint_sample(sim, simpoints_path, weights_path, interval, warmup, cpi);
+}
+
+int muriscv_split(muriscv_t *sim, uint32_t num_instructions, const char *path) {
+	return split_run(sim, num_instructions ? num_instructions : UINT32_MAX, path);
+}
+
+int muriscv_record(muriscv_t *sim, const char *path, uint32_t num_instructions) {
+	return split_record(sim, path, num_instructions ? num_instructions : UINT32_MAX);
+}
+
+int muriscv_replay(muriscv_t *sim, const char *path) {
+	return split_replay(sim, path);
+}
+
+int muriscv_save(muriscv_t *sim, const char *path) {
+	return checkpoint_save(sim, path);
+}
+
+int muriscv_restore(muriscv_t *sim, const char *path) {
+	return checkpoint_restore(sim, path);
+}
+
+int muriscv_diff_mem(muriscv_t *sim, const char *path, uint32_t start, uint32_t stop, uint32_t max_report) {
+	return mem_diff(sim, path, start, stop, max_report);
+}
+
+int muriscv_save_mem(muriscv_t *sim, const char *path, uint32_t start, uint32_t stop) {
+	return mem_image_save(sim, path, start, stop);
+}
+
+void muriscv_dump_regs(muriscv_t *sim) {
+	rdump(sim);
+}
+
+void muriscv_dump_mem(muriscv_t *sim, uint32_t start, uint32_t stop) {
+	mdump(sim, start, stop);
+}
+
+void muriscv_show_pipeline(muriscv_t *sim) {
+	show_pipeline(sim);
+}
+
+void muriscv_print_program(muriscv_t *sim) {
+	print_program(sim);
+}
+
+void muriscv_show_branch_stats(muriscv_t *sim) {
+	show_branch_stats(sim);
+}
+
+void muriscv_show_cache_stats(muriscv_t *sim) {
+	show_cache_stats(sim);
+}
+
+void muriscv_show_stats(muriscv_t *sim) {
+	show_stats(sim);
+}
+
+int muriscv_show_profile(muriscv_t *sim) {
+	return show_profile(sim);
+}
+
+void muriscv_reset_profile(muriscv_t *sim) {
+	prof_reset(sim);
+}
+
+int muriscv_write_stats_json(muriscv_t *sim, const char *path) {
+	return write_stats_json(sim, path);
+}
+
+/* quotes, backslashes and control characters escaped */
+void muriscv_json_string(FILE *fp, const char *text) {
+	fputc('"', fp);
+	for (; *text != '\0'; text++) {
+		if (*text == '"' || *text == '\\') {
+			fprintf(fp, "\\%c", *text);
+		} else if (*text == '\t') {
+			fprintf(fp, "\\t");
+		} else if ((unsigned char)*text < 0x20) {
+			fprintf(fp, "\\u%04x", *text);
+		} else {
+			fputc(*text, fp);
+		}
+	}
+	fputc('"', fp);
+}
@@ -0,0 +1,210 @@
+#ifndef MURISCV_H
+#define MURISCV_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/***************************************************************/
+/* libmuriscv: embeddable MU-RISCV simulator                                                           */
+/***************************************************************/
+/*
+ * Every simulation lives in its own muriscv_t, so a process can host as many
+ * as it likes. A single muriscv_t must only be used by one thread at a time.
+ *
+ *	muriscv_t *sim = muriscv_create();
+ *	if (muriscv_load(sim, "inputs/testPipeline1.in") == 0) {
+ *		muriscv_run(sim);
+ *		printf("x2 = %u\n", muriscv_read_reg(sim, 2));
+ *	}
+ *	muriscv_destroy(sim);
+ *
+ * Unless stated otherwise, functions returning int return 0 on success and
+ * -1 on failure (after printing the reason).
+ */
+typedef struct mu_sim muriscv_t;
+
+/* register numbers accepted by muriscv_read_reg/muriscv_write_reg besides x0-x31 */
+#define MURISCV_REG_PC 32
+#define MURISCV_REG_HI 33
+#define MURISCV_REG_LO 34
+
+/* how much the simulator prints while running */
+#define MURISCV_TRACE_NONE	0	/* nothing */
+#define MURISCV_TRACE_SUMMARY	1	/* one summary line per run */
+#define MURISCV_TRACE_RETIRE	2	/* one line per retired instruction */
+#define MURISCV_TRACE_CYCLE	3	/* pipeline registers every cycle (default) */
+
+/* lifetime */
+muriscv_t *muriscv_create(void);
+void muriscv_destroy(muriscv_t *sim);
+/* ELF32 RISC-V executable or hex listing. Loading another program starts it from empty
+ * memory and a reset pipeline, keeping breakpoints and watchpoints; if it fails to load,
+ * the old program stays loaded as it was. */
+int muriscv_load(muriscv_t *sim, const char *program);
+void muriscv_reset(muriscv_t *sim);
+
+/* execution; step/run return the number of cycles simulated */
+uint32_t muriscv_step(muriscv_t *sim, uint32_t num_cycles);
+uint32_t muriscv_run(muriscv_t *sim);
+int muriscv_running(muriscv_t *sim);
+void muriscv_fast_forward(muriscv_t *sim, uint32_t num_instructions);
+void muriscv_fast_forward_until(muriscv_t *sim, uint32_t pc);
+
+/* state */
+uint32_t muriscv_read_reg(muriscv_t *sim, int reg);
+void muriscv_write_reg(muriscv_t *sim, int reg, uint32_t value);	/* writes to x0 are ignored */
+uint32_t muriscv_read_mem(muriscv_t *sim, uint32_t address);
+void muriscv_write_mem(muriscv_t *sim, uint32_t address, uint32_t value);
+uint32_t muriscv_cycles(muriscv_t *sim);
+uint32_t muriscv_instructions(muriscv_t *sim);
+int muriscv_exit_code(muriscv_t *sim);	/* a0 of the exit ecall (a7=93), -1 if the program has not exited */
+int muriscv_lookup_symbol(muriscv_t *sim, const char *name, uint32_t *address);	/* ELF programs only */
+
+/* configuration */
+/* forwarding (default on): without it an instruction waits in ID until its operands are written back */
+void muriscv_set_forwarding(muriscv_t *sim, int enable);
+int muriscv_forwarding(muriscv_t *sim);
+void muriscv_set_trace_level(muriscv_t *sim, int level);
+int muriscv_parse_trace_level(const char *name);	/* -1 if unknown */
+int muriscv_trace_file(muriscv_t *sim, const char *path);	/* NULL stops tracing */
+/* functional engine used by fast-forward: "threaded" (default), "jit" (x86-64 Linux hosts) or "step" (reference) */
+int muriscv_set_engine(muriscv_t *sim, const char *engine);
+const char *muriscv_engine(muriscv_t *sim);
+
+/* debugging: a breakpoint stops a run before the instruction at pc accesses memory, a
+ * watchpoint after the cycle in which the program reads or writes [address, address + len).
+ * Both are honoured by muriscv_step/muriscv_run and by fast-forward (on the step engine). */
+#define MURISCV_WATCH_READ	1
+#define MURISCV_WATCH_WRITE	2
+
+int muriscv_add_breakpoint(muriscv_t *sim, uint32_t pc);
+int muriscv_remove_breakpoint(muriscv_t *sim, uint32_t pc);	/* -1 if there was none */
+void muriscv_clear_breakpoints(muriscv_t *sim);
+int muriscv_add_watchpoint(muriscv_t *sim, uint32_t address, uint32_t len, int kind);
+int muriscv_remove_watchpoint(muriscv_t *sim, uint32_t address);	/* every watchpoint starting at address */
+void muriscv_clear_watchpoints(muriscv_t *sim);
+void muriscv_show_breakpoints(muriscv_t *sim);
+/* serve one GDB remote session on a TCP port ("1234", "host:1234") or a Unix socket path;
+ * returns when the debugger detaches */
+int muriscv_gdb_serve(muriscv_t *sim, const char *where);
+
+/* branch prediction: kind is not-taken, btfn, bimodal or gshare; table_bits sizes the
+ * bimodal/gshare counter table and btb_entries 0 means no BTB (direct targets only) */
+#define MURISCV_BP_TABLE_BITS 10	/* default: 1024 counters */
+
+typedef struct {
+	uint32_t branches, branch_mispredicts;
+	uint32_t jumps, jump_mispredicts;
+	uint32_t flush_cycles;
+} muriscv_branch_stats_t;
+
+int muriscv_set_predictor(muriscv_t *sim, const char *kind, int table_bits, int btb_entries);
+void muriscv_branch_stats(muriscv_t *sim, muriscv_branch_stats_t *stats);
+
+/* caches: level is l1i, l1d or l2; spec is
+ * <size>[k|m]:<assoc>:<line>[:lru|fifo|random[:wb|wt[:<miss latency>]]], NULL or "off"
+ * removes the level. All levels are off by default (memory has no latency). */
+typedef struct {
+	uint32_t reads, writes;
+	uint32_t read_misses, write_misses;
+	uint32_t evictions, writebacks;
+	uint32_t stall_cycles;
+} muriscv_cache_stats_t;
+
+int muriscv_set_cache(muriscv_t *sim, const char *level, const char *spec);
+int muriscv_cache_stats(muriscv_t *sim, const char *level, muriscv_cache_stats_t *stats);
+
+/* functional-unit latency: cycles an instruction of class cls (alu, alu_imm, load, store,
+ * branch, jump, upper, mul, div, atomic or system) holds EX, stalling everything behind it.
+ * Classes other than mul and div default to 1. */
+#define MURISCV_MUL_LATENCY 3
+#define MURISCV_DIV_LATENCY 32
+
+int muriscv_set_latency(muriscv_t *sim, const char *cls, int cycles);
+void muriscv_show_latencies(muriscv_t *sim);
+
+/* loads and stores whose address is not a multiple of their size: "allow" (the
+ * default) does them at no extra cost, "penalty[:<cycles>]" stalls MEM that many more
+ * cycles (MURISCV_MISALIGNED_PENALTY by default) and "trap" stops the run before one */
+#define MURISCV_MISALIGNED_PENALTY 2
+
+int muriscv_set_misaligned(muriscv_t *sim, const char *policy);
+void muriscv_show_misaligned(muriscv_t *sim);
+
+/* multi-hart machines: sim becomes hart 0 of num_harts harts (1 goes back to one) that
+ * share its memory and program, each with its own registers and pipeline and a copy of
+ * hart 0's configuration, and each simulated on its own host thread. Harts synchronize
+ * every quantum cycles; stores become visible to other harts and RV32A atomics are
+ * performed at those barriers, so runs are deterministic. Hart n starts with a0 = n and
+ * sp MURISCV_HART_STACK * n bytes below hart 0's. muriscv_step/muriscv_run run every
+ * hart and return machine cycles; muriscv_hart gives hart n for reading its state.
+ * Setting the number of harts resets the simulation. Tracing beyond summaries,
+ * breakpoints, watchpoints, fast-forward, checkpoints and GDB need a single hart. */
+#define MURISCV_MAX_HARTS 8
+#define MURISCV_QUANTUM 1000	/* default cycles between barriers */
+#define MURISCV_HART_STACK 0x10000
+
+int muriscv_set_harts(muriscv_t *sim, int num_harts, int quantum);
+int muriscv_harts(muriscv_t *sim);
+muriscv_t *muriscv_hart(muriscv_t *sim, int hart);	/* NULL if there is no such hart */
+void muriscv_show_harts(muriscv_t *sim);
+
+/* sampled simulation (SimPoint): muriscv_bbv_profile runs the program functionally from
+ * the start and writes a basic-block vector per interval instructions in SimPoint's .bb
+ * format, returning the number of intervals. muriscv_simpoints clusters those into at
+ * most max_k representative intervals and writes SimPoint .simpoints and .weights files
+ * (SimPoint's own output works as well). muriscv_sample simulates only those intervals
+ * in detail, fast-forwarding to warmup instructions before each and running the warm-up
+ * through the pipeline, and gives the weighted CPI. Profiling and sampling reset the
+ * simulation before and after, and need a single hart. */
+#define MURISCV_SIMPOINT_INTERVAL 100000
+#define MURISCV_SIMPOINT_WARMUP 10000
+
+int muriscv_bbv_profile(muriscv_t *sim, const char *path, uint32_t interval);
+int muriscv_simpoints(const char *bbv_path, int max_k, const char *simpoints_path, const char *weights_path);
+int muriscv_sample(muriscv_t *sim, const char *simpoints_path, const char *weights_path, uint32_t interval,
+		uint32_t warmup, double *cpi);
+
+/* decoupled simulation: muriscv_split runs num_instructions (0: to the end) with the
+ * functional half executing on one host thread and the pipeline timing model on another,
+ * connected by a lock-free ring of retired-instruction records; cycles and counters are
+ * those of muriscv_run. The records are also saved to path unless it is NULL.
+ * muriscv_record only executes and saves them (the timing state is untouched), and
+ * muriscv_replay resets the simulation and models the pipeline over a saved stream under
+ * the current predictor, cache and latency settings without executing the program; the
+ * registers end as the program left them, memory as it was loaded, and the simulation
+ * stopped. The record file must come from the loaded program. */
+int muriscv_split(muriscv_t *sim, uint32_t num_instructions, const char *path);
+int muriscv_record(muriscv_t *sim, const char *path, uint32_t num_instructions);
+int muriscv_replay(muriscv_t *sim, const char *path);
+
+/* checkpoints */
+int muriscv_save(muriscv_t *sim, const char *path);
+int muriscv_restore(muriscv_t *sim, const char *path);
+
+/* memory comparison: muriscv_save_mem writes the non-zero words of [start, stop] as a
+ * sparse memory image, and muriscv_diff_mem compares [start, stop] with a memory image or
+ * a checkpoint, printing the first max_report differing words; it returns how many words
+ * differ. Pages identical on both sides or all zero are skipped without a word scan. */
+int muriscv_save_mem(muriscv_t *sim, const char *path, uint32_t start, uint32_t stop);
+int muriscv_diff_mem(muriscv_t *sim, const char *path, uint32_t start, uint32_t stop, uint32_t max_report);
+
+/* terminal output */
+void muriscv_dump_regs(muriscv_t *sim);
+void muriscv_dump_mem(muriscv_t *sim, uint32_t start, uint32_t stop);
+void muriscv_show_pipeline(muriscv_t *sim);
+void muriscv_print_program(muriscv_t *sim);
+void muriscv_show_branch_stats(muriscv_t *sim);
+void muriscv_show_cache_stats(muriscv_t *sim);
+void muriscv_show_stats(muriscv_t *sim);
+/* host time per pipeline stage; -1 unless the library was built with make PROFILE=1 */
+int muriscv_show_profile(muriscv_t *sim);
+void muriscv_reset_profile(muriscv_t *sim);
+
+/* every performance counter as a JSON object */
+int muriscv_write_stats_json(muriscv_t *sim, const char *path);
+
+/* text as a quoted JSON string, for front ends writing JSON of their own */
+void muriscv_json_string(FILE *fp, const char *text);
+
+#endif